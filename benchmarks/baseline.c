@@ -0,0 +1,134 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains a benchmark of the time taken to put a VM
+ * back to how it was before running a program which writes 256 bytes of RAM,
+ * by resetting it to a baseline, by copying all of RAM and the registers
+ * back, and by making a new VM and copying the program into it. The time
+ * for each is the time for running the program then putting the VM back,
+ * less the time for running the program alone.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../risky/baseline.h"
+#include "../risky/cache.h"
+#include "../risky/core.h"
+#include "../risky/interpreter.h"
+#include "../risky/risky.h"
+#include "../tests/instructions.h"
+#include "../tests/timing.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of words the benchmark program writes
+#define WORD_COUNT 128U
+// number of times the benchmark program is run each way
+#define REPEAT_COUNT 200000U
+
+// ways of putting the VM back after each run
+typedef enum method_t {
+    METHOD_NONE, METHOD_RESET, METHOD_COPY, METHOD_FRESH,
+} method_t;
+
+/*
+ * runs the benchmark program repeatedly, putting the VM back after each run
+ * the given way. Returns the number of seconds taken per run, or a negative
+ * number if it failed
+ */
+static double run_benchmark(
+    method_t method, risky_instruction_t * program, size_t length
+) {
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        return -1.0;
+    }
+    encode_program(state.ram, program, length);
+    risky_baseline_t baseline;
+    if(capture_risky_baseline(&baseline, &state) != STATUS_SUCCESS) {
+        free_risky_vm_state(&state);
+        return -1.0;
+    }
+    bool failed = false;
+    double start = seconds();
+    for(unsigned int i = 0; i < REPEAT_COUNT && !failed; i++) {
+        risky_stop_reason_t reason;
+        failed = run_risky_vm(&state, &reason) != STATUS_SUCCESS;
+        switch(method) {
+            case METHOD_NONE:
+                // the program sets every register it uses
+                state.program_counter = 0x0000U;
+                break;
+            case METHOD_RESET:
+                reset_risky_vm_to_baseline(&state, &baseline);
+                break;
+            case METHOD_COPY:
+                memcpy(state.ram, baseline.ram, RISKY_RAM_AMOUNT);
+                invalidate_instruction_cache(&state);
+                memcpy(
+                    state.registers, baseline.registers,
+                    sizeof(state.registers)
+                );
+                state.program_counter = 0x0000U;
+                break;
+            case METHOD_FRESH:
+                free_risky_vm_state(&state);
+                state = (risky_vm_state_t) { .registers = {0}, .ram = NULL, };
+                failed = init_risky_vm_state(&state) != STATUS_SUCCESS;
+                if(!failed) {
+                    memcpy(state.ram, baseline.ram, RISKY_RAM_AMOUNT);
+                }
+                break;
+        }
+    }
+    double elapsed = seconds() - start;
+    free_risky_baseline(&baseline);
+    free_risky_vm_state(&state);
+    return failed ? -1.0 : elapsed / REPEAT_COUNT;
+}
+
+int main() {
+    // writes a counter to WORD_COUNT words from 0x8000, then halts
+    risky_instruction_t program[] = {
+        set(1, 0x8000U),
+        set(2, 0x8000U + 2 * WORD_COUNT),
+        set(3, 2),
+        set(4, 0x0010U), // address of loop
+        // loop:
+        op(SAV, 0x06U, 1, 1, 0),
+        op(ADD, 0x07U, 1, 1, 3),
+        op(LTN, 0x03U, 5, 1, 2),
+        op(BRA, 0x00U, 4, 5, 0),
+        op(HLT, 0, 0, 0, 0),
+    };
+    size_t length = sizeof(program) / sizeof(program[0]);
+    const char * names[] = { "run", "reset", "copy", "fresh", };
+    double run = run_benchmark(METHOD_NONE, program, length);
+    if(run < 0) {
+        fprintf(stderr, "error running benchmark run\n");
+        return 1;
+    }
+    printf("%-10s %10.1f ns\n", names[METHOD_NONE], run * 1e9);
+    for(method_t method = METHOD_RESET; method <= METHOD_FRESH; method++) {
+        double elapsed = run_benchmark(method, program, length);
+        if(elapsed < 0) {
+            fprintf(stderr, "error running benchmark %s\n", names[method]);
+            return 1;
+        }
+        printf("%-10s %10.1f ns\n", names[method], (elapsed - run) * 1e9);
+    }
+    return 0;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
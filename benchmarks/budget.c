@@ -0,0 +1,121 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains a benchmark comparing the instructions per
+ * second of a VM run without a budget, run in time slices of various sizes
+ * with run_risky_vm_for(), and run in time slices one step at a time
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../risky/core.h"
+#include "../risky/interpreter.h"
+#include "../risky/risky.h"
+#include "../tests/instructions.h"
+#include "../tests/timing.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of times the loop in the benchmark program goes round
+#define LOOP_COUNT 60000U
+// number of times the benchmark program is run, per method
+#define REPEAT_COUNT 50U
+// number of instructions one run of the benchmark program executes
+#define EXECUTED (4 + 3 * (unsigned long) LOOP_COUNT + 1)
+
+/*
+ * runs the VM to completion in slices of the given number of instructions,
+ * with run_risky_vm_for() or by stepping it, or with run_risky_vm() if the
+ * slice is 0. Returns false on error
+ */
+static bool run_sliced(risky_vm_state_t * state, uint64_t slice, bool step) {
+    risky_stop_reason_t reason = RISKY_STOP_NONE;
+    if(slice == 0) {
+        return run_risky_vm(state, &reason) == STATUS_SUCCESS;
+    }
+    while(reason != RISKY_STOP_HALTED) {
+        if(!step) {
+            status_t result = run_risky_vm_for(state, slice, NULL, &reason);
+            if(result != STATUS_SUCCESS) {
+                return false;
+            }
+            continue;
+        }
+        // the way a scheduler had to time-slice a VM without a budget
+        reason = RISKY_STOP_NONE;
+        for(uint64_t i = 0; i < slice && reason == RISKY_STOP_NONE; i++) {
+            if(step_risky_vm(state, &reason) != STATUS_SUCCESS) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * runs the benchmark program repeatedly in slices of the given size and
+ * prints the number of instructions executed per second
+ */
+static void run_benchmark(
+    risky_vm_state_t * state, const char * method, uint64_t slice, bool step
+) {
+    double start = seconds();
+    for(unsigned int i = 0; i < REPEAT_COUNT; i++) {
+        state->program_counter = 0x0000U;
+        if(!run_sliced(state, slice, step)) {
+            fprintf(stderr, "error running %s\n", method);
+            return;
+        }
+    }
+    double elapsed = seconds() - start;
+    printf(
+        "%-10s %-8llu %10.2f M instructions/s\n", method,
+        (unsigned long long) slice,
+        (double) EXECUTED * REPEAT_COUNT / elapsed / 1e6
+    );
+}
+
+int main() {
+    // a tight countdown loop: 4 setup instructions, 3 per loop and a HLT
+    risky_instruction_t countdown[] = {
+        set(1, LOOP_COUNT),
+        set(2, 1),
+        set(3, 0x0010U),
+        set(6, 0),
+        op(SUB, 0x07U, 1, 1, 2),
+        op(NEQ, 0x03U, 5, 1, 6),
+        op(BRA, 0x00U, 3, 5, 0),
+        op(HLT, 0, 0, 0, 0),
+    };
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        fprintf(stderr, "could not allocate VM state\n");
+        return 1;
+    }
+    encode_program(
+        state.ram, countdown, sizeof(countdown) / sizeof(countdown[0])
+    );
+    uint64_t slices[] = { 64, 1024, 65536, };
+    run_benchmark(&state, "unbudgeted", 0, false);
+    for(size_t i = 0; i < sizeof(slices) / sizeof(slices[0]); i++) {
+        run_benchmark(&state, "budgeted", slices[i], false);
+    }
+    for(size_t i = 0; i < sizeof(slices) / sizeof(slices[0]); i++) {
+        run_benchmark(&state, "stepped", slices[i], true);
+    }
+    free_risky_vm_state(&state);
+    return 0;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
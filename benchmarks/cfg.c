@@ -0,0 +1,90 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains a benchmark of the time taken to build the
+ * control-flow graph of a program filling all of RAM, with a jump or branch to
+ * a constant address every few instructions
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../risky/cfg.h"
+#include "../risky/core.h"
+#include "../risky/encoder.h"
+#include "../risky/risky.h"
+#include "../tests/timing.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of times the graph is built
+#define REPEAT_COUNT 200U
+
+int main() {
+    risky_ram_t * image = (risky_ram_t *) malloc(RISKY_RAM_AMOUNT);
+    if(image == NULL) {
+        fprintf(stderr, "could not allocate image\n");
+        return 1;
+    }
+    /*
+     * blocks of random arithmetic, each ended by a SET of a random address
+     * followed by a JMP or BRA to it
+     */
+    srand(1);
+    for(size_t address = 0; address < RISKY_RAM_AMOUNT; address += 4) {
+        risky_instruction_t instruction = {
+            .opcode = (risky_opcode_t) (ADD + rand() % 8),
+            .a_flag = true, .b_flag = true, .c_flag = true,
+            .r = (risky_byte_t) rand(), .a = (risky_byte_t) rand(),
+            .b = (risky_byte_t) rand(), .l = 0,
+        };
+        if(rand() % 8 == 0 && address + 4 < RISKY_RAM_AMOUNT) {
+            instruction = (risky_instruction_t) {
+                .opcode = SET, .a_flag = true, .r = 1,
+                .l = (risky_word_t) ((rand() % (RISKY_RAM_AMOUNT / 4)) * 4),
+            };
+            encode_instruction_to_raw(
+                &instruction, (risky_raw_instruction_t *) &image[address]
+            );
+            address += 4;
+            instruction = (risky_instruction_t) {
+                .opcode = (rand() % 2) ? JMP : BRA, .r = 1, .a = 2,
+            };
+        }
+        encode_instruction_to_raw(
+            &instruction, (risky_raw_instruction_t *) &image[address]
+        );
+    }
+    risky_cfg_t cfg = { .blocks = NULL, .count = 0, };
+    status_t result = STATUS_SUCCESS;
+    double start = seconds();
+    for(
+        unsigned int i = 0; i < REPEAT_COUNT && result == STATUS_SUCCESS; i++
+    ) {
+        free_risky_cfg(&cfg);
+        result = build_risky_cfg(image, RISKY_RAM_AMOUNT, &cfg);
+    }
+    double elapsed = seconds() - start;
+    if(result != STATUS_SUCCESS) {
+        fprintf(stderr, "error building control-flow graph\n");
+        free(image);
+        return 1;
+    }
+    printf(
+        "%-10s %10.2f us for %u blocks\n",
+        "build", elapsed / REPEAT_COUNT * 1e6, cfg.count
+    );
+    free_risky_cfg(&cfg);
+    free(image);
+    return 0;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,126 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains a benchmark comparing the cost of a WRI to a
+ * channel backed by a ring buffer against one backed by a callback, and
+ * against an ADD
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../risky/cache.h"
+#include "../risky/channel.h"
+#include "../risky/core.h"
+#include "../risky/interpreter.h"
+#include "../risky/risky.h"
+#include "../tests/instructions.h"
+#include "../tests/timing.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of times the loop in the program goes round
+#define LOOP_COUNT 50000U
+// number of times the program is run for each measurement
+#define RUNS 200U
+// number of words each ring holds
+#define RING_SIZE 65536U
+
+// channel callback which sums the words written, so they aren't optimised out
+static void sum_word(
+    void * context, risky_channel_t channel, risky_word_t data
+) {
+    (void) channel;
+    *(uint64_t *) context += data;
+}
+
+// sink which sums the words drained from a ring
+static void sum_words(
+    void * context, const risky_word_t * words, size_t count
+) {
+    for(size_t i = 0; i < count; i++) {
+        *(uint64_t *) context += words[i];
+    }
+}
+
+/*
+ * runs a loop whose body is the given instruction, then INC, DEC and BRA, and
+ * prints the time taken by each go round the loop. The ring, if given, is
+ * drained whenever the VM blocks on it. Returns non-zero on error
+ */
+static int measure(
+    const char * name, risky_instruction_t body, risky_vm_state_t * state,
+    risky_channel_ring_t * ring
+) {
+    risky_instruction_t program[] = {
+        op(SET, 0x04U, 5, 0, 0),
+        op(CDC, 0x00U, 1, 1, 1),
+        op(SET, 0x04U, 2, 0, 0),
+        body,
+        op(INC, 0x06U, 3, 3, 0),
+        op(DEC, 0x06U, 2, 2, 0),
+        op(BRA, 0x04U, 5, 2, 0),
+        op(HLT, 0x00U, 0, 0, 0),
+    };
+    program[0].l = 12;
+    program[2].l = LOOP_COUNT;
+    encode_program(state->ram, program, 8);
+    invalidate_instruction_cache(state);
+    uint64_t sum = 0;
+    state->channel_io.context = &sum;
+    state->rings[1] = ring;
+    double start = seconds();
+    for(size_t run = 0; run < RUNS; run++) {
+        state->program_counter = 0x0000U;
+        state->registers[3] = 0;
+        risky_stop_reason_t reason = RISKY_STOP_NONE;
+        while(reason != RISKY_STOP_HALTED) {
+            if(run_risky_vm(state, &reason) != STATUS_SUCCESS) {
+                fprintf(stderr, "error running VM\n");
+                return 1;
+            }
+            if(ring != NULL) {
+                drain_risky_channel_ring(ring, sum_words, &sum);
+            }
+        }
+    }
+    double elapsed = seconds() - start;
+    printf(
+        "%-14s %6.2f ns per loop (checksum %llu)\n", name,
+        elapsed / ((double) RUNS * LOOP_COUNT) * 1e9,
+        (unsigned long long) sum
+    );
+    return 0;
+}
+
+int main() {
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    risky_channel_ring_t ring;
+    if(
+        init_risky_vm_state(&state) != STATUS_SUCCESS ||
+        init_risky_channel_ring(&ring, RING_SIZE) != STATUS_SUCCESS
+    ) {
+        fprintf(stderr, "could not allocate VM state\n");
+        return 1;
+    }
+    state.channel_io.write = sum_word;
+    int result = (
+        measure("ADD", op(ADD, 0x00U, 4, 4, 3), &state, NULL) ||
+        measure("WRI ring", op(WRI, 0x00U, 1, 3, 0), &state, &ring) ||
+        measure("WRI callback", op(WRI, 0x00U, 1, 3, 0), &state, NULL)
+    );
+    free_risky_vm_state(&state);
+    free_risky_channel_ring(&ring);
+    return result;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,146 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains a benchmark of the time taken to save a
+ * checkpoint of a warmed-up VM, with half of its RAM in use, to restore a VM
+ * from it and run it to completion, and to append deltas to a checkpoint log
+ * of the VM when it has written to a few pages of RAM
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../risky/cache.h"
+#include "../risky/checkpoint.h"
+#include "../risky/core.h"
+#include "../risky/encoder.h"
+#include "../risky/interpreter.h"
+#include "../risky/risky.h"
+#include "../tests/timing.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of times each checkpoint operation is timed
+#define REPEAT_COUNT 2000U
+
+// prints the mean time taken by an operation, in microseconds
+static void report(const char * operation, double elapsed) {
+    printf("%-10s %10.2f us\n", operation, elapsed / REPEAT_COUNT * 1e6);
+}
+
+/*
+ * times appending deltas to a checkpoint log of the VM, each after writing to
+ * the given number of pages of its RAM and changing a register.
+ * Returns a status_t with error / success information
+ */
+static status_t time_deltas(
+    risky_vm_state_t * state, const char * base, const char * path,
+    size_t pages
+) {
+    risky_checkpoint_log_t log;
+    status_t result = open_risky_checkpoint_log(&log, state, base, path);
+    if(result != STATUS_SUCCESS) {
+        return result;
+    }
+    double start = seconds();
+    for(
+        unsigned int i = 0; i < REPEAT_COUNT && result == STATUS_SUCCESS; i++
+    ) {
+        for(size_t page = 0; page < pages; page++) {
+            risky_ram_address_t address = (risky_ram_address_t) (
+                page * RISKY_RAM_AMOUNT / pages
+            );
+            state->ram[address] ^= 0x01U;
+            invalidate_cached_instructions(state, address, 1);
+        }
+        state->registers[1]++;
+        result = append_risky_checkpoint_log(&log, state);
+    }
+    char operation[16];
+    snprintf(operation, sizeof(operation), "delta %zu", pages);
+    report(operation, seconds() - start);
+    status_t closed = close_risky_checkpoint_log(&log);
+    return (result == STATUS_SUCCESS) ? closed : result;
+}
+
+int main() {
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    risky_vm_state_t restored = { .registers = {0}, .ram = NULL, };
+    if(
+        init_risky_vm_state(&state) != STATUS_SUCCESS ||
+        init_risky_vm_state(&restored) != STATUS_SUCCESS
+    ) {
+        fprintf(stderr, "could not allocate VM state\n");
+        return 1;
+    }
+    // a VM stopped part way through, with the first 32KiB of RAM in use
+    srand(1);
+    for(size_t i = 0; i < RISKY_RAM_AMOUNT / 2; i++) {
+        state.ram[i] = (risky_ram_t) rand();
+    }
+    for(size_t i = 0; i < RISKY_REGISTER_COUNT; i++) {
+        state.registers[i] = (risky_register_t) rand();
+    }
+    risky_instruction_t halt = { .opcode = HLT, };
+    encode_instruction_to_raw(
+        &halt, (risky_raw_instruction_t *) &state.ram[0x1000]
+    );
+    state.program_counter = 0x1000U;
+    char path[] = "/tmp/risky-checkpoint-XXXXXX";
+    int descriptor = mkstemp(path);
+    if(descriptor == -1) {
+        fprintf(stderr, "could not create checkpoint file\n");
+        return 1;
+    }
+    close(descriptor);
+    status_t result = STATUS_SUCCESS;
+    double start = seconds();
+    for(
+        unsigned int i = 0; i < REPEAT_COUNT && result == STATUS_SUCCESS; i++
+    ) {
+        result = save_risky_vm_checkpoint(&state, path);
+    }
+    report("save", seconds() - start);
+    start = seconds();
+    for(
+        unsigned int i = 0; i < REPEAT_COUNT && result == STATUS_SUCCESS; i++
+    ) {
+        risky_stop_reason_t reason;
+        result = restore_risky_vm_checkpoint(&restored, path);
+        if(result == STATUS_SUCCESS) {
+            result = run_risky_vm(&restored, &reason);
+        }
+    }
+    report("restore", seconds() - start);
+    char log_path[] = "/tmp/risky-checkpoint-log-XXXXXX";
+    descriptor = mkstemp(log_path);
+    if(descriptor != -1) {
+        close(descriptor);
+        for(
+            size_t pages = 1; pages <= 4 && result == STATUS_SUCCESS;
+            pages *= 2
+        ) {
+            result = time_deltas(&state, path, log_path, pages);
+        }
+        unlink(log_path);
+    }
+    unlink(path);
+    free_risky_vm_state(&restored);
+    free_risky_vm_state(&state);
+    if(result != STATUS_SUCCESS) {
+        fprintf(stderr, "error saving, restoring or logging checkpoint\n");
+        return 1;
+    }
+    return 0;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
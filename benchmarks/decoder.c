@@ -0,0 +1,66 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains a benchmark comparing the instructions per
+ * second decoded one at a time and by the batch decoder
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../risky/core.h"
+#include "../risky/decoder.h"
+#include "../risky/risky.h"
+#include "../tests/timing.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of instructions in the image being decoded (a whole RAM's worth)
+#define IMAGE_LENGTH (RISKY_RAM_AMOUNT / 4U)
+// number of times the image is decoded, per decoder
+#define REPEAT_COUNT 500U
+
+static risky_raw_instruction_t image[IMAGE_LENGTH];
+static risky_instruction_t decoded[IMAGE_LENGTH];
+
+// prints the number of instructions decoded per second since start
+static void report(const char * decoder, double start) {
+    double elapsed = seconds() - start;
+    double count = (double) IMAGE_LENGTH * REPEAT_COUNT;
+    printf("%-10s %10.2f M instructions/s\n", decoder, count / elapsed / 1e6);
+}
+
+int main() {
+    // fill the image with pseudo-random instructions
+    uint32_t seed = 0x2545f491U;
+    for(size_t i = 0; i < IMAGE_LENGTH; i++) {
+        for(size_t j = 0; j < 4; j++) {
+            seed = seed * 1103515245U + 12345U;
+            image[i].bytes[j] = (risky_byte_t) (seed >> 16);
+        }
+    }
+    double start = seconds();
+    for(unsigned int i = 0; i < REPEAT_COUNT; i++) {
+        for(size_t j = 0; j < IMAGE_LENGTH; j++) {
+            decode_instruction_from_raw(&image[j], &decoded[j]);
+        }
+    }
+    report("single", start);
+    start = seconds();
+    for(unsigned int i = 0; i < REPEAT_COUNT; i++) {
+        decode_instructions_from_raw(image, IMAGE_LENGTH, decoded);
+    }
+    report("batch", start);
+    return 0;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,106 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains a benchmark measuring how many words per
+ * second one host thread moves through pipes between thousands of VMs with
+ * the event loop
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "../risky/core.h"
+#include "../risky/event.h"
+#include "../risky/interpreter.h"
+#include "../risky/risky.h"
+#include "../tests/instructions.h"
+#include "../tests/timing.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of pairs of VMs, each a producer writing to a consumer over a pipe
+#define PAIRS 1024U
+// number of words each producer writes
+#define WORDS 20000U
+
+int main() {
+    // the producer writes WORDS words to channel 1, the consumer reads them
+    risky_instruction_t producer[] = {
+        set(2, WORDS), set(5, 12),
+        op(CDC, 0x00U, 1, 1, 1),
+        op(WRI, 0x00U, 1, 2, 0),
+        op(DEC, 0x06U, 2, 2, 0),
+        op(BRA, 0x04U, 5, 2, 0),
+        op(HLT, 0x00U, 0, 0, 0),
+        op(NOP, 0x00U, 0, 0, 0),
+    };
+    risky_instruction_t consumer[] = {
+        set(2, WORDS), set(5, 12),
+        op(CDC, 0x00U, 0, 0, 1),
+        op(REA, 0x00U, 3, 0, 0),
+        op(ADD, 0x07U, 4, 4, 3),
+        op(DEC, 0x06U, 2, 2, 0),
+        op(BRA, 0x04U, 5, 2, 0),
+        op(HLT, 0x00U, 0, 0, 0),
+    };
+    static risky_vm_state_t states[PAIRS * 2];
+    static risky_vm_state_t * pointers[PAIRS * 2];
+    for(size_t i = 0; i < PAIRS * 2; i++) {
+        if(
+            init_program(&states[i], (i % 2) ? consumer : producer, 8) !=
+            STATUS_SUCCESS
+        ) {
+            fprintf(stderr, "could not allocate VM state\n");
+            return 1;
+        }
+        pointers[i] = &states[i];
+    }
+    risky_event_loop_t loop;
+    if(init_risky_event_loop(&loop, pointers, PAIRS * 2) != STATUS_SUCCESS) {
+        fprintf(stderr, "could not allocate event loop\n");
+        return 1;
+    }
+    for(size_t i = 0; i < PAIRS; i++) {
+        int descriptors[2];
+        if(
+            pipe(descriptors) != 0 ||
+            bind_risky_event_channel(&loop, i * 2, 1, descriptors[1], true) !=
+            STATUS_SUCCESS ||
+            bind_risky_event_channel(
+                &loop, i * 2 + 1, 0, descriptors[0], false
+            ) != STATUS_SUCCESS
+        ) {
+            fprintf(stderr, "could not bind channels\n");
+            return 1;
+        }
+        close(descriptors[0]);
+        close(descriptors[1]);
+    }
+    double start = seconds();
+    status_t result = run_risky_event_loop(&loop);
+    double elapsed = seconds() - start;
+    size_t halted = 0;
+    for(size_t i = 0; i < PAIRS * 2; i++) {
+        halted += loop.reasons[i] == RISKY_STOP_HALTED;
+    }
+    printf(
+        "%u VMs on one thread: %.2f M words/s through pipes, %zu halted\n",
+        PAIRS * 2, (double) PAIRS * WORDS / elapsed / 1e6, halted
+    );
+    free_risky_event_loop(&loop);
+    for(size_t i = 0; i < PAIRS * 2; i++) {
+        free_risky_vm_state(&states[i]);
+    }
+    return result == STATUS_SUCCESS ? 0 : 1;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
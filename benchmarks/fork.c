@@ -0,0 +1,78 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains a benchmark comparing the time taken to clone
+ * a prepared VM by copying its RAM and by forking it copy-on-write
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../risky/core.h"
+#include "../risky/fork.h"
+#include "../risky/risky.h"
+#include "../tests/timing.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of clones made of the prepared VM
+#define CLONE_COUNT 4096U
+
+// prints the average time taken to make each clone since start
+static void report(const char * method, double start) {
+    double elapsed = seconds() - start;
+    printf(
+        "%-8s %10.3f microseconds per clone\n",
+        method, elapsed / CLONE_COUNT * 1e6
+    );
+}
+
+int main() {
+    static risky_vm_state_t clones[CLONE_COUNT];
+    risky_vm_state_t parent = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&parent) != STATUS_SUCCESS) {
+        fprintf(stderr, "could not allocate VM state\n");
+        return 1;
+    }
+    // fill RAM with something standing in for a program and its tables
+    for(size_t i = 0; i < RISKY_RAM_AMOUNT; i++) {
+        parent.ram[i] = (risky_ram_t) (i * 7U);
+    }
+    double start = seconds();
+    for(size_t i = 0; i < CLONE_COUNT; i++) {
+        clones[i] = (risky_vm_state_t) { .registers = {0}, .ram = NULL, };
+        if(init_risky_vm_state(&clones[i]) != STATUS_SUCCESS) {
+            fprintf(stderr, "could not allocate VM state\n");
+            return 1;
+        }
+        memcpy(clones[i].ram, parent.ram, RISKY_RAM_AMOUNT);
+    }
+    report("copy", start);
+    for(size_t i = 0; i < CLONE_COUNT; i++) {
+        free_risky_vm_state(&clones[i]);
+    }
+    start = seconds();
+    for(size_t i = 0; i < CLONE_COUNT; i++) {
+        if(fork_risky_vm(&parent, &clones[i]) != STATUS_SUCCESS) {
+            fprintf(stderr, "could not fork VM\n");
+            return 1;
+        }
+    }
+    report("fork", start);
+    for(size_t i = 0; i < CLONE_COUNT; i++) {
+        free_risky_vm_state(&clones[i]);
+    }
+    free_risky_vm_state(&parent);
+    return 0;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,108 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains a benchmark comparing the instructions per
+ * second of the threaded and switch interpreters running a loop made mostly of
+ * instruction pairs which the instruction cache fuses (build with
+ * RISKY_NO_FUSION defined to compare against the threaded interpreter without
+ * fusion)
+ */
+#include <stddef.h>
+#include <stdio.h>
+
+#include "../risky/core.h"
+#include "../risky/interpreter.h"
+#include "../risky/risky.h"
+#include "../tests/instructions.h"
+#include "../tests/timing.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of times round the loop of the benchmark program
+#define LOOP_COUNT 60000U
+// number of times the benchmark program is run each way
+#define REPEAT_COUNT 200U
+// number of instructions the benchmark program executes
+#define EXECUTED (4UL + 7UL * LOOP_COUNT + 1UL)
+// number of dispatches the benchmark program needs, with pairs fused
+#define FUSED_DISPATCHES (4UL + 5UL * LOOP_COUNT + 1UL)
+
+// type of the interpreter functions being compared
+typedef status_t (* runner_t)(risky_vm_state_t *, risky_stop_reason_t *);
+
+/*
+ * runs the benchmark program repeatedly with the given interpreter and prints
+ * the number of instructions executed per second
+ */
+static void run_benchmark(
+    const char * method, runner_t run, risky_instruction_t * program,
+    size_t length
+) {
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        fprintf(stderr, "could not allocate VM state\n");
+        return;
+    }
+    encode_program(state.ram, program, length);
+    double start = seconds();
+    for(unsigned int i = 0; i < REPEAT_COUNT; i++) {
+        risky_stop_reason_t reason;
+        state.program_counter = 0x0000U;
+        if(
+            run(&state, &reason) != STATUS_SUCCESS ||
+            reason != RISKY_STOP_HALTED
+        ) {
+            fprintf(stderr, "error running benchmark %s\n", method);
+            break;
+        }
+    }
+    double elapsed = seconds() - start;
+    printf(
+        "%-10s %10.2f M instructions/s\n",
+        method, (double) EXECUTED * REPEAT_COUNT / elapsed / 1e6
+    );
+    free_risky_vm_state(&state);
+}
+
+int main() {
+    /*
+     * counts up to LOOP_COUNT, calling a block by SET then JMP and testing
+     * the count with INC then LTN each time round: 4 setup instructions, 7
+     * per loop (two fused pairs) and a HLT
+     */
+    risky_instruction_t program[] = {
+        set(1, 0),
+        set(2, LOOP_COUNT),
+        set(3, 0x0010U),
+        set(8, 0),
+        // 0x10: loop
+        op(ADD, 0x07U, 8, 8, 1),
+        set(4, 0x001cU),
+        op(JMP, 0x00U, 4, 0, 0),
+        // 0x1c: the block jumped to
+        op(XOR, 0x07U, 9, 9, 8),
+        op(INC, 0x06U, 1, 1, 0),
+        op(LTN, 0x03U, 5, 1, 2),
+        op(BRA, 0x00U, 3, 5, 0),
+        op(HLT, 0, 0, 0, 0),
+    };
+    size_t length = sizeof(program) / sizeof(program[0]);
+    run_benchmark("threaded", run_risky_vm, program, length);
+    run_benchmark("switch", run_risky_vm_switch, program, length);
+    printf(
+        "%-10s %10.2f dispatches per instruction when fused\n",
+        "fusion", (double) FUSED_DISPATCHES / EXECUTED
+    );
+    return 0;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,182 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains a benchmark comparing the speed and data TLB
+ * misses of switching round-robin between many VMs, with their RAM allocated
+ * separately, from a pool of normal pages and from a pool of huge pages
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "../risky/core.h"
+#include "../risky/encoder.h"
+#include "../risky/interpreter.h"
+#include "../risky/pool.h"
+#include "../risky/risky.h"
+#include "../tests/instructions.h"
+#include "../tests/timing.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of VMs being switched between
+#define VM_COUNT 4096U
+// number of instructions each VM runs before switching to the next one
+#define QUANTUM 8U
+// number of times every VM gets a turn
+#define ROUND_COUNT 64U
+
+/*
+ * opens a counter of data TLB read misses in this process.
+ * Returns its file descriptor, or -1 if the counter isn't available
+ */
+static int open_tlb_counter(void) {
+#ifdef __linux__
+    struct perf_event_attr attributes;
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.size = sizeof(attributes);
+    attributes.type = PERF_TYPE_HW_CACHE;
+    attributes.config = PERF_COUNT_HW_CACHE_DTLB |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attributes.disabled = 1;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+/*
+ * loads a program into a VM which walks through all of its RAM a page at a
+ * time, reading and writing a word on each
+ */
+static void load_walker(risky_vm_state_t * state, size_t index) {
+    risky_instruction_t program[] = {
+        { .opcode = SET, .a_flag = true, .r = 1, .l = 0x1000U, },
+        { .opcode = SET, .a_flag = true, .r = 2, .l = 0x0010U, },
+        // 0x08: loop
+        { .opcode = LOD, .a_flag = true, .b_flag = true, .r = 3, .a = 1, },
+        { .opcode = INC, .a_flag = true, .b_flag = true, .r = 3, .a = 3, },
+        { .opcode = SAV, .a_flag = true, .b_flag = true, .r = 3, .a = 1, },
+        { .opcode = ADD, .a_flag = true, .b_flag = true, .c_flag = true,
+          .r = 1, .a = 1, .b = 2, },
+        { .opcode = SET, .a_flag = true, .r = 4, .l = 0x0008U, },
+        { .opcode = JMP, .r = 4, },
+    };
+    encode_program(state->ram, program, 8);
+    // start each VM walking from a different offset into its pages
+    program[1].l = (risky_word_t) (0x1000U + (index % 64) * 4);
+    encode_instruction_to_raw(
+        &program[1], (risky_raw_instruction_t *) &state->ram[4]
+    );
+    state->program_counter = 0x0000U;
+}
+
+/*
+ * switches round-robin between the VMs, then prints the time taken and the
+ * data TLB misses counted, if the counter is available
+ */
+static void measure(const char * allocator, risky_vm_state_t ** states) {
+    for(size_t i = 0; i < VM_COUNT; i++) {
+        // fault in every page first, so that only TLB misses are measured
+        for(size_t page = 0; page < RISKY_RAM_AMOUNT; page += 4096) {
+            states[i]->ram[page] = 0x00U;
+        }
+        load_walker(states[i], i);
+        // and allocate the VM's instruction cache
+        risky_stop_reason_t reason;
+        step_risky_vm(states[i], &reason);
+    }
+    int counter = open_tlb_counter();
+#ifdef __linux__
+    if(counter != -1) {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+    double start = seconds();
+    for(size_t round = 0; round < ROUND_COUNT; round++) {
+        for(size_t i = 0; i < VM_COUNT; i++) {
+            risky_stop_reason_t reason;
+            for(size_t j = 0; j < QUANTUM; j++) {
+                step_risky_vm(states[i], &reason);
+            }
+        }
+    }
+    double elapsed = seconds() - start;
+    printf(
+        "%-22s %10.2f M instructions/s", allocator,
+        (double) VM_COUNT * ROUND_COUNT * QUANTUM / elapsed / 1e6
+    );
+    uint64_t misses = 0;
+    if(counter != -1 && read(counter, &misses, sizeof(misses)) > 0) {
+        printf(", %12llu dTLB misses\n", (unsigned long long) misses);
+    } else {
+        printf(", dTLB misses not available\n");
+    }
+    if(counter != -1) {
+        close(counter);
+    }
+}
+
+// runs the benchmark on VMs from a pool, with the given flags
+static int measure_pool(unsigned int flags, risky_vm_state_t ** states) {
+    static const char * names[] = {
+        "pool (normal pages)", "pool (transparent THP)", "pool (hugetlb)",
+    };
+    risky_vm_pool_t pool;
+    if(init_risky_vm_pool(&pool, VM_COUNT, flags) != STATUS_SUCCESS) {
+        fprintf(stderr, "could not allocate VM pool\n");
+        return 1;
+    }
+    for(size_t i = 0; i < VM_COUNT; i++) {
+        acquire_risky_vm(&pool, &states[i]);
+    }
+    measure(names[pool.pages], states);
+    free_risky_vm_pool(&pool);
+    return 0;
+}
+
+int main() {
+    static risky_vm_state_t separate[VM_COUNT];
+    risky_vm_state_t * states[VM_COUNT];
+    for(size_t i = 0; i < VM_COUNT; i++) {
+        separate[i] = (risky_vm_state_t) { .registers = {0}, .ram = NULL, };
+        if(init_risky_vm_state(&separate[i]) != STATUS_SUCCESS) {
+            fprintf(stderr, "could not allocate VM state\n");
+            return 1;
+        }
+        states[i] = &separate[i];
+    }
+    measure("init_risky_vm_state", states);
+    for(size_t i = 0; i < VM_COUNT; i++) {
+        free_risky_vm_state(&separate[i]);
+    }
+    if(
+        measure_pool(0, states) != 0 ||
+        measure_pool(RISKY_POOL_HUGE_PAGES, states) != 0
+    ) {
+        return 1;
+    }
+    return 0;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
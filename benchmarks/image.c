@@ -0,0 +1,97 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains a benchmark comparing the time taken to
+ * start many VMs from the same program file by reading it into each VM's RAM
+ * against mapping it copy-on-write
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../risky/core.h"
+#include "../risky/image.h"
+#include "../risky/risky.h"
+#include "../tests/timing.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of VMs started from the program file
+#define VM_COUNT 4096U
+
+// loads the program file into the given VM by reading it into RAM
+static status_t read_program_file(risky_vm_state_t * state, const char * path) {
+    FILE * file = fopen(path, "rb");
+    if(file == NULL) {
+        return STATUS_FAIL;
+    }
+    size_t size = fread(state->ram, 1, RISKY_RAM_AMOUNT, file);
+    fclose(file);
+    return (size > 0) ? STATUS_SUCCESS : STATUS_FAIL;
+}
+
+/*
+ * starts every VM from the program file with the given loader and prints the
+ * time taken per VM, returning non-zero on error
+ */
+static int measure(
+    const char * name, risky_vm_state_t * states, const char * path,
+    status_t (* load)(risky_vm_state_t * state, const char * path)
+) {
+    double start = seconds();
+    for(size_t i = 0; i < VM_COUNT; i++) {
+        states[i] = (risky_vm_state_t) { .registers = {0}, .ram = NULL, };
+        if(
+            init_risky_vm_state(&states[i]) != STATUS_SUCCESS ||
+            load(&states[i], path) != STATUS_SUCCESS
+        ) {
+            fprintf(stderr, "could not start VM\n");
+            return 1;
+        }
+    }
+    double elapsed = seconds() - start;
+    printf("%-12s %8.2f us per VM\n", name, elapsed / VM_COUNT * 1e6);
+    for(size_t i = 0; i < VM_COUNT; i++) {
+        free_risky_vm_state(&states[i]);
+    }
+    return 0;
+}
+
+int main() {
+    // a program filling all of RAM with a pattern
+    risky_byte_t * program = (risky_byte_t *) malloc(RISKY_RAM_AMOUNT);
+    char path[] = "/tmp/risky-bench-XXXXXX";
+    int descriptor = mkstemp(path);
+    if(program == NULL || descriptor == -1) {
+        fprintf(stderr, "could not create program file\n");
+        return 1;
+    }
+    for(size_t i = 0; i < RISKY_RAM_AMOUNT; i++) {
+        program[i] = (risky_byte_t) (i * 0x9dU);
+    }
+    ssize_t written = write(descriptor, program, RISKY_RAM_AMOUNT);
+    close(descriptor);
+    free(program);
+    static risky_vm_state_t states[VM_COUNT];
+    int result = 1;
+    if(written == RISKY_RAM_AMOUNT) {
+        result = measure("read+memcpy", states, path, read_program_file);
+        if(result == 0) {
+            result = measure("mmap", states, path, load_risky_program_file);
+        }
+    }
+    unlink(path);
+    return result;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
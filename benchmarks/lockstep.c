@@ -0,0 +1,102 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains a benchmark comparing the instructions per
+ * second of running many copies of a program one at a time and in lockstep
+ */
+#include <stddef.h>
+#include <stdio.h>
+
+#include "../risky/core.h"
+#include "../risky/interpreter.h"
+#include "../risky/lockstep.h"
+#include "../risky/risky.h"
+#include "../tests/instructions.h"
+#include "../tests/timing.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of copies of the program being run
+#define VM_COUNT 1024U
+// number of times the loop in the program goes round
+#define LOOP_COUNT 2000U
+// number of instructions one run of the program executes
+#define EXECUTED (4U + 6U * LOOP_COUNT + 1U)
+
+/*
+ * loads the program into every VM, giving each a different input in
+ * register 1, and resets them to start from the beginning
+ */
+static void reset(risky_vm_state_t * states, risky_instruction_t * program) {
+    for(size_t i = 0; i < VM_COUNT; i++) {
+        encode_program(states[i].ram, program, 11);
+        states[i].registers[1] = (risky_register_t) (i * 31U + 7U);
+        states[i].program_counter = 0x0000U;
+    }
+}
+
+// prints the number of instructions executed per second since start
+static void report(const char * engine, double start) {
+    double elapsed = seconds() - start;
+    double executed = (double) EXECUTED * VM_COUNT;
+    printf("%-10s %10.2f M instructions/s\n", engine, executed / elapsed / 1e6);
+}
+
+int main() {
+    // a hash-like loop: 4 setup instructions, 6 per loop and a HLT
+    risky_instruction_t program[] = {
+        set(2, LOOP_COUNT),
+        set(3, 0x9e37U),
+        set(4, 5),
+        set(5, 0x0010U),
+        op(MLT, 0x07U, 1, 1, 3),
+        op(XOR, 0x07U, 1, 1, 2),
+        op(LSH, 0x07U, 6, 1, 4),
+        op(ADD, 0x07U, 1, 1, 6),
+        op(DEC, 0x06U, 2, 2, 0),
+        op(BRA, 0x04U, 5, 2, 0),
+        op(HLT, 0, 0, 0, 0),
+    };
+    static risky_vm_state_t states[VM_COUNT];
+    risky_vm_state_t * pointers[VM_COUNT];
+    for(size_t i = 0; i < VM_COUNT; i++) {
+        states[i] = (risky_vm_state_t) { .registers = {0}, .ram = NULL, };
+        if(init_risky_vm_state(&states[i]) != STATUS_SUCCESS) {
+            fprintf(stderr, "could not allocate VM state\n");
+            return 1;
+        }
+        pointers[i] = &states[i];
+    }
+    reset(states, program);
+    double start = seconds();
+    for(size_t i = 0; i < VM_COUNT; i++) {
+        risky_stop_reason_t reason;
+        run_risky_vm(&states[i], &reason);
+    }
+    report("separate", start);
+    reset(states, program);
+    risky_lockstep_t engine;
+    if(init_risky_lockstep(&engine, pointers, VM_COUNT) != STATUS_SUCCESS) {
+        fprintf(stderr, "could not allocate lockstep engine\n");
+        return 1;
+    }
+    start = seconds();
+    run_risky_lockstep(&engine);
+    report("lockstep", start);
+    free_risky_lockstep(&engine);
+    for(size_t i = 0; i < VM_COUNT; i++) {
+        free_risky_vm_state(&states[i]);
+    }
+    return 0;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,98 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains a benchmark comparing the number of
+ * short-lived VMs per second which can be created, run and destroyed with
+ * init_risky_vm_state() and free_risky_vm_state(), and with a pool
+ */
+#include <stddef.h>
+#include <stdio.h>
+
+#include "../risky/core.h"
+#include "../risky/interpreter.h"
+#include "../risky/pool.h"
+#include "../risky/risky.h"
+#include "../tests/instructions.h"
+#include "../tests/timing.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of VM lifecycles measured
+#define JOB_COUNT 100000U
+// number of VMs alive at once
+#define LIVE_COUNT 64U
+
+// loads a short job into a VM and runs it, as each short-lived VM would
+static void run_job(risky_vm_state_t * state, size_t job) {
+    risky_instruction_t program[] = {
+        { .opcode = SET, .a_flag = true, .r = 1, .l = 0x4000U, },
+        { .opcode = SET, .a_flag = true, .r = 2, .l = (risky_word_t) job, },
+        { .opcode = SAV, .a_flag = true, .b_flag = true, .r = 2, .a = 1, },
+        { .opcode = HLT, },
+    };
+    encode_program(state->ram, program, 4);
+    risky_stop_reason_t reason;
+    run_risky_vm(state, &reason);
+}
+
+// prints the number of VM lifecycles per second since start
+static void report(const char * method, double start) {
+    double elapsed = seconds() - start;
+    printf(
+        "%-8s %10.2f thousand VMs/s\n", method, JOB_COUNT / elapsed / 1e3
+    );
+}
+
+int main() {
+    static risky_vm_state_t states[LIVE_COUNT];
+    risky_vm_state_t * live[LIVE_COUNT];
+    double start = seconds();
+    for(size_t job = 0; job < JOB_COUNT; job++) {
+        risky_vm_state_t * state = &states[job % LIVE_COUNT];
+        // replace the oldest live VM with a new one
+        if(job >= LIVE_COUNT) {
+            free_risky_vm_state(state);
+        }
+        *state = (risky_vm_state_t) { .registers = {0}, .ram = NULL, };
+        if(init_risky_vm_state(state) != STATUS_SUCCESS) {
+            fprintf(stderr, "could not allocate VM state\n");
+            return 1;
+        }
+        run_job(state, job);
+    }
+    report("calloc", start);
+    for(size_t i = 0; i < LIVE_COUNT; i++) {
+        free_risky_vm_state(&states[i]);
+    }
+    risky_vm_pool_t pool;
+    if(init_risky_vm_pool(&pool, LIVE_COUNT, 0) != STATUS_SUCCESS) {
+        fprintf(stderr, "could not allocate VM pool\n");
+        return 1;
+    }
+    start = seconds();
+    for(size_t job = 0; job < JOB_COUNT; job++) {
+        risky_vm_state_t ** state = &live[job % LIVE_COUNT];
+        if(job >= LIVE_COUNT) {
+            release_risky_vm(&pool, *state);
+        }
+        if(acquire_risky_vm(&pool, state) != STATUS_SUCCESS) {
+            fprintf(stderr, "could not acquire VM state\n");
+            return 1;
+        }
+        run_job(*state, job);
+    }
+    report("pool", start);
+    free_risky_vm_pool(&pool);
+    return 0;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,146 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains a benchmark comparing the instructions per
+ * second of the interpreter with and without a profile being collected
+ */
+#include <stddef.h>
+#include <stdio.h>
+
+#include "../risky/core.h"
+#include "../risky/interpreter.h"
+#include "../risky/profile.h"
+#include "../risky/risky.h"
+#include "../tests/instructions.h"
+#include "../tests/timing.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of times the loop in each benchmark program goes round
+#define LOOP_COUNT 60000U
+// number of times each benchmark program is run, with and without profiling
+#define REPEAT_COUNT 50U
+
+// type of the interpreter functions being compared
+typedef status_t (* runner_t)(risky_vm_state_t *, risky_stop_reason_t *);
+
+// the profile collected by run_profiled()
+static risky_profile_t profile;
+
+// a benchmark program and how many instructions one run of it executes
+typedef struct program_t {
+    const char * name;
+    risky_instruction_t * instructions;
+    size_t length;
+    unsigned long executed;
+} program_t;
+
+// runs the VM with run_risky_vm_profiled(), collecting into the profile
+static status_t run_profiled(
+    risky_vm_state_t * state, risky_stop_reason_t * reason
+) {
+    return run_risky_vm_profiled(state, &profile, reason);
+}
+
+/*
+ * runs the given program repeatedly with the given interpreter and prints the
+ * number of instructions executed per second
+ */
+static void run_benchmark(
+    const char * method, runner_t run, program_t * program
+) {
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        fprintf(stderr, "could not allocate VM state\n");
+        return;
+    }
+    encode_program(state.ram, program->instructions, program->length);
+    double start = seconds();
+    for(unsigned int i = 0; i < REPEAT_COUNT; i++) {
+        risky_stop_reason_t reason;
+        state.program_counter = 0x0000U;
+        if(run(&state, &reason) != STATUS_SUCCESS) {
+            fprintf(stderr, "error running %s\n", program->name);
+            break;
+        }
+    }
+    double elapsed = seconds() - start;
+    double executed = (double) program->executed * REPEAT_COUNT;
+    printf(
+        "%-12s %-10s %10.2f M instructions/s\n",
+        program->name, method, executed / elapsed / 1e6
+    );
+    free_risky_vm_state(&state);
+}
+
+int main() {
+    if(init_risky_profile(&profile) != STATUS_SUCCESS) {
+        fprintf(stderr, "could not allocate profile\n");
+        return 1;
+    }
+    // a tight countdown loop: 4 setup instructions, 3 per loop and a HLT
+    risky_instruction_t countdown[] = {
+        set(1, LOOP_COUNT),
+        set(2, 1),
+        set(3, 0x0010U),
+        set(6, 0),
+        op(SUB, 0x07U, 1, 1, 2),
+        op(NEQ, 0x03U, 5, 1, 6),
+        op(BRA, 0x00U, 3, 5, 0),
+        op(HLT, 0, 0, 0, 0),
+    };
+    /*
+     * the call / return pattern of fibonacci.asm in a counted loop: 8 setup
+     * instructions, 9 per loop and a HLT
+     */
+    risky_instruction_t fibonacci[] = {
+        set(1, 1),
+        set(2, 1),
+        set(3, 0),
+        set(6, 0),
+        set(7, 0x0038U), // address of fibonacci
+        set(8, LOOP_COUNT),
+        set(9, 0x0020U), // address of main
+        set(10, 0x0028U), // address of return
+        // main:
+        op(COP, 0x06U, 4, 10, 0),
+        op(JMP, 0x00U, 7, 0, 0),
+        // return:
+        op(DEC, 0x06U, 8, 8, 0),
+        op(NEQ, 0x03U, 5, 8, 6),
+        op(BRA, 0x00U, 9, 5, 0),
+        op(HLT, 0, 0, 0, 0),
+        // fibonacci:
+        op(ADD, 0x07U, 3, 1, 2),
+        op(COP, 0x06U, 1, 2, 0),
+        op(COP, 0x06U, 2, 3, 0),
+        op(JMP, 0x00U, 4, 0, 0),
+    };
+    program_t programs[] = {
+        {
+            "countdown", countdown, sizeof(countdown) / sizeof(countdown[0]),
+            4 + 3 * (unsigned long) LOOP_COUNT + 1,
+        },
+        {
+            "fibonacci", fibonacci, sizeof(fibonacci) / sizeof(fibonacci[0]),
+            8 + 9 * (unsigned long) LOOP_COUNT + 1,
+        },
+    };
+    for(size_t i = 0; i < sizeof(programs) / sizeof(programs[0]); i++) {
+        run_benchmark("plain", run_risky_vm, &programs[i]);
+        run_benchmark("profiled", run_profiled, &programs[i]);
+    }
+    free_risky_profile(&profile);
+    return 0;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
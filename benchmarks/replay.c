@@ -0,0 +1,148 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains a benchmark comparing the instructions per
+ * second of the interpreter running a program which reads from a channel as
+ * normal (with each kind of dispatch), while recording its channel input and
+ * while replaying it
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "../risky/core.h"
+#include "../risky/interpreter.h"
+#include "../risky/replay.h"
+#include "../risky/risky.h"
+#include "../tests/instructions.h"
+#include "../tests/timing.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of words the benchmark program reads
+#define LOOP_COUNT 60000U
+// number of times the benchmark program is run each way
+#define REPEAT_COUNT 50U
+// number of instructions the benchmark program executes
+#define EXECUTED (5UL + 12UL * LOOP_COUNT + 1UL)
+
+// type of the interpreter functions being compared
+typedef status_t (* runner_t)(risky_vm_state_t *, risky_stop_reason_t *);
+
+// the log recorded by run_recorded() and replayed by run_replayed()
+static risky_replay_log_t replay_log;
+
+// channel read callback, reads an ever-increasing word
+static bool read_word(
+    void * context, risky_channel_t channel, risky_word_t * data
+) {
+    (void) channel;
+    risky_word_t * next = (risky_word_t *) context;
+    *data = (*next)++;
+    return true;
+}
+
+// runs the VM with run_risky_vm_recorded(), recording a new log
+static status_t run_recorded(
+    risky_vm_state_t * state, risky_stop_reason_t * reason
+) {
+    free_risky_replay_log(&replay_log);
+    return run_risky_vm_recorded(state, &replay_log, reason);
+}
+
+// runs the VM with run_risky_vm_replayed(), replaying the last log recorded
+static status_t run_replayed(
+    risky_vm_state_t * state, risky_stop_reason_t * reason
+) {
+    rewind_risky_replay_log(&replay_log);
+    return run_risky_vm_replayed(state, &replay_log, reason);
+}
+
+/*
+ * runs the benchmark program repeatedly with the given interpreter and prints
+ * the number of instructions executed per second
+ */
+static void run_benchmark(
+    const char * method, runner_t run, risky_instruction_t * program,
+    size_t length
+) {
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        fprintf(stderr, "could not allocate VM state\n");
+        return;
+    }
+    encode_program(state.ram, program, length);
+    risky_word_t next = 0;
+    state.channel_io = (risky_channel_io_t) {
+        .read = read_word, .write = NULL, .context = &next,
+    };
+    double start = seconds();
+    for(unsigned int i = 0; i < REPEAT_COUNT; i++) {
+        risky_stop_reason_t reason;
+        state.program_counter = 0x0000U;
+        if(
+            run(&state, &reason) != STATUS_SUCCESS ||
+            reason != RISKY_STOP_HALTED
+        ) {
+            fprintf(stderr, "error running benchmark %s\n", method);
+            break;
+        }
+    }
+    double elapsed = seconds() - start;
+    printf(
+        "%-10s %10.2f M instructions/s\n",
+        method, (double) EXECUTED * REPEAT_COUNT / elapsed / 1e6
+    );
+    free_risky_vm_state(&state);
+}
+
+int main() {
+    init_risky_replay_log(&replay_log);
+    /*
+     * reads a word each time round a loop, and does some sums with it: 5
+     * setup instructions, 12 per loop and a HLT
+     */
+    risky_instruction_t program[] = {
+        op(CDC, 0x00U, 0, 0, 1),
+        set(1, LOOP_COUNT),
+        set(2, 1),
+        set(3, 0x0014U),
+        set(6, 0),
+        // loop:
+        op(REA, 0x00U, 7, 0, 0),
+        op(ADD, 0x07U, 8, 8, 7),
+        op(XOR, 0x07U, 9, 9, 8),
+        op(LSH, 0x07U, 10, 8, 2),
+        op(ADD, 0x07U, 9, 9, 10),
+        op(AND, 0x07U, 10, 9, 7),
+        op(SUB, 0x07U, 8, 8, 10),
+        op(QDC, 0x00U, 11, 0, 0),
+        op(ADD, 0x07U, 8, 8, 11),
+        op(SUB, 0x07U, 1, 1, 2),
+        op(NEQ, 0x03U, 5, 1, 6),
+        op(BRA, 0x00U, 3, 5, 0),
+        op(HLT, 0, 0, 0, 0),
+    };
+    size_t length = sizeof(program) / sizeof(program[0]);
+    run_benchmark("switch", run_risky_vm_switch, program, length);
+    run_benchmark("threaded", run_risky_vm, program, length);
+    run_benchmark("recorded", run_recorded, program, length);
+    run_benchmark("replayed", run_replayed, program, length);
+    printf(
+        "%-10s %10.2f bytes per event\n",
+        "log", (double) replay_log.size / (2.0 * LOOP_COUNT)
+    );
+    free_risky_replay_log(&replay_log);
+    return 0;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,118 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains a benchmark measuring how the instructions
+ * per second of the scheduler scale with the number of worker threads
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "../risky/core.h"
+#include "../risky/interpreter.h"
+#include "../risky/risky.h"
+#include "../risky/scheduler.h"
+#include "../tests/instructions.h"
+#include "../tests/timing.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of VMs being scheduled
+#define VM_COUNT 1024U
+// number of times the loop in the program goes round
+#define LOOP_COUNT 5000U
+// number of instructions one run of the program executes
+#define EXECUTED (3U + 4U * LOOP_COUNT + 1U)
+
+/*
+ * runs every VM from the start of its program with the given number of
+ * workers, then prints the throughput and each worker's utilisation
+ */
+static int measure(risky_vm_state_t ** states, size_t workers) {
+    for(size_t i = 0; i < VM_COUNT; i++) {
+        states[i]->registers[1] = (risky_register_t) i;
+        states[i]->program_counter = 0x0000U;
+    }
+    risky_scheduler_t scheduler;
+    if(
+        init_risky_scheduler(&scheduler, states, VM_COUNT, workers, 0) !=
+        STATUS_SUCCESS
+    ) {
+        fprintf(stderr, "could not allocate scheduler\n");
+        return 1;
+    }
+    double start = seconds();
+    run_risky_scheduler(&scheduler);
+    double elapsed = seconds() - start;
+    printf(
+        "%3zu workers %10.2f M instructions/s, utilisation:",
+        workers, (double) EXECUTED * VM_COUNT / elapsed / 1e6
+    );
+    for(size_t i = 0; i < workers; i++) {
+        risky_worker_stats_t stats;
+        get_risky_worker_stats(&scheduler, i, &stats);
+        uint64_t total = stats.busy_nanoseconds + stats.idle_nanoseconds;
+        printf(
+            " %.0f%%",
+            total ? 100.0 * (double) stats.busy_nanoseconds / total : 0.0
+        );
+    }
+    printf("\n");
+    free_risky_scheduler(&scheduler);
+    return 0;
+}
+
+int main() {
+    // a hash-like loop: 3 setup instructions, 4 per loop and a HLT
+    risky_instruction_t program[] = {
+        set(2, LOOP_COUNT),
+        set(3, 0x9e37U),
+        set(5, 0x000cU),
+        op(MLT, 0x07U, 1, 1, 3),
+        op(XOR, 0x07U, 1, 1, 2),
+        op(DEC, 0x06U, 2, 2, 0),
+        op(BRA, 0x04U, 5, 2, 0),
+        op(HLT, 0, 0, 0, 0),
+    };
+    static risky_vm_state_t states[VM_COUNT];
+    risky_vm_state_t * pointers[VM_COUNT];
+    for(size_t i = 0; i < VM_COUNT; i++) {
+        states[i] = (risky_vm_state_t) { .registers = {0}, .ram = NULL, };
+        if(init_risky_vm_state(&states[i]) != STATUS_SUCCESS) {
+            fprintf(stderr, "could not allocate VM state\n");
+            return 1;
+        }
+        encode_program(states[i].ram, program, 8);
+        pointers[i] = &states[i];
+    }
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t processors = (online > 0) ? (size_t) online : 1;
+    // double the workers each time, finishing with one per processor
+    for(size_t workers = 1; ; workers *= 2) {
+        if(workers > processors) {
+            workers = processors;
+        }
+        if(measure(pointers, workers) != 0) {
+            return 1;
+        }
+        if(workers == processors) {
+            break;
+        }
+    }
+    for(size_t i = 0; i < VM_COUNT; i++) {
+        free_risky_vm_state(&states[i]);
+    }
+    return 0;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,954 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * jit - this compilation unit defines an optional compiler which translates
+ * basic blocks of RISKY instructions into native x86-64 machine code, falling
+ * back to the interpreter for any instructions it can't translate.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include "../risky/cache.h"
+#include "../risky/core.h"
+#include "../risky/interpreter.h"
+#include "../risky/packed.h"
+#include "../risky/risky.h"
+#include "jit.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// maximum number of RISKY instructions translated into one block
+#define MAX_BLOCK_LENGTH 64
+
+// x86-64 register numbers, as used in instruction encodings
+enum {
+    RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+/*
+ * host registers used to hold guest registers for the duration of a block.
+ * RAX, RCX and RDX are scratch registers, RBX holds the VM state pointer
+ */
+static const uint8_t CACHE_REGISTERS[] = {
+    RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15,
+};
+#define CACHE_REGISTER_COUNT (\
+    sizeof(CACHE_REGISTERS) / sizeof(CACHE_REGISTERS[0])\
+)
+
+// translated code is entered through this, with the state and block address
+typedef uint32_t (* entry_point_t)(risky_vm_state_t * state, uint8_t * block);
+
+// cursor for writing machine code into a region of the executable buffer
+typedef struct emitter_t {
+    uint8_t * cursor;
+    uint8_t * end;
+    // set if the region ran out of space
+    bool full;
+} emitter_t;
+
+// bookkeeping for translating one block
+typedef struct block_t {
+    // host register holding each guest register, or -1 if not yet loaded
+    int8_t host[RISKY_REGISTER_COUNT];
+    // guest registers with a host register, in order of first use
+    risky_register_address_t cached[CACHE_REGISTER_COUNT];
+    size_t cached_count;
+    // which guest registers have been written since they were loaded
+    bool dirty[RISKY_REGISTER_COUNT];
+    // which guest registers hold values known at translation time
+    bool known[RISKY_REGISTER_COUNT];
+    risky_word_t constant[RISKY_REGISTER_COUNT];
+} block_t;
+
+/*
+ * private functions - write raw bytes and little-endian integers to the
+ * emitter, marking it as full instead if there is no space left
+ */
+static void emit_byte(emitter_t * e, uint8_t byte) {
+    if(e->cursor < e->end) {
+        *e->cursor++ = byte;
+    } else {
+        e->full = true;
+    }
+}
+
+static void emit_bytes(emitter_t * e, const uint8_t * bytes, size_t count) {
+    for(size_t i = 0; i < count; i++) {
+        emit_byte(e, bytes[i]);
+    }
+}
+
+static void emit_u32(emitter_t * e, uint32_t value) {
+    for(size_t i = 0; i < 4; i++) {
+        emit_byte(e, (uint8_t) (value >> (i * 8)));
+    }
+}
+
+static void emit_u64(emitter_t * e, uint64_t value) {
+    for(size_t i = 0; i < 8; i++) {
+        emit_byte(e, (uint8_t) (value >> (i * 8)));
+    }
+}
+
+// private function - writes a 32-bit relative displacement to a jump target
+static void patch_rel32(uint8_t * site, const uint8_t * target) {
+    int32_t displacement = (int32_t) (target - (site + 4));
+    memcpy(site, &displacement, sizeof(displacement));
+}
+
+/*
+ * private function - emits an instruction with a one-byte opcode and a
+ * register-direct operand pair (32-bit operand size)
+ */
+static void emit_register_pair(
+    emitter_t * e, uint8_t opcode, uint8_t reg, uint8_t rm
+) {
+    uint8_t rex = (uint8_t) (0x40U | ((reg >> 3) << 2) | (rm >> 3));
+    if(rex != 0x40U) {
+        emit_byte(e, rex);
+    }
+    emit_byte(e, opcode);
+    emit_byte(e, (uint8_t) (0xc0U | ((reg & 7U) << 3) | (rm & 7U)));
+}
+
+// private function - emits mov dst, src (32-bit)
+static void emit_mov(emitter_t * e, uint8_t dst, uint8_t src) {
+    emit_register_pair(e, 0x89U, src, dst);
+}
+
+// private function - emits mov dst, imm32
+static void emit_mov_immediate(emitter_t * e, uint8_t dst, uint32_t value) {
+    if(dst >= R8) {
+        emit_byte(e, 0x41U);
+    }
+    emit_byte(e, (uint8_t) (0xb8U + (dst & 7U)));
+    emit_u32(e, value);
+}
+
+/*
+ * private function - emits movzx to zero-extend the low 8 or 16 bits of a
+ * scratch register (RAX, RCX or RDX) into itself
+ */
+static void emit_zero_extend(emitter_t * e, uint8_t scratch, bool wide) {
+    emit_byte(e, 0x0fU);
+    emit_byte(e, wide ? 0xb7U : 0xb6U);
+    emit_byte(e, (uint8_t) (0xc0U | (scratch << 3) | scratch));
+}
+
+/*
+ * private function - emits an instruction with the given opcode bytes whose
+ * memory operand is [rbx + displacement]
+ */
+static void emit_rbx_operand(
+    emitter_t * e, bool operand16, bool wide64,
+    const uint8_t * opcode, size_t opcode_size,
+    uint8_t reg, uint32_t displacement
+) {
+    if(operand16) {
+        emit_byte(e, 0x66U);
+    }
+    uint8_t rex = (uint8_t) (
+        0x40U | (wide64 ? 0x08U : 0x00U) | ((reg >> 3) << 2)
+    );
+    if(rex != 0x40U) {
+        emit_byte(e, rex);
+    }
+    emit_bytes(e, opcode, opcode_size);
+    emit_byte(e, (uint8_t) (0x80U | ((reg & 7U) << 3) | RBX));
+    emit_u32(e, displacement);
+}
+
+// private function - emits movzx reg, word [rbx + 2 * guest]
+static void emit_load_guest(
+    emitter_t * e, uint8_t reg, risky_register_address_t guest
+) {
+    static const uint8_t opcode[] = { 0x0fU, 0xb7U, };
+    emit_rbx_operand(
+        e, false, false, opcode, 2, reg,
+        (uint32_t) offsetof(risky_vm_state_t, registers) +
+        guest * sizeof(risky_register_t)
+    );
+}
+
+// private function - emits mov word [rbx + 2 * guest], reg
+static void emit_store_guest(
+    emitter_t * e, uint8_t reg, risky_register_address_t guest
+) {
+    static const uint8_t opcode[] = { 0x89U, };
+    emit_rbx_operand(
+        e, true, false, opcode, 1, reg,
+        (uint32_t) offsetof(risky_vm_state_t, registers) +
+        guest * sizeof(risky_register_t)
+    );
+}
+
+// private function - emits mov byte [rbx + operation_flags], al
+static void emit_store_flags(emitter_t * e) {
+    static const uint8_t opcode[] = { 0x88U, };
+    emit_rbx_operand(
+        e, false, false, opcode, 1, RAX,
+        (uint32_t) offsetof(risky_vm_state_t, operation_flags)
+    );
+}
+
+// private function - emits mov rdx, qword [rbx + ram]
+static void emit_load_ram_pointer(emitter_t * e) {
+    static const uint8_t opcode[] = { 0x8bU, };
+    emit_rbx_operand(
+        e, false, true, opcode, 1, RDX,
+        (uint32_t) offsetof(risky_vm_state_t, ram)
+    );
+}
+
+/*
+ * private function - emits a jump (jmp if condition is 0, otherwise the jcc
+ * with that condition code) with a 32-bit displacement to be patched later,
+ * returning the address of the displacement
+ */
+static uint8_t * emit_jump(emitter_t * e, uint8_t condition) {
+    if(condition == 0) {
+        emit_byte(e, 0xe9U);
+    } else {
+        emit_byte(e, 0x0fU);
+        emit_byte(e, (uint8_t) (0x80U | condition));
+    }
+    uint8_t * site = e->cursor;
+    emit_u32(e, 0);
+    return e->full ? NULL : site;
+}
+
+// private function - emits a jump straight to the given address
+static void emit_jump_to(emitter_t * e, uint8_t condition, uint8_t * target) {
+    uint8_t * site = emit_jump(e, condition);
+    if(site != NULL) {
+        patch_rel32(site, target);
+    }
+}
+
+// x86 condition codes used with jcc and setcc
+#define CONDITION_BELOW 0x2U
+#define CONDITION_NOT_BELOW 0x3U
+#define CONDITION_EQUAL 0x4U
+#define CONDITION_NOT_EQUAL 0x5U
+#define CONDITION_ABOVE 0x7U
+
+// private function - emits setcc al
+static void emit_set_condition(emitter_t * e, uint8_t condition) {
+    emit_byte(e, 0x0fU);
+    emit_byte(e, (uint8_t) (0x90U | condition));
+    emit_byte(e, 0xc0U);
+}
+
+/*
+ * private function - returns the host register holding the given guest
+ * register for this block, assigning one (and loading the guest register's
+ * value into it, if load is set) the first time it is used
+ */
+static uint8_t use_register(
+    block_t * block, emitter_t * e, risky_register_address_t guest, bool load
+) {
+    if(block->host[guest] < 0) {
+        uint8_t host = CACHE_REGISTERS[block->cached_count];
+        block->cached[block->cached_count++] = guest;
+        block->host[guest] = (int8_t) host;
+        if(load) {
+            emit_load_guest(e, host, guest);
+        }
+    }
+    return (uint8_t) block->host[guest];
+}
+
+/*
+ * private function - emits code to copy the given guest register into the
+ * given scratch register, truncated to 8 bits unless wide is set
+ */
+static void read_operand(
+    block_t * block, emitter_t * e, uint8_t scratch,
+    risky_register_address_t guest, bool wide
+) {
+    emit_mov(e, scratch, use_register(block, e, guest, true));
+    if(!wide) {
+        emit_zero_extend(e, scratch, false);
+    }
+}
+
+/*
+ * private function - emits code to store the given scratch register into the
+ * given guest register, truncated to 8 bits unless wide is set
+ */
+static void write_result(
+    block_t * block, emitter_t * e, uint8_t scratch,
+    risky_register_address_t guest, bool wide
+) {
+    emit_zero_extend(e, scratch, wide);
+    emit_mov(e, use_register(block, e, guest, false), scratch);
+    block->dirty[guest] = true;
+    block->known[guest] = false;
+}
+
+// private function - emits code to write all modified guest registers back
+static void spill_registers(block_t * block, emitter_t * e) {
+    for(size_t i = 0; i < block->cached_count; i++) {
+        risky_register_address_t guest = block->cached[i];
+        if(block->dirty[guest]) {
+            emit_store_guest(e, (uint8_t) block->host[guest], guest);
+        }
+    }
+}
+
+/*
+ * private function - emits code that raises the overflow flag (and clears
+ * the others) if the given scratch register exceeds the given limit.
+ * Clobbers RAX
+ */
+static void emit_overflow_flags(
+    emitter_t * e, uint8_t scratch, uint32_t limit
+) {
+    static const uint8_t shift_left_two[] = { 0xc1U, 0xe0U, 0x02U, };
+    // xor eax, eax
+    emit_register_pair(e, 0x31U, RAX, RAX);
+    // cmp scratch, limit
+    emit_byte(e, 0x81U);
+    emit_byte(e, (uint8_t) (0xf8U | scratch));
+    emit_u32(e, limit);
+    emit_set_condition(e, CONDITION_ABOVE);
+    emit_bytes(e, shift_left_two, sizeof(shift_left_two));
+    emit_store_flags(e);
+}
+
+/*
+ * private function - emits code subtracting the given operand (either RDX or
+ * an 8-bit immediate, if operand is 0xff) from RCX, then optionally setting the
+ * operation flags the same way as the interpreter does. Clobbers RAX
+ */
+static void emit_subtract(
+    emitter_t * e, uint8_t operand, bool flags, uint32_t limit
+) {
+    static const uint8_t underflow[] = { 0xb0U, RISKY_UNDERFLOW, };
+    static const uint8_t decrement[] = { 0x83U, 0xe9U, 0x01U, };
+    if(flags) {
+        // xor eax, eax before the subtraction, so it doesn't clobber CF
+        emit_register_pair(e, 0x31U, RAX, RAX);
+    }
+    if(operand == 0xffU) {
+        emit_bytes(e, decrement, sizeof(decrement));
+    } else {
+        emit_register_pair(e, 0x29U, operand, RCX);
+    }
+    if(!flags) {
+        return;
+    }
+    // jae no_underflow; mov al, UNDERFLOW; jmp done
+    emit_byte(e, 0x73U);
+    emit_byte(e, 0x04U);
+    emit_bytes(e, underflow, sizeof(underflow));
+    emit_byte(e, 0xebU);
+    emit_byte(e, 0x0cU);
+    // no_underflow: 12 bytes of overflow check
+    static const uint8_t shift_left_two[] = { 0xc1U, 0xe0U, 0x02U, };
+    emit_byte(e, 0x81U);
+    emit_byte(e, 0xf9U);
+    emit_u32(e, limit);
+    emit_set_condition(e, CONDITION_ABOVE);
+    emit_bytes(e, shift_left_two, sizeof(shift_left_two));
+    // done:
+    emit_store_flags(e);
+}
+
+// private function - emits code to leave translated code at the given address
+static void emit_exit(
+    risky_jit_t * jit, emitter_t * e, risky_ram_address_t pc
+) {
+    emit_mov_immediate(e, RAX, pc);
+    emit_jump_to(e, 0, jit->exit);
+}
+
+/*
+ * private function - emits code to continue at the given constant address,
+ * jumping directly to its translated block if it has one, otherwise leaving
+ * translated code through a jump that will be linked to the block once it has
+ * been translated
+ */
+static void emit_link(
+    risky_jit_t * jit, emitter_t * e, risky_ram_address_t pc
+) {
+    size_t slot = pc / RISKY_INSTRUCTION_SIZE;
+    if(pc % RISKY_INSTRUCTION_SIZE != 0) {
+        emit_exit(jit, e, pc);
+    } else if(jit->blocks[slot] != NULL) {
+        emit_jump_to(e, 0, jit->blocks[slot]);
+    } else if(
+        (jit->untranslatable[slot / 64] >> (slot % 64)) & 1U ||
+        jit->link_count == RISKY_JIT_MAX_PENDING_LINKS
+    ) {
+        emit_exit(jit, e, pc);
+    } else {
+        // the jump initially goes to the exit code directly after it
+        uint8_t * site = emit_jump(e, 0);
+        if(site != NULL) {
+            patch_rel32(site, site + 4);
+            jit->links[jit->link_count++] = (risky_jit_link_t) { site, pc, };
+        }
+        emit_exit(jit, e, pc);
+    }
+}
+
+/*
+ * private function - emits code to continue at the address in EAX, jumping
+ * directly to its translated block if it has one, otherwise leaving
+ * translated code
+ */
+static void emit_indirect(risky_jit_t * jit, emitter_t * e) {
+    // test al, 3; jnz exit
+    static const uint8_t test_aligned[] = { 0xa8U, 0x03U, };
+    // mov rdx, [rdx + rax * 2]; test rdx, rdx
+    static const uint8_t load_block[] = {
+        0x48U, 0x8bU, 0x14U, 0x42U, 0x48U, 0x85U, 0xd2U,
+    };
+    // jmp rdx
+    static const uint8_t jump_block[] = { 0xffU, 0xe2U, };
+    emit_bytes(e, test_aligned, sizeof(test_aligned));
+    emit_jump_to(e, CONDITION_NOT_EQUAL, jit->exit);
+    // mov rdx, &jit->blocks[0]
+    emit_byte(e, 0x48U);
+    emit_byte(e, 0xbaU);
+    emit_u64(e, (uint64_t) (uintptr_t) jit->blocks);
+    emit_bytes(e, load_block, sizeof(load_block));
+    emit_jump_to(e, CONDITION_EQUAL, jit->exit);
+    emit_bytes(e, jump_block, sizeof(jump_block));
+}
+
+// private function - returns whether the given instruction can be translated
+static bool is_translatable(const risky_instruction_t * instruction) {
+    switch(instruction->opcode) {
+        case NOP: case JMP: case BRA:
+        case EQU: case NEQ: case GTN: case LTN:
+        case ADD: case SUB: case MLT:
+        case INC: case DEC:
+        case EOR: case AND: case XOR: case NOT:
+        case LSH: case RSH:
+        case SET: case COP: case LOD:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// private function - returns whether the given instruction sets the flags
+static bool sets_flags(const risky_instruction_t * instruction) {
+    switch(instruction->opcode) {
+        case ADD: case SUB: case MLT: case INC: case DEC:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * private function - stores the guest registers used by the given
+ * (translatable) instruction and returns how many there are
+ */
+static size_t instruction_registers(
+    const risky_instruction_t * instruction,
+    risky_register_address_t registers[3]
+) {
+    registers[0] = instruction->r;
+    registers[1] = instruction->a;
+    registers[2] = instruction->b;
+    switch(instruction->opcode) {
+        case NOP:
+            return 0;
+        case JMP: case SET:
+            return 1;
+        case BRA: case INC: case DEC: case NOT: case COP: case LOD:
+            return 2;
+        default:
+            return 3;
+    }
+}
+
+// private function - emits code for one instruction that doesn't end a block
+static void translate_instruction(
+    block_t * block, emitter_t * e, const risky_instruction_t * instruction,
+    bool flags
+) {
+    static const uint8_t shift_left[] = { 0xd3U, 0xe0U, };
+    static const uint8_t shift_right[] = { 0xd3U, 0xe8U, };
+    // cmp ecx, 16; sbb edx, edx; and eax, edx
+    static const uint8_t clamp_shift[] = {
+        0x83U, 0xf9U, 0x10U, 0x19U, 0xd2U, 0x21U, 0xd0U,
+    };
+    static const uint8_t increment[] = { 0x83U, 0xc1U, 0x01U, };
+    static const uint8_t multiply[] = { 0x0fU, 0xafU, 0xcaU, };
+    static const uint8_t invert[] = { 0xf7U, 0xd1U, };
+    // movzx eax, byte [rdx + rcx]
+    static const uint8_t load_byte[] = { 0x0fU, 0xb6U, 0x04U, 0x0aU, };
+    // shl eax, 8; add ecx, 1; movzx ecx, cx; movzx ecx, byte [rdx + rcx]
+    static const uint8_t load_second_byte[] = {
+        0xc1U, 0xe0U, 0x08U, 0x83U, 0xc1U, 0x01U, 0x0fU, 0xb7U, 0xc9U,
+        0x0fU, 0xb6U, 0x0cU, 0x0aU,
+    };
+    uint32_t limit = instruction->a_flag ? 0xffffU : 0xffU;
+    uint8_t condition = 0;
+    uint8_t logic = 0;
+    switch(instruction->opcode) {
+        case NOP:
+            break;
+        case SET: {
+            risky_word_t value = instruction->a_flag ?
+                instruction->l : instruction->l & 0xffU;
+            emit_mov_immediate(
+                e, use_register(block, e, instruction->r, false), value
+            );
+            block->dirty[instruction->r] = true;
+            block->known[instruction->r] = true;
+            block->constant[instruction->r] = value;
+            break;
+        }
+        case COP:
+            read_operand(block, e, RCX, instruction->a, instruction->b_flag);
+            write_result(block, e, RCX, instruction->r, instruction->a_flag);
+            break;
+        case EQU: condition = CONDITION_EQUAL; goto compare;
+        case NEQ: condition = CONDITION_NOT_EQUAL; goto compare;
+        case GTN: condition = CONDITION_ABOVE; goto compare;
+        case LTN: condition = CONDITION_BELOW; goto compare;
+        compare:
+            read_operand(block, e, RCX, instruction->a, instruction->b_flag);
+            read_operand(block, e, RDX, instruction->b, instruction->c_flag);
+            emit_register_pair(e, 0x31U, RAX, RAX);
+            emit_register_pair(e, 0x39U, RDX, RCX);
+            emit_set_condition(e, condition);
+            write_result(block, e, RAX, instruction->r, instruction->a_flag);
+            break;
+        case ADD:
+        case MLT:
+            read_operand(block, e, RCX, instruction->a, instruction->b_flag);
+            read_operand(block, e, RDX, instruction->b, instruction->c_flag);
+            if(instruction->opcode == ADD) {
+                emit_register_pair(e, 0x01U, RDX, RCX);
+            } else {
+                emit_bytes(e, multiply, sizeof(multiply));
+            }
+            if(flags) {
+                emit_overflow_flags(e, RCX, limit);
+            }
+            write_result(block, e, RCX, instruction->r, instruction->a_flag);
+            break;
+        case INC:
+            read_operand(block, e, RCX, instruction->a, instruction->b_flag);
+            emit_bytes(e, increment, sizeof(increment));
+            if(flags) {
+                emit_overflow_flags(e, RCX, limit);
+            }
+            write_result(block, e, RCX, instruction->r, instruction->a_flag);
+            break;
+        case SUB:
+            read_operand(block, e, RCX, instruction->a, instruction->b_flag);
+            read_operand(block, e, RDX, instruction->b, instruction->c_flag);
+            emit_subtract(e, RDX, flags, limit);
+            write_result(block, e, RCX, instruction->r, instruction->a_flag);
+            break;
+        case DEC:
+            read_operand(block, e, RCX, instruction->a, instruction->b_flag);
+            emit_subtract(e, 0xffU, flags, limit);
+            write_result(block, e, RCX, instruction->r, instruction->a_flag);
+            break;
+        case EOR: logic = 0x09U; goto logical;
+        case AND: logic = 0x21U; goto logical;
+        case XOR: logic = 0x31U; goto logical;
+        logical:
+            read_operand(block, e, RCX, instruction->a, instruction->b_flag);
+            read_operand(block, e, RDX, instruction->b, instruction->c_flag);
+            emit_register_pair(e, logic, RDX, RCX);
+            write_result(block, e, RCX, instruction->r, instruction->a_flag);
+            break;
+        case NOT:
+            read_operand(block, e, RCX, instruction->a, instruction->b_flag);
+            emit_bytes(e, invert, sizeof(invert));
+            write_result(block, e, RCX, instruction->r, instruction->a_flag);
+            break;
+        case LSH:
+        case RSH:
+            read_operand(block, e, RAX, instruction->a, instruction->b_flag);
+            read_operand(block, e, RCX, instruction->b, instruction->c_flag);
+            if(instruction->opcode == LSH) {
+                emit_bytes(e, shift_left, sizeof(shift_left));
+            } else {
+                emit_bytes(e, shift_right, sizeof(shift_right));
+            }
+            emit_bytes(e, clamp_shift, sizeof(clamp_shift));
+            write_result(block, e, RAX, instruction->r, instruction->a_flag);
+            break;
+        case LOD:
+            read_operand(block, e, RCX, instruction->a, instruction->b_flag);
+            emit_load_ram_pointer(e);
+            emit_bytes(e, load_byte, sizeof(load_byte));
+            if(instruction->a_flag) {
+                emit_bytes(e, load_second_byte, sizeof(load_second_byte));
+                emit_register_pair(e, 0x09U, RCX, RAX);
+            }
+            write_result(block, e, RAX, instruction->r, instruction->a_flag);
+            break;
+        default:
+            // never reached, untranslatable instructions end the block
+            break;
+    }
+}
+
+// private function - emits code for a JMP or BRA, which always ends a block
+static void translate_jump(
+    risky_jit_t * jit, block_t * block, emitter_t * e,
+    const risky_instruction_t * instruction, risky_ram_address_t pc
+) {
+    static const uint8_t test_condition[] = { 0x85U, 0xc9U, };
+    bool known = block->known[instruction->r];
+    if(instruction->opcode == BRA) {
+        read_operand(block, e, RCX, instruction->a, instruction->a_flag);
+    }
+    if(!known) {
+        emit_mov(e, RAX, use_register(block, e, instruction->r, true));
+    }
+    spill_registers(block, e);
+    if(instruction->opcode == BRA) {
+        // test ecx, ecx; jnz taken; (not taken:) continue at next instruction
+        emit_bytes(e, test_condition, sizeof(test_condition));
+        uint8_t * taken = emit_jump(e, CONDITION_NOT_EQUAL);
+        emit_link(jit, e, (risky_ram_address_t) (pc + RISKY_INSTRUCTION_SIZE));
+        if(taken != NULL) {
+            patch_rel32(taken, e->cursor);
+        }
+    }
+    if(known) {
+        emit_link(jit, e, block->constant[instruction->r]);
+    } else {
+        emit_indirect(jit, e);
+    }
+}
+
+/*
+ * private function - translates the block starting at the given address and
+ * returns the address of its code, or NULL if it couldn't be translated.
+ * Sets full if the executable buffer ran out of space
+ */
+static uint8_t * translate_block(
+    risky_jit_t * jit, risky_ram_address_t start, bool * full
+) {
+    risky_instruction_t program[MAX_BLOCK_LENGTH];
+    size_t count = 0;
+    bool ends_with_jump = false;
+    bool next_untranslatable = false;
+    bool used[RISKY_REGISTER_COUNT] = { false };
+    size_t used_count = 0;
+    risky_ram_address_t pc = start;
+    // first pass: find the end of the block
+    while(count < MAX_BLOCK_LENGTH) {
+        risky_packed_instruction_t * packed = NULL;
+        if(fetch_instruction(jit->state, pc, &packed) != STATUS_SUCCESS) {
+            break;
+        }
+        risky_instruction_t * instruction = &program[count];
+        unpack_instruction(packed, instruction);
+        if(!is_translatable(instruction)) {
+            size_t slot = pc / RISKY_INSTRUCTION_SIZE;
+            jit->untranslatable[slot / 64] |= (uint64_t) 1U << (slot % 64);
+            next_untranslatable = true;
+            break;
+        }
+        // stop if there aren't enough host registers for this instruction
+        risky_register_address_t registers[3];
+        size_t register_count = instruction_registers(instruction, registers);
+        size_t new_count = 0;
+        for(size_t i = 0; i < register_count; i++) {
+            bool seen = used[registers[i]];
+            for(size_t j = 0; j < i; j++) {
+                seen = seen || registers[j] == registers[i];
+            }
+            new_count += seen ? 0 : 1;
+        }
+        if(used_count + new_count > CACHE_REGISTER_COUNT) {
+            break;
+        }
+        for(size_t i = 0; i < register_count; i++) {
+            used_count += used[registers[i]] ? 0 : 1;
+            used[registers[i]] = true;
+        }
+        count++;
+        if(instruction->opcode == JMP || instruction->opcode == BRA) {
+            ends_with_jump = true;
+            break;
+        }
+        pc += RISKY_INSTRUCTION_SIZE;
+        // blocks never wrap around the end of RAM
+        if(pc == 0) {
+            break;
+        }
+    }
+    if(count == 0) {
+        return NULL;
+    }
+    // only the last instruction to set the flags needs to store them
+    size_t last_flags = count;
+    for(size_t i = 0; i < count; i++) {
+        if(sets_flags(&program[i])) {
+            last_flags = i;
+        }
+    }
+    // second pass: emit the code
+    block_t block;
+    memset(block.host, 0xff, sizeof(block.host));
+    memset(block.dirty, 0, sizeof(block.dirty));
+    memset(block.known, 0, sizeof(block.known));
+    block.cached_count = 0;
+    uint8_t * code = jit->code + jit->code_used;
+    emitter_t e = { code, jit->code + RISKY_JIT_CODE_SIZE, false, };
+    size_t link_count = jit->link_count;
+    for(size_t i = 0; i < count; i++) {
+        risky_ram_address_t address = (risky_ram_address_t) (
+            start + i * RISKY_INSTRUCTION_SIZE
+        );
+        if(ends_with_jump && i == count - 1) {
+            translate_jump(jit, &block, &e, &program[i], address);
+        } else {
+            translate_instruction(&block, &e, &program[i], i == last_flags);
+        }
+    }
+    if(!ends_with_jump) {
+        spill_registers(&block, &e);
+        if(next_untranslatable) {
+            emit_exit(jit, &e, pc);
+        } else {
+            emit_link(jit, &e, pc);
+        }
+    }
+    if(e.full) {
+        // forget any links recorded from the partially emitted block
+        jit->link_count = link_count;
+        *full = true;
+        return NULL;
+    }
+    jit->code_used = (size_t) (e.cursor - jit->code);
+    // record the block and which slots it was translated from
+    size_t first = start / RISKY_INSTRUCTION_SIZE;
+    jit->blocks[first] = code;
+    for(size_t slot = first; slot < first + count; slot++) {
+        jit->translated[slot / 64] |= (uint64_t) 1U << (slot % 64);
+    }
+    // link up any jumps that were waiting for this block
+    for(size_t i = 0; i < jit->link_count; ) {
+        if(jit->links[i].target == start) {
+            patch_rel32(jit->links[i].site, code);
+            jit->links[i] = jit->links[--jit->link_count];
+        } else {
+            i++;
+        }
+    }
+    return code;
+}
+
+/*
+ * private function - makes the buffer of translated code writable (and not
+ * executable) or executable (and not writable), if it isn't already.
+ * Returns false if its protection couldn't be changed
+ */
+static bool protect_code(risky_jit_t * jit, bool writable) {
+    if(jit->writable == writable) {
+        return true;
+    }
+    int protection = writable ?
+        PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC;
+    if(mprotect(jit->code, RISKY_JIT_CODE_SIZE, protection) != 0) {
+        return false;
+    }
+    jit->writable = writable;
+    return true;
+}
+
+/*
+ * private function - returns the translated code for the block starting at
+ * the given address, translating it first if needed, or NULL if it must be
+ * interpreted instead
+ */
+static uint8_t * find_block(risky_jit_t * jit, risky_ram_address_t pc) {
+    size_t slot = pc / RISKY_INSTRUCTION_SIZE;
+    if(jit->code == NULL || pc % RISKY_INSTRUCTION_SIZE != 0) {
+        return NULL;
+    }
+    if(jit->blocks[slot] != NULL) {
+        return jit->blocks[slot];
+    }
+    if(
+        ((jit->untranslatable[slot / 64] >> (slot % 64)) & 1U) ||
+        !protect_code(jit, true)
+    ) {
+        return NULL;
+    }
+    bool full = false;
+    uint8_t * block = translate_block(jit, pc, &full);
+    // start again with an empty buffer if it ran out of space
+    if(full) {
+        invalidate_risky_jit(jit);
+        full = false;
+        block = translate_block(jit, pc, &full);
+    }
+    return block;
+}
+
+/*
+ * private function - discards all translated code if any of the given range
+ * of RAM has been translated
+ */
+static void invalidate_written(
+    risky_jit_t * jit, risky_ram_address_t address, size_t length
+) {
+    for(size_t i = 0; i < length; i++) {
+        size_t slot = (
+            (address + i) % RISKY_RAM_AMOUNT
+        ) / RISKY_INSTRUCTION_SIZE;
+        if((jit->translated[slot / 64] >> (slot % 64)) & 1U) {
+            invalidate_risky_jit(jit);
+            return;
+        }
+    }
+}
+
+/*
+ * private function - emits the code at the start of the buffer which enters
+ * and leaves translated code
+ */
+static void emit_entry_and_exit(risky_jit_t * jit) {
+    /*
+     * entry: save the callee-saved registers, move the state pointer to RBX
+     * and jump to the block
+     */
+    static const uint8_t entry[] = {
+        0x53U, 0x55U, 0x41U, 0x54U, 0x41U, 0x55U, 0x41U, 0x56U, 0x41U, 0x57U,
+        0x48U, 0x89U, 0xfbU, 0xffU, 0xe6U,
+    };
+    // exit: restore the callee-saved registers, returning the address in EAX
+    static const uint8_t exit[] = {
+        0x41U, 0x5fU, 0x41U, 0x5eU, 0x41U, 0x5dU, 0x41U, 0x5cU, 0x5dU, 0x5bU,
+        0xc3U,
+    };
+    memcpy(jit->code, entry, sizeof(entry));
+    jit->exit = jit->code + sizeof(entry);
+    memcpy(jit->exit, exit, sizeof(exit));
+    jit->code_used = sizeof(entry) + sizeof(exit);
+}
+
+/*
+ * given a pointer to a risky_jit_t and a pointer to an initialised
+ * risky_vm_state_t, initialises the JIT to translate and run code from that
+ * VM's RAM, mapping a buffer of executable memory for it. If executable
+ * memory can't be mapped, the JIT still works but always interprets.
+ * Returns a status_t with error / success information
+ */
+status_t init_risky_jit(risky_jit_t * jit, risky_vm_state_t * state) {
+    jit->state = state;
+    // it starts off writable, for the entry and exit code
+    jit->code = (uint8_t *) mmap(
+        NULL, RISKY_JIT_CODE_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+    );
+    jit->writable = true;
+    if(jit->code == MAP_FAILED) {
+        jit->code = NULL;
+    }
+    jit->exit = NULL;
+    jit->code_used = 0;
+    if(jit->code != NULL) {
+        emit_entry_and_exit(jit);
+    }
+    memset(jit->blocks, 0, sizeof(jit->blocks));
+    memset(jit->untranslatable, 0, sizeof(jit->untranslatable));
+    memset(jit->translated, 0, sizeof(jit->translated));
+    jit->link_count = 0;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_jit_t, unmaps its executable memory.
+ * Returns a status_t with error / success information
+ */
+status_t free_risky_jit(risky_jit_t * jit) {
+    if(jit->code != NULL) {
+        munmap(jit->code, RISKY_JIT_CODE_SIZE);
+        jit->code = NULL;
+    }
+    jit->state = NULL;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_jit_t, discards all translated code. This must be
+ * called if the host writes to the VM's RAM after code has been translated
+ * (writes made by SAV instructions are detected automatically).
+ */
+void invalidate_risky_jit(risky_jit_t * jit) {
+    if(jit->code != NULL && protect_code(jit, true)) {
+        emit_entry_and_exit(jit);
+    }
+    memset(jit->blocks, 0, sizeof(jit->blocks));
+    memset(jit->untranslatable, 0, sizeof(jit->untranslatable));
+    memset(jit->translated, 0, sizeof(jit->translated));
+    jit->link_count = 0;
+}
+
+/*
+ * given a pointer to a risky_jit_t and a pointer to a risky_stop_reason_t,
+ * execute the JIT's VM from its program counter until it stops, in the same
+ * way as run_risky_vm(). Blocks are translated the first time they are
+ * reached, and any instruction that can't be translated is interpreted.
+ * Returns a status_t with error / success information
+ */
+status_t run_risky_jit(risky_jit_t * jit, risky_stop_reason_t * reason) {
+    risky_vm_state_t * state = jit->state;
+    entry_point_t enter = NULL;
+    // entry point is at the start of the buffer (ISO C has no data->code cast)
+    memcpy(&enter, &jit->code, sizeof(enter));
+    *reason = RISKY_STOP_NONE;
+    for(;;) {
+        uint8_t * block = find_block(jit, state->program_counter);
+        if(block != NULL && protect_code(jit, false)) {
+            state->program_counter = (risky_ram_address_t) enter(state, block);
+            continue;
+        }
+        // interpret this instruction, noting where it writes if it is a SAV
+        risky_packed_instruction_t * instruction = NULL;
+        status_t result = fetch_instruction(
+            state, state->program_counter, &instruction
+        );
+        if(result != STATUS_SUCCESS) {
+            return result;
+        }
+        bool saving = packed_opcode(instruction) == SAV;
+        risky_ram_address_t address = packed_b_flag(instruction) ?
+            state->registers[instruction->a] :
+            state->registers[instruction->a] & 0xffU;
+        size_t length = packed_a_flag(instruction) ? 2 : 1;
+        result = step_risky_vm(state, reason);
+        if(result != STATUS_SUCCESS || *reason != RISKY_STOP_NONE) {
+            return result;
+        }
+        if(saving) {
+            invalidate_written(jit, address, length);
+        }
+    }
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
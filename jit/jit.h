@@ -0,0 +1,105 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * jit - this compilation unit defines an optional compiler which translates
+ * basic blocks of RISKY instructions into native x86-64 machine code, falling
+ * back to the interpreter for any instructions it can't translate.
+ */
+#ifndef SAXBOPHONE_RISKY_JIT_H
+#define SAXBOPHONE_RISKY_JIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../risky/cache.h"
+#include "../risky/core.h"
+#include "../risky/interpreter.h"
+#include "../risky/risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// size in bytes of the executable buffer translated code is written into
+#define RISKY_JIT_CODE_SIZE (1024 * 1024)
+// maximum number of direct jumps between blocks waiting to be linked up
+#define RISKY_JIT_MAX_PENDING_LINKS 4096
+
+// a direct jump in translated code which will be patched once its target exists
+typedef struct risky_jit_link_t {
+    // address of the 32-bit relative displacement of the jump
+    uint8_t * site;
+    // RAM address of the block the jump should go to
+    risky_ram_address_t target;
+} risky_jit_link_t;
+
+// state of the JIT compiler for one VM
+typedef struct risky_jit_t {
+    // the VM whose code is being translated and run
+    risky_vm_state_t * state;
+    /*
+     * buffer of translated code, NULL if it could not be mapped. It is never
+     * writable and executable at once: it is made writable to translate code
+     * into it and executable again to run it
+     */
+    uint8_t * code;
+    // whether the buffer is currently writable rather than executable
+    bool writable;
+    // number of bytes of the buffer currently in use
+    size_t code_used;
+    // address of the shared code that returns from translated code to C
+    uint8_t * exit;
+    // translated code for the block starting at each 4-byte slot of RAM
+    uint8_t * blocks[RISKY_INSTRUCTION_SLOTS];
+    // bitmap of slots whose first instruction can't be translated
+    uint64_t untranslatable[RISKY_INSTRUCTION_SLOTS / 64];
+    // bitmap of slots that have been translated as part of any block
+    uint64_t translated[RISKY_INSTRUCTION_SLOTS / 64];
+    // direct jumps to blocks which haven't been translated yet
+    risky_jit_link_t links[RISKY_JIT_MAX_PENDING_LINKS];
+    size_t link_count;
+} risky_jit_t;
+
+/*
+ * given a pointer to a risky_jit_t and a pointer to an initialised
+ * risky_vm_state_t, initialises the JIT to translate and run code from that
+ * VM's RAM, mapping a buffer of executable memory for it. If executable
+ * memory can't be mapped, the JIT still works but always interprets.
+ * Returns a status_t with error / success information
+ */
+status_t init_risky_jit(risky_jit_t * jit, risky_vm_state_t * state);
+
+/*
+ * given a pointer to a risky_jit_t, unmaps its executable memory.
+ * Returns a status_t with error / success information
+ */
+status_t free_risky_jit(risky_jit_t * jit);
+
+/*
+ * given a pointer to a risky_jit_t, discards all translated code. This must be
+ * called if the host writes to the VM's RAM after code has been translated
+ * (writes made by SAV instructions are detected automatically).
+ */
+void invalidate_risky_jit(risky_jit_t * jit);
+
+/*
+ * given a pointer to a risky_jit_t and a pointer to a risky_stop_reason_t,
+ * execute the JIT's VM from its program counter until it stops, in the same
+ * way as run_risky_vm(). Blocks are translated the first time they are
+ * reached, and any instruction that can't be translated is interpreted.
+ * Returns a status_t with error / success information
+ */
+status_t run_risky_jit(risky_jit_t * jit, risky_stop_reason_t * reason);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+// end of header file
+#endif
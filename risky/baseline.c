@@ -0,0 +1,118 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * baseline - this compilation unit defines baselines of the state of a RISKY
+ * virtual machine which it can quickly be reset to.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "baseline.h"
+#include "cache.h"
+#include "core.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of instruction cache slots in a line of RAM
+#define LINE_SLOTS (RISKY_WRITE_LINE_SIZE / RISKY_INSTRUCTION_SIZE)
+// mask of the cache's valid bits for the slots of one line of RAM
+#define LINE_SLOTS_MASK ((UINT64_C(1) << LINE_SLOTS) - 1U)
+
+/*
+ * given a pointer to an uninitialised risky_baseline_t and a pointer to an
+ * initialised risky_vm_state_t, capture the VM's state as it is now as the
+ * baseline, and start tracking which lines of RAM the VM writes to.
+ * Returns a status_t with error / success information
+ */
+status_t capture_risky_baseline(
+    risky_baseline_t * baseline, risky_vm_state_t * state
+) {
+    baseline->ram = (risky_ram_t *) malloc(RISKY_RAM_AMOUNT);
+    if(baseline->ram == NULL) {
+        return MALLOC_REFUSED;
+    }
+    memcpy(baseline->ram, state->ram, RISKY_RAM_AMOUNT);
+    memcpy(baseline->registers, state->registers, sizeof(state->registers));
+    baseline->program_counter = state->program_counter;
+    baseline->operation_flags = state->operation_flags;
+    memcpy(baseline->channels, state->channels, sizeof(state->channels));
+    memset(state->written_lines, 0, sizeof(state->written_lines));
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_baseline_t, free its copy of RAM.
+ * Returns a status_t with error / success information
+ */
+status_t free_risky_baseline(risky_baseline_t * baseline) {
+    free(baseline->ram);
+    baseline->ram = NULL;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to the risky_vm_state_t a risky_baseline_t was captured
+ * from and a pointer to the baseline, reset the VM to the baseline, copying
+ * back only the lines of RAM written to since.
+ * Returns a status_t with error / success information
+ */
+status_t reset_risky_vm_to_baseline(
+    risky_vm_state_t * state, const risky_baseline_t * baseline
+) {
+    for(size_t word = 0; word < RISKY_WRITE_LINE_WORDS; word++) {
+        uint64_t lines = state->written_lines[word];
+        if(lines == 0) {
+            continue;
+        }
+        state->written_lines[word] = 0;
+        do {
+            size_t line = word * 64 + risky_lowest_bit(lines);
+            lines &= lines - 1;
+            size_t address = line * RISKY_WRITE_LINE_SIZE;
+            memcpy(
+                &state->ram[address], &baseline->ram[address],
+                RISKY_WRITE_LINE_SIZE
+            );
+            /*
+             * instructions decoded since the line was written to were
+             * decoded from what was written, so must be decoded again, as
+             * must the one before the line, which may be fused with them
+             */
+            if(state->cache != NULL) {
+                size_t slot = line * LINE_SLOTS;
+                state->cache->valid[slot / 64] &= ~(
+                    LINE_SLOTS_MASK << (slot % 64)
+                );
+                if(slot > 0) {
+                    state->cache->valid[(slot - 1) / 64] &= ~(
+                        UINT64_C(1) << ((slot - 1) % 64)
+                    );
+                }
+            }
+            // the line is written to again, as far as checkpoints can tell
+            state->dirty_pages |= (uint32_t) 1U << (
+                line / RISKY_PAGE_LINES
+            );
+        } while(lines != 0);
+        state->ram_written = true;
+    }
+    memcpy(state->registers, baseline->registers, sizeof(state->registers));
+    state->program_counter = baseline->program_counter;
+    state->operation_flags = baseline->operation_flags;
+    memcpy(state->channels, baseline->channels, sizeof(state->channels));
+    return STATUS_SUCCESS;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
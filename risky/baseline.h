@@ -0,0 +1,78 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * baseline - this compilation unit defines baselines of the state of a RISKY
+ * virtual machine which it can quickly be reset to, for running the same
+ * program over and over with different input (as a fuzzer or batch job
+ * does). Resetting copies back only the 64-byte lines of RAM the VM has
+ * written to since, which it tracks as it writes them, along with its
+ * registers, so a run which only wrote a few hundred bytes is undone in a
+ * few dozen nanoseconds.
+ */
+#ifndef SAXBOPHONE_RISKY_BASELINE_H
+#define SAXBOPHONE_RISKY_BASELINE_H
+
+#include "core.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// baseline struct, a copy of the state of a VM to reset it to
+typedef struct risky_baseline_t {
+    // copy of the VM's registers
+    risky_register_t registers[RISKY_REGISTER_COUNT];
+    // a pointer to a dynamically allocated copy of the VM's RAM
+    risky_ram_t * ram;
+    // copy of the VM's program counter
+    risky_ram_address_t program_counter;
+    // copy of the VM's operation flags
+    risky_byte_t operation_flags;
+    // copy of the VM's channel states
+    risky_byte_t channels[RISKY_CHANNEL_COUNT];
+} risky_baseline_t;
+
+/*
+ * given a pointer to an uninitialised risky_baseline_t and a pointer to an
+ * initialised risky_vm_state_t, capture the VM's registers, RAM, program
+ * counter, operation flags and channel states as they are now as the
+ * baseline, and start tracking which lines of RAM the VM writes to from now
+ * on. Anything which writes to the VM's RAM other than by running it must
+ * call invalidate_cached_instructions() for resetting to undo the write.
+ * Returns a status_t with error / success information
+ */
+status_t capture_risky_baseline(
+    risky_baseline_t * baseline, risky_vm_state_t * state
+);
+
+/*
+ * given a pointer to a risky_baseline_t, free its copy of RAM.
+ * Returns a status_t with error / success information
+ */
+status_t free_risky_baseline(risky_baseline_t * baseline);
+
+/*
+ * given a pointer to the risky_vm_state_t a risky_baseline_t was captured
+ * from and a pointer to the baseline, reset the VM's registers, RAM, program
+ * counter, operation flags and channel states to the baseline. Only the lines
+ * of RAM written to since the baseline was captured (or the VM was last reset)
+ * are copied, and cached instructions decoded from them invalidated. The
+ * channel callbacks and rings are left as they are.
+ * Returns a status_t with error / success information
+ */
+status_t reset_risky_vm_to_baseline(
+    risky_vm_state_t * state, const risky_baseline_t * baseline
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+// end of header file
+#endif
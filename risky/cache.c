@@ -0,0 +1,326 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * cache - this compilation unit defines a per-VM cache of predecoded
+ * instructions, so that instructions which are executed repeatedly only have to
+ * be decoded from raw RAM contents the first time they are fetched.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "core.h"
+#include "image.h"
+#include "packed.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * private function - given a pointer to a risky_vm_state_t and a RAM address,
+ * copy the four bytes of RAM starting at that address into a raw instruction,
+ * wrapping around at the end of RAM
+ */
+static risky_raw_instruction_t read_raw_instruction(
+    risky_vm_state_t * state, risky_ram_address_t address
+) {
+    risky_raw_instruction_t raw;
+    for(size_t i = 0; i < RISKY_INSTRUCTION_SIZE; i++) {
+        raw.bytes[i] = state->ram[(address + i) % RISKY_RAM_AMOUNT];
+    }
+    return raw;
+}
+
+/*
+ * private function - given a pointer to a risky_vm_state_t, allocate its cache
+ * on first use, with all slots marked as invalid.
+ * Returns a status_t with error / success information
+ */
+static status_t allocate_cache(risky_vm_state_t * state) {
+    if(state->cache == NULL) {
+        state->cache = (risky_instruction_cache_t *) calloc(
+            1, sizeof(risky_instruction_cache_t)
+        );
+        if(state->cache == NULL) {
+            return MALLOC_REFUSED;
+        }
+    }
+    return STATUS_SUCCESS;
+}
+
+/*
+ * private function - given the opcodes of two instructions, the second
+ * following the first in RAM, returns the risky_fused_t kind which the first
+ * can be fused with the second as, or RISKY_FUSED_NONE if they can't be fused
+ */
+static risky_byte_t fusable_kind(risky_opcode_t first, risky_opcode_t second) {
+#ifdef RISKY_NO_FUSION
+    (void) first;
+    (void) second;
+    return RISKY_FUSED_NONE;
+#else
+    switch(first) {
+    case EQU:
+    case NEQ:
+    case GTN:
+    case LTN:
+        return (second == BRA) ? RISKY_FUSED_BRA : RISKY_FUSED_NONE;
+    case SET:
+        return (second == JMP) ? RISKY_FUSED_JMP : RISKY_FUSED_NONE;
+    case INC:
+    case DEC:
+        switch(second) {
+        case EQU:
+            return RISKY_FUSED_EQU;
+        case NEQ:
+            return RISKY_FUSED_NEQ;
+        case GTN:
+            return RISKY_FUSED_GTN;
+        case LTN:
+            return RISKY_FUSED_LTN;
+        default:
+            return RISKY_FUSED_NONE;
+        }
+    default:
+        return RISKY_FUSED_NONE;
+    }
+#endif
+}
+
+/*
+ * private function - given an opcode, returns whether an instruction with it
+ * can be fused with some instruction following it
+ */
+static bool is_fusable_first(risky_opcode_t opcode) {
+    return (
+        fusable_kind(opcode, BRA) != RISKY_FUSED_NONE ||
+        fusable_kind(opcode, JMP) != RISKY_FUSED_NONE ||
+        fusable_kind(opcode, EQU) != RISKY_FUSED_NONE
+    );
+}
+
+/*
+ * private function - given a pointer to a risky_instruction_cache_t and a
+ * slot, returns whether that slot holds a valid decoded instruction
+ */
+static bool is_valid_slot(risky_instruction_cache_t * cache, size_t slot) {
+    return (cache->valid[slot / 64] >> (slot % 64)) & 1U;
+}
+
+/*
+ * private function - given a pointer to a risky_vm_state_t and a slot whose
+ * instruction has just been decoded, fuses it with the instruction in the
+ * next slot if they can be, decoding that one too if it isn't already (and
+ * fusing it with the one after in turn). The last slot is never fused, as
+ * execution wraps around after it
+ */
+static void fuse_slots(risky_vm_state_t * state, size_t slot) {
+    risky_instruction_cache_t * cache = state->cache;
+    for(; slot + 1 < RISKY_INSTRUCTION_SLOTS; slot++) {
+        risky_packed_instruction_t * first = &cache->instructions[slot];
+        risky_opcode_t opcode = packed_opcode(first);
+        if(!is_fusable_first(opcode)) {
+            return;
+        }
+        size_t next = slot + 1;
+        risky_packed_instruction_t * second = &cache->instructions[next];
+        bool decoded = !is_valid_slot(cache, next);
+        if(decoded) {
+            risky_raw_instruction_t raw = read_raw_instruction(
+                state, (risky_ram_address_t) (next * RISKY_INSTRUCTION_SIZE)
+            );
+            if(
+                decode_packed_instruction_from_raw(&raw, second) !=
+                STATUS_SUCCESS
+            ) {
+                return;
+            }
+            cache->valid[next / 64] |= (uint64_t) 1U << (next % 64);
+        }
+        first->fused = fusable_kind(opcode, packed_opcode(second));
+        // a slot which was already valid has been fused already
+        if(!decoded) {
+            return;
+        }
+    }
+}
+
+/*
+ * given a pointer to a risky_vm_state_t, a RAM address and a pointer to a
+ * pointer to a risky_packed_instruction_t, fetch the decoded instruction
+ * stored at that address in the VM's RAM and store a pointer to it in the
+ * pointer at the given address.
+ * the instruction is only decoded if it has not already been decoded since the
+ * last time its slot was invalidated. The cache itself is allocated on the
+ * first call to this function for any given VM state.
+ * the pointer returned is owned by the cache and is only valid until the next
+ * call to any function of this module with the same VM state.
+ * Returns a status_t with error / success information
+ */
+status_t fetch_instruction(
+    risky_vm_state_t * state, risky_ram_address_t address,
+    risky_packed_instruction_t ** instruction
+) {
+    if(allocate_cache(state) != STATUS_SUCCESS) {
+        return MALLOC_REFUSED;
+    }
+    risky_instruction_cache_t * cache = state->cache;
+    risky_raw_instruction_t raw;
+    // unaligned instructions are decoded every time, into the scratch space
+    if(address % RISKY_INSTRUCTION_SIZE != 0) {
+        raw = read_raw_instruction(state, address);
+        *instruction = &cache->unaligned;
+        return decode_packed_instruction_from_raw(&raw, *instruction);
+    }
+    size_t slot = address / RISKY_INSTRUCTION_SIZE;
+    uint64_t bit = (uint64_t) 1U << (slot % 64);
+    *instruction = &cache->instructions[slot];
+    // return early if this slot has already been decoded
+    if(cache->valid[slot / 64] & bit) {
+        return STATUS_SUCCESS;
+    }
+    // otherwise, decode it and mark it as valid only if decoding succeeded
+    raw = read_raw_instruction(state, address);
+    status_t result = decode_packed_instruction_from_raw(&raw, *instruction);
+    if(result == STATUS_SUCCESS) {
+        cache->valid[slot / 64] |= bit;
+        fuse_slots(state, slot);
+    }
+    return result;
+}
+
+// number of lines of RAM whose writes are tracked
+#define WRITE_LINE_COUNT (RISKY_RAM_AMOUNT / RISKY_WRITE_LINE_SIZE)
+
+/*
+ * private function - marks the lines and pages of RAM covering the given
+ * range of addresses (wrapping around at the end of RAM) as written to
+ */
+static void mark_written(
+    risky_vm_state_t * state, risky_ram_address_t address, size_t length
+) {
+    if(length > RISKY_RAM_AMOUNT - RISKY_IMAGE_PAGE_SIZE) {
+        state->dirty_pages = RISKY_IMAGE_ALL_PAGES;
+        memset(state->written_lines, 0xff, sizeof(state->written_lines));
+        return;
+    }
+    size_t first = address / RISKY_WRITE_LINE_SIZE;
+    size_t last = (
+        (address + length - 1) % RISKY_RAM_AMOUNT
+    ) / RISKY_WRITE_LINE_SIZE;
+    for(size_t line = first; ; line = (line + 1) % WRITE_LINE_COUNT) {
+        state->written_lines[line / 64] |= (uint64_t) 1U << (line % 64);
+        state->dirty_pages |= (uint32_t) 1U << (line / RISKY_PAGE_LINES);
+        if(line == last) {
+            break;
+        }
+    }
+}
+
+/*
+ * given a pointer to a risky_vm_state_t, a 4-byte aligned RAM address and a
+ * pointer to a risky_packed_instruction_t, store a copy of the instruction in
+ * the cache as the decoded form of the instruction at that address, without
+ * decoding it from RAM. It is fused with the instructions either side of it
+ * if they are already in the cache.
+ * Returns a status_t with error / success information
+ */
+status_t prime_cached_instruction(
+    risky_vm_state_t * state, risky_ram_address_t address,
+    const risky_packed_instruction_t * instruction
+) {
+    if(address % RISKY_INSTRUCTION_SIZE != 0) {
+        return STATUS_FAIL;
+    }
+    if(allocate_cache(state) != STATUS_SUCCESS) {
+        return MALLOC_REFUSED;
+    }
+    risky_instruction_cache_t * cache = state->cache;
+    size_t slot = address / RISKY_INSTRUCTION_SIZE;
+    cache->instructions[slot] = *instruction;
+    cache->instructions[slot].fused = RISKY_FUSED_NONE;
+    cache->valid[slot / 64] |= (uint64_t) 1U << (slot % 64);
+    size_t next = slot + 1;
+    if(next < RISKY_INSTRUCTION_SLOTS && is_valid_slot(cache, next)) {
+        cache->instructions[slot].fused = fusable_kind(
+            packed_opcode(&cache->instructions[slot]),
+            packed_opcode(&cache->instructions[next])
+        );
+    }
+    if(slot > 0 && is_valid_slot(cache, slot - 1)) {
+        cache->instructions[slot - 1].fused = fusable_kind(
+            packed_opcode(&cache->instructions[slot - 1]),
+            packed_opcode(&cache->instructions[slot])
+        );
+    }
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_vm_state_t, a RAM address and a length in bytes,
+ * invalidate any cached instructions which were decoded from bytes in that
+ * range of RAM (wrapping around at the end of RAM), so they will be decoded
+ * again the next time they are fetched.
+ * this must be called whenever RAM is written to after execution has begun.
+ */
+void invalidate_cached_instructions(
+    risky_vm_state_t * state, risky_ram_address_t address, size_t length
+) {
+    if(length == 0) {
+        return;
+    }
+    state->ram_written = true;
+    mark_written(state, address, length);
+    // nothing to do if nothing has ever been decoded
+    if(state->cache == NULL) {
+        return;
+    }
+    // writes that could touch every slot are the same as invalidating all
+    if(length > RISKY_RAM_AMOUNT - RISKY_INSTRUCTION_SIZE) {
+        invalidate_instruction_cache(state);
+        return;
+    }
+    size_t first = address / RISKY_INSTRUCTION_SIZE;
+    size_t last = (
+        (address + length - 1) % RISKY_RAM_AMOUNT
+    ) / RISKY_INSTRUCTION_SIZE;
+    // the slot before may be fused with the first one, and the last is never
+    if(first > 0) {
+        state->cache->valid[(first - 1) / 64] &= ~(
+            (uint64_t) 1U << ((first - 1) % 64)
+        );
+    }
+    // walk the slots from first to last, wrapping around at the end of RAM
+    for(size_t slot = first; ; slot = (slot + 1) % RISKY_INSTRUCTION_SLOTS) {
+        state->cache->valid[slot / 64] &= ~((uint64_t) 1U << (slot % 64));
+        if(slot == last) {
+            break;
+        }
+    }
+}
+
+/*
+ * given a pointer to a risky_vm_state_t, invalidate all cached instructions
+ * (for example, after loading a new program into RAM)
+ */
+void invalidate_instruction_cache(risky_vm_state_t * state) {
+    state->ram_written = true;
+    state->dirty_pages = RISKY_IMAGE_ALL_PAGES;
+    memset(state->written_lines, 0xff, sizeof(state->written_lines));
+    if(state->cache != NULL) {
+        memset(state->cache->valid, 0, sizeof(state->cache->valid));
+    }
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
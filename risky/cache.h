@@ -0,0 +1,140 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * cache - this compilation unit defines a per-VM cache of predecoded
+ * instructions, so that instructions which are executed repeatedly only have to
+ * be decoded from raw RAM contents the first time they are fetched.
+ */
+#ifndef SAXBOPHONE_RISKY_CACHE_H
+#define SAXBOPHONE_RISKY_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core.h"
+#include "image.h"
+#include "packed.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// size of one instruction in bytes
+#define RISKY_INSTRUCTION_SIZE 4
+// number of instruction-sized (4-byte aligned) slots in RAM
+#define RISKY_INSTRUCTION_SLOTS (RISKY_RAM_AMOUNT / RISKY_INSTRUCTION_SIZE)
+// number of the lines of RAM whose writes are tracked in each page of RAM
+#define RISKY_PAGE_LINES (RISKY_IMAGE_PAGE_SIZE / RISKY_WRITE_LINE_SIZE)
+
+/*
+ * returns the index of the lowest bit set in the given word (of a bitmap of
+ * slots or lines of RAM), which must not be zero
+ */
+static inline size_t risky_lowest_bit(uint64_t word) {
+#ifdef __GNUC__
+    return (size_t) __builtin_ctzll(word);
+#else
+    size_t bit = 0;
+    while(!((word >> bit) & 1U)) {
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+/*
+ * kinds of instruction which an instruction in the cache can be fused with,
+ * the one following it, into a superinstruction which the interpreter runs
+ * with one dispatch. These pairs are fused: EQU, NEQ, GTN or LTN then BRA;
+ * SET then JMP; and INC or DEC then EQU, NEQ, GTN or LTN. The second
+ * instruction of a pair stays in its own slot as it was, so a jump to it
+ * runs it alone. Fusing can be turned off by defining RISKY_NO_FUSION.
+ */
+typedef enum risky_fused_t {
+    RISKY_FUSED_NONE,
+    RISKY_FUSED_BRA, RISKY_FUSED_JMP,
+    RISKY_FUSED_EQU, RISKY_FUSED_NEQ, RISKY_FUSED_GTN, RISKY_FUSED_LTN,
+    // number of kinds, including none
+    RISKY_FUSED_KINDS,
+} risky_fused_t;
+
+// predecoded instruction cache struct
+typedef struct risky_instruction_cache_t {
+    // one decoded instruction for every 4-byte aligned slot of RAM
+    risky_packed_instruction_t instructions[RISKY_INSTRUCTION_SLOTS];
+    // bitmap of which slots currently hold a valid decoded instruction
+    uint64_t valid[RISKY_INSTRUCTION_SLOTS / 64];
+    /*
+     * instructions at addresses that are not 4-byte aligned can straddle two
+     * slots so are never cached, they are decoded into this scratch space
+     */
+    risky_packed_instruction_t unaligned;
+} risky_instruction_cache_t;
+
+/*
+ * given a pointer to a risky_vm_state_t, a RAM address and a pointer to a
+ * pointer to a risky_packed_instruction_t, fetch the decoded instruction
+ * stored at that address in the VM's RAM and store a pointer to it in the
+ * pointer at the given address.
+ * the instruction is only decoded if it has not already been decoded since the
+ * last time its slot was invalidated. The cache itself is allocated on the
+ * first call to this function for any given VM state. If the instruction can
+ * be fused with the next one, the next one is decoded too, and the pair
+ * fused: a fused instruction is only valid while the one after it in the
+ * cache is what is in RAM.
+ * the pointer returned is owned by the cache and is only valid until the next
+ * call to any function of this module with the same VM state.
+ * Returns a status_t with error / success information
+ */
+status_t fetch_instruction(
+    risky_vm_state_t * state, risky_ram_address_t address,
+    risky_packed_instruction_t ** instruction
+);
+
+/*
+ * given a pointer to a risky_vm_state_t, a 4-byte aligned RAM address and a
+ * pointer to a risky_packed_instruction_t, store a copy of the instruction in
+ * the cache as the decoded form of the instruction at that address, without
+ * decoding it from RAM (for example, when loading a program which was decoded
+ * ahead of time). The caller must make sure that the instruction is what
+ * decoding RAM at that address would produce.
+ * Returns a status_t with error / success information
+ */
+status_t prime_cached_instruction(
+    risky_vm_state_t * state, risky_ram_address_t address,
+    const risky_packed_instruction_t * instruction
+);
+
+/*
+ * given a pointer to a risky_vm_state_t, a RAM address and a length in bytes,
+ * invalidate any cached instructions which were decoded from bytes in that
+ * range of RAM (wrapping around at the end of RAM), and the one before them in
+ * case it was fused with the first of them, so they will be decoded again the
+ * next time they are fetched.
+ * this must be called whenever RAM is written to after execution has begun,
+ * after a VM has been forked from, or once a checkpoint log has been opened
+ * for it, as it also marks the lines and pages written to as such.
+ */
+void invalidate_cached_instructions(
+    risky_vm_state_t * state, risky_ram_address_t address, size_t length
+);
+
+/*
+ * given a pointer to a risky_vm_state_t, invalidate all cached instructions
+ * (for example, after loading a new program into RAM), marking all of RAM
+ * as written to
+ */
+void invalidate_instruction_cache(risky_vm_state_t * state);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+// end of header file
+#endif
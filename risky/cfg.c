@@ -0,0 +1,421 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * cfg - this compilation unit defines static analysis of a program image into
+ * its basic blocks and the control-flow graph between them, with the
+ * registers each block defines and uses.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "cfg.h"
+#include "core.h"
+#include "decoder.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// the operand register r is read
+#define READS_R 0x01U
+// the operand register a is read
+#define READS_A 0x02U
+// the operand register b is read
+#define READS_B 0x04U
+// the operand register r is written to
+#define WRITES_R 0x08U
+// shorthand for instructions computing r from registers a and b
+#define BINARY (READS_A | READS_B | WRITES_R)
+// shorthand for instructions computing r from register a
+#define UNARY (READS_A | WRITES_R)
+
+/*
+ * how each opcode uses its operand registers, indexed by opcode. Operands
+ * which are channel numbers or literals aren't registers, so aren't included
+ */
+static const risky_byte_t OPERAND_ROLES[32] = {
+    [NOP] = 0, [JMP] = READS_R, [BRA] = READS_R | READS_A, [HLT] = 0,
+    [EQU] = BINARY, [NEQ] = BINARY, [GTN] = BINARY, [LTN] = BINARY,
+    [ADD] = BINARY, [SUB] = BINARY, [MLT] = BINARY, [DIV] = BINARY,
+    [MOD] = BINARY, [INC] = UNARY, [DEC] = UNARY, [QOP] = WRITES_R,
+    [EOR] = BINARY, [AND] = BINARY, [XOR] = BINARY, [NOT] = UNARY,
+    [LSH] = BINARY, [RSH] = BINARY, [ROT] = UNARY, [CAS] = BINARY,
+    [SET] = WRITES_R, [COP] = UNARY, [LOD] = UNARY, [SAV] = READS_R | READS_A,
+    [QDC] = WRITES_R, [CDC] = 0, [REA] = WRITES_R, [WRI] = READS_A,
+};
+
+/*
+ * a JMP or BRA to a constant address within the image, found while scanning
+ * it before all the blocks are known. Its target only starts a block if no
+ * block starts between the SET and the jump, as the register might have been
+ * set to something else if one did
+ */
+typedef struct risky_candidate_t {
+    // slots of the SET, the jump and its target
+    uint16_t set, jump, target;
+} risky_candidate_t;
+
+// private function - returns whether the given slot starts a block
+static bool is_leader(const uint64_t * leaders, size_t slot) {
+    return (leaders[slot / 64] >> (slot % 64)) & 1U;
+}
+
+// private function - marks the given slot as starting a block
+static void set_leader(uint64_t * leaders, size_t slot) {
+    leaders[slot / 64] |= (uint64_t) 1U << (slot % 64);
+}
+
+// private function - returns the number of bits set in the given word
+static size_t count_bits(uint64_t word) {
+#ifdef __GNUC__
+    return (size_t) __builtin_popcountll(word);
+#else
+    size_t count = 0;
+    for(; word != 0; word &= word - 1) {
+        count++;
+    }
+    return count;
+#endif
+}
+
+/*
+ * private function - returns the first slot after the given one, and before
+ * the given count of slots, which starts a block, or the count if none does
+ */
+static size_t next_leader(const uint64_t * leaders, size_t slot, size_t count) {
+    for(slot++; slot < count; slot = (slot | 63U) + 1) {
+        uint64_t word = leaders[slot / 64] >> (slot % 64);
+        if(word != 0) {
+            slot += risky_lowest_bit(word);
+            return (slot < count) ? slot : count;
+        }
+    }
+    return count;
+}
+
+// private function - returns whether the given opcode ends a block
+static bool ends_block(risky_opcode_t opcode) {
+    return opcode == JMP || opcode == BRA || opcode == HLT;
+}
+
+/*
+ * private function - given the instructions of a program, the slot of the
+ * first instruction of a block and the slot of a JMP or BRA in it, finds the
+ * last instruction before the jump in the block which writes to the jump's
+ * register. Returns whether there was one and it was a SET, storing the
+ * address it set the register to and its slot if so
+ */
+static bool constant_target(
+    const risky_instruction_t * instructions, size_t first, size_t jump,
+    risky_ram_address_t * target, size_t * set
+) {
+    risky_register_address_t r = instructions[jump].r;
+    for(size_t slot = jump; slot-- > first; ) {
+        const risky_instruction_t * instruction = &instructions[slot];
+        if(
+            (OPERAND_ROLES[instruction->opcode] & WRITES_R) &&
+            instruction->r == r
+        ) {
+            if(instruction->opcode != SET) {
+                return false;
+            }
+            *target = (risky_ram_address_t) (
+                instruction->a_flag ? instruction->l : instruction->l & 0xffU
+            );
+            *set = slot;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * private function - scans the given instructions, marking as leaders the
+ * slots after each JMP, BRA and HLT, and stores each JMP and BRA whose
+ * register was SET to the address of an instruction in the image since the
+ * last of those in the given array, returning how many there were
+ */
+static size_t find_candidates(
+    const risky_instruction_t * instructions, size_t count, uint64_t * leaders,
+    risky_candidate_t * candidates
+) {
+    size_t found = 0;
+    // first slot after the last JMP, BRA or HLT
+    size_t first = 0;
+    for(size_t slot = 0; slot < count; slot++) {
+        risky_opcode_t opcode = instructions[slot].opcode;
+        if(!ends_block(opcode)) {
+            continue;
+        }
+        risky_ram_address_t target;
+        size_t set;
+        if(
+            opcode != HLT &&
+            constant_target(instructions, first, slot, &target, &set) &&
+            target % RISKY_INSTRUCTION_SIZE == 0 &&
+            target / RISKY_INSTRUCTION_SIZE < count
+        ) {
+            candidates[found++] = (risky_candidate_t) {
+                .set = (uint16_t) set, .jump = (uint16_t) slot,
+                .target = (uint16_t) (target / RISKY_INSTRUCTION_SIZE),
+            };
+        }
+        first = slot + 1;
+        if(first < count) {
+            set_leader(leaders, first);
+        }
+    }
+    return found;
+}
+
+/*
+ * private function - marks the targets of the given candidate jumps as
+ * leaders, for as long as marking one doesn't split a block in between the
+ * SET and the jump of another. Marking targets only ever splits blocks, so
+ * the targets of those it does split are left marked, which is harmless
+ */
+static void mark_targets(
+    uint64_t * leaders, risky_candidate_t * candidates, size_t count
+) {
+    bool again = true;
+    while(again) {
+        again = false;
+        size_t kept = 0;
+        for(size_t i = 0; i < count; i++) {
+            risky_candidate_t candidate = candidates[i];
+            if(
+                next_leader(leaders, candidate.set, candidate.jump + 1U) <=
+                candidate.jump
+            ) {
+                continue;
+            }
+            if(!is_leader(leaders, candidate.target)) {
+                set_leader(leaders, candidate.target);
+                // it may be in between the SET and jump of another
+                again = true;
+            }
+            candidates[kept++] = candidate;
+        }
+        count = kept;
+    }
+}
+
+/*
+ * private function - adds the registers the given instruction reads and
+ * writes to the given sets of registers used and defined by its block.
+ * Written without branches on the instruction, as programs mix instructions
+ * too unpredictably for them
+ */
+static void add_operands(
+    risky_register_set_t * uses, risky_register_set_t * defines,
+    const risky_instruction_t * instruction
+) {
+    risky_byte_t roles = OPERAND_ROLES[instruction->opcode];
+    // only registers read before the block writes to them are its uses
+    risky_register_address_t reads[3] = {
+        instruction->r, instruction->a, instruction->b,
+    };
+    for(size_t i = 0; i < 3; i++) {
+        uint64_t read = -(uint64_t) ((roles >> i) & 1U);
+        size_t word = reads[i] / 64;
+        uses->bits[word] |= read & ~defines->bits[word] & (
+            (uint64_t) 1U << (reads[i] % 64)
+        );
+    }
+    uint64_t writes = -(uint64_t) ((roles & WRITES_R) != 0);
+    defines->bits[instruction->r / 64] |= writes & (
+        (uint64_t) 1U << (instruction->r % 64)
+    );
+}
+
+/*
+ * private function - builds the blocks of the graph from the given
+ * instructions once their leaders have all been found, then links them up,
+ * using the given array of an index for each slot to find blocks by slot.
+ * Returns a status_t with error / success information
+ */
+static status_t build_blocks(
+    const risky_instruction_t * instructions, size_t count, risky_cfg_t * cfg,
+    uint16_t * block_of
+) {
+    size_t blocks = 0;
+    for(size_t word = 0; word < RISKY_INSTRUCTION_SLOTS / 64; word++) {
+        blocks += count_bits(cfg->leaders[word]);
+    }
+    cfg->blocks = (risky_basic_block_t *) malloc(
+        blocks * sizeof(risky_basic_block_t)
+    );
+    if(cfg->blocks == NULL) {
+        return MALLOC_REFUSED;
+    }
+    cfg->count = (uint32_t) blocks;
+    size_t first = 0;
+    for(uint32_t i = 0; i < cfg->count; i++) {
+        size_t end = next_leader(cfg->leaders, first, count);
+        block_of[first] = (uint16_t) i;
+        risky_basic_block_t block = {
+            .start = (risky_ram_address_t) (first * RISKY_INSTRUCTION_SIZE),
+            .length = (uint32_t) (end - first),
+            .exit = (end < count) ? RISKY_EXIT_FALL_THROUGH : RISKY_EXIT_END,
+            .target_known = false, .target = 0,
+            .taken = RISKY_CFG_NO_BLOCK,
+            .next = (end < count) ? i + 1 : RISKY_CFG_NO_BLOCK,
+            .defines = { .bits = {0}, }, .uses = { .bits = {0}, },
+        };
+        for(size_t slot = first; slot < end; slot++) {
+            add_operands(&block.uses, &block.defines, &instructions[slot]);
+        }
+        size_t set;
+        switch(instructions[end - 1].opcode) {
+        case JMP:
+            block.next = RISKY_CFG_NO_BLOCK;
+            // fall through
+        case BRA:
+            block.exit = (instructions[end - 1].opcode == JMP) ?
+                RISKY_EXIT_JUMP : RISKY_EXIT_BRANCH;
+            block.target_known = constant_target(
+                instructions, first, end - 1, &block.target, &set
+            );
+            break;
+        case HLT:
+            block.exit = RISKY_EXIT_HALT;
+            block.next = RISKY_CFG_NO_BLOCK;
+            break;
+        default:
+            break;
+        }
+        cfg->blocks[i] = block;
+        first = end;
+    }
+    // every known target in the image starts a block, so can be linked up
+    for(uint32_t i = 0; i < cfg->count; i++) {
+        risky_basic_block_t * block = &cfg->blocks[i];
+        size_t target = block->target / RISKY_INSTRUCTION_SIZE;
+        if(
+            block->target_known &&
+            block->target % RISKY_INSTRUCTION_SIZE == 0 && target < count
+        ) {
+            block->taken = block_of[target];
+        }
+    }
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a program image of at most RISKY_RAM_AMOUNT bytes, loaded
+ * at address 0, its size and a pointer to an uninitialised risky_cfg_t,
+ * decode every instruction in it and build the graph of its basic blocks.
+ * Returns a status_t with error / success information
+ */
+status_t build_risky_cfg(
+    const risky_ram_t * image, size_t size, risky_cfg_t * cfg
+) {
+    cfg->blocks = NULL;
+    cfg->count = 0;
+    memset(cfg->leaders, 0, sizeof(cfg->leaders));
+    if(size > RISKY_RAM_AMOUNT) {
+        return STATUS_FAIL;
+    }
+    size_t whole = size / RISKY_INSTRUCTION_SIZE;
+    size_t count = (size + RISKY_INSTRUCTION_SIZE - 1) / RISKY_INSTRUCTION_SIZE;
+    if(count == 0) {
+        return STATUS_SUCCESS;
+    }
+    /*
+     * one allocation holds the decoded instructions, the candidate jumps
+     * (at most one for every two instructions) and the index of the block
+     * each slot starts
+     */
+    size_t candidates_offset = count * sizeof(risky_instruction_t);
+    size_t block_of_offset = candidates_offset + (
+        (count / 2 + 1) * sizeof(risky_candidate_t)
+    );
+    void * scratch = malloc(block_of_offset + count * sizeof(uint16_t));
+    if(scratch == NULL) {
+        return MALLOC_REFUSED;
+    }
+    risky_instruction_t * instructions = (risky_instruction_t *) scratch;
+    risky_candidate_t * candidates = (risky_candidate_t *) (
+        (char *) scratch + candidates_offset
+    );
+    uint16_t * block_of = (uint16_t *) ((char *) scratch + block_of_offset);
+    // decoding only reads the raw instructions, the image isn't written to
+    status_t result = decode_instructions_from_raw(
+        (risky_raw_instruction_t *) image, whole, instructions
+    );
+    if(result == STATUS_SUCCESS && whole < count) {
+        risky_raw_instruction_t raw = { .bytes = {0}, };
+        memcpy(
+            raw.bytes, &image[whole * RISKY_INSTRUCTION_SIZE],
+            size - whole * RISKY_INSTRUCTION_SIZE
+        );
+        result = decode_instruction_from_raw(&raw, &instructions[whole]);
+    }
+    if(result == STATUS_SUCCESS) {
+        set_leader(cfg->leaders, 0);
+        size_t found = find_candidates(
+            instructions, count, cfg->leaders, candidates
+        );
+        mark_targets(cfg->leaders, candidates, found);
+        result = build_blocks(instructions, count, cfg, block_of);
+    }
+    free(scratch);
+    return result;
+}
+
+/*
+ * given a pointer to a risky_cfg_t, free its blocks.
+ * Returns a status_t with error / success information
+ */
+status_t free_risky_cfg(risky_cfg_t * cfg) {
+    free(cfg->blocks);
+    cfg->blocks = NULL;
+    cfg->count = 0;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_cfg_t and a RAM address, returns the index of
+ * the block holding the instruction starting at that address, or
+ * RISKY_CFG_NO_BLOCK if it isn't the start of an instruction in the image
+ */
+uint32_t find_risky_basic_block(
+    const risky_cfg_t * cfg, risky_ram_address_t address
+) {
+    if(cfg->count == 0 || address % RISKY_INSTRUCTION_SIZE != 0) {
+        return RISKY_CFG_NO_BLOCK;
+    }
+    // binary search for the last block starting at or before the address
+    uint32_t low = 0;
+    uint32_t high = cfg->count;
+    while(high - low > 1) {
+        uint32_t middle = low + (high - low) / 2;
+        if(cfg->blocks[middle].start <= address) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    const risky_basic_block_t * block = &cfg->blocks[low];
+    if(
+        (size_t) address >=
+        block->start + (size_t) block->length * RISKY_INSTRUCTION_SIZE
+    ) {
+        return RISKY_CFG_NO_BLOCK;
+    }
+    return low;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
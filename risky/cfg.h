@@ -0,0 +1,135 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * cfg - this compilation unit defines static analysis of a program image into
+ * its basic blocks and the control-flow graph between them, with the
+ * registers each block defines and uses, for anything which needs to know
+ * where blocks start before running a program (fusing, translating or
+ * checking its instructions).
+ * Blocks start at address 0, after every JMP, BRA and HLT, and at the target
+ * of every JMP or BRA whose register was set to a constant by a SET earlier
+ * in the same block. The targets of other jumps can't be known statically,
+ * so such blocks are marked as indirect and anything relying on the graph
+ * must allow for them jumping anywhere.
+ */
+#ifndef SAXBOPHONE_RISKY_CFG_H
+#define SAXBOPHONE_RISKY_CFG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cache.h"
+#include "core.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// index of no block, for edges to places outside of the graph
+#define RISKY_CFG_NO_BLOCK UINT32_MAX
+
+// ways a basic block can end
+typedef enum risky_block_exit_t {
+    // runs on into the block which follows it
+    RISKY_EXIT_FALL_THROUGH,
+    // ends with a JMP
+    RISKY_EXIT_JUMP,
+    // ends with a BRA, which either jumps or runs on into the next block
+    RISKY_EXIT_BRANCH,
+    // ends with a HLT
+    RISKY_EXIT_HALT,
+    // runs on past the end of the image
+    RISKY_EXIT_END,
+} risky_block_exit_t;
+
+// set of registers, one bit per register
+typedef struct risky_register_set_t {
+    uint64_t bits[RISKY_REGISTER_COUNT / 64];
+} risky_register_set_t;
+
+// returns whether the given register is in the given set of registers
+static inline bool risky_register_set_has(
+    const risky_register_set_t * set, risky_register_address_t address
+) {
+    return (set->bits[address / 64] >> (address % 64)) & 1U;
+}
+
+// basic block struct, a run of instructions only ever entered at the start
+typedef struct risky_basic_block_t {
+    // address of the first instruction of the block
+    risky_ram_address_t start;
+    // number of instructions in the block, including the one ending it
+    uint32_t length;
+    // how the block ends
+    risky_block_exit_t exit;
+    // whether the address a JMP or BRA ending the block goes to is known
+    bool target_known;
+    // the address it goes to, if known
+    risky_ram_address_t target;
+    /*
+     * index of the block a JMP or BRA ending the block goes to, or
+     * RISKY_CFG_NO_BLOCK if its target isn't known or isn't the start of an
+     * instruction in the image
+     */
+    uint32_t taken;
+    /*
+     * index of the block which runs next if the block falls through or a BRA
+     * ending it doesn't jump, or RISKY_CFG_NO_BLOCK if neither can happen
+     */
+    uint32_t next;
+    // registers written to by the block
+    risky_register_set_t defines;
+    // registers read by the block before it writes to them
+    risky_register_set_t uses;
+} risky_basic_block_t;
+
+// control-flow graph struct
+typedef struct risky_cfg_t {
+    // dynamically allocated array of the blocks, in order of address
+    risky_basic_block_t * blocks;
+    // number of blocks
+    uint32_t count;
+    // bitmap of the 4-byte slots of RAM which start a block
+    uint64_t leaders[RISKY_INSTRUCTION_SLOTS / 64];
+} risky_cfg_t;
+
+/*
+ * given a pointer to a program image of at most RISKY_RAM_AMOUNT bytes, loaded
+ * at address 0, its size and a pointer to an uninitialised risky_cfg_t,
+ * decode every instruction in it and build the graph of its basic blocks.
+ * An instruction cut short by the end of the image is decoded as if the
+ * missing bytes were zero, as they are in RAM.
+ * Returns a status_t with error / success information
+ */
+status_t build_risky_cfg(
+    const risky_ram_t * image, size_t size, risky_cfg_t * cfg
+);
+
+/*
+ * given a pointer to a risky_cfg_t, free its blocks.
+ * Returns a status_t with error / success information
+ */
+status_t free_risky_cfg(risky_cfg_t * cfg);
+
+/*
+ * given a pointer to a risky_cfg_t and a RAM address, returns the index of
+ * the block holding the instruction starting at that address, or
+ * RISKY_CFG_NO_BLOCK if it isn't the start of an instruction in the image
+ */
+uint32_t find_risky_basic_block(
+    const risky_cfg_t * cfg, risky_ram_address_t address
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+// end of header file
+#endif
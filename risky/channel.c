@@ -0,0 +1,186 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * channel - this compilation unit defines lock-free ring buffers which back
+ * the data channels of a RISKY virtual machine, so that the VM and the host
+ * exchange words through host memory and the host moves them in bulk.
+ */
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "channel.h"
+#include "core.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of words flushed to a file descriptor in each system call at most
+#define FLUSH_WORDS 2048U
+
+/*
+ * given a pointer to a risky_channel_ring_t and the number of words it should
+ * hold at least, allocate its storage for the next power of two words.
+ * Returns a status_t with error / success information
+ */
+status_t init_risky_channel_ring(risky_channel_ring_t * ring, size_t capacity) {
+    size_t size = 1;
+    while(size < capacity) {
+        size *= 2;
+    }
+    *ring = (risky_channel_ring_t) { .words = NULL, .mask = size - 1, };
+    ring->words = (risky_word_t *) malloc(size * sizeof(risky_word_t));
+    if(ring->words == NULL) {
+        return MALLOC_REFUSED;
+    }
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_channel_ring_t, free its storage.
+ * Returns a status_t with error / success information
+ */
+status_t free_risky_channel_ring(risky_channel_ring_t * ring) {
+    free(ring->words);
+    ring->words = NULL;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_channel_ring_t, a pointer to some words and the
+ * number of them, push as many of the words onto the ring as there is room
+ * for, publishing them to the consumer all at once.
+ * Returns the number of words pushed
+ */
+size_t write_risky_channel_ring(
+    risky_channel_ring_t * ring, const risky_word_t * words, size_t count
+) {
+    size_t head = ring->head;
+    ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    size_t room = ring->mask + 1 - (head - ring->cached_tail);
+    if(count > room) {
+        count = room;
+    }
+    // the words may wrap around the end of the storage
+    size_t start = head & ring->mask;
+    size_t first = ring->mask + 1 - start;
+    if(first > count) {
+        first = count;
+    }
+    memcpy(ring->words + start, words, first * sizeof(risky_word_t));
+    memcpy(ring->words, words + first, (count - first) * sizeof(risky_word_t));
+    __atomic_store_n(&ring->head, head + count, __ATOMIC_RELEASE);
+    return count;
+}
+
+/*
+ * given a pointer to a risky_channel_ring_t, a pointer to storage for some
+ * words and the number of them, pop up to that many words off the ring.
+ * Returns the number of words popped
+ */
+size_t read_risky_channel_ring(
+    risky_channel_ring_t * ring, risky_word_t * words, size_t count
+) {
+    size_t tail = ring->tail;
+    ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    size_t available = ring->cached_head - tail;
+    if(count > available) {
+        count = available;
+    }
+    size_t start = tail & ring->mask;
+    size_t first = ring->mask + 1 - start;
+    if(first > count) {
+        first = count;
+    }
+    memcpy(words, ring->words + start, first * sizeof(risky_word_t));
+    memcpy(words + first, ring->words, (count - first) * sizeof(risky_word_t));
+    __atomic_store_n(&ring->tail, tail + count, __ATOMIC_RELEASE);
+    return count;
+}
+
+/*
+ * given a pointer to a risky_channel_ring_t, a risky_channel_sink_t and a
+ * pointer to pass to it, pop every word on the ring, passing them to the sink
+ * straight from the ring's storage.
+ * Returns the number of words drained
+ */
+size_t drain_risky_channel_ring(
+    risky_channel_ring_t * ring, risky_channel_sink_t sink, void * context
+) {
+    size_t tail = ring->tail;
+    ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    size_t count = ring->cached_head - tail;
+    if(count == 0) {
+        return 0;
+    }
+    size_t start = tail & ring->mask;
+    size_t first = ring->mask + 1 - start;
+    if(first > count) {
+        first = count;
+    }
+    sink(context, ring->words + start, first);
+    if(count > first) {
+        sink(context, ring->words, count - first);
+    }
+    // the words can only be overwritten once the sink is done with them
+    __atomic_store_n(&ring->tail, tail + count, __ATOMIC_RELEASE);
+    return count;
+}
+
+/*
+ * given a file descriptor, a pointer to some bytes and the number of them,
+ * write all of the bytes to the descriptor.
+ * Returns false if they couldn't all be written
+ */
+bool write_risky_bytes(
+    int descriptor, const risky_byte_t * bytes, size_t size
+) {
+    while(size > 0) {
+        ssize_t written = write(descriptor, bytes, size);
+        if(written < 0 && errno == EINTR) {
+            continue;
+        }
+        if(written <= 0) {
+            return false;
+        }
+        bytes += written;
+        size -= (size_t) written;
+    }
+    return true;
+}
+
+/*
+ * given a pointer to a risky_channel_ring_t and a file descriptor, pop every
+ * word on the ring and write them to the file descriptor as big-endian bytes,
+ * in as few system calls as possible.
+ * Returns a status_t with error / success information
+ */
+status_t flush_risky_channel_ring(risky_channel_ring_t * ring, int descriptor) {
+    risky_byte_t bytes[FLUSH_WORDS * 2];
+    risky_word_t words[FLUSH_WORDS];
+    size_t count;
+    while((count = read_risky_channel_ring(ring, words, FLUSH_WORDS)) != 0) {
+        for(size_t i = 0; i < count; i++) {
+            bytes[i * 2] = (risky_byte_t) (words[i] >> 8);
+            bytes[i * 2 + 1] = (risky_byte_t) (words[i] & 0xffU);
+        }
+        if(!write_risky_bytes(descriptor, bytes, count * 2)) {
+            return STATUS_FAIL;
+        }
+    }
+    return STATUS_SUCCESS;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,168 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * channel - this compilation unit defines lock-free ring buffers which back
+ * the data channels of a RISKY virtual machine, so that the VM and the host
+ * exchange words through host memory and the host moves them in bulk.
+ */
+#ifndef SAXBOPHONE_RISKY_CHANNEL_H
+#define SAXBOPHONE_RISKY_CHANNEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "core.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * a ring buffer of words with one producer and one consumer, which may be
+ * different threads. For a write channel the VM is the producer and the host
+ * the consumer, and the other way round for a read channel.
+ */
+typedef struct risky_channel_ring_t {
+    // storage for the words, a power of two of them
+    risky_word_t * words;
+    // one less than the number of words the ring holds
+    size_t mask;
+    /*
+     * the above are only written when the ring is set up, so they get a line
+     * of their own which both ends can read without it bouncing between them
+     */
+    risky_byte_t shared_padding[RISKY_CACHE_LINE];
+    // number of words ever pushed, only changed by the producer
+    size_t head;
+    // the producer's last look at tail, so it rarely has to load it
+    size_t cached_tail;
+    risky_byte_t producer_padding[RISKY_CACHE_LINE];
+    // number of words ever popped, only changed by the consumer
+    size_t tail;
+    // the consumer's last look at head, so it rarely has to load it
+    size_t cached_head;
+    risky_byte_t consumer_padding[RISKY_CACHE_LINE];
+} risky_channel_ring_t;
+
+// function which a ring's words are drained to, in as few calls as possible
+typedef void (* risky_channel_sink_t)(
+    void * context, const risky_word_t * words, size_t count
+);
+
+/*
+ * given a pointer to a risky_channel_ring_t and a word, push the word onto
+ * the ring. This is the producer's end of the ring.
+ * Returns false if the ring is full
+ */
+static inline bool push_risky_channel_ring(
+    risky_channel_ring_t * ring, risky_word_t word
+) {
+    size_t head = ring->head;
+    if(head - ring->cached_tail > ring->mask) {
+        ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if(head - ring->cached_tail > ring->mask) {
+            return false;
+        }
+    }
+    ring->words[head & ring->mask] = word;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*
+ * given a pointer to a risky_channel_ring_t and a pointer to a word, pop the
+ * oldest word off the ring into it. This is the consumer's end of the ring.
+ * Returns false if the ring is empty
+ */
+static inline bool pop_risky_channel_ring(
+    risky_channel_ring_t * ring, risky_word_t * word
+) {
+    size_t tail = ring->tail;
+    if(tail == ring->cached_head) {
+        ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if(tail == ring->cached_head) {
+            return false;
+        }
+    }
+    *word = ring->words[tail & ring->mask];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*
+ * given a pointer to a risky_channel_ring_t and the number of words it should
+ * hold at least, allocate its storage for the next power of two words.
+ * Returns a status_t with error / success information
+ */
+status_t init_risky_channel_ring(risky_channel_ring_t * ring, size_t capacity);
+
+/*
+ * given a pointer to a risky_channel_ring_t, free its storage. It must not be
+ * attached to any VM's channels any more.
+ * Returns a status_t with error / success information
+ */
+status_t free_risky_channel_ring(risky_channel_ring_t * ring);
+
+/*
+ * given a pointer to a risky_channel_ring_t, a pointer to some words and the
+ * number of them, push as many of the words onto the ring as there is room
+ * for, publishing them to the consumer all at once. This is the producer's
+ * end of the ring, for the host to feed a VM's read channel.
+ * Returns the number of words pushed
+ */
+size_t write_risky_channel_ring(
+    risky_channel_ring_t * ring, const risky_word_t * words, size_t count
+);
+
+/*
+ * given a pointer to a risky_channel_ring_t, a pointer to storage for some
+ * words and the number of them, pop up to that many words off the ring. This
+ * is the consumer's end of the ring, for the host to take what a VM has
+ * written to a write channel.
+ * Returns the number of words popped
+ */
+size_t read_risky_channel_ring(
+    risky_channel_ring_t * ring, risky_word_t * words, size_t count
+);
+
+/*
+ * given a pointer to a risky_channel_ring_t, a risky_channel_sink_t and a
+ * pointer to pass to it, pop every word on the ring, passing them to the sink
+ * straight from the ring's storage (in at most two calls, as the words may
+ * wrap around the end of it). This is the consumer's end of the ring.
+ * Returns the number of words drained
+ */
+size_t drain_risky_channel_ring(
+    risky_channel_ring_t * ring, risky_channel_sink_t sink, void * context
+);
+
+/*
+ * given a file descriptor, a pointer to some bytes and the number of them,
+ * write all of the bytes to the descriptor, retrying after partial writes and
+ * interruptions. The library uses this wherever it streams data to a file.
+ * Returns false if they couldn't all be written
+ */
+bool write_risky_bytes(
+    int descriptor, const risky_byte_t * bytes, size_t size
+);
+
+/*
+ * given a pointer to a risky_channel_ring_t and a file descriptor, pop every
+ * word on the ring and write them to the file descriptor as big-endian bytes,
+ * in as few system calls as possible. This is the consumer's end of the ring.
+ * Returns a status_t with error / success information
+ */
+status_t flush_risky_channel_ring(risky_channel_ring_t * ring, int descriptor);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+// end of header file
+#endif
@@ -0,0 +1,564 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * checkpoint - this compilation unit defines functions for saving the whole
+ * state of a RISKY virtual machine to a file, and restoring it from one.
+ */
+// pread(), ftruncate() and mkstemp() need POSIX
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "channel.h"
+#include "checkpoint.h"
+#include "core.h"
+#include "image.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// the magic bytes every checkpoint file starts with
+static const risky_byte_t CHECKPOINT_MAGIC[4] = { 'R', 'C', 'K', 'P', };
+// the magic bytes every checkpoint log file starts with
+static const risky_byte_t LOG_MAGIC[4] = { 'R', 'C', 'K', 'L', };
+
+// base 2 logarithm of RISKY_IMAGE_PAGE_SIZE, as stored in the header
+#define PAGE_SHIFT 12U
+// offsets of the fields of the header
+#define PAGES_OFFSET 8U
+#define PROGRAM_COUNTER_OFFSET 10U
+#define OPERATION_FLAGS_OFFSET 12U
+#define REGISTERS_OFFSET 16U
+#define CHANNELS_OFFSET (REGISTERS_OFFSET + 2U * RISKY_REGISTER_COUNT)
+// number of bytes of the header which aren't always zero
+#define HEADER_USED (CHANNELS_OFFSET + RISKY_CHANNEL_COUNT)
+// size of the fixed part at the start of each delta in a log
+#define DELTA_HEADER_SIZE 10U
+// largest size of the registers and channels changed by a delta
+#define DELTA_CHANGES_SIZE \
+    (3U * RISKY_REGISTER_COUNT + 2U * RISKY_CHANNEL_COUNT)
+
+/*
+ * private function - writes all the bytes of the given buffers to the file
+ * descriptor, which may move the buffers' starts along.
+ * Returns false if they couldn't all be written
+ */
+static bool write_vector(int descriptor, struct iovec * vector, int count) {
+    while(count > 0) {
+        ssize_t written = writev(descriptor, vector, count);
+        if(written < 0 && errno == EINTR) {
+            continue;
+        }
+        if(written <= 0) {
+            return false;
+        }
+        // skip the buffers written in full, then the start of the next
+        while(count > 0 && (size_t) written >= vector->iov_len) {
+            written -= (ssize_t) vector->iov_len;
+            vector++;
+            count--;
+        }
+        if(count > 0) {
+            vector->iov_base = (risky_byte_t *) vector->iov_base + written;
+            vector->iov_len -= (size_t) written;
+        }
+    }
+    return true;
+}
+
+/*
+ * private function - reads the given number of bytes from the file descriptor
+ * at the given offset. Returns false if they couldn't all be read
+ */
+static bool read_all(
+    int descriptor, risky_byte_t * bytes, size_t size, off_t offset
+) {
+    while(size > 0) {
+        ssize_t count = pread(descriptor, bytes, size, offset);
+        if(count < 0 && errno == EINTR) {
+            continue;
+        }
+        if(count <= 0) {
+            return false;
+        }
+        bytes += count;
+        size -= (size_t) count;
+        offset += count;
+    }
+    return true;
+}
+
+/*
+ * private function - returns whether the page of RAM at the given address is
+ * all zero: if its first byte is zero and every byte equals the one after
+ */
+static bool is_zero_page(const risky_ram_t * page) {
+    return (
+        page[0] == 0 &&
+        memcmp(page, page + 1, RISKY_IMAGE_PAGE_SIZE - 1) == 0
+    );
+}
+
+/*
+ * private function - returns whether the given page is set in the given mask
+ * of pages
+ */
+static bool has_page(uint32_t pages, size_t page) {
+    return (pages >> page) & 1U;
+}
+
+/*
+ * private function - returns the number of pages set in the given mask
+ */
+static size_t count_pages(uint32_t pages) {
+    size_t count = 0;
+    for(size_t page = 0; page < RISKY_IMAGE_PAGE_COUNT; page++) {
+        count += has_page(pages, page);
+    }
+    return count;
+}
+
+/*
+ * private function - fills in the VM's RAM from the pages held in the
+ * checkpoint file with the given descriptor by reading them, for when they
+ * can't be mapped.
+ * Returns a status_t with error / success information
+ */
+static status_t read_pages(
+    risky_vm_state_t * state, int descriptor, uint32_t pages
+) {
+    off_t offset = RISKY_CHECKPOINT_HEADER_SIZE;
+    for(size_t page = 0; page < RISKY_IMAGE_PAGE_COUNT; page++) {
+        risky_ram_t * ram = &state->ram[page * RISKY_IMAGE_PAGE_SIZE];
+        if(!has_page(pages, page)) {
+            memset(ram, 0, RISKY_IMAGE_PAGE_SIZE);
+            continue;
+        }
+        if(!read_all(descriptor, ram, RISKY_IMAGE_PAGE_SIZE, offset)) {
+            return STATUS_FAIL;
+        }
+        offset += RISKY_IMAGE_PAGE_SIZE;
+    }
+    invalidate_instruction_cache(state);
+    // the RAM no longer matches any image it is mapped from
+    state->ram_written = true;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to an array of bytes from the start of a file and the number
+ * of bytes, returns whether they start with the magic bytes of a checkpoint
+ */
+bool is_risky_checkpoint(const risky_byte_t * bytes, size_t size) {
+    return (
+        size >= sizeof(CHECKPOINT_MAGIC) &&
+        memcmp(bytes, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) == 0
+    );
+}
+
+/*
+ * given a pointer to an initialised risky_vm_state_t and the path of a file,
+ * write the VM's state to the file as a checkpoint. It is written to a new
+ * file which then replaces the one at the path, so that a checkpoint can be
+ * saved over the one the VM was restored from while its RAM maps it.
+ * Returns a status_t with error / success information
+ */
+status_t save_risky_vm_checkpoint(
+    const risky_vm_state_t * state, const char * path
+) {
+    risky_byte_t header[RISKY_CHECKPOINT_HEADER_SIZE] = {
+        CHECKPOINT_MAGIC[0], CHECKPOINT_MAGIC[1],
+        CHECKPOINT_MAGIC[2], CHECKPOINT_MAGIC[3],
+        RISKY_CHECKPOINT_VERSION_MAJOR, RISKY_CHECKPOINT_VERSION_MINOR,
+        PAGE_SHIFT, 0,
+    };
+    uint32_t pages = 0;
+    for(size_t page = 0; page < RISKY_IMAGE_PAGE_COUNT; page++) {
+        if(!is_zero_page(&state->ram[page * RISKY_IMAGE_PAGE_SIZE])) {
+            pages |= 1U << page;
+        }
+    }
+    header[PAGES_OFFSET] = (risky_byte_t) (pages >> 8);
+    header[PAGES_OFFSET + 1] = (risky_byte_t) pages;
+    risky_byte_t * counter = &header[PROGRAM_COUNTER_OFFSET];
+    counter[0] = (risky_byte_t) (state->program_counter >> 8);
+    counter[1] = (risky_byte_t) state->program_counter;
+    header[OPERATION_FLAGS_OFFSET] = state->operation_flags;
+    for(size_t i = 0; i < RISKY_REGISTER_COUNT; i++) {
+        risky_byte_t * word = &header[REGISTERS_OFFSET + 2 * i];
+        word[0] = (risky_byte_t) (state->registers[i] >> 8);
+        word[1] = (risky_byte_t) state->registers[i];
+    }
+    memcpy(&header[CHANNELS_OFFSET], state->channels, RISKY_CHANNEL_COUNT);
+    // the new file sits next to the one it replaces, so it can be renamed over
+    size_t length = strlen(path);
+    char * temporary = (char *) malloc(length + sizeof(".XXXXXX"));
+    if(temporary == NULL) {
+        return MALLOC_REFUSED;
+    }
+    memcpy(temporary, path, length);
+    memcpy(temporary + length, ".XXXXXX", sizeof(".XXXXXX"));
+    int descriptor = mkstemp(temporary);
+    if(descriptor == -1) {
+        free(temporary);
+        return STATUS_FAIL;
+    }
+    bool written = write_risky_bytes(descriptor, header, sizeof(header));
+    // each run of non-zero pages is contiguous in RAM, so is one write
+    size_t page = 0;
+    while(written && page < RISKY_IMAGE_PAGE_COUNT) {
+        if(!has_page(pages, page)) {
+            page++;
+            continue;
+        }
+        size_t first = page;
+        while(page < RISKY_IMAGE_PAGE_COUNT && has_page(pages, page)) {
+            page++;
+        }
+        written = write_risky_bytes(
+            descriptor, &state->ram[first * RISKY_IMAGE_PAGE_SIZE],
+            (page - first) * RISKY_IMAGE_PAGE_SIZE
+        );
+    }
+    // mkstemp() only lets the owner read the file
+    written = written && fchmod(descriptor, 0644) == 0;
+    if(close(descriptor) != 0 || !written || rename(temporary, path) != 0) {
+        unlink(temporary);
+        free(temporary);
+        return STATUS_FAIL;
+    }
+    free(temporary);
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to an initialised risky_vm_state_t and the path of a file,
+ * restore the VM to the state saved in the checkpoint file.
+ * Returns a status_t with error / success information
+ */
+status_t restore_risky_vm_checkpoint(
+    risky_vm_state_t * state, const char * path
+) {
+    int descriptor = open(path, O_RDONLY | O_CLOEXEC);
+    if(descriptor == -1) {
+        return STATUS_FAIL;
+    }
+    risky_byte_t header[HEADER_USED];
+    struct stat status;
+    if(
+        !read_all(descriptor, header, sizeof(header), 0) ||
+        !is_risky_checkpoint(header, sizeof(header)) ||
+        header[4] != RISKY_CHECKPOINT_VERSION_MAJOR ||
+        header[6] != PAGE_SHIFT || fstat(descriptor, &status) != 0
+    ) {
+        close(descriptor);
+        return STATUS_FAIL;
+    }
+    uint32_t pages = (uint32_t) (header[PAGES_OFFSET] << 8);
+    pages |= header[PAGES_OFFSET + 1];
+    off_t size = RISKY_CHECKPOINT_HEADER_SIZE;
+    size += (off_t) (count_pages(pages) * RISKY_IMAGE_PAGE_SIZE);
+    // a truncated file would fault when its missing pages were touched
+    if(status.st_size < size) {
+        close(descriptor);
+        return STATUS_FAIL;
+    }
+    risky_ram_image_t * image = NULL;
+    status_t result = open_risky_ram_image_pages(
+        descriptor, RISKY_CHECKPOINT_HEADER_SIZE, pages, &image
+    );
+    if(result == STATUS_SUCCESS) {
+        result = map_risky_ram_image(state, image);
+    }
+    if(result != STATUS_SUCCESS) {
+        result = read_pages(state, descriptor, pages);
+    }
+    // the image owns the descriptor if it was made, and the VM its mapping
+    if(image != NULL) {
+        drop_risky_ram_image(image);
+    } else {
+        close(descriptor);
+    }
+    if(result != STATUS_SUCCESS) {
+        return result;
+    }
+    state->program_counter = (risky_ram_address_t) (
+        header[PROGRAM_COUNTER_OFFSET] << 8
+    );
+    state->program_counter |= header[PROGRAM_COUNTER_OFFSET + 1];
+    state->operation_flags = header[OPERATION_FLAGS_OFFSET];
+    for(size_t i = 0; i < RISKY_REGISTER_COUNT; i++) {
+        state->registers[i] = (risky_register_t) (
+            header[REGISTERS_OFFSET + 2 * i] << 8
+        );
+        state->registers[i] |= header[REGISTERS_OFFSET + 2 * i + 1];
+    }
+    memcpy(state->channels, &header[CHANNELS_OFFSET], RISKY_CHANNEL_COUNT);
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_checkpoint_log_t, a pointer to an initialised
+ * risky_vm_state_t and the paths of two files, save a checkpoint of the VM to
+ * the first file as the base of a new, empty log in the second.
+ * Returns a status_t with error / success information
+ */
+status_t open_risky_checkpoint_log(
+    risky_checkpoint_log_t * log, risky_vm_state_t * state,
+    const char * base, const char * path
+) {
+    status_t result = save_risky_vm_checkpoint(state, base);
+    if(result != STATUS_SUCCESS) {
+        return result;
+    }
+    const risky_byte_t header[RISKY_CHECKPOINT_LOG_HEADER_SIZE] = {
+        LOG_MAGIC[0], LOG_MAGIC[1], LOG_MAGIC[2], LOG_MAGIC[3],
+        RISKY_CHECKPOINT_LOG_VERSION_MAJOR, RISKY_CHECKPOINT_LOG_VERSION_MINOR,
+        0, 0,
+    };
+    log->descriptor = open(
+        path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644
+    );
+    if(log->descriptor == -1) {
+        return STATUS_FAIL;
+    }
+    if(!write_risky_bytes(log->descriptor, header, sizeof(header))) {
+        close(log->descriptor);
+        return STATUS_FAIL;
+    }
+    log->size = sizeof(header);
+    memcpy(log->registers, state->registers, sizeof(log->registers));
+    memcpy(log->channels, state->channels, sizeof(log->channels));
+    state->dirty_pages = 0;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_checkpoint_log_t and a pointer to the
+ * risky_vm_state_t it was opened for, append a delta of what the VM has
+ * changed since the last delta to the log, in one write where it can be.
+ * Returns a status_t with error / success information
+ */
+status_t append_risky_checkpoint_log(
+    risky_checkpoint_log_t * log, risky_vm_state_t * state
+) {
+    risky_byte_t delta[DELTA_HEADER_SIZE + DELTA_CHANGES_SIZE];
+    uint32_t pages = state->dirty_pages;
+    delta[0] = (risky_byte_t) (pages >> 8);
+    delta[1] = (risky_byte_t) pages;
+    delta[2] = (risky_byte_t) (state->program_counter >> 8);
+    delta[3] = (risky_byte_t) state->program_counter;
+    delta[4] = state->operation_flags;
+    delta[5] = 0;
+    size_t size = DELTA_HEADER_SIZE;
+    size_t registers = 0;
+    for(size_t i = 0; i < RISKY_REGISTER_COUNT; i++) {
+        if(state->registers[i] != log->registers[i]) {
+            delta[size++] = (risky_byte_t) i;
+            delta[size++] = (risky_byte_t) (state->registers[i] >> 8);
+            delta[size++] = (risky_byte_t) state->registers[i];
+            registers++;
+        }
+    }
+    size_t channels = 0;
+    for(size_t i = 0; i < RISKY_CHANNEL_COUNT; i++) {
+        if(state->channels[i] != log->channels[i]) {
+            delta[size++] = (risky_byte_t) i;
+            delta[size++] = state->channels[i];
+            channels++;
+        }
+    }
+    delta[6] = (risky_byte_t) (registers >> 8);
+    delta[7] = (risky_byte_t) registers;
+    delta[8] = (risky_byte_t) (channels >> 8);
+    delta[9] = (risky_byte_t) channels;
+    // the changes, then each run of dirty pages, which is contiguous in RAM
+    struct iovec vector[1 + RISKY_IMAGE_PAGE_COUNT / 2];
+    vector[0] = (struct iovec) { .iov_base = delta, .iov_len = size, };
+    int count = 1;
+    size_t page = 0;
+    while(page < RISKY_IMAGE_PAGE_COUNT) {
+        if(!has_page(pages, page)) {
+            page++;
+            continue;
+        }
+        size_t first = page;
+        while(page < RISKY_IMAGE_PAGE_COUNT && has_page(pages, page)) {
+            page++;
+        }
+        vector[count++] = (struct iovec) {
+            .iov_base = &state->ram[first * RISKY_IMAGE_PAGE_SIZE],
+            .iov_len = (page - first) * RISKY_IMAGE_PAGE_SIZE,
+        };
+        size += (page - first) * RISKY_IMAGE_PAGE_SIZE;
+    }
+    if(!write_vector(log->descriptor, vector, count)) {
+        // cut off any part of the delta written, so the log stays readable
+        int truncated = ftruncate(log->descriptor, log->size);
+        (void) truncated;
+        return STATUS_FAIL;
+    }
+    log->size += (off_t) size;
+    memcpy(log->registers, state->registers, sizeof(log->registers));
+    memcpy(log->channels, state->channels, sizeof(log->channels));
+    state->dirty_pages = 0;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_checkpoint_log_t, close its file.
+ * Returns a status_t with error / success information
+ */
+status_t close_risky_checkpoint_log(risky_checkpoint_log_t * log) {
+    int descriptor = log->descriptor;
+    log->descriptor = -1;
+    return (close(descriptor) == 0) ? STATUS_SUCCESS : STATUS_FAIL;
+}
+
+/*
+ * given a pointer to an initialised risky_vm_state_t restored from the base
+ * of a checkpoint log and the path of the log file, apply every whole delta
+ * in the log to the VM in turn. Each delta is checked to be all there before
+ * any of it is applied.
+ * Returns a status_t with error / success information
+ */
+status_t apply_risky_checkpoint_log(
+    risky_vm_state_t * state, const char * path
+) {
+    int descriptor = open(path, O_RDONLY | O_CLOEXEC);
+    if(descriptor == -1) {
+        return STATUS_FAIL;
+    }
+    risky_byte_t header[RISKY_CHECKPOINT_LOG_HEADER_SIZE];
+    struct stat status;
+    if(
+        !read_all(descriptor, header, sizeof(header), 0) ||
+        memcmp(header, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0 ||
+        header[4] != RISKY_CHECKPOINT_LOG_VERSION_MAJOR ||
+        fstat(descriptor, &status) != 0
+    ) {
+        close(descriptor);
+        return STATUS_FAIL;
+    }
+    status_t result = STATUS_SUCCESS;
+    off_t offset = RISKY_CHECKPOINT_LOG_HEADER_SIZE;
+    risky_byte_t delta[DELTA_HEADER_SIZE + DELTA_CHANGES_SIZE];
+    while(offset < status.st_size) {
+        if(!read_all(descriptor, delta, DELTA_HEADER_SIZE, offset)) {
+            break;
+        }
+        uint32_t pages = (uint32_t) ((delta[0] << 8) | delta[1]);
+        size_t registers = (size_t) ((delta[6] << 8) | delta[7]);
+        size_t channels = (size_t) ((delta[8] << 8) | delta[9]);
+        if(
+            registers > RISKY_REGISTER_COUNT || channels > RISKY_CHANNEL_COUNT
+        ) {
+            result = STATUS_FAIL;
+            break;
+        }
+        size_t changes = 3 * registers + 2 * channels;
+        off_t end = offset + (off_t) (
+            DELTA_HEADER_SIZE + changes +
+            count_pages(pages) * RISKY_IMAGE_PAGE_SIZE
+        );
+        if(
+            end > status.st_size || !read_all(
+                descriptor, &delta[DELTA_HEADER_SIZE], changes,
+                offset + DELTA_HEADER_SIZE
+            )
+        ) {
+            break;
+        }
+        off_t position = offset + (off_t) (DELTA_HEADER_SIZE + changes);
+        for(size_t page = 0; page < RISKY_IMAGE_PAGE_COUNT; page++) {
+            if(!has_page(pages, page)) {
+                continue;
+            }
+            risky_ram_address_t address = (risky_ram_address_t) (
+                page * RISKY_IMAGE_PAGE_SIZE
+            );
+            if(
+                !read_all(
+                    descriptor, &state->ram[address], RISKY_IMAGE_PAGE_SIZE,
+                    position
+                )
+            ) {
+                result = STATUS_FAIL;
+                break;
+            }
+            invalidate_cached_instructions(
+                state, address, RISKY_IMAGE_PAGE_SIZE
+            );
+            position += RISKY_IMAGE_PAGE_SIZE;
+        }
+        if(result != STATUS_SUCCESS) {
+            break;
+        }
+        state->program_counter = (risky_ram_address_t) (
+            (delta[2] << 8) | delta[3]
+        );
+        state->operation_flags = delta[4];
+        const risky_byte_t * change = &delta[DELTA_HEADER_SIZE];
+        for(size_t i = 0; i < registers; i++, change += 3) {
+            state->registers[change[0]] = (risky_register_t) (
+                (change[1] << 8) | change[2]
+            );
+        }
+        for(size_t i = 0; i < channels; i++, change += 2) {
+            state->channels[change[0]] = change[1];
+        }
+        offset = end;
+    }
+    close(descriptor);
+    return result;
+}
+
+/*
+ * given the paths of the base checkpoint of a log and of the log file, fold
+ * the log's deltas into the base by restoring a VM from both and saving it
+ * as the new base, then empty the log.
+ * Returns a status_t with error / success information
+ */
+status_t compact_risky_checkpoint_log(const char * base, const char * path) {
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    status_t result = init_risky_vm_state(&state);
+    if(result != STATUS_SUCCESS) {
+        return result;
+    }
+    result = restore_risky_vm_checkpoint(&state, base);
+    if(result == STATUS_SUCCESS) {
+        result = apply_risky_checkpoint_log(&state, path);
+    }
+    if(result == STATUS_SUCCESS) {
+        result = save_risky_vm_checkpoint(&state, base);
+    }
+    if(
+        result == STATUS_SUCCESS &&
+        truncate(path, RISKY_CHECKPOINT_LOG_HEADER_SIZE) != 0
+    ) {
+        result = STATUS_FAIL;
+    }
+    status_t freed = free_risky_vm_state(&state);
+    return (result == STATUS_SUCCESS) ? freed : result;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,162 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * checkpoint - this compilation unit defines functions for saving the whole
+ * state of a RISKY virtual machine to a file, and restoring it from one.
+ * Restoring maps the saved RAM copy-on-write rather than reading it, so a
+ * VM can be booted from a checkpoint of a warmed-up one in a few system
+ * calls.
+ *
+ * A checkpoint file starts with a header one RAM page (4096 bytes) long: the
+ * magic bytes "RCKP", the major and minor version of the format, the base 2
+ * logarithm of the page size and a reserved byte, then a big-endian mask of
+ * the pages of RAM held in the file (the lowest bit for the first page), the
+ * big-endian program counter, the operation flags and three reserved bytes,
+ * the 256 registers as big-endian words and the 256 channel states, with
+ * the rest of the header zero. The pages of RAM with any non-zero bytes follow
+ * in order, and all other pages are zero, so they take up no room.
+ *
+ * A checkpoint log follows on from a checkpoint (its base), holding only what
+ * has changed since: each delta appended to it has the pages of RAM written
+ * to and the registers and channel states changed since the delta before it,
+ * so it costs in proportion to what the VM did rather than to the size of
+ * RAM. A log file starts with an 8-byte header: the magic bytes "RCKL", the
+ * major and minor version of the format and two reserved bytes. Each delta
+ * starts with a big-endian mask of the pages of RAM it holds, the big-endian
+ * program counter, the operation flags, a reserved byte and the big-endian
+ * numbers of registers and of channels changed. Each register changed
+ * follows as its number and big-endian value, then each channel changed as
+ * its number and state, then the pages of RAM in order. Each delta holds
+ * the whole new value of everything in it, so applying a log again to a
+ * state it has already been applied to changes nothing.
+ */
+#ifndef SAXBOPHONE_RISKY_CHECKPOINT_H
+#define SAXBOPHONE_RISKY_CHECKPOINT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "core.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// version of the checkpoint file format
+#define RISKY_CHECKPOINT_VERSION_MAJOR 1
+#define RISKY_CHECKPOINT_VERSION_MINOR 0
+// size of the header at the start of a checkpoint file, in bytes
+#define RISKY_CHECKPOINT_HEADER_SIZE 4096U
+// version of the checkpoint log file format
+#define RISKY_CHECKPOINT_LOG_VERSION_MAJOR 1
+#define RISKY_CHECKPOINT_LOG_VERSION_MINOR 0
+// size of the header at the start of a checkpoint log file, in bytes
+#define RISKY_CHECKPOINT_LOG_HEADER_SIZE 8U
+
+// checkpoint log struct, a log file being appended to for one VM
+typedef struct risky_checkpoint_log_t {
+    // file descriptor of the log file
+    int descriptor;
+    // size of the log file, up to the end of the last delta
+    off_t size;
+    // the VM's registers and channel states as of the last delta
+    risky_register_t registers[RISKY_REGISTER_COUNT];
+    risky_byte_t channels[RISKY_CHANNEL_COUNT];
+} risky_checkpoint_log_t;
+
+/*
+ * given a pointer to an array of bytes from the start of a file and the number
+ * of bytes, returns whether they start with the magic bytes of a checkpoint
+ */
+bool is_risky_checkpoint(const risky_byte_t * bytes, size_t size);
+
+/*
+ * given a pointer to an initialised risky_vm_state_t and the path of a file,
+ * write the VM's registers, RAM, program counter, operation flags and
+ * channel states to the file as a checkpoint, leaving out pages of RAM which
+ * are all zero. The channel callbacks and rings are not saved.
+ * Returns a status_t with error / success information
+ */
+status_t save_risky_vm_checkpoint(
+    const risky_vm_state_t * state, const char * path
+);
+
+/*
+ * given a pointer to an initialised risky_vm_state_t and the path of a file,
+ * restore the VM to the state saved in the checkpoint file, leaving its
+ * channel callbacks and rings as they are. The saved RAM is mapped
+ * copy-on-write where the VM's RAM can be mapped, and read otherwise (for
+ * VMs in pools of explicit huge pages, say). The VM is left unchanged if the
+ * file isn't a checkpoint of a version this can read.
+ * Returns a status_t with error / success information
+ */
+status_t restore_risky_vm_checkpoint(
+    risky_vm_state_t * state, const char * path
+);
+
+/*
+ * given a pointer to a risky_checkpoint_log_t, a pointer to an initialised
+ * risky_vm_state_t and the paths of two files, save a checkpoint of the VM to
+ * the first file as the base of a new, empty log in the second, and start
+ * tracking which pages of RAM the VM writes to from now on. Anything which
+ * writes to the VM's RAM other than by running it must call
+ * invalidate_cached_instructions() for the log to see the change.
+ * Returns a status_t with error / success information
+ */
+status_t open_risky_checkpoint_log(
+    risky_checkpoint_log_t * log, risky_vm_state_t * state,
+    const char * base, const char * path
+);
+
+/*
+ * given a pointer to a risky_checkpoint_log_t and a pointer to the
+ * risky_vm_state_t it was opened for, append a delta of the pages of RAM,
+ * registers and channel states the VM has changed since the last delta (or
+ * the base) to the log. The log is left as it was if this fails.
+ * Returns a status_t with error / success information
+ */
+status_t append_risky_checkpoint_log(
+    risky_checkpoint_log_t * log, risky_vm_state_t * state
+);
+
+/*
+ * given a pointer to a risky_checkpoint_log_t, close its file.
+ * Returns a status_t with error / success information
+ */
+status_t close_risky_checkpoint_log(risky_checkpoint_log_t * log);
+
+/*
+ * given a pointer to an initialised risky_vm_state_t restored from the base
+ * of a checkpoint log and the path of the log file, apply every delta in the
+ * log to the VM in turn, bringing it up to date with the last one. A delta
+ * cut short at the end of the log (by a crash while it was being appended,
+ * say) is left out.
+ * Returns a status_t with error / success information
+ */
+status_t apply_risky_checkpoint_log(
+    risky_vm_state_t * state, const char * path
+);
+
+/*
+ * given the paths of the base checkpoint of a log and of the log file, fold
+ * the log's deltas into the base, then empty the log. The new base replaces
+ * the old one in one step, so a crash part of the way through leaves either
+ * the old base or the new one with the log, which come to the same state.
+ * Nothing may append to the log meanwhile.
+ * Returns a status_t with error / success information
+ */
+status_t compact_risky_checkpoint_log(const char * base, const char * path);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+// end of header file
+#endif
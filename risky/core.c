@@ -11,7 +11,10 @@
  */
 #include <stdlib.h>
 
+#include "cache.h"
 #include "core.h"
+#include "image.h"
+#include "pool.h"
 #include "risky.h"
 
 
@@ -26,6 +29,26 @@ extern "C"{
  */
 status_t init_risky_vm_state(risky_vm_state_t * state) {
     status_t result = STATUS_SUCCESS;
+    // the instruction cache is not allocated until the first instruction fetch
+    state->cache = NULL;
+    // RAM is a plain allocation until the VM is forked from
+    state->image = NULL;
+    state->ram_written = false;
+    state->dirty_pages = 0;
+    for(size_t i = 0; i < RISKY_WRITE_LINE_WORDS; i++) {
+        state->written_lines[i] = 0;
+    }
+    state->pool = NULL;
+    // execution starts at the beginning of RAM, with all channels inactive
+    state->program_counter = 0x0000U;
+    state->operation_flags = 0x00U;
+    for(size_t i = 0; i < RISKY_CHANNEL_COUNT; i++) {
+        state->channels[i] = 0x00U;
+    }
+    state->channel_io = (risky_channel_io_t) { NULL, NULL, NULL, };
+    for(size_t i = 0; i < RISKY_CHANNEL_COUNT; i++) {
+        state->rings[i] = NULL;
+    }
     // allocate memory for RAM, set all to zero
     state->ram = (risky_ram_t *) calloc(RISKY_RAM_AMOUNT, sizeof(risky_ram_t));
     // check if allocation was denied and return MALLOC_REFUSED error code
@@ -41,16 +64,28 @@ status_t init_risky_vm_state(risky_vm_state_t * state) {
  * Returns a status_t with error / success information
  */
 status_t free_risky_vm_state(risky_vm_state_t * state) {
+    // VMs acquired from a pool are given back to it rather than freed
+    if(state->pool != NULL) {
+        return release_risky_vm(state->pool, state);
+    }
     status_t result = STATUS_SUCCESS;
     // set all registers to 0
     for(size_t i = 0; i < RISKY_REGISTER_COUNT; i++) {
         state->registers[i] = 0x00U;
     }
     // de-allocate memory if pointer is not NULL
-    if(state->ram != NULL) {
+    if(state->image != NULL) {
+        // forked RAM is a mapping of a snapshot, which may outlive this VM
+        result = release_risky_ram_image(state);
+    } else if(state->ram != NULL) {
         free(state->ram);
         state->ram = NULL;
     }
+    // de-allocate the instruction cache if it was ever allocated
+    if(state->cache != NULL) {
+        free(state->cache);
+        state->cache = NULL;
+    }
     return result;
 }
 
@@ -26,6 +26,55 @@ extern "C"{
 typedef risky_word_t risky_register_t;
 // RAM type
 typedef risky_byte_t risky_ram_t;
+// register address type
+typedef risky_byte_t risky_register_address_t;
+// RAM address type
+typedef risky_word_t risky_ram_address_t;
+// data channel number type
+typedef risky_byte_t risky_channel_t;
+
+// bits of the last operation flags, in the order they are queried by QOP
+#define RISKY_OVERFLOW 0x04U
+#define RISKY_UNDERFLOW 0x02U
+#define RISKY_DIVIDE_BY_ZERO 0x01U
+
+// bits of the state of a data channel, as configured by CDC and read by QDC
+#define RISKY_CHANNEL_ACTIVE 0x01U
+#define RISKY_CHANNEL_WRITE 0x02U
+
+/*
+ * size of a cache line on the host, which data written by different threads
+ * is spaced apart by so that they don't share a line
+ */
+#define RISKY_CACHE_LINE 64
+
+// size of the lines of RAM whose writes are tracked for resetting a VM
+#define RISKY_WRITE_LINE_SIZE 64U
+// number of 64-bit words in the bitmap of lines of RAM written to
+#define RISKY_WRITE_LINE_WORDS (RISKY_RAM_AMOUNT / RISKY_WRITE_LINE_SIZE / 64U)
+
+// host callbacks used to service the data channel instructions
+typedef struct risky_channel_io_t {
+    /*
+     * called by REA with the number of an active read channel, should store
+     * the next word of data from it and return true, or return false if there
+     * is no data ready to be read yet
+     */
+    bool (* read)(void * context, risky_channel_t channel, risky_word_t * data);
+    // called by WRI with the number of an active write channel and the data
+    void (* write)(void * context, risky_channel_t channel, risky_word_t data);
+    // pointer passed as the first argument to the above callbacks
+    void * context;
+} risky_channel_io_t;
+
+// predecoded instruction cache, defined in the cache module
+struct risky_instruction_cache_t;
+// copy-on-write image of RAM shared between VMs, defined in the image module
+struct risky_ram_image_t;
+// preallocated VM states and RAM, defined in the pool module
+struct risky_vm_pool_t;
+// ring buffer backing a data channel, defined in the channel module
+struct risky_channel_ring_t;
 
 // risky vm state struct
 typedef struct risky_vm_state_t {
@@ -33,6 +82,49 @@ typedef struct risky_vm_state_t {
     risky_register_t registers[RISKY_REGISTER_COUNT];
     // a pointer to a dynamically allocated array of RAM (65,536 bytes / 64KiB)
     risky_ram_t * ram;
+    /*
+     * a pointer to the predecoded instruction cache for this VM's RAM, which
+     * is allocated lazily on first instruction fetch (NULL until then)
+     */
+    struct risky_instruction_cache_t * cache;
+    /*
+     * the image this VM's RAM is a copy-on-write mapping of, if it was loaded
+     * from a file, forked or has been forked from (NULL otherwise)
+     */
+    struct risky_ram_image_t * image;
+    // set whenever RAM is written to, so forking knows when to snapshot again
+    bool ram_written;
+    /*
+     * one bit for each 4KiB page of RAM (the lowest for the first page), set
+     * when the page is written to and cleared by the checkpoint log once it
+     * has saved the page, so only changed pages need saving again
+     */
+    uint32_t dirty_pages;
+    /*
+     * one bit for each 64-byte line of RAM, set when the line is written to
+     * and cleared when the VM is reset to a baseline, so that only the lines
+     * written to need copying back
+     */
+    uint64_t written_lines[RISKY_WRITE_LINE_WORDS];
+    /*
+     * the pool this VM was acquired from, which owns its RAM and cache (NULL
+     * if they were allocated by init_risky_vm_state())
+     */
+    struct risky_vm_pool_t * pool;
+    // address in RAM of the next instruction to execute
+    risky_ram_address_t program_counter;
+    // flags raised by the last arithmetic operation, as read by QOP
+    risky_byte_t operation_flags;
+    // the state of each data channel
+    risky_byte_t channels[RISKY_CHANNEL_COUNT];
+    // host callbacks for data channel I/O (NULL callbacks are ignored)
+    risky_channel_io_t channel_io;
+    /*
+     * the ring buffer backing each data channel, used instead of the above
+     * callbacks for any channel which has one (NULL otherwise). They are
+     * owned by the host, which attaches them by setting these directly
+     */
+    struct risky_channel_ring_t * rings[RISKY_CHANNEL_COUNT];
 } risky_vm_state_t;
 
 // all RISKY opcodes
@@ -47,11 +139,6 @@ typedef enum risky_opcode_t {
     QDC, CDC, REA, WRI, // query, configure, read from, write to (data channel)
 } risky_opcode_t;
 
-// register address type
-typedef risky_byte_t risky_register_address_t;
-// RAM address type
-typedef risky_word_t risky_ram_address_t;
-
 // risky instruction struct
 typedef struct risky_instruction_t {
     risky_opcode_t opcode; // instruction opcode
@@ -0,0 +1,217 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * counters - this compilation unit defines a set of the host processor's
+ * hardware performance counters, read through Linux's perf_event_open(), for
+ * measuring how efficiently the host runs a RISKY virtual machine.
+ */
+// syscall() is a GNU extension
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "counters.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// names of the counters, in the order of risky_counter_t
+static const char * const COUNTER_NAMES[RISKY_COUNTER_COUNT] = {
+    "cycles", "instructions", "branches", "branch-misses",
+    "L1-dcache-load-misses", "LLC-load-misses", "dTLB-load-misses",
+};
+
+/*
+ * given a risky_counter_t, returns its name, in the style of the perf tool
+ * (NULL if it isn't a valid counter)
+ */
+const char * get_risky_counter_name(risky_counter_t counter) {
+    if((unsigned int) counter >= RISKY_COUNTER_COUNT) {
+        return NULL;
+    }
+    return COUNTER_NAMES[counter];
+}
+
+#ifdef __linux__
+// private function - returns the perf event config of a cache read miss
+static uint64_t cache_miss(uint64_t cache) {
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+/*
+ * private function - opens the given counter for the calling thread, disabled.
+ * Returns its file descriptor, or -1 if the host doesn't allow it
+ */
+static int open_counter(risky_counter_t counter) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    switch(counter) {
+        case RISKY_COUNTER_CYCLES:
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case RISKY_COUNTER_INSTRUCTIONS:
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case RISKY_COUNTER_BRANCHES:
+            attr.config = PERF_COUNT_HW_BRANCH_INSTRUCTIONS;
+            break;
+        case RISKY_COUNTER_BRANCH_MISSES:
+            attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+        case RISKY_COUNTER_L1D_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = cache_miss(PERF_COUNT_HW_CACHE_L1D);
+            break;
+        case RISKY_COUNTER_LLC_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = cache_miss(PERF_COUNT_HW_CACHE_LL);
+            break;
+        case RISKY_COUNTER_DTLB_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = cache_miss(PERF_COUNT_HW_CACHE_DTLB);
+            break;
+        default:
+            return -1;
+    }
+    attr.disabled = 1;
+    // only the VM's own work, which also needs the fewest privileges
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    long descriptor = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    return (descriptor < 0) ? -1 : (int) descriptor;
+}
+#endif
+
+/*
+ * given a pointer to a risky_counters_t, open every counter the host allows.
+ * Returns a status_t with error / success information
+ */
+status_t init_risky_counters(risky_counters_t * counters) {
+    for(size_t i = 0; i < RISKY_COUNTER_COUNT; i++) {
+#ifdef __linux__
+        counters->descriptors[i] = open_counter((risky_counter_t) i);
+#else
+        counters->descriptors[i] = -1;
+#endif
+        counters->values[i] = 0;
+        counters->counted[i] = false;
+    }
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_counters_t, close all of its counters.
+ * Returns a status_t with error / success information
+ */
+status_t free_risky_counters(risky_counters_t * counters) {
+    for(size_t i = 0; i < RISKY_COUNTER_COUNT; i++) {
+        if(counters->descriptors[i] != -1) {
+            close(counters->descriptors[i]);
+            counters->descriptors[i] = -1;
+        }
+    }
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_counters_t, returns whether any of its counters
+ * could be opened
+ */
+bool risky_counters_available(const risky_counters_t * counters) {
+    for(size_t i = 0; i < RISKY_COUNTER_COUNT; i++) {
+        if(counters->descriptors[i] != -1) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * given a pointer to a risky_counters_t, reset all of its open counters to
+ * zero and start them counting.
+ * Returns a status_t with error / success information
+ */
+status_t start_risky_counters(risky_counters_t * counters) {
+    status_t result = STATUS_SUCCESS;
+    for(size_t i = 0; i < RISKY_COUNTER_COUNT; i++) {
+        counters->values[i] = 0;
+        counters->counted[i] = false;
+#ifdef __linux__
+        int descriptor = counters->descriptors[i];
+        if(
+            descriptor != -1 && (
+                ioctl(descriptor, PERF_EVENT_IOC_RESET, 0) == -1 ||
+                ioctl(descriptor, PERF_EVENT_IOC_ENABLE, 0) == -1
+            )
+        ) {
+            result = STATUS_FAIL;
+        }
+#endif
+    }
+    return result;
+}
+
+/*
+ * given a pointer to a risky_counters_t, stop all of its open counters and
+ * store their values, scaled up if they were multiplexed.
+ * Returns a status_t with error / success information
+ */
+status_t stop_risky_counters(risky_counters_t * counters) {
+    status_t result = STATUS_SUCCESS;
+#ifdef __linux__
+    // stop them all first, so none of them counts reading the others
+    for(size_t i = 0; i < RISKY_COUNTER_COUNT; i++) {
+        int descriptor = counters->descriptors[i];
+        if(descriptor != -1) {
+            ioctl(descriptor, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    for(size_t i = 0; i < RISKY_COUNTER_COUNT; i++) {
+        int descriptor = counters->descriptors[i];
+        if(descriptor == -1) {
+            continue;
+        }
+        // the value, then the time enabled and the time actually running
+        uint64_t data[3];
+        if(read(descriptor, data, sizeof(data)) != sizeof(data)) {
+            result = STATUS_FAIL;
+            continue;
+        }
+        if(data[2] == 0) {
+            // it never got a turn on the hardware
+            continue;
+        }
+        counters->values[i] = (data[2] < data[1])
+            ? (uint64_t) ((double) data[0] * data[1] / data[2]) : data[0];
+        counters->counted[i] = true;
+    }
+#else
+    (void) counters;
+#endif
+    return result;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,96 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * counters - this compilation unit defines a set of the host processor's
+ * hardware performance counters, read through Linux's perf_event_open(), for
+ * measuring how efficiently the host runs a RISKY virtual machine. Counters
+ * which can't be opened (such as when perf events aren't permitted in a
+ * container, or on other systems) are simply left out.
+ */
+#ifndef SAXBOPHONE_RISKY_COUNTERS_H
+#define SAXBOPHONE_RISKY_COUNTERS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// the hardware events counted
+typedef enum risky_counter_t {
+    RISKY_COUNTER_CYCLES = 0,
+    RISKY_COUNTER_INSTRUCTIONS,
+    RISKY_COUNTER_BRANCHES,
+    RISKY_COUNTER_BRANCH_MISSES,
+    RISKY_COUNTER_L1D_MISSES,
+    RISKY_COUNTER_LLC_MISSES,
+    RISKY_COUNTER_DTLB_MISSES,
+    // number of different counters
+    RISKY_COUNTER_COUNT,
+} risky_counter_t;
+
+// counters struct
+typedef struct risky_counters_t {
+    // the perf event file descriptor of each counter (-1 if it isn't open)
+    int descriptors[RISKY_COUNTER_COUNT];
+    // the value of each counter between the last start and stop
+    uint64_t values[RISKY_COUNTER_COUNT];
+    // whether each value was actually counted by the last stop
+    bool counted[RISKY_COUNTER_COUNT];
+} risky_counters_t;
+
+/*
+ * given a risky_counter_t, returns its name, in the style of the perf tool
+ * (NULL if it isn't a valid counter)
+ */
+const char * get_risky_counter_name(risky_counter_t counter);
+
+/*
+ * given a pointer to a risky_counters_t, open every counter the host allows,
+ * counting only the calling thread in user space. Any which can't be opened
+ * are left closed, which is not an error.
+ * Returns a status_t with error / success information
+ */
+status_t init_risky_counters(risky_counters_t * counters);
+
+/*
+ * given a pointer to a risky_counters_t, close all of its counters.
+ * Returns a status_t with error / success information
+ */
+status_t free_risky_counters(risky_counters_t * counters);
+
+/*
+ * given a pointer to a risky_counters_t, returns whether any of its counters
+ * could be opened
+ */
+bool risky_counters_available(const risky_counters_t * counters);
+
+/*
+ * given a pointer to a risky_counters_t, reset all of its open counters to
+ * zero and start them counting.
+ * Returns a status_t with error / success information
+ */
+status_t start_risky_counters(risky_counters_t * counters);
+
+/*
+ * given a pointer to a risky_counters_t, stop all of its open counters and
+ * store their values. If the kernel had to share the hardware between more
+ * counters than it has, each value is scaled up to estimate the full count.
+ * Returns a status_t with error / success information
+ */
+status_t stop_risky_counters(risky_counters_t * counters);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+// end of header file
+#endif
@@ -9,6 +9,8 @@
  * data into the instructions they represent
  */
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
 
 #include "core.h"
 #include "decoder.h"
@@ -176,6 +178,298 @@ status_t decode_instruction_from_raw(
     return result;
 }
 
+// mnemonic of every opcode, in the order of risky_opcode_t
+static const char * const MNEMONICS[32] = {
+    "nop", "jmp", "bra", "hlt", "equ", "neq", "gtn", "ltn",
+    "add", "sub", "mlt", "div", "mod", "inc", "dec", "qop",
+    "eor", "and", "xor", "not", "lsh", "rsh", "rot", "cas",
+    "set", "cop", "lod", "sav", "qdc", "cdc", "rea", "wri",
+};
+
+/*
+ * given a risky_opcode_t, returns its mnemonic as used in the assembly
+ * language (NULL if it isn't a valid opcode)
+ */
+const char * get_risky_opcode_mnemonic(risky_opcode_t opcode) {
+    return ((unsigned int) opcode < 32) ? MNEMONICS[opcode] : NULL;
+}
+
+/*
+ * given a pointer to a risky_instruction_t, a pointer to a buffer of chars
+ * and its size, write the instruction to the buffer as a line of assembly.
+ * returns a status_t with error / success information
+ */
+status_t disassemble_instruction(
+    const risky_instruction_t * instruction, char * text, size_t size
+) {
+    if(size == 0 || (unsigned int) instruction->opcode >= 32) {
+        return STATUS_FAIL;
+    }
+    char flags[5] = ".";
+    size_t flag_count = 1;
+    if(instruction->a_flag) {
+        flags[flag_count++] = 'a';
+    }
+    if(instruction->b_flag) {
+        flags[flag_count++] = 'b';
+    }
+    if(instruction->c_flag) {
+        flags[flag_count++] = 'c';
+    }
+    // no full stop at all if there are no flags
+    flags[(flag_count == 1) ? 0 : flag_count] = '\0';
+    const char * mnemonic = MNEMONICS[instruction->opcode];
+    unsigned int r = instruction->r;
+    unsigned int a = instruction->a;
+    unsigned int b = instruction->b;
+    int written;
+    // operands are grouped the same as in decode_instruction_from_raw()
+    switch(instruction->opcode) {
+        case NOP:
+        case HLT:
+            written = snprintf(text, size, "%s%s", mnemonic, flags);
+            break;
+        case JMP:
+        case QOP:
+            written = snprintf(text, size, "%s%s %u", mnemonic, flags, r);
+            break;
+        case BRA:
+        case INC:
+        case DEC:
+        case NOT:
+        case ROT:
+        case COP:
+        case LOD:
+        case SAV:
+        case REA:
+        case WRI:
+            written = snprintf(
+                text, size, "%s%s %u %u", mnemonic, flags, r, a
+            );
+            break;
+        case SET:
+            written = snprintf(
+                text, size, "%s%s %u 0x%04x", mnemonic, flags, r,
+                (unsigned int) instruction->l
+            );
+            break;
+        default:
+            written = snprintf(
+                text, size, "%s%s %u %u %u", mnemonic, flags, r, a, b
+            );
+            break;
+    }
+    if(written < 0 || (size_t) written >= size) {
+        return STATUS_FAIL;
+    }
+    return STATUS_SUCCESS;
+}
+
+/*
+ * the batch decoder has SIMD implementations for x86 processors supporting
+ * SSSE3 or AVX2, chosen at runtime. These need GCC-style target attributes.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    !defined(RISKY_NO_SIMD_DECODER)
+#define RISKY_SIMD_DECODER
+#include <immintrin.h>
+#endif
+
+#ifdef RISKY_SIMD_DECODER
+/*
+ * the SIMD decoders build each decoded instruction in a 16-byte vector laid
+ * out the same as risky_instruction_t, with 4 bytes to spare at the end.
+ * This is a template mask for the instruction fields used by one opcode: the
+ * flag bytes hold the bit of the first raw byte they are taken from, the
+ * operand bytes are all-ones if the operand is used
+ */
+#define FIELD_MASK(a_flag, b_flag, c_flag, r, a, b, l) { \
+    0x00U, 0x00U, 0x00U, 0x00U, \
+    (a_flag) ? 0x04U : 0x00U, \
+    (b_flag) ? 0x02U : 0x00U, \
+    (c_flag) ? 0x01U : 0x00U, \
+    (r) ? 0xffU : 0x00U, (a) ? 0xffU : 0x00U, (b) ? 0xffU : 0x00U, \
+    (l) ? 0xffU : 0x00U, (l) ? 0xffU : 0x00U, \
+    0x00U, 0x00U, 0x00U, 0x00U, \
+}
+
+// the fields used by each opcode, mirroring decode_instruction_from_raw()
+#define NO_FIELDS FIELD_MASK(false, false, false, false, false, false, false)
+#define JMP_FIELDS FIELD_MASK(false, false, false, true, false, false, false)
+#define BRA_FIELDS FIELD_MASK(true, false, false, true, true, false, false)
+#define ALL_FIELDS FIELD_MASK(true, true, true, true, true, true, false)
+#define TWO_FIELDS FIELD_MASK(true, true, false, true, true, false, false)
+#define RW_FIELDS FIELD_MASK(false, false, false, true, true, false, false)
+#define QOP_FIELDS FIELD_MASK(true, true, true, true, false, false, false)
+#define SET_FIELDS FIELD_MASK(true, false, false, true, false, false, true)
+
+// field masks for each opcode, in the order of risky_opcode_t
+static const risky_byte_t FIELD_MASKS[32][16] __attribute__((aligned(16))) = {
+    NO_FIELDS, JMP_FIELDS, BRA_FIELDS, NO_FIELDS, // NOP, JMP, BRA, HLT
+    ALL_FIELDS, ALL_FIELDS, ALL_FIELDS, ALL_FIELDS, // EQU, NEQ, GTN, LTN
+    ALL_FIELDS, ALL_FIELDS, ALL_FIELDS, ALL_FIELDS, // ADD, SUB, MLT, DIV
+    ALL_FIELDS, TWO_FIELDS, TWO_FIELDS, QOP_FIELDS, // MOD, INC, DEC, QOP
+    ALL_FIELDS, ALL_FIELDS, ALL_FIELDS, TWO_FIELDS, // EOR, AND, XOR, NOT
+    ALL_FIELDS, ALL_FIELDS, TWO_FIELDS, ALL_FIELDS, // LSH, RSH, ROT, CAS
+    SET_FIELDS, TWO_FIELDS, TWO_FIELDS, TWO_FIELDS, // SET, COP, LOD, SAV
+    ALL_FIELDS, ALL_FIELDS, RW_FIELDS, RW_FIELDS, // QDC, CDC, REA, WRI
+};
+
+/*
+ * byte shuffle moving the four raw bytes of an instruction at the start of a
+ * vector to where they belong in a decoded instruction: the first byte into
+ * each flag, the operand bytes into r, a and b and the last two bytes into l,
+ * swapped from big-endian. 0x80 zeroes a byte
+ */
+#define RAW_SHUFFLE(first) \
+    (char) 0x80, (char) 0x80, (char) 0x80, (char) 0x80, \
+    (first), (first), (first), (first) + 1, (first) + 2, (first) + 3, \
+    (first) + 3, (first) + 2, \
+    (char) 0x80, (char) 0x80, (char) 0x80, (char) 0x80
+
+// flag bytes are clamped to 1 (true), other bytes are left as they are
+#define BOOLEAN_LIMITS \
+    (char) 0xff, (char) 0xff, (char) 0xff, (char) 0xff, 1, 1, 1, \
+    (char) 0xff, (char) 0xff, (char) 0xff, (char) 0xff, (char) 0xff, \
+    (char) 0xff, (char) 0xff, (char) 0xff, (char) 0xff
+
+/*
+ * private function - returns whether risky_instruction_t has the little-endian
+ * layout which the SIMD decoders write directly
+ */
+static bool simd_layout_matches(void) {
+    risky_register_t one = 1;
+    return (
+        sizeof(risky_instruction_t) == 12 && sizeof(risky_opcode_t) == 4 &&
+        sizeof(bool) == 1 && *(risky_byte_t *) &one == 1 &&
+        offsetof(risky_instruction_t, a_flag) == 4 &&
+        offsetof(risky_instruction_t, b_flag) == 5 &&
+        offsetof(risky_instruction_t, c_flag) == 6 &&
+        offsetof(risky_instruction_t, r) == 7 &&
+        offsetof(risky_instruction_t, a) == 8 &&
+        offsetof(risky_instruction_t, b) == 9 &&
+        offsetof(risky_instruction_t, l) == 10
+    );
+}
+
+/*
+ * private function - decodes one instruction into a vector using SSSE3.
+ * every step is branch-free, with the fields to keep looked up by opcode
+ */
+__attribute__((target("ssse3")))
+static inline __m128i decode_vector_ssse3(const risky_raw_instruction_t * raw) {
+    int first = raw->bytes[0];
+    __m128i bytes = _mm_cvtsi32_si128(
+        first | raw->bytes[1] << 8 | raw->bytes[2] << 16 |
+        (int) ((unsigned int) raw->bytes[3] << 24)
+    );
+    __m128i fields = _mm_and_si128(
+        _mm_shuffle_epi8(bytes, _mm_setr_epi8(RAW_SHUFFLE(0))),
+        _mm_load_si128((const __m128i *) FIELD_MASKS[first >> 3])
+    );
+    fields = _mm_min_epu8(fields, _mm_setr_epi8(BOOLEAN_LIMITS));
+    return _mm_insert_epi16(fields, first >> 3, 0);
+}
+
+/*
+ * private function - decodes instructions one at a time with SSSE3, leaving
+ * the last one to the scalar decoder, as each store writes 4 bytes past the
+ * end of the instruction. Returns how many instructions were decoded
+ */
+__attribute__((target("ssse3")))
+static size_t decode_ssse3(
+    risky_raw_instruction_t * raw, size_t count,
+    risky_instruction_t * instructions
+) {
+    size_t i = 0;
+    for(; i + 1 < count; i++) {
+        _mm_storeu_si128(
+            (__m128i *) &instructions[i], decode_vector_ssse3(&raw[i])
+        );
+    }
+    return i;
+}
+
+/*
+ * private function - decodes instructions two at a time with AVX2, one in
+ * each 128-bit lane, packing the pair together before storing them. Leaves
+ * at least one instruction for the scalar decoder, as each store writes 8
+ * bytes past the end of the pair. Returns how many instructions were decoded
+ */
+__attribute__((target("avx2")))
+static size_t decode_avx2(
+    risky_raw_instruction_t * raw, size_t count,
+    risky_instruction_t * instructions
+) {
+    const __m256i shuffle = _mm256_setr_epi8(
+        RAW_SHUFFLE(0), RAW_SHUFFLE(4)
+    );
+    const __m256i limits = _mm256_setr_epi8(BOOLEAN_LIMITS, BOOLEAN_LIMITS);
+    // moves the second instruction down to directly after the first
+    const __m256i pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    size_t i = 0;
+    for(; i + 3 <= count; i += 2) {
+        int first = raw[i].bytes[0];
+        int second = raw[i + 1].bytes[0];
+        __m256i bytes = _mm256_broadcastsi128_si256(
+            _mm_loadl_epi64((const __m128i *) &raw[i])
+        );
+        __m256i masks = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(
+                _mm_load_si128((const __m128i *) FIELD_MASKS[first >> 3])
+            ),
+            _mm_load_si128((const __m128i *) FIELD_MASKS[second >> 3]), 1
+        );
+        __m256i fields = _mm256_and_si256(
+            _mm256_shuffle_epi8(bytes, shuffle), masks
+        );
+        fields = _mm256_min_epu8(fields, limits);
+        fields = _mm256_insert_epi16(fields, (short) (first >> 3), 0);
+        fields = _mm256_insert_epi16(fields, (short) (second >> 3), 8);
+        _mm256_storeu_si256(
+            (__m256i *) &instructions[i],
+            _mm256_permutevar8x32_epi32(fields, pack)
+        );
+    }
+    return i;
+}
+#endif
+
+/*
+ * given a pointer to an array of risky_raw_instruction_t, the number of
+ * instructions in it and a pointer to an array of at least that many
+ * risky_instruction_t, decode every raw instruction into the corresponding
+ * risky_instruction_t, giving exactly the same results as calling
+ * decode_instruction_from_raw() on each one. Uses SIMD instructions if the
+ * processor supports them.
+ * returns a status_t with error / success information
+ */
+status_t decode_instructions_from_raw(
+    risky_raw_instruction_t * raw, size_t count,
+    risky_instruction_t * instructions
+) {
+    size_t decoded = 0;
+    #ifdef RISKY_SIMD_DECODER
+    if(simd_layout_matches()) {
+        if(__builtin_cpu_supports("avx2")) {
+            decoded = decode_avx2(raw, count, instructions);
+        } else if(__builtin_cpu_supports("ssse3")) {
+            decoded = decode_ssse3(raw, count, instructions);
+        }
+    }
+    #endif
+    // decode whatever is left (all of them, without SIMD) one at a time
+    for(size_t i = decoded; i < count; i++) {
+        status_t result = decode_instruction_from_raw(
+            &raw[i], &instructions[i]
+        );
+        if(result != STATUS_SUCCESS) {
+            return result;
+        }
+    }
+    return STATUS_SUCCESS;
+}
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -11,6 +11,8 @@
 #ifndef SAXBOPHONE_RISKY_DECODER_H
 #define SAXBOPHONE_RISKY_DECODER_H
 
+#include <stddef.h>
+
 #include "core.h"
 #include "risky.h"
 
@@ -29,6 +31,42 @@ status_t decode_instruction_from_raw(
     risky_raw_instruction_t * raw, risky_instruction_t * instruction
 );
 
+/*
+ * given a pointer to an array of risky_raw_instruction_t, the number of
+ * instructions in it and a pointer to an array of at least that many
+ * risky_instruction_t, decode every raw instruction into the corresponding
+ * risky_instruction_t, giving exactly the same results as calling
+ * decode_instruction_from_raw() on each one. Uses SIMD instructions if the
+ * processor supports them.
+ * returns a status_t with error / success information
+ */
+status_t decode_instructions_from_raw(
+    risky_raw_instruction_t * raw, size_t count,
+    risky_instruction_t * instructions
+);
+
+/*
+ * given a risky_opcode_t, returns its mnemonic as used in the assembly
+ * language, in lowercase (NULL if it isn't a valid opcode)
+ */
+const char * get_risky_opcode_mnemonic(risky_opcode_t opcode);
+
+// size of buffer which is always big enough for a disassembled instruction
+#define RISKY_DISASSEMBLY_SIZE 32
+
+/*
+ * given a pointer to a risky_instruction_t, a pointer to a buffer of chars
+ * and its size, write the instruction to the buffer as a line of assembly in
+ * the same form as the assembly language: the lowercase mnemonic, followed by
+ * a full stop and any flags that are set (such as "sub.abc"), then whichever
+ * operands the instruction uses, separated by spaces. SET's literal is written
+ * in hexadecimal, all other operands in decimal.
+ * returns a status_t with error / success information
+ */
+status_t disassemble_instruction(
+    const risky_instruction_t * instruction, char * text, size_t size
+);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
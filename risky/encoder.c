@@ -0,0 +1,57 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * encoder - this compilation unit defines functions used for encoding
+ * instructions into the binary data that represents them
+ */
+#include "core.h"
+#include "encoder.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * given a pointer to a risky_instruction_t and a pointer to a
+ * risky_raw_instruction_t, encode the instruction opcode, flags and operands
+ * into the raw instruction data. This is the inverse of
+ * decode_instruction_from_raw(). The 16-bit literal value operand is only
+ * encoded for instructions that use it, otherwise the 'a' and 'b' register
+ * operands are used for the last two bytes.
+ * returns a status_t with error / success information
+ */
+status_t encode_instruction_to_raw(
+    risky_instruction_t * instruction, risky_raw_instruction_t * raw
+) {
+    // opcodes outside of the 5-bit range can't be encoded
+    if((unsigned int) instruction->opcode >= 32) {
+        return STATUS_FAIL;
+    }
+    // opcode goes in the first 5 bits, then the three flags
+    raw->bytes[0] = (risky_byte_t) (
+        (instruction->opcode << 3) |
+        (instruction->a_flag ? 0x04U : 0x00U) |
+        (instruction->b_flag ? 0x02U : 0x00U) |
+        (instruction->c_flag ? 0x01U : 0x00U)
+    );
+    raw->bytes[1] = instruction->r;
+    // SET is the only instruction that uses the 16-bit literal value
+    if(instruction->opcode == SET) {
+        raw->bytes[2] = (risky_byte_t) (instruction->l >> 8);
+        raw->bytes[3] = (risky_byte_t) (instruction->l & 0xffU);
+    } else {
+        raw->bytes[2] = instruction->a;
+        raw->bytes[3] = instruction->b;
+    }
+    return STATUS_SUCCESS;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,40 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * encoder - this compilation unit defines functions used for encoding
+ * instructions into the binary data that represents them
+ */
+#ifndef SAXBOPHONE_RISKY_ENCODER_H
+#define SAXBOPHONE_RISKY_ENCODER_H
+
+#include "core.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * given a pointer to a risky_instruction_t and a pointer to a
+ * risky_raw_instruction_t, encode the instruction opcode, flags and operands
+ * into the raw instruction data. This is the inverse of
+ * decode_instruction_from_raw(). The 16-bit literal value operand is only
+ * encoded for instructions that use it, otherwise the 'a' and 'b' register
+ * operands are used for the last two bytes.
+ * returns a status_t with error / success information
+ */
+status_t encode_instruction_to_raw(
+    risky_instruction_t * instruction, risky_raw_instruction_t * raw
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+// end of header file
+#endif
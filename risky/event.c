@@ -0,0 +1,497 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * event - this compilation unit defines an event loop which runs many RISKY
+ * virtual machines on one host thread, with their data channels backed by
+ * non-blocking file descriptors, so that a VM waiting for I/O is suspended
+ * rather than blocking the thread.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "channel.h"
+#include "core.h"
+#include "event.h"
+#include "interpreter.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of bytes buffered between each descriptor and its ring
+#define BUFFER_SIZE 4096U
+// number of events taken from epoll at once at most
+#define EVENT_BATCH 64
+// marks the end of a VM's list of bindings
+#define NO_BINDING SIZE_MAX
+
+// the ways the event loop can be waiting on a VM
+typedef enum vm_state_t {
+    // queued to run, or running
+    VM_RUNNABLE,
+    // blocked, until one of its bindings is ready
+    VM_WAITING,
+    // halted, or blocked with no way of making progress
+    VM_FINISHED,
+} vm_state_t;
+
+// a channel of a VM bound to a file descriptor
+typedef struct risky_event_binding_t {
+    // the VM and channel bound, and whether the VM writes to it
+    size_t vm;
+    risky_channel_t channel;
+    bool write;
+    // the event loop's own copy of the descriptor
+    int descriptor;
+    // false for descriptors epoll doesn't support, which are always ready
+    bool pollable;
+    // set while waiting for epoll to report that the descriptor is ready
+    bool armed;
+    // set once input has reached end of file, or the descriptor has failed
+    bool closed;
+    // index of the next binding of the same VM, or NO_BINDING
+    size_t next;
+    // ring buffer attached to the VM's channel
+    risky_channel_ring_t ring;
+    /*
+     * bytes read but not yet pushed as words (at most one odd byte is left
+     * over), or words popped as bytes but not yet written
+     */
+    risky_byte_t bytes[BUFFER_SIZE];
+    size_t start;
+    size_t end;
+} risky_event_binding_t;
+
+// the event loop's view of each VM
+typedef struct risky_event_vm_t {
+    vm_state_t state;
+    // index of the VM's first binding, or NO_BINDING
+    size_t first_binding;
+} risky_event_vm_t;
+
+// private function - adds the given VM to the back of the runnable queue
+static void queue_vm(risky_event_loop_t * loop, size_t vm) {
+    loop->vms[vm].state = VM_RUNNABLE;
+    size_t slot = (loop->runnable_start + loop->runnable_count) % loop->count;
+    loop->runnable[slot] = vm;
+    loop->runnable_count++;
+}
+
+/*
+ * private function - moves input from a read binding's descriptor into its
+ * ring, until the ring is full or no more input is ready.
+ * Returns the number of words pushed onto the ring
+ */
+static size_t service_read(risky_event_binding_t * binding) {
+    size_t moved = 0;
+    for(;;) {
+        // push every whole word buffered, as far as there is room
+        risky_word_t words[BUFFER_SIZE / 2];
+        size_t count = (binding->end - binding->start) / 2;
+        for(size_t i = 0; i < count; i++) {
+            const risky_byte_t * pair = binding->bytes + binding->start + i * 2;
+            words[i] = (risky_word_t) ((pair[0] << 8) | pair[1]);
+        }
+        size_t pushed = write_risky_channel_ring(&binding->ring, words, count);
+        binding->start += pushed * 2;
+        moved += pushed;
+        if(pushed < count || binding->closed) {
+            return moved;
+        }
+        // keep any odd byte, and read more after it
+        for(size_t i = binding->start; i < binding->end; i++) {
+            binding->bytes[i - binding->start] = binding->bytes[i];
+        }
+        binding->end -= binding->start;
+        binding->start = 0;
+        ssize_t size = read(
+            binding->descriptor, binding->bytes + binding->end,
+            BUFFER_SIZE - binding->end
+        );
+        if(size > 0) {
+            binding->end += (size_t) size;
+        } else if(size < 0 && errno == EINTR) {
+            continue;
+        } else if(size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return moved;
+        } else {
+            // end of file, or an error which won't go away
+            binding->closed = true;
+            return moved;
+        }
+    }
+}
+
+/*
+ * private function - moves output from a write binding's ring to its
+ * descriptor, until the ring is empty or the descriptor can't take any more.
+ * Output to a failed descriptor is thrown away.
+ * Returns the number of words popped off the ring
+ */
+static size_t service_write(risky_event_binding_t * binding) {
+    size_t moved = 0;
+    for(;;) {
+        if(binding->start == binding->end) {
+            risky_word_t words[BUFFER_SIZE / 2];
+            size_t count = read_risky_channel_ring(
+                &binding->ring, words, BUFFER_SIZE / 2
+            );
+            if(count == 0) {
+                return moved;
+            }
+            moved += count;
+            if(binding->closed) {
+                continue;
+            }
+            for(size_t i = 0; i < count; i++) {
+                binding->bytes[i * 2] = (risky_byte_t) (words[i] >> 8);
+                binding->bytes[i * 2 + 1] = (risky_byte_t) (words[i] & 0xffU);
+            }
+            binding->start = 0;
+            binding->end = count * 2;
+        }
+        ssize_t size = write(
+            binding->descriptor, binding->bytes + binding->start,
+            binding->end - binding->start
+        );
+        if(size > 0) {
+            binding->start += (size_t) size;
+        } else if(size < 0 && errno == EINTR) {
+            continue;
+        } else if(size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return moved;
+        } else {
+            binding->closed = true;
+            binding->start = binding->end = 0;
+        }
+    }
+}
+
+// private function - moves words between a binding's ring and descriptor
+static size_t service_binding(risky_event_binding_t * binding) {
+    return binding->write ? service_write(binding) : service_read(binding);
+}
+
+/*
+ * private function - returns whether a read binding's ring has no room for
+ * any more input, so that reading its descriptor can't make progress
+ */
+static bool ring_full(risky_event_binding_t * binding) {
+    risky_channel_ring_t * ring = &binding->ring;
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    return ring->head - tail > ring->mask;
+}
+
+/*
+ * private function - asks epoll to report when a binding's descriptor is
+ * ready, if it still might be and the binding isn't already waiting for it.
+ * A read binding whose ring is full doesn't wait, as its descriptor would be
+ * reported ready over and over with nowhere to put the input; it is serviced
+ * again whenever its VM next runs and empties some of the ring.
+ * Returns whether the binding is now waiting
+ */
+static bool arm_binding(
+    risky_event_loop_t * loop, risky_event_binding_t * binding
+) {
+    if(binding->armed) {
+        return true;
+    }
+    bool pending = binding->write ?
+        binding->start != binding->end :
+        !binding->closed && !ring_full(binding);
+    if(!pending || binding->closed || !binding->pollable) {
+        return false;
+    }
+    struct epoll_event event = {
+        .events = (binding->write ? EPOLLOUT : EPOLLIN) | EPOLLONESHOT,
+        .data = { .ptr = binding, },
+    };
+    if(
+        epoll_ctl(loop->epoll, EPOLL_CTL_MOD, binding->descriptor, &event) !=
+        0
+    ) {
+        binding->closed = true;
+        return false;
+    }
+    binding->armed = true;
+    loop->armed++;
+    return true;
+}
+
+/*
+ * private function - stops waiting for a binding's descriptor to be ready,
+ * once its VM doesn't need it to be any more
+ */
+static void disarm_binding(
+    risky_event_loop_t * loop, risky_event_binding_t * binding
+) {
+    if(!binding->armed) {
+        return;
+    }
+    struct epoll_event event = { .events = 0, .data = { .ptr = binding, }, };
+    epoll_ctl(loop->epoll, EPOLL_CTL_MOD, binding->descriptor, &event);
+    binding->armed = false;
+    loop->armed--;
+}
+
+/*
+ * private function - runs the given VM until it stops or has used up its
+ * quantum, then moves its input and output along and decides whether it can
+ * run again straight away, has to wait for its descriptors, or is finished.
+ * Returns a status_t with error / success information
+ */
+static status_t run_vm(risky_event_loop_t * loop, size_t vm) {
+    risky_stop_reason_t reason;
+    status_t result = run_risky_vm_for(
+        loop->states[vm], RISKY_EVENT_QUANTUM, NULL, &reason
+    );
+    loop->reasons[vm] = reason;
+    bool progress = false;
+    for(
+        size_t i = loop->vms[vm].first_binding; i != NO_BINDING;
+        i = loop->bindings[i]->next
+    ) {
+        if(service_binding(loop->bindings[i]) != 0) {
+            progress = true;
+        }
+    }
+    if(result == STATUS_SUCCESS && reason == RISKY_STOP_BUDGET) {
+        // it goes to the back of the queue, so the other VMs get a turn
+        queue_vm(loop, vm);
+        return result;
+    }
+    bool blocked = result == STATUS_SUCCESS && reason == RISKY_STOP_BLOCKED;
+    if(blocked && progress) {
+        // whatever it blocked on may have been the channel which moved
+        queue_vm(loop, vm);
+        return result;
+    }
+    /*
+     * a blocked VM waits for any of its descriptors, a finished one only for
+     * its output to be written
+     */
+    bool waiting = false;
+    for(
+        size_t i = loop->vms[vm].first_binding; i != NO_BINDING;
+        i = loop->bindings[i]->next
+    ) {
+        risky_event_binding_t * binding = loop->bindings[i];
+        if(blocked || binding->write) {
+            if(arm_binding(loop, binding) && blocked) {
+                waiting = true;
+            }
+        } else {
+            disarm_binding(loop, binding);
+        }
+    }
+    loop->vms[vm].state = waiting ? VM_WAITING : VM_FINISHED;
+    return result;
+}
+
+/*
+ * private function - handles epoll reporting that a binding's descriptor is
+ * ready, making its VM runnable again if it was waiting on it
+ */
+static void handle_event(
+    risky_event_loop_t * loop, risky_event_binding_t * binding
+) {
+    // it may have been disarmed by an earlier event in the same batch
+    if(!binding->armed) {
+        return;
+    }
+    binding->armed = false;
+    loop->armed--;
+    size_t moved = service_binding(binding);
+    risky_event_vm_t * vm = &loop->vms[binding->vm];
+    if(vm->state == VM_WAITING && (moved != 0 || binding->closed)) {
+        queue_vm(loop, binding->vm);
+    } else if(binding->write || vm->state == VM_WAITING) {
+        // output left to write, or input which still isn't ready
+        arm_binding(loop, binding);
+    }
+}
+
+/*
+ * given a pointer to a risky_event_loop_t, an array of pointers to
+ * initialised risky_vm_state_t and the number of them, allocate the event
+ * loop's storage, with every VM ready to run.
+ * Returns a status_t with error / success information
+ */
+status_t init_risky_event_loop(
+    risky_event_loop_t * loop, risky_vm_state_t ** states, size_t count
+) {
+    *loop = (risky_event_loop_t) {
+        .states = states, .count = count, .epoll = -1,
+    };
+    loop->epoll = epoll_create1(EPOLL_CLOEXEC);
+    if(loop->epoll == -1) {
+        return STATUS_FAIL;
+    }
+    loop->reasons = (risky_stop_reason_t *) calloc(
+        count + 1, sizeof(risky_stop_reason_t)
+    );
+    loop->vms = (risky_event_vm_t *) calloc(
+        count + 1, sizeof(risky_event_vm_t)
+    );
+    loop->runnable = (size_t *) calloc(count + 1, sizeof(size_t));
+    if(loop->reasons == NULL || loop->vms == NULL || loop->runnable == NULL) {
+        free_risky_event_loop(loop);
+        return MALLOC_REFUSED;
+    }
+    for(size_t i = 0; i < count; i++) {
+        loop->vms[i].first_binding = NO_BINDING;
+        queue_vm(loop, i);
+    }
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_event_loop_t, free its storage, detaching the
+ * ring buffers of any bound channels from their VMs.
+ * Returns a status_t with error / success information
+ */
+status_t free_risky_event_loop(risky_event_loop_t * loop) {
+    for(size_t i = 0; i < loop->binding_count; i++) {
+        risky_event_binding_t * binding = loop->bindings[i];
+        risky_vm_state_t * state = loop->states[binding->vm];
+        if(state->rings[binding->channel] == &binding->ring) {
+            state->rings[binding->channel] = NULL;
+        }
+        free_risky_channel_ring(&binding->ring);
+        close(binding->descriptor);
+        free(binding);
+    }
+    free(loop->bindings);
+    free(loop->reasons);
+    free(loop->vms);
+    free(loop->runnable);
+    if(loop->epoll != -1) {
+        close(loop->epoll);
+    }
+    *loop = (risky_event_loop_t) { .epoll = -1, };
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_event_loop_t, the index of one of its VMs, a
+ * channel number, a file descriptor and whether the VM writes to the channel
+ * rather than reading from it, back that channel of the VM with the
+ * descriptor.
+ * Returns a status_t with error / success information
+ */
+status_t bind_risky_event_channel(
+    risky_event_loop_t * loop, size_t vm, risky_channel_t channel,
+    int descriptor, bool write
+) {
+    if(vm >= loop->count) {
+        return STATUS_FAIL;
+    }
+    risky_event_binding_t ** bindings = (risky_event_binding_t **) realloc(
+        loop->bindings,
+        (loop->binding_count + 1) * sizeof(risky_event_binding_t *)
+    );
+    if(bindings == NULL) {
+        return MALLOC_REFUSED;
+    }
+    loop->bindings = bindings;
+    risky_event_binding_t * binding = (risky_event_binding_t *) malloc(
+        sizeof(risky_event_binding_t)
+    );
+    if(binding == NULL) {
+        return MALLOC_REFUSED;
+    }
+    *binding = (risky_event_binding_t) {
+        .vm = vm, .channel = channel, .write = write, .pollable = true,
+        .next = loop->vms[vm].first_binding,
+    };
+    status_t result = init_risky_channel_ring(
+        &binding->ring, RISKY_EVENT_RING_SIZE
+    );
+    if(result != STATUS_SUCCESS) {
+        free(binding);
+        return result;
+    }
+    /*
+     * a copy of the descriptor can be registered with epoll separately from
+     * any other copies, so the same descriptor can back several channels
+     */
+    binding->descriptor = fcntl(descriptor, F_DUPFD_CLOEXEC, 0);
+    int flags = (binding->descriptor == -1) ?
+        -1 : fcntl(binding->descriptor, F_GETFL);
+    if(
+        flags == -1 ||
+        fcntl(binding->descriptor, F_SETFL, flags | O_NONBLOCK) == -1
+    ) {
+        if(binding->descriptor != -1) {
+            close(binding->descriptor);
+        }
+        free_risky_channel_ring(&binding->ring);
+        free(binding);
+        return STATUS_FAIL;
+    }
+    struct epoll_event event = { .events = 0, .data = { .ptr = binding, }, };
+    if(
+        epoll_ctl(loop->epoll, EPOLL_CTL_ADD, binding->descriptor, &event) !=
+        0
+    ) {
+        if(errno != EPERM) {
+            close(binding->descriptor);
+            free_risky_channel_ring(&binding->ring);
+            free(binding);
+            return STATUS_FAIL;
+        }
+        // regular files and the like are always ready
+        binding->pollable = false;
+    }
+    loop->bindings[loop->binding_count] = binding;
+    loop->vms[vm].first_binding = loop->binding_count++;
+    loop->states[vm]->rings[channel] = &binding->ring;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_event_loop_t, run its VMs on the calling thread
+ * until every one has halted or can't make any more progress.
+ * Returns a status_t with error / success information
+ */
+status_t run_risky_event_loop(risky_event_loop_t * loop) {
+    status_t result = STATUS_SUCCESS;
+    for(;;) {
+        while(loop->runnable_count != 0) {
+            size_t vm = loop->runnable[loop->runnable_start];
+            loop->runnable_start = (loop->runnable_start + 1) % loop->count;
+            loop->runnable_count--;
+            status_t status = run_vm(loop, vm);
+            if(status != STATUS_SUCCESS && result == STATUS_SUCCESS) {
+                result = status;
+            }
+        }
+        if(loop->armed == 0) {
+            return result;
+        }
+        struct epoll_event events[EVENT_BATCH];
+        int count = epoll_wait(loop->epoll, events, EVENT_BATCH, -1);
+        if(count < 0 && errno != EINTR) {
+            return STATUS_FAIL;
+        }
+        for(int i = 0; i < count; i++) {
+            handle_event(loop, (risky_event_binding_t *) events[i].data.ptr);
+        }
+    }
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
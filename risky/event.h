@@ -0,0 +1,117 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * event - this compilation unit defines an event loop which runs many RISKY
+ * virtual machines on one host thread, with their data channels backed by
+ * non-blocking file descriptors, so that a VM waiting for I/O is suspended
+ * rather than blocking the thread.
+ */
+#ifndef SAXBOPHONE_RISKY_EVENT_H
+#define SAXBOPHONE_RISKY_EVENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "core.h"
+#include "interpreter.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of words in the ring buffer of each channel bound to a descriptor
+#define RISKY_EVENT_RING_SIZE 1024U
+// number of instructions each VM runs for at most before the next one runs
+#define RISKY_EVENT_QUANTUM 65536U
+
+// a channel of a VM bound to a file descriptor, defined in the event module
+struct risky_event_binding_t;
+// the event loop's view of each VM, defined in the event module
+struct risky_event_vm_t;
+
+// event loop struct
+typedef struct risky_event_loop_t {
+    // the VMs being run, and how many of them there are
+    risky_vm_state_t ** states;
+    size_t count;
+    // the reason each VM last stopped (RISKY_STOP_NONE if it hasn't yet)
+    risky_stop_reason_t * reasons;
+    // the event loop's view of each VM
+    struct risky_event_vm_t * vms;
+    // every channel bound to a descriptor, and how many of them there are
+    struct risky_event_binding_t ** bindings;
+    size_t binding_count;
+    // VMs ready to run, in the order they became ready
+    size_t * runnable;
+    size_t runnable_start;
+    size_t runnable_count;
+    // number of bindings waiting for their descriptor to become ready
+    size_t armed;
+    // the epoll instance descriptors are registered with
+    int epoll;
+} risky_event_loop_t;
+
+/*
+ * given a pointer to a risky_event_loop_t, an array of pointers to
+ * initialised risky_vm_state_t and the number of them, allocate the event
+ * loop's storage, with every VM ready to run.
+ * Returns a status_t with error / success information
+ */
+status_t init_risky_event_loop(
+    risky_event_loop_t * loop, risky_vm_state_t ** states, size_t count
+);
+
+/*
+ * given a pointer to a risky_event_loop_t, free its storage, detaching the
+ * ring buffers of any bound channels from their VMs and closing the event
+ * loop's copies of their descriptors. The VMs themselves are not freed.
+ * Returns a status_t with error / success information
+ */
+status_t free_risky_event_loop(risky_event_loop_t * loop);
+
+/*
+ * given a pointer to a risky_event_loop_t, the index of one of its VMs, a
+ * channel number, a file descriptor and whether the VM writes to the channel
+ * rather than reading from it, back that channel of the VM with the
+ * descriptor: words written by WRI are written to it, or REA reads words from
+ * it, in either case as two big-endian bytes each.
+ * The event loop attaches a ring buffer to the channel and moves words
+ * between it and a copy of the descriptor, which is made non-blocking (which
+ * also affects the given descriptor). The VM still has to configure the
+ * channel with CDC. Descriptors which epoll doesn't support, such as regular
+ * files, are always treated as ready.
+ * Returns a status_t with error / success information
+ */
+status_t bind_risky_event_channel(
+    risky_event_loop_t * loop, size_t vm, risky_channel_t channel,
+    int descriptor, bool write
+);
+
+/*
+ * given a pointer to a risky_event_loop_t, run its VMs on the calling thread
+ * until every one has halted or can't make any more progress, storing the
+ * reason each one stopped in the loop's reasons array.
+ * Each VM runs for about RISKY_EVENT_QUANTUM instructions at a time, so a VM
+ * which computes for a long time between I/O doesn't starve the others.
+ * A VM which blocks on a bound channel (a REA with no input ready, or a WRI
+ * with its channel's ring buffer full) is suspended until its descriptor is
+ * ready, while the other VMs run. A VM which blocks on a channel which isn't
+ * bound, or on input which has reached end of file, is finished with
+ * RISKY_STOP_BLOCKED. This only returns once any output the VMs wrote has been
+ * written to its descriptor (or the descriptor has failed).
+ * Returns a status_t with error / success information
+ */
+status_t run_risky_event_loop(risky_event_loop_t * loop);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+// end of header file
+#endif
@@ -0,0 +1,59 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * fork - this compilation unit defines functions for cloning a RISKY virtual
+ * machine, with the clone sharing the RAM of the original copy-on-write.
+ */
+#include <string.h>
+
+#include "core.h"
+#include "fork.h"
+#include "image.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * given a pointer to an initialised risky_vm_state_t (the parent) and a
+ * pointer to an uninitialised risky_vm_state_t (the child), initialise the
+ * child as a copy of the parent, sharing RAM copy-on-write.
+ * Returns a status_t with error / success information
+ */
+status_t fork_risky_vm(risky_vm_state_t * parent, risky_vm_state_t * child) {
+    // the image must match the parent's RAM as it is now
+    if(parent->image == NULL || parent->ram_written) {
+        status_t result = snapshot_risky_ram_image(parent);
+        if(result != STATUS_SUCCESS) {
+            return result;
+        }
+    }
+    // the child decodes its own instructions, as it may change its own code
+    child->cache = NULL;
+    // the child's RAM is its own mapping, even if the parent is pooled
+    child->ram = NULL;
+    child->image = NULL;
+    child->pool = NULL;
+    status_t result = map_risky_ram_image(child, parent->image);
+    if(result != STATUS_SUCCESS) {
+        return result;
+    }
+    memcpy(child->registers, parent->registers, sizeof(child->registers));
+    child->program_counter = parent->program_counter;
+    child->operation_flags = parent->operation_flags;
+    memcpy(child->channels, parent->channels, sizeof(child->channels));
+    child->channel_io = parent->channel_io;
+    // a ring has only one producer and one consumer, so can't be shared
+    memset(child->rings, 0, sizeof(child->rings));
+    return STATUS_SUCCESS;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,49 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * fork - this compilation unit defines functions for cloning a RISKY virtual
+ * machine, with the clone sharing the RAM of the original copy-on-write.
+ */
+#ifndef SAXBOPHONE_RISKY_FORK_H
+#define SAXBOPHONE_RISKY_FORK_H
+
+#include "core.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * given a pointer to an initialised risky_vm_state_t (the parent) and a
+ * pointer to an uninitialised risky_vm_state_t (the child), initialise the
+ * child as a copy of the parent: its registers, program counter, operation
+ * flags, channels and channel callbacks, but not the channels' ring buffers,
+ * which the host must attach to the child itself if it wants any. The child's
+ * RAM shares its pages with the parent copy-on-write in the operating
+ * system's pages (usually 4KiB), so each page is only copied the first time
+ * the parent or child writes to it, and memory use grows with the pages
+ * written.
+ * The first fork of a VM snapshots its RAM into an image (see the image
+ * module), which may move the parent's RAM to a new address. Later forks
+ * reuse the image, unless the parent's RAM has been written to since, so
+ * forking the same prepared VM many times only costs a mapping each time.
+ * VMs in a pool of explicit huge pages can't be forked from. As with the
+ * instruction cache, the host must call invalidate_cached_instructions()
+ * after writing to RAM directly.
+ * The child must be freed with free_risky_vm_state() as usual.
+ * Returns a status_t with error / success information
+ */
+status_t fork_risky_vm(risky_vm_state_t * parent, risky_vm_state_t * child);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+// end of header file
+#endif
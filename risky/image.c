@@ -0,0 +1,403 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * image - this compilation unit defines read-only images of RAM held in files,
+ * which the RAM of any number of RISKY virtual machines can map copy-on-write.
+ */
+// memfd_create() and mremap() are GNU extensions
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "core.h"
+#include "image.h"
+#include "pool.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * private function - creates an anonymous file to hold an image of RAM.
+ * Returns its file descriptor, or -1 if it couldn't be created
+ */
+static int create_image_file(void) {
+#ifdef MFD_CLOEXEC
+    return memfd_create("risky-ram", MFD_CLOEXEC);
+#else
+    // without memfd, use a temporary file which is deleted straight away
+    char path[] = "/tmp/risky-ram-XXXXXX";
+    int descriptor = mkstemp(path);
+    if(descriptor != -1) {
+        unlink(path);
+    }
+    return descriptor;
+#endif
+}
+
+/*
+ * private function - allocates an image of the given file descriptor, offset,
+ * pages and size, holding one reference for the caller.
+ * Returns NULL if it couldn't be allocated
+ */
+static risky_ram_image_t * new_image(
+    int descriptor, off_t offset, uint32_t pages, size_t size
+) {
+    risky_ram_image_t * image = (risky_ram_image_t *) malloc(
+        sizeof(risky_ram_image_t)
+    );
+    if(image != NULL) {
+        *image = (risky_ram_image_t) {
+            .descriptor = descriptor, .offset = offset, .pages = pages,
+            .size = size, .references = 1,
+        };
+    }
+    return image;
+}
+
+/*
+ * private function - returns the mask of the pages of an image which starts
+ * with the given number of bytes of RAM, followed by zeroes
+ */
+static uint32_t leading_pages(size_t size) {
+    size_t count = (size + RISKY_IMAGE_PAGE_SIZE - 1) / RISKY_IMAGE_PAGE_SIZE;
+    return (uint32_t) (((uint64_t) 1U << count) - 1U);
+}
+
+/*
+ * private function - maps the given image copy-on-write at an address of the
+ * system's choosing, storing the mask of the pages mapped from its file (the
+ * rest are anonymous) in the given mask.
+ * Returns the address of the mapping, or NULL if it couldn't be mapped
+ */
+static risky_ram_t * build_image(
+    risky_ram_image_t * image, uint32_t * file_pages
+) {
+    int protection = PROT_READ | PROT_WRITE;
+    *file_pages = RISKY_IMAGE_ALL_PAGES;
+    if(image->size == RISKY_RAM_AMOUNT) {
+        void * mapping = mmap(
+            NULL, RISKY_RAM_AMOUNT, protection, MAP_PRIVATE,
+            image->descriptor, image->offset
+        );
+        return (mapping == MAP_FAILED) ? NULL : (risky_ram_t *) mapping;
+    }
+    /*
+     * touching a page wholly past the end of a file is an error, so pages
+     * not held in the file are anonymous zero pages, with each run of pages
+     * that are held mapped over them
+     */
+    *file_pages = 0;
+    risky_ram_t * mapping = (risky_ram_t *) mmap(
+        NULL, RISKY_RAM_AMOUNT, protection, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+    );
+    if(mapping == MAP_FAILED) {
+        return NULL;
+    }
+    // number of bytes of the file mapped so far
+    size_t held = 0;
+    size_t page = 0;
+    while(page < RISKY_IMAGE_PAGE_COUNT) {
+        if(!((image->pages >> page) & 1U)) {
+            page++;
+            continue;
+        }
+        size_t first = page;
+        while(page < RISKY_IMAGE_PAGE_COUNT && ((image->pages >> page) & 1U)) {
+            page++;
+        }
+        size_t length = (page - first) * RISKY_IMAGE_PAGE_SIZE;
+        if(length > image->size - held) {
+            length = image->size - held;
+        }
+        if(
+            length != 0 && mmap(
+                &mapping[first * RISKY_IMAGE_PAGE_SIZE], length, protection,
+                MAP_PRIVATE | MAP_FIXED, image->descriptor,
+                image->offset + (off_t) held
+            ) == MAP_FAILED
+        ) {
+            munmap(mapping, RISKY_RAM_AMOUNT);
+            return NULL;
+        }
+        size_t pages = (length + RISKY_IMAGE_PAGE_SIZE - 1) /
+            RISKY_IMAGE_PAGE_SIZE;
+        *file_pages |= (uint32_t) ((((uint64_t) 1U << pages) - 1U) << first);
+        held += length;
+    }
+    return mapping;
+}
+
+/*
+ * private function - maps the given image copy-on-write, at the given address
+ * if it isn't NULL (replacing whatever was mapped there). The mapping is
+ * built elsewhere and moved into place, so a failure to map the image leaves
+ * what was there alone; only running out of memory part of the way through
+ * the move can't be undone, in which case the given flag is set to say that
+ * the contents at the address are now undefined.
+ * Returns the address of the mapping, or NULL if it couldn't be mapped
+ */
+static risky_ram_t * map_image(
+    risky_ram_image_t * image, risky_ram_t * at, bool * replaced
+) {
+    *replaced = false;
+    uint32_t file_pages;
+    risky_ram_t * mapping = build_image(image, &file_pages);
+    if(mapping == NULL || at == NULL) {
+        return mapping;
+    }
+    /*
+     * a range can only be moved within a single mapping, so each run of
+     * pages mapped the same way (from the file or not) is moved on its own
+     */
+    size_t page = 0;
+    while(page < RISKY_IMAGE_PAGE_COUNT) {
+        size_t first = page;
+        bool from_file = (file_pages >> page) & 1U;
+        while(
+            page < RISKY_IMAGE_PAGE_COUNT &&
+            (bool) ((file_pages >> page) & 1U) == from_file
+        ) {
+            page++;
+        }
+        size_t offset = first * RISKY_IMAGE_PAGE_SIZE;
+        size_t length = (page - first) * RISKY_IMAGE_PAGE_SIZE;
+        if(
+            mremap(
+                &mapping[offset], length, length, MREMAP_MAYMOVE | MREMAP_FIXED,
+                &at[offset]
+            ) == MAP_FAILED
+        ) {
+            // whatever is left of the mapping which wasn't moved
+            munmap(mapping, RISKY_RAM_AMOUNT);
+            *replaced = first != 0;
+            return NULL;
+        }
+    }
+    return at;
+}
+
+/*
+ * given a path to a file of at most RISKY_RAM_AMOUNT bytes and a pointer to a
+ * pointer to a risky_ram_image_t, open the file as an image of the initial
+ * contents of RAM.
+ * Returns a status_t with error / success information
+ */
+status_t open_risky_ram_image(const char * path, risky_ram_image_t ** image) {
+    int descriptor = open(path, O_RDONLY | O_CLOEXEC);
+    if(descriptor == -1) {
+        return STATUS_FAIL;
+    }
+    struct stat status;
+    if(
+        fstat(descriptor, &status) != 0 || status.st_size < 0 ||
+        status.st_size > RISKY_RAM_AMOUNT
+    ) {
+        close(descriptor);
+        return STATUS_FAIL;
+    }
+    size_t size = (size_t) status.st_size;
+    *image = new_image(descriptor, 0, leading_pages(size), size);
+    if(*image == NULL) {
+        close(descriptor);
+        return MALLOC_REFUSED;
+    }
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a file descriptor, an offset in its file, a mask of pages of RAM and
+ * a pointer to a pointer to a risky_ram_image_t, make an image of RAM from
+ * the pages held in the file from the offset, with every other page zero.
+ * Returns a status_t with error / success information
+ */
+status_t open_risky_ram_image_pages(
+    int descriptor, off_t offset, uint32_t pages, risky_ram_image_t ** image
+) {
+    if(
+        sysconf(_SC_PAGESIZE) != RISKY_IMAGE_PAGE_SIZE ||
+        offset % RISKY_IMAGE_PAGE_SIZE != 0 ||
+        pages > leading_pages(RISKY_RAM_AMOUNT)
+    ) {
+        return STATUS_FAIL;
+    }
+    size_t size = 0;
+    for(size_t page = 0; page < RISKY_IMAGE_PAGE_COUNT; page++) {
+        if((pages >> page) & 1U) {
+            size += RISKY_IMAGE_PAGE_SIZE;
+        }
+    }
+    *image = new_image(descriptor, offset, pages, size);
+    if(*image == NULL) {
+        return MALLOC_REFUSED;
+    }
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_ram_image_t, drop one reference to it, freeing
+ * it once nothing refers to it. VMs can be freed on different threads, so
+ * the count is changed atomically
+ */
+void drop_risky_ram_image(risky_ram_image_t * image) {
+    if(__atomic_sub_fetch(&image->references, 1, __ATOMIC_ACQ_REL) == 0) {
+        close(image->descriptor);
+        free(image);
+    }
+}
+
+/*
+ * private function - replaces the VM's RAM with a copy-on-write mapping of the
+ * image. If the image holds what is in RAM already, the VM's cached
+ * instructions and its record of what has been written are kept, as nothing
+ * in RAM has changed; otherwise they are thrown away.
+ * Returns a status_t with error / success information
+ */
+static status_t replace_ram(
+    risky_vm_state_t * state, risky_ram_image_t * image, bool same_contents
+) {
+    // explicit huge pages can't be remapped a small page at a time
+    if(
+        state->pool != NULL && state->pool->pages == RISKY_POOL_HUGETLB_PAGES
+    ) {
+        return STATUS_FAIL;
+    }
+    /*
+     * RAM which is already a mapping (of an image or in a pool's arena) is
+     * page-aligned, so the new mapping can replace it at the same address.
+     * A plain allocation has to move
+     */
+    bool mapped = state->image != NULL || state->pool != NULL;
+    bool replaced;
+    risky_ram_t * ram = map_image(image, mapped ? state->ram : NULL, &replaced);
+    if(ram == NULL) {
+        if(replaced) {
+            // RAM is part old and part new, so nothing about it can be kept
+            invalidate_instruction_cache(state);
+        }
+        return STATUS_FAIL;
+    }
+    __atomic_add_fetch(&image->references, 1, __ATOMIC_RELAXED);
+    if(state->image != NULL) {
+        drop_risky_ram_image(state->image);
+    } else if(!mapped) {
+        free(state->ram);
+    }
+    state->ram = ram;
+    state->image = image;
+    if(!same_contents) {
+        invalidate_instruction_cache(state);
+    }
+    state->ram_written = false;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to an initialised risky_vm_state_t and a pointer to a
+ * risky_ram_image_t, replace the VM's RAM with a copy-on-write mapping of the
+ * image.
+ * Returns a status_t with error / success information
+ */
+status_t map_risky_ram_image(
+    risky_vm_state_t * state, risky_ram_image_t * image
+) {
+    return replace_ram(state, image, false);
+}
+
+/*
+ * given a pointer to an initialised risky_vm_state_t, take an image of its
+ * RAM as it is now and replace its RAM with a copy-on-write mapping of it.
+ * Returns a status_t with error / success information
+ */
+status_t snapshot_risky_ram_image(risky_vm_state_t * state) {
+    int descriptor = create_image_file();
+    if(descriptor == -1) {
+        return STATUS_FAIL;
+    }
+    risky_ram_image_t * image = new_image(
+        descriptor, 0, leading_pages(RISKY_RAM_AMOUNT), RISKY_RAM_AMOUNT
+    );
+    if(image == NULL) {
+        close(descriptor);
+        return MALLOC_REFUSED;
+    }
+    size_t written = 0;
+    while(written < RISKY_RAM_AMOUNT) {
+        ssize_t count = write(
+            descriptor, state->ram + written, RISKY_RAM_AMOUNT - written
+        );
+        if(count <= 0) {
+            drop_risky_ram_image(image);
+            return STATUS_FAIL;
+        }
+        written += (size_t) count;
+    }
+    status_t result = replace_ram(state, image, true);
+    // the VM now holds the only reference, if it was mapped
+    drop_risky_ram_image(image);
+    return result;
+}
+
+/*
+ * given a pointer to a risky_vm_state_t whose RAM is mapped from an image,
+ * unmap it and drop the VM's reference to the image.
+ * Returns a status_t with error / success information
+ */
+status_t release_risky_ram_image(risky_vm_state_t * state) {
+    if(state->image == NULL) {
+        return STATUS_FAIL;
+    }
+    status_t result = STATUS_SUCCESS;
+    if(state->pool != NULL) {
+        // pooled RAM stays in the pool's arena, replaced by fresh zero pages
+        void * mapping = mmap(
+            state->ram, RISKY_RAM_AMOUNT, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0
+        );
+        if(mapping == MAP_FAILED) {
+            result = STATUS_FAIL;
+        }
+    } else {
+        if(munmap(state->ram, RISKY_RAM_AMOUNT) != 0) {
+            result = STATUS_FAIL;
+        }
+        state->ram = NULL;
+    }
+    drop_risky_ram_image(state->image);
+    state->image = NULL;
+    return result;
+}
+
+/*
+ * given a pointer to an initialised risky_vm_state_t and a path to a file of
+ * bytecode, load the file as the initial contents of the VM's RAM by mapping
+ * it copy-on-write.
+ * Returns a status_t with error / success information
+ */
+status_t load_risky_program_file(risky_vm_state_t * state, const char * path) {
+    risky_ram_image_t * image;
+    status_t result = open_risky_ram_image(path, &image);
+    if(result != STATUS_SUCCESS) {
+        return result;
+    }
+    result = map_risky_ram_image(state, image);
+    drop_risky_ram_image(image);
+    return result;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,135 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * image - this compilation unit defines read-only images of RAM held in files,
+ * which the RAM of any number of RISKY virtual machines can map copy-on-write.
+ */
+#ifndef SAXBOPHONE_RISKY_IMAGE_H
+#define SAXBOPHONE_RISKY_IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "core.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// size of the pages of RAM an image is made up of
+#define RISKY_IMAGE_PAGE_SIZE 4096U
+// number of pages of RAM
+#define RISKY_IMAGE_PAGE_COUNT (RISKY_RAM_AMOUNT / RISKY_IMAGE_PAGE_SIZE)
+// a mask of pages with every page of RAM set
+#define RISKY_IMAGE_ALL_PAGES \
+    ((uint32_t) ((UINT64_C(1) << RISKY_IMAGE_PAGE_COUNT) - 1U))
+
+// a read-only image of RAM, which VMs map copy-on-write
+typedef struct risky_ram_image_t {
+    // file descriptor of the file holding the image
+    int descriptor;
+    // offset in the file of the first page of the image
+    off_t offset;
+    /*
+     * one bit for each page of RAM (the lowest for the first page), set if
+     * the page is held in the file. Those pages are held one after the
+     * other from the offset, and the rest of RAM is zero
+     */
+    uint32_t pages;
+    // number of bytes of pages held in the file, the last may be cut short
+    size_t size;
+    /*
+     * number of references to the image: one for each VM whose RAM is a
+     * mapping of it, and one for whoever opened it until they drop it
+     */
+    size_t references;
+} risky_ram_image_t;
+
+/*
+ * given a path to a file of at most RISKY_RAM_AMOUNT bytes and a pointer to a
+ * pointer to a risky_ram_image_t, open the file as an image of the initial
+ * contents of RAM, with any RAM beyond the end of the file being zero, and
+ * store a pointer to the image in the pointer at the given address.
+ * The caller holds one reference to the image, which it must drop with
+ * drop_risky_ram_image() once it has mapped it into all the VMs it wants to.
+ * Returns a status_t with error / success information
+ */
+status_t open_risky_ram_image(const char * path, risky_ram_image_t ** image);
+
+/*
+ * given a file descriptor, an offset in its file, a mask of pages of RAM and
+ * a pointer to a pointer to a risky_ram_image_t, make an image of RAM from
+ * the pages held in the file one after the other from the offset, one for
+ * each bit set in the mask, with every other page of RAM being zero. The
+ * offset must be a multiple of RISKY_IMAGE_PAGE_SIZE, and this fails if the
+ * host's pages are of a different size, as they couldn't be mapped one at a
+ * time. On success, the image owns the file descriptor, and the caller holds
+ * one reference to the image as with open_risky_ram_image().
+ * Returns a status_t with error / success information
+ */
+status_t open_risky_ram_image_pages(
+    int descriptor, off_t offset, uint32_t pages, risky_ram_image_t ** image
+);
+
+/*
+ * given a pointer to a risky_ram_image_t, drop one reference to it, freeing
+ * it once nothing refers to it. This may be called from any thread.
+ */
+void drop_risky_ram_image(risky_ram_image_t * image);
+
+/*
+ * given a pointer to an initialised risky_vm_state_t and a pointer to a
+ * risky_ram_image_t, replace the VM's RAM with a copy-on-write mapping of the
+ * image. No bytes are copied: the VM shares the image's pages (with the page
+ * cache, for images of files on disk) until it writes to them, when the
+ * operating system copies each page written. The VM's RAM may move to a new
+ * address, unless it is already a mapping or belongs to a pool. If the image
+ * can't be mapped, RAM is left as it was, unless the system runs out of
+ * memory part of the way through replacing it, in which case its contents
+ * are undefined (and treated as all having been written to).
+ * Returns a status_t with error / success information
+ */
+status_t map_risky_ram_image(
+    risky_vm_state_t * state, risky_ram_image_t * image
+);
+
+/*
+ * given a pointer to an initialised risky_vm_state_t, take an image of its
+ * RAM as it is now, held in an anonymous file, and replace its RAM with a
+ * copy-on-write mapping of that image, so that later writes by the VM don't
+ * change the image. As RAM holds the same bytes afterwards, the VM keeps its
+ * cached instructions and the pages and lines it has marked as written.
+ * Returns a status_t with error / success information
+ */
+status_t snapshot_risky_ram_image(risky_vm_state_t * state);
+
+/*
+ * given a pointer to a risky_vm_state_t whose RAM is mapped from an image,
+ * unmap it and drop the VM's reference to the image. The RAM of a VM from a
+ * pool is replaced with zeroes in place instead of being unmapped. This is
+ * called by free_risky_vm_state().
+ * Returns a status_t with error / success information
+ */
+status_t release_risky_ram_image(risky_vm_state_t * state);
+
+/*
+ * given a pointer to an initialised risky_vm_state_t and a path to a file of
+ * bytecode, load the file as the initial contents of the VM's RAM by mapping
+ * it copy-on-write, rather than reading and copying it.
+ * Returns a status_t with error / success information
+ */
+status_t load_risky_program_file(risky_vm_state_t * state, const char * path);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+// end of header file
+#endif
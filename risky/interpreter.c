@@ -0,0 +1,1168 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * interpreter - this compilation unit defines functions for executing the
+ * instructions in the RAM of a RISKY virtual machine.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cache.h"
+#include "channel.h"
+#include "core.h"
+#include "interpreter.h"
+#include "packed.h"
+#include "profile.h"
+#include "replay.h"
+#include "risky.h"
+#include "trace.h"
+
+/*
+ * direct-threaded dispatch relies on the GNU 'labels as values' extension,
+ * which -pedantic warns about, so silence that for this file only
+ */
+#if defined(__GNUC__) && !defined(RISKY_NO_THREADED_DISPATCH)
+#define RISKY_THREADED_DISPATCH
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+/*
+ * the switch statement executing an instruction is used by every copy of the
+ * switch interpreter, and must be inlined into each of them to keep its
+ * registers in host registers, which GCC won't do by itself for all of them
+ */
+#ifdef __GNUC__
+#define EXECUTE_INLINE static inline __attribute__((always_inline))
+#else
+#define EXECUTE_INLINE static inline
+#endif
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * private function - returns the value of the given register, truncated to 8
+ * bits unless the wide flag is set
+ */
+static inline risky_word_t read_register(
+    risky_vm_state_t * state, risky_register_address_t address, bool wide
+) {
+    return wide ? state->registers[address] : state->registers[address] & 0xffU;
+}
+
+/*
+ * private function - stores the given value in the given register, truncated
+ * to 8 bits unless the wide flag is set
+ */
+static inline void write_register(
+    risky_vm_state_t * state, risky_register_address_t address,
+    uint32_t value, bool wide
+) {
+    state->registers[address] = (risky_register_t) (
+        wide ? value & 0xffffU : value & 0xffU
+    );
+}
+
+/*
+ * private function - stores the result of an arithmetic operation in the
+ * return register of the given instruction and updates the operation flags,
+ * raising the overflow flag if it doesn't fit in the register (unless the
+ * result has already wrapped around from underflowing)
+ */
+static inline void write_arithmetic_result(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction,
+    uint32_t value, risky_byte_t flags
+) {
+    uint32_t limit = packed_a_flag(instruction) ? 0xffffU : 0xffU;
+    if(value > limit && !(flags & RISKY_UNDERFLOW)) {
+        flags |= RISKY_OVERFLOW;
+    }
+    state->operation_flags = flags;
+    write_register(state, instruction->r, value, packed_a_flag(instruction));
+}
+
+/*
+ * the following private functions each execute one kind of instruction that
+ * does not affect control flow.
+ * for instructions taking three registers, flags a, b and c specify whether
+ * registers r, a and b (respectively) are used at 16-bit or 8-bit width. For
+ * those taking two registers, flags a and b do the same for r and a.
+ */
+
+static inline void execute_equ(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    write_register(
+        state, instruction->r,
+        read_register(state, instruction->a, packed_b_flag(instruction)) ==
+        read_register(state, instruction->b, packed_c_flag(instruction)),
+        packed_a_flag(instruction)
+    );
+}
+
+static inline void execute_neq(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    write_register(
+        state, instruction->r,
+        read_register(state, instruction->a, packed_b_flag(instruction)) !=
+        read_register(state, instruction->b, packed_c_flag(instruction)),
+        packed_a_flag(instruction)
+    );
+}
+
+static inline void execute_gtn(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    write_register(
+        state, instruction->r,
+        read_register(state, instruction->a, packed_b_flag(instruction)) >
+        read_register(state, instruction->b, packed_c_flag(instruction)),
+        packed_a_flag(instruction)
+    );
+}
+
+static inline void execute_ltn(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    write_register(
+        state, instruction->r,
+        read_register(state, instruction->a, packed_b_flag(instruction)) <
+        read_register(state, instruction->b, packed_c_flag(instruction)),
+        packed_a_flag(instruction)
+    );
+}
+
+static inline void execute_add(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    uint32_t a = read_register(
+        state, instruction->a, packed_b_flag(instruction)
+    );
+    uint32_t b = read_register(
+        state, instruction->b, packed_c_flag(instruction)
+    );
+    write_arithmetic_result(state, instruction, a + b, 0x00U);
+}
+
+static inline void execute_sub(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    uint32_t a = read_register(
+        state, instruction->a, packed_b_flag(instruction)
+    );
+    uint32_t b = read_register(
+        state, instruction->b, packed_c_flag(instruction)
+    );
+    write_arithmetic_result(
+        state, instruction, (a - b) & 0xffffU,
+        (b > a) ? RISKY_UNDERFLOW : 0x00U
+    );
+}
+
+static inline void execute_mlt(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    uint32_t a = read_register(
+        state, instruction->a, packed_b_flag(instruction)
+    );
+    uint32_t b = read_register(
+        state, instruction->b, packed_c_flag(instruction)
+    );
+    write_arithmetic_result(state, instruction, a * b, 0x00U);
+}
+
+static inline void execute_div(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    uint32_t a = read_register(
+        state, instruction->a, packed_b_flag(instruction)
+    );
+    uint32_t b = read_register(
+        state, instruction->b, packed_c_flag(instruction)
+    );
+    if(b == 0) {
+        write_arithmetic_result(state, instruction, 0, RISKY_DIVIDE_BY_ZERO);
+    } else {
+        write_arithmetic_result(state, instruction, a / b, 0x00U);
+    }
+}
+
+static inline void execute_mod(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    uint32_t a = read_register(
+        state, instruction->a, packed_b_flag(instruction)
+    );
+    uint32_t b = read_register(
+        state, instruction->b, packed_c_flag(instruction)
+    );
+    if(b == 0) {
+        write_arithmetic_result(state, instruction, 0, RISKY_DIVIDE_BY_ZERO);
+    } else {
+        write_arithmetic_result(state, instruction, a % b, 0x00U);
+    }
+}
+
+static inline void execute_inc(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    uint32_t a = read_register(
+        state, instruction->a, packed_b_flag(instruction)
+    );
+    write_arithmetic_result(state, instruction, a + 1, 0x00U);
+}
+
+static inline void execute_dec(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    uint32_t a = read_register(
+        state, instruction->a, packed_b_flag(instruction)
+    );
+    write_arithmetic_result(
+        state, instruction, (a - 1) & 0xffffU,
+        (a == 0) ? RISKY_UNDERFLOW : 0x00U
+    );
+}
+
+static inline void execute_qop(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    // flags a, b and c select which of the last operation flags to test for
+    risky_byte_t query = (risky_byte_t) (
+        (packed_a_flag(instruction) ? RISKY_OVERFLOW : 0x00U) |
+        (packed_b_flag(instruction) ? RISKY_UNDERFLOW : 0x00U) |
+        (packed_c_flag(instruction) ? RISKY_DIVIDE_BY_ZERO : 0x00U)
+    );
+    state->registers[instruction->r] = (state->operation_flags & query) != 0;
+}
+
+static inline void execute_eor(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    write_register(
+        state, instruction->r,
+        read_register(state, instruction->a, packed_b_flag(instruction)) |
+        read_register(state, instruction->b, packed_c_flag(instruction)),
+        packed_a_flag(instruction)
+    );
+}
+
+static inline void execute_and(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    write_register(
+        state, instruction->r,
+        read_register(state, instruction->a, packed_b_flag(instruction)) &
+        read_register(state, instruction->b, packed_c_flag(instruction)),
+        packed_a_flag(instruction)
+    );
+}
+
+static inline void execute_xor(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    write_register(
+        state, instruction->r,
+        read_register(state, instruction->a, packed_b_flag(instruction)) ^
+        read_register(state, instruction->b, packed_c_flag(instruction)),
+        packed_a_flag(instruction)
+    );
+}
+
+static inline void execute_not(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    write_register(
+        state, instruction->r,
+        ~(uint32_t) read_register(
+            state, instruction->a, packed_b_flag(instruction)
+        ),
+        packed_a_flag(instruction)
+    );
+}
+
+static inline void execute_lsh(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    uint32_t a = read_register(
+        state, instruction->a, packed_b_flag(instruction)
+    );
+    uint32_t b = read_register(
+        state, instruction->b, packed_c_flag(instruction)
+    );
+    write_register(
+        state, instruction->r, (b < 16) ? a << b : 0, packed_a_flag(instruction)
+    );
+}
+
+static inline void execute_rsh(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    uint32_t a = read_register(
+        state, instruction->a, packed_b_flag(instruction)
+    );
+    uint32_t b = read_register(
+        state, instruction->b, packed_c_flag(instruction)
+    );
+    write_register(
+        state, instruction->r, (b < 16) ? a >> b : 0, packed_a_flag(instruction)
+    );
+}
+
+// ROT rotates the bits of a value left by one place, within its width
+static inline void execute_rot(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    uint32_t width = packed_b_flag(instruction) ? 16 : 8;
+    uint32_t mask = packed_b_flag(instruction) ? 0xffffU : 0xffU;
+    uint32_t a = read_register(
+        state, instruction->a, packed_b_flag(instruction)
+    );
+    write_register(
+        state, instruction->r, ((a << 1) | (a >> (width - 1))) & mask,
+        packed_a_flag(instruction)
+    );
+}
+
+/*
+ * CAS cascades the top bit of a value down as it is shifted right, so vacated
+ * bits are filled with copies of the top bit rather than zeros
+ */
+static inline void execute_cas(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    uint32_t width = packed_b_flag(instruction) ? 16 : 8;
+    uint32_t a = read_register(
+        state, instruction->a, packed_b_flag(instruction)
+    );
+    uint32_t b = read_register(
+        state, instruction->b, packed_c_flag(instruction)
+    );
+    uint32_t fill = (a >> (width - 1)) ? (0xffffU << width) | a : a;
+    write_register(
+        state, instruction->r,
+        (b < width) ? fill >> b : ((a >> (width - 1)) ? 0xffffU : 0),
+        packed_a_flag(instruction)
+    );
+}
+
+// SET uses flag a to specify whether to set 16 bits of the literal or 8
+static inline void execute_set(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    write_register(
+        state, instruction->r, instruction->l, packed_a_flag(instruction)
+    );
+}
+
+static inline void execute_cop(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    write_register(
+        state, instruction->r,
+        read_register(state, instruction->a, packed_b_flag(instruction)),
+        packed_a_flag(instruction)
+    );
+}
+
+/*
+ * LOD reads one byte (or two big-endian bytes, if flag a is set) from the RAM
+ * address in register a into register r
+ */
+static inline void execute_lod(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    risky_ram_address_t address = read_register(
+        state, instruction->a, packed_b_flag(instruction)
+    );
+    uint32_t value = state->ram[address];
+    if(packed_a_flag(instruction)) {
+        value = (value << 8) | state->ram[(address + 1) % RISKY_RAM_AMOUNT];
+    }
+    write_register(state, instruction->r, value, packed_a_flag(instruction));
+}
+
+/*
+ * SAV writes one byte (or two big-endian bytes, if flag a is set) from
+ * register r to the RAM address in register a, invalidating any instructions
+ * that had been decoded from the bytes it overwrites
+ */
+static inline void execute_sav(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    risky_ram_address_t address = read_register(
+        state, instruction->a, packed_b_flag(instruction)
+    );
+    risky_register_t value = state->registers[instruction->r];
+    if(packed_a_flag(instruction)) {
+        state->ram[address] = (risky_ram_t) (value >> 8);
+        state->ram[(address + 1) % RISKY_RAM_AMOUNT] = (risky_ram_t) value;
+        invalidate_cached_instructions(state, address, 2);
+    } else {
+        state->ram[address] = (risky_ram_t) value;
+        invalidate_cached_instructions(state, address, 1);
+    }
+}
+
+// QDC stores the state of the channel numbered a in register r
+static inline void execute_qdc(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    state->registers[instruction->r] = state->channels[instruction->a];
+}
+
+/*
+ * CDC configures the channel numbered r, making it a write channel if a is
+ * non-zero (DC_WRITE) and activating it if b is non-zero (DC_ACTIVE)
+ */
+static inline void execute_cdc(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    state->channels[instruction->r] = (risky_byte_t) (
+        (instruction->a ? RISKY_CHANNEL_WRITE : 0x00U) |
+        (instruction->b ? RISKY_CHANNEL_ACTIVE : 0x00U)
+    );
+}
+
+/*
+ * REA reads one word from the channel numbered a into register r, from its
+ * ring buffer if it has one. Reading an inactive channel or a write channel
+ * gives zero. Returns false if the channel is an active read channel with no
+ * data ready, in which case the VM must stop and retry the instruction later.
+ */
+static inline bool execute_rea(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    if(state->channels[instruction->a] != RISKY_CHANNEL_ACTIVE) {
+        state->registers[instruction->r] = 0x0000U;
+        return true;
+    }
+    risky_channel_ring_t * ring = state->rings[instruction->a];
+    if(ring != NULL) {
+        return pop_risky_channel_ring(ring, &state->registers[instruction->r]);
+    }
+    if(state->channel_io.read == NULL) {
+        return false;
+    }
+    return state->channel_io.read(
+        state->channel_io.context, instruction->a,
+        &state->registers[instruction->r]
+    );
+}
+
+/*
+ * WRI writes the value of register a to the channel numbered r, if it is an
+ * active write channel, otherwise the value is discarded. A channel with a
+ * ring buffer takes the value with a single store into it. Returns false if
+ * that ring is full, in which case the VM must stop and retry the
+ * instruction once the host has drained it.
+ */
+static inline bool execute_wri(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction
+) {
+    if(
+        state->channels[instruction->r] !=
+        (RISKY_CHANNEL_ACTIVE | RISKY_CHANNEL_WRITE)
+    ) {
+        return true;
+    }
+    risky_channel_ring_t * ring = state->rings[instruction->r];
+    if(ring != NULL) {
+        return push_risky_channel_ring(
+            ring, state->registers[instruction->a]
+        );
+    }
+    if(state->channel_io.write != NULL) {
+        state->channel_io.write(
+            state->channel_io.context, instruction->r,
+            state->registers[instruction->a]
+        );
+    }
+    return true;
+}
+
+/*
+ * private function - fetches the decoded instruction at the given address,
+ * taking a fast path if it is already in the VM's instruction cache.
+ * Returns false and stores the error in result if it could not be fetched
+ */
+static inline bool fetch_next_instruction(
+    risky_vm_state_t * state, risky_ram_address_t address,
+    const risky_packed_instruction_t ** instruction, status_t * result
+) {
+    risky_instruction_cache_t * cache = state->cache;
+    size_t slot = address / RISKY_INSTRUCTION_SIZE;
+    if(
+        cache != NULL && (address % RISKY_INSTRUCTION_SIZE) == 0 &&
+        ((cache->valid[slot / 64] >> (slot % 64)) & 1U)
+    ) {
+        *instruction = &cache->instructions[slot];
+        return true;
+    }
+    risky_packed_instruction_t * decoded = NULL;
+    *result = fetch_instruction(state, address, &decoded);
+    *instruction = decoded;
+    return *result == STATUS_SUCCESS;
+}
+
+/*
+ * private function - executes the given instruction using a switch statement
+ * on its opcode, updating the program counter at the given address.
+ * Returns false if the VM must stop, having stored the reason why (or an
+ * error in result)
+ */
+EXECUTE_INLINE bool execute_instruction(
+    risky_vm_state_t * state, const risky_packed_instruction_t * instruction,
+    risky_ram_address_t * pc, risky_stop_reason_t * reason, status_t * result
+) {
+    switch(packed_opcode(instruction)) {
+        case NOP:
+            break;
+        case JMP:
+            *pc = state->registers[instruction->r];
+            return true;
+        case BRA:
+            if(
+                read_register(state, instruction->a, packed_a_flag(instruction))
+            ) {
+                *pc = state->registers[instruction->r];
+                return true;
+            }
+            break;
+        case HLT:
+            *reason = RISKY_STOP_HALTED;
+            return false;
+        case EQU: execute_equ(state, instruction); break;
+        case NEQ: execute_neq(state, instruction); break;
+        case GTN: execute_gtn(state, instruction); break;
+        case LTN: execute_ltn(state, instruction); break;
+        case ADD: execute_add(state, instruction); break;
+        case SUB: execute_sub(state, instruction); break;
+        case MLT: execute_mlt(state, instruction); break;
+        case DIV: execute_div(state, instruction); break;
+        case MOD: execute_mod(state, instruction); break;
+        case INC: execute_inc(state, instruction); break;
+        case DEC: execute_dec(state, instruction); break;
+        case QOP: execute_qop(state, instruction); break;
+        case EOR: execute_eor(state, instruction); break;
+        case AND: execute_and(state, instruction); break;
+        case XOR: execute_xor(state, instruction); break;
+        case NOT: execute_not(state, instruction); break;
+        case LSH: execute_lsh(state, instruction); break;
+        case RSH: execute_rsh(state, instruction); break;
+        case ROT: execute_rot(state, instruction); break;
+        case CAS: execute_cas(state, instruction); break;
+        case SET: execute_set(state, instruction); break;
+        case COP: execute_cop(state, instruction); break;
+        case LOD: execute_lod(state, instruction); break;
+        case SAV: execute_sav(state, instruction); break;
+        case QDC: execute_qdc(state, instruction); break;
+        case CDC: execute_cdc(state, instruction); break;
+        case REA:
+            if(!execute_rea(state, instruction)) {
+                *reason = RISKY_STOP_BLOCKED;
+                return false;
+            }
+            break;
+        case WRI:
+            if(!execute_wri(state, instruction)) {
+                *reason = RISKY_STOP_BLOCKED;
+                return false;
+            }
+            break;
+        // impossible to match none of the opcodes, but just in case
+        default:
+            *result = IMPOSSIBLE_CONDITION;
+            return false;
+    }
+    *pc += RISKY_INSTRUCTION_SIZE;
+    return true;
+}
+
+/*
+ * private function - the same as run_risky_vm_for(), but dispatching each
+ * instruction with a switch statement and counting them one at a time
+ */
+static status_t run_switch_for(
+    risky_vm_state_t * state, uint64_t budget, uint64_t * executed,
+    risky_stop_reason_t * reason
+) {
+    status_t result = STATUS_SUCCESS;
+    risky_ram_address_t pc = state->program_counter;
+    const risky_packed_instruction_t * instruction = NULL;
+    uint64_t count = 0;
+    *reason = RISKY_STOP_NONE;
+    while(
+        count < budget &&
+        fetch_next_instruction(state, pc, &instruction, &result) &&
+        execute_instruction(state, instruction, &pc, reason, &result)
+    ) {
+        count++;
+    }
+    if(*reason == RISKY_STOP_HALTED) {
+        count++;
+    } else if(count >= budget) {
+        *reason = RISKY_STOP_BUDGET;
+    }
+    state->program_counter = pc;
+    if(executed != NULL) {
+        *executed = count;
+    }
+    return result;
+}
+
+#ifdef RISKY_THREADED_DISPATCH
+// what run_threaded_for() does at each REA and QDC besides running it
+typedef enum channel_mode_t {
+    // nothing more
+    CHANNEL_LIVE,
+    // appends its result to a replay log
+    CHANNEL_RECORD,
+    // takes its result from a replay log instead of running it
+    CHANNEL_REPLAY,
+} channel_mode_t;
+
+/*
+ * private function - the same as run_risky_vm_for(), but dispatching each
+ * instruction by jumping straight from the handler of one instruction to the
+ * handler of the next. Unless the mode is CHANNEL_LIVE, every REA and QDC is
+ * recorded to or replayed from the given log, which only their handlers
+ * check, so every other instruction runs as fast as it does without a log
+ */
+static status_t run_threaded_for(
+    risky_vm_state_t * state, uint64_t budget, uint64_t * executed,
+    risky_stop_reason_t * reason, risky_replay_log_t * log,
+    channel_mode_t mode
+) {
+    /*
+     * handler label addresses, indexed by opcode plus 32 times the kind of
+     * instruction it is fused with. Pairs which are never fused are left NULL
+     */
+    static const void * const handlers[32 * RISKY_FUSED_KINDS] = {
+        &&do_nop, &&do_jmp, &&do_bra, &&do_hlt,
+        &&do_equ, &&do_neq, &&do_gtn, &&do_ltn,
+        &&do_add, &&do_sub, &&do_mlt, &&do_div,
+        &&do_mod, &&do_inc, &&do_dec, &&do_qop,
+        &&do_eor, &&do_and, &&do_xor, &&do_not,
+        &&do_lsh, &&do_rsh, &&do_rot, &&do_cas,
+        &&do_set, &&do_cop, &&do_lod, &&do_sav,
+        &&do_qdc, &&do_cdc, &&do_rea, &&do_wri,
+        [32 * RISKY_FUSED_BRA + EQU] = &&do_equ_bra,
+        [32 * RISKY_FUSED_BRA + NEQ] = &&do_neq_bra,
+        [32 * RISKY_FUSED_BRA + GTN] = &&do_gtn_bra,
+        [32 * RISKY_FUSED_BRA + LTN] = &&do_ltn_bra,
+        [32 * RISKY_FUSED_JMP + SET] = &&do_set_jmp,
+        [32 * RISKY_FUSED_EQU + INC] = &&do_inc_equ,
+        [32 * RISKY_FUSED_NEQ + INC] = &&do_inc_neq,
+        [32 * RISKY_FUSED_GTN + INC] = &&do_inc_gtn,
+        [32 * RISKY_FUSED_LTN + INC] = &&do_inc_ltn,
+        [32 * RISKY_FUSED_EQU + DEC] = &&do_dec_equ,
+        [32 * RISKY_FUSED_NEQ + DEC] = &&do_dec_neq,
+        [32 * RISKY_FUSED_GTN + DEC] = &&do_dec_gtn,
+        [32 * RISKY_FUSED_LTN + DEC] = &&do_dec_ltn,
+    };
+    status_t result = STATUS_SUCCESS;
+    risky_ram_address_t pc = state->program_counter;
+    const risky_packed_instruction_t * instruction = NULL;
+    /*
+     * instructions are counted a basic block at a time: only when control is
+     * transferred (or execution wraps around the end of RAM) are the
+     * instructions since the start of the block added to the count and the
+     * budget checked
+     */
+    risky_ram_address_t block = pc;
+    uint64_t count = 0;
+    *reason = RISKY_STOP_NONE;
+    // number of instructions in the current block before the one at pc
+    #define BLOCK_LENGTH() (\
+        (risky_ram_address_t) (pc - block) / RISKY_INSTRUCTION_SIZE\
+    )
+    /*
+     * ends the current block with the instruction at pc, starting the next at
+     * the given address, stopping if the budget has run out
+     */
+    #define END_BLOCK(next) do {\
+        count += BLOCK_LENGTH() + 1U;\
+        pc = (next);\
+        block = pc;\
+        if(count >= budget) {\
+            *reason = RISKY_STOP_BUDGET;\
+            goto stop;\
+        }\
+    } while(0)
+    /*
+     * every handler ends with its own copy of this indirect jump, so that the
+     * host's branch predictor can learn which handler follows which
+     */
+    #define DISPATCH() do {\
+        if(!fetch_next_instruction(state, pc, &instruction, &result)) {\
+            goto stop;\
+        }\
+        goto *handlers[\
+            packed_opcode(instruction) + 32U * instruction->fused\
+        ];\
+    } while(0)
+    // move on to the next instruction in sequence
+    #define NEXT() do {\
+        if(pc >= RISKY_RAM_AMOUNT - RISKY_INSTRUCTION_SIZE) {\
+            END_BLOCK((risky_ram_address_t) (pc + RISKY_INSTRUCTION_SIZE));\
+        } else {\
+            pc += RISKY_INSTRUCTION_SIZE;\
+        }\
+        DISPATCH();\
+    } while(0)
+    // execute a simple instruction handled by one of the execute_ functions
+    #define HANDLER(label, function) label: function(state, instruction); NEXT()
+    /*
+     * execute the first instruction of a fused pair, then go straight to the
+     * handler of the second, which is always in the next slot of the cache.
+     * The last slot is never fused, so pc can't wrap around here
+     */
+    #define FUSED(label, function, second) label:\
+        function(state, instruction);\
+        instruction++;\
+        pc += RISKY_INSTRUCTION_SIZE;\
+        goto second
+
+    if(budget == 0) {
+        *reason = RISKY_STOP_BUDGET;
+        goto stop;
+    }
+    DISPATCH();
+do_nop:
+    NEXT();
+do_jmp:
+    END_BLOCK(state->registers[instruction->r]);
+    DISPATCH();
+do_bra:
+    if(read_register(state, instruction->a, packed_a_flag(instruction))) {
+        END_BLOCK(state->registers[instruction->r]);
+    } else {
+        END_BLOCK((risky_ram_address_t) (pc + RISKY_INSTRUCTION_SIZE));
+    }
+    DISPATCH();
+do_hlt:
+    *reason = RISKY_STOP_HALTED;
+    // the HLT itself counts as executed
+    count++;
+    goto stop;
+HANDLER(do_equ, execute_equ);
+HANDLER(do_neq, execute_neq);
+HANDLER(do_gtn, execute_gtn);
+HANDLER(do_ltn, execute_ltn);
+HANDLER(do_add, execute_add);
+HANDLER(do_sub, execute_sub);
+HANDLER(do_mlt, execute_mlt);
+HANDLER(do_div, execute_div);
+HANDLER(do_mod, execute_mod);
+HANDLER(do_inc, execute_inc);
+HANDLER(do_dec, execute_dec);
+HANDLER(do_qop, execute_qop);
+HANDLER(do_eor, execute_eor);
+HANDLER(do_and, execute_and);
+HANDLER(do_xor, execute_xor);
+HANDLER(do_not, execute_not);
+HANDLER(do_lsh, execute_lsh);
+HANDLER(do_rsh, execute_rsh);
+HANDLER(do_rot, execute_rot);
+HANDLER(do_cas, execute_cas);
+HANDLER(do_set, execute_set);
+HANDLER(do_cop, execute_cop);
+HANDLER(do_lod, execute_lod);
+HANDLER(do_sav, execute_sav);
+HANDLER(do_cdc, execute_cdc);
+FUSED(do_equ_bra, execute_equ, do_bra);
+FUSED(do_neq_bra, execute_neq, do_bra);
+FUSED(do_gtn_bra, execute_gtn, do_bra);
+FUSED(do_ltn_bra, execute_ltn, do_bra);
+FUSED(do_set_jmp, execute_set, do_jmp);
+FUSED(do_inc_equ, execute_inc, do_equ);
+FUSED(do_inc_neq, execute_inc, do_neq);
+FUSED(do_inc_gtn, execute_inc, do_gtn);
+FUSED(do_inc_ltn, execute_inc, do_ltn);
+FUSED(do_dec_equ, execute_dec, do_equ);
+FUSED(do_dec_neq, execute_dec, do_neq);
+FUSED(do_dec_gtn, execute_dec, do_gtn);
+FUSED(do_dec_ltn, execute_dec, do_ltn);
+do_qdc:
+    if(mode == CHANNEL_REPLAY) {
+        goto replay_channel;
+    }
+    execute_qdc(state, instruction);
+    if(mode == CHANNEL_RECORD) {
+        goto record_channel;
+    }
+    NEXT();
+do_rea:
+    if(mode == CHANNEL_REPLAY) {
+        goto replay_channel;
+    }
+    if(!execute_rea(state, instruction)) {
+        *reason = RISKY_STOP_BLOCKED;
+        goto stop;
+    }
+    if(mode == CHANNEL_RECORD) {
+        goto record_channel;
+    }
+    NEXT();
+do_wri:
+    if(!execute_wri(state, instruction)) {
+        *reason = RISKY_STOP_BLOCKED;
+        goto stop;
+    }
+    NEXT();
+record_channel: {
+        risky_replay_event_t event = {
+            .count = log->executed + count + BLOCK_LENGTH(),
+            .opcode = packed_opcode(instruction), .channel = instruction->a,
+            .value = state->registers[instruction->r],
+        };
+        result = append_risky_replay_event(log, &event);
+        if(result != STATUS_SUCCESS) {
+            // it has still been executed, so stop after it
+            END_BLOCK((risky_ram_address_t) (pc + RISKY_INSTRUCTION_SIZE));
+            goto stop;
+        }
+    }
+    NEXT();
+replay_channel: {
+        // the recording ended here, just as if the input had run out
+        if(log->position == log->size) {
+            *reason = RISKY_STOP_BLOCKED;
+            goto stop;
+        }
+        risky_replay_event_t event;
+        result = next_risky_replay_event(log, &event);
+        // anything else means the run has diverged from the recording
+        if(
+            result != STATUS_SUCCESS ||
+            event.count != log->executed + count + BLOCK_LENGTH() ||
+            event.opcode != packed_opcode(instruction) ||
+            event.channel != instruction->a
+        ) {
+            result = STATUS_FAIL;
+            goto stop;
+        }
+        state->registers[instruction->r] = event.value;
+    }
+    NEXT();
+stop:
+    // count the rest of the block, up to the instruction which stopped it
+    count += BLOCK_LENGTH();
+    state->program_counter = pc;
+    if(executed != NULL) {
+        *executed = count;
+    }
+    return result;
+
+    #undef FUSED
+    #undef HANDLER
+    #undef NEXT
+    #undef DISPATCH
+    #undef END_BLOCK
+    #undef BLOCK_LENGTH
+}
+#endif
+
+/*
+ * the same as run_risky_vm(), but always uses a portable switch statement to
+ * dispatch each instruction. run_risky_vm() uses this when the compiler does
+ * not support taking the address of labels.
+ * Returns a status_t with error / success information
+ */
+status_t run_risky_vm_switch(
+    risky_vm_state_t * state, risky_stop_reason_t * reason
+) {
+    return run_switch_for(state, UINT64_MAX, NULL, reason);
+}
+
+/*
+ * the same as run_risky_vm(), but also adds every instruction executed to the
+ * counts in the given risky_profile_t.
+ * Returns a status_t with error / success information
+ */
+status_t run_risky_vm_profiled(
+    risky_vm_state_t * state, risky_profile_t * profile,
+    risky_stop_reason_t * reason
+) {
+    status_t result = STATUS_SUCCESS;
+    risky_ram_address_t pc = state->program_counter;
+    const risky_packed_instruction_t * instruction = NULL;
+    uint64_t * counts = profile->counts;
+    uint64_t * entries = profile->entries;
+    *reason = RISKY_STOP_NONE;
+    // the very first instruction run is where execution entered the program
+    if(profile->total == 0) {
+        entries[pc]++;
+    }
+    while(fetch_next_instruction(state, pc, &instruction, &result)) {
+        risky_ram_address_t address = pc;
+        // executing it may overwrite the instruction, so look at it first
+        risky_opcode_t opcode = packed_opcode(instruction);
+        bool running = execute_instruction(
+            state, instruction, &pc, reason, &result
+        );
+        if(running || *reason == RISKY_STOP_HALTED) {
+            counts[address]++;
+            profile->opcodes[opcode]++;
+            profile->total++;
+        }
+        if(!running) {
+            break;
+        }
+        if(pc != (risky_ram_address_t) (address + RISKY_INSTRUCTION_SIZE)) {
+            entries[pc]++;
+        }
+    }
+    state->program_counter = pc;
+    return result;
+}
+
+/*
+ * the opcodes of the instructions which write to their register r, as bits
+ * of a mask: EQU to CAS, SET, COP, LOD, QDC and REA
+ */
+#define TRACE_WRITERS (\
+    0x00fffff0UL | (1UL << SET) | (1UL << COP) | (1UL << LOD) |\
+    (1UL << QDC) | (1UL << REA)\
+)
+
+/*
+ * the same as run_risky_vm(), but also appends a record of every instruction
+ * executed to the given risky_trace_t.
+ * Returns a status_t with error / success information
+ */
+status_t run_risky_vm_traced(
+    risky_vm_state_t * state, risky_trace_t * trace,
+    risky_stop_reason_t * reason
+) {
+    status_t result = STATUS_SUCCESS;
+    risky_ram_address_t pc = state->program_counter;
+    const risky_packed_instruction_t * instruction = NULL;
+    /*
+     * the ring is filled in through local copies of its position and of how
+     * far it can go before it is full, so that storing the bytes of each
+     * record doesn't make the compiler reload them every time
+     */
+    risky_trace_record_t * records = trace->records;
+    size_t head = trace->head;
+    size_t limit = wait_for_risky_trace(trace);
+    *reason = RISKY_STOP_NONE;
+    while(fetch_next_instruction(state, pc, &instruction, &result)) {
+        if(head == limit) {
+            publish_risky_trace(trace, head);
+            limit = wait_for_risky_trace(trace);
+        }
+        risky_trace_record_t * record =
+            &records[head & (RISKY_TRACE_RING_SIZE - 1)];
+        // executing it may overwrite the instruction, so look at it first
+        record->address[0] = (risky_byte_t) (pc >> 8);
+        record->address[1] = (risky_byte_t) pc;
+        if(pc <= RISKY_RAM_AMOUNT - RISKY_INSTRUCTION_SIZE) {
+            memcpy(record->raw, &state->ram[pc], RISKY_INSTRUCTION_SIZE);
+        } else {
+            for(size_t i = 0; i < RISKY_INSTRUCTION_SIZE; i++) {
+                record->raw[i] = state->ram[(pc + i) % RISKY_RAM_AMOUNT];
+            }
+        }
+        risky_byte_t destination = instruction->r;
+        bool writes = (TRACE_WRITERS >> packed_opcode(instruction)) & 1U;
+        bool running = execute_instruction(
+            state, instruction, &pc, reason, &result
+        );
+        // a blocked REA or WRI will be recorded once it is retried
+        if(running || *reason == RISKY_STOP_HALTED) {
+            risky_register_t value = state->registers[destination];
+            record->destination = destination;
+            record->flags = writes ? RISKY_TRACE_WROTE_REGISTER : 0x00U;
+            record->value[0] = (risky_byte_t) (value >> 8);
+            record->value[1] = (risky_byte_t) value;
+            head++;
+            if(head % RISKY_TRACE_BATCH == 0) {
+                publish_risky_trace(trace, head);
+            }
+        }
+        if(!running) {
+            break;
+        }
+    }
+    publish_risky_trace(trace, head);
+    state->program_counter = pc;
+    return result;
+}
+
+/*
+ * the same as run_risky_vm(), but also appends the result of every REA and QDC
+ * instruction executed to the given risky_replay_log_t.
+ * Returns a status_t with error / success information
+ */
+status_t run_risky_vm_recorded(
+    risky_vm_state_t * state, risky_replay_log_t * log,
+    risky_stop_reason_t * reason
+) {
+#ifdef RISKY_THREADED_DISPATCH
+    uint64_t executed = 0;
+    status_t result = run_threaded_for(
+        state, UINT64_MAX, &executed, reason, log, CHANNEL_RECORD
+    );
+    log->executed += executed;
+    return result;
+#else
+    status_t result = STATUS_SUCCESS;
+    risky_ram_address_t pc = state->program_counter;
+    const risky_packed_instruction_t * instruction = NULL;
+    uint64_t count = log->executed;
+    *reason = RISKY_STOP_NONE;
+    while(fetch_next_instruction(state, pc, &instruction, &result)) {
+        risky_replay_event_t event = {
+            .count = count, .opcode = packed_opcode(instruction),
+            .channel = instruction->a, .value = 0,
+        };
+        risky_byte_t destination = instruction->r;
+        if(!execute_instruction(state, instruction, &pc, reason, &result)) {
+            if(*reason == RISKY_STOP_HALTED) {
+                count++;
+            }
+            break;
+        }
+        count++;
+        if(event.opcode == REA || event.opcode == QDC) {
+            event.value = state->registers[destination];
+            result = append_risky_replay_event(log, &event);
+            if(result != STATUS_SUCCESS) {
+                break;
+            }
+        }
+    }
+    log->executed = count;
+    state->program_counter = pc;
+    return result;
+#endif
+}
+
+/*
+ * the same as run_risky_vm(), but every REA and QDC instruction takes its
+ * result from the next event in the given risky_replay_log_t.
+ * Returns a status_t with error / success information
+ */
+status_t run_risky_vm_replayed(
+    risky_vm_state_t * state, risky_replay_log_t * log,
+    risky_stop_reason_t * reason
+) {
+#ifdef RISKY_THREADED_DISPATCH
+    uint64_t executed = 0;
+    status_t result = run_threaded_for(
+        state, UINT64_MAX, &executed, reason, log, CHANNEL_REPLAY
+    );
+    log->executed += executed;
+    return result;
+#else
+    status_t result = STATUS_SUCCESS;
+    risky_ram_address_t pc = state->program_counter;
+    const risky_packed_instruction_t * instruction = NULL;
+    uint64_t count = log->executed;
+    *reason = RISKY_STOP_NONE;
+    while(fetch_next_instruction(state, pc, &instruction, &result)) {
+        risky_opcode_t opcode = packed_opcode(instruction);
+        if(opcode == REA || opcode == QDC) {
+            // the recording ended here, just as if the input had run out
+            if(log->position == log->size) {
+                *reason = RISKY_STOP_BLOCKED;
+                break;
+            }
+            risky_replay_event_t event;
+            result = next_risky_replay_event(log, &event);
+            // anything else means the run has diverged from the recording
+            if(
+                result != STATUS_SUCCESS || event.count != count ||
+                event.opcode != opcode || event.channel != instruction->a
+            ) {
+                result = STATUS_FAIL;
+                break;
+            }
+            state->registers[instruction->r] = event.value;
+            pc += RISKY_INSTRUCTION_SIZE;
+        } else if(
+            !execute_instruction(state, instruction, &pc, reason, &result)
+        ) {
+            if(*reason == RISKY_STOP_HALTED) {
+                count++;
+            }
+            break;
+        }
+        count++;
+    }
+    log->executed = count;
+    state->program_counter = pc;
+    return result;
+#endif
+}
+
+/*
+ * given a pointer to a risky_vm_state_t and a pointer to a
+ * risky_stop_reason_t, execute exactly one instruction at the VM's program
+ * counter, storing the reason why the VM stopped if the instruction caused it
+ * to (RISKY_STOP_NONE otherwise).
+ * Returns a status_t with error / success information
+ */
+status_t step_risky_vm(risky_vm_state_t * state, risky_stop_reason_t * reason) {
+    status_t result = STATUS_SUCCESS;
+    risky_ram_address_t pc = state->program_counter;
+    const risky_packed_instruction_t * instruction = NULL;
+    *reason = RISKY_STOP_NONE;
+    if(fetch_next_instruction(state, pc, &instruction, &result)) {
+        execute_instruction(state, instruction, &pc, reason, &result);
+    }
+    state->program_counter = pc;
+    return result;
+}
+
+/*
+ * given a pointer to a risky_vm_state_t and a pointer to a
+ * risky_stop_reason_t, execute instructions starting at the VM's program
+ * counter until it stops, then store the reason why it stopped.
+ * the program counter is left pointing at the instruction that caused the VM
+ * to stop, so calling this again resumes execution (retrying a blocked REA or
+ * WRI).
+ * when compiled with GCC or Clang, this uses direct-threaded dispatch, where
+ * each instruction handler jumps straight to the handler of the next one, and
+ * the pairs of instructions fused in the instruction cache are run with one
+ * dispatch between them.
+ * Returns a status_t with error / success information
+ */
+status_t run_risky_vm(risky_vm_state_t * state, risky_stop_reason_t * reason) {
+    return run_risky_vm_for(state, UINT64_MAX, NULL, reason);
+}
+
+/*
+ * given a pointer to a risky_vm_state_t, a budget of instructions, a pointer
+ * to a uint64_t (or NULL) and a pointer to a risky_stop_reason_t, execute
+ * instructions starting at the VM's program counter until it stops or has
+ * used up the budget, then store the number executed and why it stopped.
+ * Returns a status_t with error / success information
+ */
+status_t run_risky_vm_for(
+    risky_vm_state_t * state, uint64_t budget, uint64_t * executed,
+    risky_stop_reason_t * reason
+) {
+#ifndef RISKY_THREADED_DISPATCH
+    return run_switch_for(state, budget, executed, reason);
+#else
+    return run_threaded_for(
+        state, budget, executed, reason, NULL, CHANNEL_LIVE
+    );
+#endif
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,163 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * interpreter - this compilation unit defines functions for executing the
+ * instructions in the RAM of a RISKY virtual machine.
+ */
+#ifndef SAXBOPHONE_RISKY_INTERPRETER_H
+#define SAXBOPHONE_RISKY_INTERPRETER_H
+
+#include <stdint.h>
+
+#include "core.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// counts of the instructions a VM executed, defined in the profile module
+struct risky_profile_t;
+// a binary execution trace being written, defined in the trace module
+struct risky_trace_t;
+// a log of the data channel input of a VM, defined in the replay module
+struct risky_replay_log_t;
+
+// reasons for which a running VM may stop executing instructions
+typedef enum risky_stop_reason_t {
+    RISKY_STOP_NONE = 0,
+    // a HLT instruction was executed
+    RISKY_STOP_HALTED,
+    /*
+     * a REA instruction was executed on an active channel with no data ready,
+     * or a WRI on a channel whose ring buffer is full
+     */
+    RISKY_STOP_BLOCKED,
+    // the budget of instructions given to run_risky_vm_for() was used up
+    RISKY_STOP_BUDGET,
+} risky_stop_reason_t;
+
+/*
+ * given a pointer to a risky_vm_state_t and a pointer to a
+ * risky_stop_reason_t, execute instructions starting at the VM's program
+ * counter until it stops, then store the reason why it stopped.
+ * the program counter is left pointing at the instruction that caused the VM
+ * to stop, so calling this again resumes execution (retrying a blocked REA or
+ * WRI).
+ * when compiled with GCC or Clang, this uses direct-threaded dispatch, where
+ * each instruction handler jumps straight to the handler of the next one, and
+ * the pairs of instructions fused in the instruction cache are run with one
+ * dispatch between them.
+ * Returns a status_t with error / success information
+ */
+status_t run_risky_vm(risky_vm_state_t * state, risky_stop_reason_t * reason);
+
+/*
+ * given a pointer to a risky_vm_state_t, a budget of instructions, a pointer
+ * to a uint64_t (or NULL) and a pointer to a risky_stop_reason_t, execute
+ * instructions starting at the VM's program counter until it stops as with
+ * run_risky_vm(), or until it has executed at least the budgeted number of
+ * instructions (RISKY_STOP_BUDGET). The number of instructions executed is
+ * stored in the uint64_t, if given, counting a HLT but not a blocked REA or
+ * WRI.
+ * Everything needed to carry on is kept in the VM state, so calling this (or
+ * run_risky_vm()) again resumes exactly where it stopped. With direct-threaded
+ * dispatch, instructions are counted a basic block at a time and the budget
+ * is only checked at the end of each block (a JMP or BRA, or wrapping around
+ * the end of RAM), so it may be overrun by the rest of the block it runs out
+ * in. That keeps the cost of the budget out of all other instructions.
+ * Returns a status_t with error / success information
+ */
+status_t run_risky_vm_for(
+    risky_vm_state_t * state, uint64_t budget, uint64_t * executed,
+    risky_stop_reason_t * reason
+);
+
+/*
+ * the same as run_risky_vm(), but always uses a portable switch statement to
+ * dispatch each instruction. run_risky_vm() uses this when the compiler does
+ * not support taking the address of labels.
+ * Returns a status_t with error / success information
+ */
+status_t run_risky_vm_switch(
+    risky_vm_state_t * state, risky_stop_reason_t * reason
+);
+
+/*
+ * the same as run_risky_vm(), but also adds every instruction executed to the
+ * counts in the given risky_profile_t (which must have been initialised with
+ * init_risky_profile()), per address and per opcode. A blocked REA or WRI
+ * isn't counted until it is retried successfully.
+ * This is a separate copy of the switch interpreter, so that collecting a
+ * profile costs nothing at all when no profile is being collected.
+ * Returns a status_t with error / success information
+ */
+status_t run_risky_vm_profiled(
+    risky_vm_state_t * state, struct risky_profile_t * profile,
+    risky_stop_reason_t * reason
+);
+
+/*
+ * the same as run_risky_vm(), but also appends a record of every instruction
+ * executed to the given risky_trace_t (which must have been opened with
+ * open_risky_trace()): its address and raw bytes, and the register it wrote
+ * with its new value. A blocked REA or WRI isn't recorded until it is retried
+ * successfully. Like run_risky_vm_profiled(), this is a separate copy of the
+ * switch interpreter, so tracing costs nothing when it is off.
+ * Returns a status_t with error / success information
+ */
+status_t run_risky_vm_traced(
+    risky_vm_state_t * state, struct risky_trace_t * trace,
+    risky_stop_reason_t * reason
+);
+
+/*
+ * the same as run_risky_vm(), but also appends the result of every REA and QDC
+ * instruction executed to the given risky_replay_log_t (which must have been
+ * initialised with init_risky_replay_log()), with the number of instructions
+ * executed before it by this and earlier runs recording to the same log. A
+ * blocked REA isn't recorded until it is retried successfully.
+ * Returns a status_t with error / success information
+ */
+status_t run_risky_vm_recorded(
+    risky_vm_state_t * state, struct risky_replay_log_t * log,
+    risky_stop_reason_t * reason
+);
+
+/*
+ * the same as run_risky_vm(), but instead of reading its channels every REA
+ * and QDC instruction takes its result from the next event in the given
+ * risky_replay_log_t, so that a VM started in the same state as the recorded
+ * one repeats the recorded run exactly. Other instructions, including WRI,
+ * run as normal, and only REA and QDC cost anything more.
+ * If the log runs out, the VM stops with RISKY_STOP_BLOCKED just as the
+ * recorded one would have without more input. If an event isn't for the
+ * instruction being replayed at the same instruction count, the run has
+ * diverged from the recording, and this fails.
+ * Returns a status_t with error / success information
+ */
+status_t run_risky_vm_replayed(
+    risky_vm_state_t * state, struct risky_replay_log_t * log,
+    risky_stop_reason_t * reason
+);
+
+/*
+ * given a pointer to a risky_vm_state_t and a pointer to a
+ * risky_stop_reason_t, execute exactly one instruction at the VM's program
+ * counter, storing the reason why the VM stopped if the instruction caused it
+ * to (RISKY_STOP_NONE otherwise).
+ * Returns a status_t with error / success information
+ */
+status_t step_risky_vm(risky_vm_state_t * state, risky_stop_reason_t * reason);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+// end of header file
+#endif
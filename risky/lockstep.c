@@ -0,0 +1,593 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * lockstep - this compilation unit defines an engine which runs many RISKY
+ * virtual machines holding the same program together, executing each
+ * instruction for every VM at that point in the program at once with SIMD.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "core.h"
+#include "interpreter.h"
+#include "lockstep.h"
+#include "packed.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * the vectorised engine uses GCC vector extensions (and needs
+ * __builtin_convertvector, from GCC 9). Other compilers step every VM with
+ * the interpreter instead, which gives the same results much more slowly
+ */
+#if defined(__GNUC__) && (__GNUC__ >= 9 || defined(__clang__)) && \
+    !defined(RISKY_NO_LOCKSTEP_SIMD)
+#define RISKY_LOCKSTEP_SIMD
+#endif
+
+/*
+ * private function - marks the instruction slots covering the given range of
+ * RAM as modified, so that they are no longer executed in lockstep
+ */
+static void mark_modified(
+    risky_lockstep_t * engine, risky_ram_address_t address, size_t length
+) {
+    for(size_t i = 0; i < length; i++) {
+        size_t slot = (
+            (address + i) % RISKY_RAM_AMOUNT
+        ) / RISKY_INSTRUCTION_SIZE;
+        engine->modified[slot / 64] |= (uint64_t) 1U << (slot % 64);
+    }
+}
+
+/*
+ * private function - returns whether any VM has written to the instruction
+ * at the given address during the current run
+ */
+static bool is_modified(risky_lockstep_t * engine, risky_ram_address_t pc) {
+    size_t first = pc / RISKY_INSTRUCTION_SIZE;
+    size_t last = (
+        (pc + RISKY_INSTRUCTION_SIZE - 1) % RISKY_RAM_AMOUNT
+    ) / RISKY_INSTRUCTION_SIZE;
+    return (
+        ((engine->modified[first / 64] >> (first % 64)) & 1U) ||
+        ((engine->modified[last / 64] >> (last % 64)) & 1U)
+    );
+}
+
+/*
+ * private function - executes the instruction at the program counter of one
+ * VM with the interpreter, using the VM's own copy of the program. Only the
+ * registers that the instruction uses are copied to and from the VM.
+ * Returns a status_t with error / success information
+ */
+static status_t step_lane(
+    risky_lockstep_t * engine, size_t lane, size_t * remaining
+) {
+    risky_vm_state_t * state = engine->states[lane];
+    size_t stride = engine->stride;
+    risky_packed_instruction_t * instruction = NULL;
+    risky_ram_address_t pc = engine->program_counters[lane];
+    status_t result = fetch_instruction(state, pc, &instruction);
+    if(result != STATUS_SUCCESS) {
+        return result;
+    }
+    // copy what's needed, as stepping may invalidate the instruction
+    risky_packed_instruction_t copy = *instruction;
+    state->registers[copy.a] = engine->registers[copy.a * stride + lane];
+    state->registers[copy.b] = engine->registers[copy.b * stride + lane];
+    state->registers[copy.r] = engine->registers[copy.r * stride + lane];
+    state->program_counter = pc;
+    state->operation_flags = (risky_byte_t) engine->operation_flags[lane];
+    risky_ram_address_t address = packed_b_flag(&copy) ?
+        state->registers[copy.a] : state->registers[copy.a] & 0xffU;
+    risky_stop_reason_t reason = RISKY_STOP_NONE;
+    result = step_risky_vm(state, &reason);
+    if(result != STATUS_SUCCESS) {
+        return result;
+    }
+    engine->registers[copy.r * stride + lane] = state->registers[copy.r];
+    engine->program_counters[lane] = state->program_counter;
+    engine->operation_flags[lane] = state->operation_flags;
+    if(packed_opcode(&copy) == SAV) {
+        mark_modified(engine, address, packed_a_flag(&copy) ? 2 : 1);
+    }
+    if(reason != RISKY_STOP_NONE) {
+        engine->running[lane] = 0x0000U;
+        engine->reasons[lane] = reason;
+        (*remaining)--;
+    }
+    return STATUS_SUCCESS;
+}
+
+/*
+ * private function - steps every running VM whose program counter is at the
+ * given address, one at a time.
+ * Returns a status_t with error / success information
+ */
+static status_t step_group(
+    risky_lockstep_t * engine, risky_ram_address_t pc, size_t * remaining
+) {
+    for(size_t lane = 0; lane < engine->count; lane++) {
+        if(engine->running[lane] && engine->program_counters[lane] == pc) {
+            status_t result = step_lane(engine, lane, remaining);
+            if(result != STATUS_SUCCESS) {
+                return result;
+            }
+        }
+    }
+    return STATUS_SUCCESS;
+}
+
+/*
+ * private function - returns the index of the first running VM whose program
+ * counter is at the given address (there must be one)
+ */
+static size_t first_in_group(
+    risky_lockstep_t * engine, risky_ram_address_t pc
+) {
+    size_t lane = 0;
+    while(!engine->running[lane] || engine->program_counters[lane] != pc) {
+        lane++;
+    }
+    return lane;
+}
+
+#ifdef RISKY_LOCKSTEP_SIMD
+// one register (or program counter, or flags) of a vector's worth of VMs
+typedef risky_word_t lanes_t __attribute__((
+    vector_size(RISKY_LOCKSTEP_LANE_WIDTH * sizeof(risky_word_t))
+));
+// the same, widened to 32 bits to find out whether arithmetic overflows
+typedef uint32_t wide_lanes_t __attribute__((
+    vector_size(RISKY_LOCKSTEP_LANE_WIDTH * sizeof(uint32_t))
+));
+
+/*
+ * forces the vector helpers to be compiled for each caller's instruction set.
+ * As they are always inlined, the warnings about how vectors would be passed
+ * between functions don't apply
+ */
+#define LANES_INLINE static inline __attribute__((always_inline))
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+LANES_INLINE lanes_t load_lanes(const risky_word_t * source) {
+    lanes_t lanes;
+    memcpy(&lanes, source, sizeof(lanes));
+    return lanes;
+}
+
+LANES_INLINE void store_lanes(risky_word_t * destination, lanes_t lanes) {
+    memcpy(destination, &lanes, sizeof(lanes));
+}
+
+// returns the lanes of chosen where mask is set and otherwise where it isn't
+LANES_INLINE lanes_t select_lanes(
+    lanes_t mask, lanes_t chosen, lanes_t otherwise
+) {
+    return (mask & chosen) | (~mask & otherwise);
+}
+
+LANES_INLINE bool lanes_empty(lanes_t mask) {
+    uint64_t parts[sizeof(lanes_t) / sizeof(uint64_t)];
+    memcpy(parts, &mask, sizeof(parts));
+    uint64_t any = 0;
+    for(size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) {
+        any |= parts[i];
+    }
+    return any == 0;
+}
+
+LANES_INLINE wide_lanes_t widen_lanes(lanes_t lanes) {
+    return __builtin_convertvector(lanes, wide_lanes_t);
+}
+
+LANES_INLINE lanes_t narrow_lanes(wide_lanes_t lanes) {
+    return __builtin_convertvector(lanes, lanes_t);
+}
+
+/*
+ * stores the result of an arithmetic operation in register r of the masked
+ * lanes and updates their operation flags, the same way as the interpreter
+ */
+LANES_INLINE void write_arithmetic_lanes(
+    risky_word_t * r, risky_word_t * flags, lanes_t mask, lanes_t width,
+    wide_lanes_t value, lanes_t underflow
+) {
+    lanes_t overflow = narrow_lanes(
+        (wide_lanes_t) (value > widen_lanes(width))
+    ) & ~underflow;
+    lanes_t raised = (
+        (underflow & RISKY_UNDERFLOW) | (overflow & RISKY_OVERFLOW)
+    );
+    store_lanes(
+        r, select_lanes(mask, narrow_lanes(value) & width, load_lanes(r))
+    );
+    store_lanes(flags, select_lanes(mask, raised, load_lanes(flags)));
+}
+
+// returns whether the given opcode is executed with vector operations
+static bool is_vectorised(risky_opcode_t opcode) {
+    switch(opcode) {
+        case DIV: case MOD: case ROT: case CAS:
+        case LOD: case SAV: case QDC: case CDC: case REA: case WRI:
+            return false;
+        default:
+            return true;
+    }
+}
+
+/*
+ * executes the given instruction with vector operations, for every running VM
+ * whose program counter is at the given address. Returns whether all of those
+ * VMs moved on to the same address, storing it in next_pc if so
+ */
+LANES_INLINE bool execute_lanes(
+    risky_lockstep_t * engine, const risky_packed_instruction_t * instruction,
+    risky_ram_address_t pc, size_t * remaining, risky_ram_address_t * next_pc
+) {
+    const lanes_t zero = { 0 };
+    const lanes_t one = zero + 1;
+    size_t stride = engine->stride;
+    risky_opcode_t opcode = packed_opcode(instruction);
+    /*
+     * flag a is the width of register r (or of register a for BRA), flags b
+     * and c are the widths of registers a and b
+     */
+    lanes_t width_r = zero + (risky_word_t) (
+        packed_a_flag(instruction) ? 0xffffU : 0xffU
+    );
+    lanes_t width_a = zero + (risky_word_t) (
+        packed_b_flag(instruction) ? 0xffffU : 0xffU
+    );
+    lanes_t width_b = zero + (risky_word_t) (
+        packed_c_flag(instruction) ? 0xffffU : 0xffU
+    );
+    risky_byte_t query = instruction->operation & 0x07U;
+    risky_word_t * r = &engine->registers[instruction->r * stride];
+    risky_word_t * a = &engine->registers[instruction->a * stride];
+    risky_word_t * b = &engine->registers[instruction->b * stride];
+    // the range of addresses the VMs move on to
+    lanes_t lowest = ~zero;
+    lanes_t highest = zero;
+    for(size_t i = 0; i < stride; i += RISKY_LOCKSTEP_LANE_WIDTH) {
+        lanes_t pcs = load_lanes(&engine->program_counters[i]);
+        lanes_t mask = (lanes_t) (pcs == pc) & load_lanes(&engine->running[i]);
+        if(lanes_empty(mask)) {
+            continue;
+        }
+        lanes_t x = load_lanes(&a[i]) & width_a;
+        lanes_t y = load_lanes(&b[i]) & width_b;
+        lanes_t next = zero + (risky_word_t) (pc + RISKY_INSTRUCTION_SIZE);
+        lanes_t result = zero;
+        bool writes_r = true;
+        switch(opcode) {
+            case NOP:
+                writes_r = false;
+                break;
+            case JMP:
+                next = load_lanes(&r[i]);
+                writes_r = false;
+                break;
+            case BRA: {
+                lanes_t taken = (lanes_t) ((load_lanes(&a[i]) & width_r) != 0);
+                next = select_lanes(taken, load_lanes(&r[i]), next);
+                writes_r = false;
+                break;
+            }
+            case HLT:
+                // halted VMs stop with their program counter on the HLT
+                store_lanes(
+                    &engine->running[i], load_lanes(&engine->running[i]) & ~mask
+                );
+                for(size_t j = 0; j < RISKY_LOCKSTEP_LANE_WIDTH; j++) {
+                    if(mask[j]) {
+                        engine->reasons[i + j] = RISKY_STOP_HALTED;
+                        (*remaining)--;
+                    }
+                }
+                continue;
+            case EQU: result = (lanes_t) (x == y) & one; break;
+            case NEQ: result = (lanes_t) (x != y) & one; break;
+            case GTN: result = (lanes_t) (x > y) & one; break;
+            case LTN: result = (lanes_t) (x < y) & one; break;
+            case ADD:
+                write_arithmetic_lanes(
+                    &r[i], &engine->operation_flags[i], mask, width_r,
+                    widen_lanes(x) + widen_lanes(y), zero
+                );
+                writes_r = false;
+                break;
+            case SUB:
+                write_arithmetic_lanes(
+                    &r[i], &engine->operation_flags[i], mask, width_r,
+                    widen_lanes(x - y), (lanes_t) (y > x)
+                );
+                writes_r = false;
+                break;
+            case MLT:
+                write_arithmetic_lanes(
+                    &r[i], &engine->operation_flags[i], mask, width_r,
+                    widen_lanes(x) * widen_lanes(y), zero
+                );
+                writes_r = false;
+                break;
+            case INC:
+                write_arithmetic_lanes(
+                    &r[i], &engine->operation_flags[i], mask, width_r,
+                    widen_lanes(x) + 1, zero
+                );
+                writes_r = false;
+                break;
+            case DEC:
+                write_arithmetic_lanes(
+                    &r[i], &engine->operation_flags[i], mask, width_r,
+                    widen_lanes(x - 1), (lanes_t) (x == 0)
+                );
+                writes_r = false;
+                break;
+            case QOP:
+                // QOP always writes the whole register
+                result = (lanes_t) (
+                    (load_lanes(&engine->operation_flags[i]) & query) != 0
+                ) & one;
+                store_lanes(
+                    &r[i], select_lanes(mask, result, load_lanes(&r[i]))
+                );
+                writes_r = false;
+                break;
+            case EOR: result = x | y; break;
+            case AND: result = x & y; break;
+            case XOR: result = x ^ y; break;
+            case NOT: result = ~x; break;
+            case LSH: result = (x << (y & 15)) & (lanes_t) (y < 16); break;
+            case RSH: result = (x >> (y & 15)) & (lanes_t) (y < 16); break;
+            case SET: result = zero + instruction->l; break;
+            case COP: result = x; break;
+            default:
+                // never reached, other instructions are stepped one at a time
+                writes_r = false;
+                break;
+        }
+        if(writes_r) {
+            store_lanes(
+                &r[i], select_lanes(mask, result & width_r, load_lanes(&r[i]))
+            );
+        }
+        store_lanes(
+            &engine->program_counters[i], select_lanes(mask, next, pcs)
+        );
+        lowest = select_lanes(mask & (lanes_t) (next < lowest), next, lowest);
+        highest = select_lanes(
+            mask & (lanes_t) (next > highest), next, highest
+        );
+    }
+    *next_pc = lowest[0];
+    risky_ram_address_t top = highest[0];
+    for(size_t j = 1; j < RISKY_LOCKSTEP_LANE_WIDTH; j++) {
+        *next_pc = (lowest[j] < *next_pc) ? lowest[j] : *next_pc;
+        top = (highest[j] > top) ? highest[j] : top;
+    }
+    return *next_pc == top && opcode != HLT;
+}
+
+/*
+ * runs all of the engine's running VMs until they stop, a group of VMs with
+ * the same program counter at a time, always choosing the group furthest
+ * behind in the program.
+ * Returns a status_t with error / success information
+ */
+LANES_INLINE status_t run_lanes(risky_lockstep_t * engine, size_t remaining) {
+    const lanes_t zero = { 0 };
+    risky_ram_address_t pc = 0x0000U;
+    // set while every running VM is known to be at the same program counter
+    bool converged = false;
+    while(remaining > 0) {
+        if(!converged) {
+            // stopped VMs count as the highest address when finding the lowest
+            lanes_t lowest = ~zero;
+            lanes_t highest = zero;
+            for(
+                size_t i = 0; i < engine->stride;
+                i += RISKY_LOCKSTEP_LANE_WIDTH
+            ) {
+                lanes_t pcs = load_lanes(&engine->program_counters[i]);
+                lanes_t running = load_lanes(&engine->running[i]);
+                lowest = select_lanes(
+                    (lanes_t) ((pcs | ~running) < lowest), pcs, lowest
+                );
+                highest = select_lanes(
+                    (lanes_t) ((pcs & running) > highest), pcs, highest
+                );
+            }
+            pc = lowest[0];
+            risky_ram_address_t top = highest[0];
+            for(size_t j = 1; j < RISKY_LOCKSTEP_LANE_WIDTH; j++) {
+                pc = (lowest[j] < pc) ? lowest[j] : pc;
+                top = (highest[j] > top) ? highest[j] : top;
+            }
+            converged = pc == top;
+        }
+        // the group's instruction is fetched from the RAM of its first VM
+        risky_packed_instruction_t * instruction = NULL;
+        status_t result = fetch_instruction(
+            engine->states[first_in_group(engine, pc)], pc, &instruction
+        );
+        if(result != STATUS_SUCCESS) {
+            return result;
+        }
+        if(
+            is_vectorised(packed_opcode(instruction)) &&
+            !is_modified(engine, pc)
+        ) {
+            risky_packed_instruction_t copy = *instruction;
+            // VMs which were all together stay together unless they diverge
+            bool together = execute_lanes(engine, &copy, pc, &remaining, &pc);
+            converged = converged && together;
+        } else {
+            result = step_group(engine, pc, &remaining);
+            if(result != STATUS_SUCCESS) {
+                return result;
+            }
+            converged = false;
+        }
+    }
+    return STATUS_SUCCESS;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// private function - run_lanes() compiled for processors supporting AVX2
+__attribute__((target("avx2")))
+static status_t run_lanes_avx2(risky_lockstep_t * engine, size_t remaining) {
+    return run_lanes(engine, remaining);
+}
+#endif
+
+// private function - run_lanes() compiled for the baseline instruction set
+static status_t run_lanes_baseline(
+    risky_lockstep_t * engine, size_t remaining
+) {
+    return run_lanes(engine, remaining);
+}
+#endif
+
+/*
+ * private function - runs all of the engine's running VMs until they stop,
+ * one instruction at a time, with whichever implementation suits the host.
+ * Returns a status_t with error / success information
+ */
+static status_t run_all_lanes(risky_lockstep_t * engine, size_t remaining) {
+    #ifdef RISKY_LOCKSTEP_SIMD
+    #if defined(__x86_64__) || defined(__i386__)
+    if(__builtin_cpu_supports("avx2")) {
+        return run_lanes_avx2(engine, remaining);
+    }
+    #endif
+    return run_lanes_baseline(engine, remaining);
+    #else
+    // without vector support, step each group of VMs one at a time
+    while(remaining > 0) {
+        risky_ram_address_t pc = 0xffffU;
+        for(size_t lane = 0; lane < engine->count; lane++) {
+            if(engine->running[lane] && engine->program_counters[lane] < pc) {
+                pc = engine->program_counters[lane];
+            }
+        }
+        status_t result = step_group(engine, pc, &remaining);
+        if(result != STATUS_SUCCESS) {
+            return result;
+        }
+    }
+    return STATUS_SUCCESS;
+    #endif
+}
+
+/*
+ * given a pointer to a risky_lockstep_t, an array of pointers to initialised
+ * risky_vm_state_t and the number of them, allocate the engine's storage for
+ * running those VMs together. Every VM must have the same program loaded in
+ * its RAM, but they may differ in anything else.
+ * Returns a status_t with error / success information
+ */
+status_t init_risky_lockstep(
+    risky_lockstep_t * engine, risky_vm_state_t ** states, size_t count
+) {
+    engine->states = states;
+    engine->count = count;
+    engine->stride = (
+        (count + RISKY_LOCKSTEP_LANE_WIDTH - 1) / RISKY_LOCKSTEP_LANE_WIDTH
+    ) * RISKY_LOCKSTEP_LANE_WIDTH;
+    engine->registers = (risky_register_t *) calloc(
+        RISKY_REGISTER_COUNT * engine->stride, sizeof(risky_register_t)
+    );
+    engine->program_counters = (risky_word_t *) calloc(
+        engine->stride, sizeof(risky_word_t)
+    );
+    engine->operation_flags = (risky_word_t *) calloc(
+        engine->stride, sizeof(risky_word_t)
+    );
+    engine->running = (risky_word_t *) calloc(
+        engine->stride, sizeof(risky_word_t)
+    );
+    engine->reasons = (risky_stop_reason_t *) calloc(
+        engine->stride, sizeof(risky_stop_reason_t)
+    );
+    if(
+        engine->registers == NULL || engine->program_counters == NULL ||
+        engine->operation_flags == NULL || engine->running == NULL ||
+        engine->reasons == NULL
+    ) {
+        free_risky_lockstep(engine);
+        return MALLOC_REFUSED;
+    }
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_lockstep_t, free the engine's storage. The VMs
+ * themselves are not freed.
+ * Returns a status_t with error / success information
+ */
+status_t free_risky_lockstep(risky_lockstep_t * engine) {
+    free(engine->registers);
+    free(engine->program_counters);
+    free(engine->operation_flags);
+    free(engine->running);
+    free(engine->reasons);
+    engine->registers = NULL;
+    engine->program_counters = NULL;
+    engine->operation_flags = NULL;
+    engine->running = NULL;
+    engine->reasons = NULL;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_lockstep_t, run all of its VMs from their
+ * program counters until every one has stopped, storing the reason each one
+ * stopped in the engine's reasons array. The end state of every VM is the same
+ * as if it had been run on its own with run_risky_vm().
+ * Returns a status_t with error / success information
+ */
+status_t run_risky_lockstep(risky_lockstep_t * engine) {
+    size_t stride = engine->stride;
+    // gather the VMs' registers into the engine
+    for(size_t lane = 0; lane < engine->count; lane++) {
+        risky_vm_state_t * state = engine->states[lane];
+        for(size_t r = 0; r < RISKY_REGISTER_COUNT; r++) {
+            engine->registers[r * stride + lane] = state->registers[r];
+        }
+        engine->program_counters[lane] = state->program_counter;
+        engine->operation_flags[lane] = state->operation_flags;
+        engine->running[lane] = 0xffffU;
+        engine->reasons[lane] = RISKY_STOP_NONE;
+    }
+    memset(engine->modified, 0, sizeof(engine->modified));
+    status_t result = run_all_lanes(engine, engine->count);
+    // then scatter them back again, even if the run failed part way
+    for(size_t lane = 0; lane < engine->count; lane++) {
+        risky_vm_state_t * state = engine->states[lane];
+        for(size_t r = 0; r < RISKY_REGISTER_COUNT; r++) {
+            state->registers[r] = engine->registers[r * stride + lane];
+        }
+        state->program_counter = engine->program_counters[lane];
+        state->operation_flags = (risky_byte_t) engine->operation_flags[lane];
+    }
+    return result;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
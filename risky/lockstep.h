@@ -0,0 +1,90 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * lockstep - this compilation unit defines an engine which runs many RISKY
+ * virtual machines holding the same program together, executing each
+ * instruction for every VM at that point in the program at once with SIMD.
+ */
+#ifndef SAXBOPHONE_RISKY_LOCKSTEP_H
+#define SAXBOPHONE_RISKY_LOCKSTEP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cache.h"
+#include "core.h"
+#include "interpreter.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of VMs (lanes) which are processed together by each vector operation
+#define RISKY_LOCKSTEP_LANE_WIDTH 16
+
+// lockstep engine struct
+typedef struct risky_lockstep_t {
+    // the VMs being run, and how many of them there are
+    risky_vm_state_t ** states;
+    size_t count;
+    /*
+     * number of lanes in each of the arrays below, which is count rounded up
+     * to a whole number of vectors. The spare lanes are never running
+     */
+    size_t stride;
+    // register r of VM i is stored at registers[r * stride + i]
+    risky_register_t * registers;
+    risky_word_t * program_counters;
+    risky_word_t * operation_flags;
+    // all bits set for VMs which are still running, clear for the rest
+    risky_word_t * running;
+    // the reason each VM stopped
+    risky_stop_reason_t * reasons;
+    // bitmap of instruction slots written by any VM during the current run
+    uint64_t modified[RISKY_INSTRUCTION_SLOTS / 64];
+} risky_lockstep_t;
+
+/*
+ * given a pointer to a risky_lockstep_t, an array of pointers to initialised
+ * risky_vm_state_t and the number of them, allocate the engine's storage for
+ * running those VMs together. Every VM must have the same program loaded in
+ * its RAM, but they may differ in anything else.
+ * Returns a status_t with error / success information
+ */
+status_t init_risky_lockstep(
+    risky_lockstep_t * engine, risky_vm_state_t ** states, size_t count
+);
+
+/*
+ * given a pointer to a risky_lockstep_t, free the engine's storage. The VMs
+ * themselves are not freed.
+ * Returns a status_t with error / success information
+ */
+status_t free_risky_lockstep(risky_lockstep_t * engine);
+
+/*
+ * given a pointer to a risky_lockstep_t, run all of its VMs from their
+ * program counters until every one has stopped, storing the reason each one
+ * stopped in the engine's reasons array. The end state of every VM is the same
+ * as if it had been run on its own with run_risky_vm().
+ * VMs at the same program counter execute each instruction together, with
+ * vector operations across their registers. When their paths diverge, the
+ * VMs furthest behind in the program run first, so that they can catch up and
+ * rejoin the others. Instructions which can't be vectorised, or which were
+ * fetched from RAM that any VM has written to, are run one VM at a time.
+ * Returns a status_t with error / success information
+ */
+status_t run_risky_lockstep(risky_lockstep_t * engine);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+// end of header file
+#endif
@@ -0,0 +1,93 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * packed - this compilation unit defines a compact 8-byte form of decoded
+ * instructions, and functions for converting to and from risky_instruction_t.
+ */
+#include <stdbool.h>
+
+#include "core.h"
+#include "decoder.h"
+#include "packed.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * given a pointer to a risky_instruction_t and a pointer to a
+ * risky_packed_instruction_t, store the packed form of the instruction in the
+ * risky_packed_instruction_t.
+ * returns a status_t with error / success information
+ */
+status_t pack_instruction(
+    const risky_instruction_t * instruction,
+    risky_packed_instruction_t * packed
+) {
+    // opcodes are only 5 bits wide
+    if((unsigned int) instruction->opcode >= 32) {
+        return STATUS_FAIL;
+    }
+    packed->operation = (risky_byte_t) (
+        (instruction->opcode << 3) |
+        (instruction->a_flag ? 0x04U : 0x00U) |
+        (instruction->b_flag ? 0x02U : 0x00U) |
+        (instruction->c_flag ? 0x01U : 0x00U)
+    );
+    packed->r = instruction->r;
+    packed->a = instruction->a;
+    packed->b = instruction->b;
+    packed->l = instruction->l;
+    packed->fused = 0;
+    packed->reserved = 0;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_packed_instruction_t and a pointer to a
+ * risky_instruction_t, store the unpacked form of the instruction in the
+ * risky_instruction_t.
+ * returns a status_t with error / success information
+ */
+status_t unpack_instruction(
+    const risky_packed_instruction_t * packed,
+    risky_instruction_t * instruction
+) {
+    instruction->opcode = packed_opcode(packed);
+    instruction->a_flag = packed_a_flag(packed);
+    instruction->b_flag = packed_b_flag(packed);
+    instruction->c_flag = packed_c_flag(packed);
+    instruction->r = packed->r;
+    instruction->a = packed->a;
+    instruction->b = packed->b;
+    instruction->l = packed->l;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_raw_instruction_t and a pointer to a
+ * risky_packed_instruction_t, decode the raw instruction data into its packed
+ * form. Fields which the opcode doesn't use are cleared, exactly as
+ * decode_instruction_from_raw() does.
+ * returns a status_t with error / success information
+ */
+status_t decode_packed_instruction_from_raw(
+    risky_raw_instruction_t * raw, risky_packed_instruction_t * packed
+) {
+    risky_instruction_t instruction;
+    status_t result = decode_instruction_from_raw(raw, &instruction);
+    if(result != STATUS_SUCCESS) {
+        return result;
+    }
+    return pack_instruction(&instruction, packed);
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
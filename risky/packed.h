@@ -0,0 +1,112 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * packed - this compilation unit defines a compact 8-byte form of decoded
+ * instructions, and functions for converting to and from risky_instruction_t.
+ */
+#ifndef SAXBOPHONE_RISKY_PACKED_H
+#define SAXBOPHONE_RISKY_PACKED_H
+
+#include <stdbool.h>
+
+#include "core.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * packed decoded instruction struct, 8 bytes long so that twice as many fit
+ * in the same amount of cache as risky_instruction_t.
+ * the first four bytes are laid out the same as in a raw instruction (with
+ * any fields the opcode doesn't use cleared), so they can be read in one load
+ */
+typedef struct risky_packed_instruction_t {
+    // opcode in the top 5 bits, flags a, b and c in the bottom 3 bits
+    risky_byte_t operation;
+    // 'return register' and other main operands
+    risky_register_address_t r, a, b;
+    // the other possible 16-bit literal value operand, in host byte order
+    risky_register_t l;
+    /*
+     * the kind of instruction this one is fused with, which follows it, as a
+     * risky_fused_t. Only ever set in the instruction cache, zero otherwise
+     */
+    risky_byte_t fused;
+    // unused, always zero
+    risky_byte_t reserved;
+} risky_packed_instruction_t;
+
+// returns the opcode of the given packed instruction
+static inline risky_opcode_t packed_opcode(
+    const risky_packed_instruction_t * instruction
+) {
+    return (risky_opcode_t) (instruction->operation >> 3);
+}
+
+// returns flag a of the given packed instruction
+static inline bool packed_a_flag(
+    const risky_packed_instruction_t * instruction
+) {
+    return instruction->operation & 0x04U;
+}
+
+// returns flag b of the given packed instruction
+static inline bool packed_b_flag(
+    const risky_packed_instruction_t * instruction
+) {
+    return instruction->operation & 0x02U;
+}
+
+// returns flag c of the given packed instruction
+static inline bool packed_c_flag(
+    const risky_packed_instruction_t * instruction
+) {
+    return instruction->operation & 0x01U;
+}
+
+/*
+ * given a pointer to a risky_instruction_t and a pointer to a
+ * risky_packed_instruction_t, store the packed form of the instruction in the
+ * risky_packed_instruction_t.
+ * returns a status_t with error / success information
+ */
+status_t pack_instruction(
+    const risky_instruction_t * instruction,
+    risky_packed_instruction_t * packed
+);
+
+/*
+ * given a pointer to a risky_packed_instruction_t and a pointer to a
+ * risky_instruction_t, store the unpacked form of the instruction in the
+ * risky_instruction_t.
+ * returns a status_t with error / success information
+ */
+status_t unpack_instruction(
+    const risky_packed_instruction_t * packed,
+    risky_instruction_t * instruction
+);
+
+/*
+ * given a pointer to a risky_raw_instruction_t and a pointer to a
+ * risky_packed_instruction_t, decode the raw instruction data into its packed
+ * form. Fields which the opcode doesn't use are cleared, exactly as
+ * decode_instruction_from_raw() does.
+ * returns a status_t with error / success information
+ */
+status_t decode_packed_instruction_from_raw(
+    risky_raw_instruction_t * raw, risky_packed_instruction_t * packed
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+// end of header file
+#endif
@@ -0,0 +1,267 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * pool - this compilation unit defines a pool of preallocated RISKY virtual
+ * machine states, which can be acquired and released without allocating.
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "core.h"
+#include "image.h"
+#include "pool.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * private function - zeroes a VM's RAM in the arena. Pages which are resident
+ * are cleared in place, so that they stay committed for the next VM to reuse,
+ * which for short-lived VMs is usually a handful of them. The rest have either
+ * never been touched or been swapped out, and a swapped out page still holds
+ * the old contents, so each run of them is discarded with madvise(), after
+ * which it reads as zero. Runs which can't be discarded are cleared in place
+ */
+static void clear_ram(risky_ram_t * ram) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    // enough room for the smallest page size there is
+    unsigned char resident[RISKY_RAM_AMOUNT / 4096];
+    if(
+        page_size < 4096 || page_size > RISKY_RAM_AMOUNT ||
+        mincore(ram, RISKY_RAM_AMOUNT, resident) != 0
+    ) {
+        memset(ram, 0, RISKY_RAM_AMOUNT);
+        return;
+    }
+    size_t size = (size_t) page_size;
+    size_t pages = RISKY_RAM_AMOUNT / size;
+    for(size_t i = 0; i < pages; i++) {
+        if(resident[i] & 0x01U) {
+            memset(ram + i * size, 0, size);
+            continue;
+        }
+        size_t run = i;
+        while(i + 1 < pages && !(resident[i + 1] & 0x01U)) {
+            i++;
+        }
+        size_t length = (i + 1 - run) * size;
+        if(madvise(ram + run * size, length, MADV_DONTNEED) != 0) {
+            memset(ram + run * size, 0, length);
+        }
+    }
+}
+
+/*
+ * private function - maps the pool's arena, of the pool's arena_size, trying
+ * huge pages first if asked to and recording which kind of pages back it.
+ * Anonymous pages are zero until written, so none of the arena is touched.
+ * Returns false if it couldn't be mapped
+ */
+static bool map_arena(risky_vm_pool_t * pool, bool huge) {
+    int protection = PROT_READ | PROT_WRITE;
+    pool->pages = RISKY_POOL_NORMAL_PAGES;
+#ifdef MAP_HUGETLB
+    if(huge) {
+        // this fails unless the system has enough huge pages set aside
+        void * arena = mmap(
+            NULL, pool->arena_size, protection,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0
+        );
+        if(arena != MAP_FAILED) {
+            pool->arena = (risky_ram_t *) arena;
+            pool->pages = RISKY_POOL_HUGETLB_PAGES;
+            return true;
+        }
+    }
+#endif
+    // transparent huge pages need the arena aligned to a huge page
+    size_t slack = huge ? RISKY_HUGE_PAGE_SIZE : 0;
+    void * mapping = mmap(
+        NULL, pool->arena_size + slack, protection,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0
+    );
+    if(mapping == MAP_FAILED) {
+        return false;
+    }
+    risky_ram_t * arena = (risky_ram_t *) mapping;
+    if(huge) {
+        // trim the mapping down to the aligned part of it
+        uintptr_t start = (uintptr_t) mapping;
+        uintptr_t aligned = (start + slack - 1) & ~((uintptr_t) slack - 1);
+        arena = (risky_ram_t *) aligned;
+        if(aligned != start) {
+            munmap(mapping, aligned - start);
+        }
+        if(aligned - start != slack) {
+            munmap(
+                arena + pool->arena_size, slack - (aligned - start)
+            );
+        }
+#ifdef MADV_HUGEPAGE
+        if(madvise(arena, pool->arena_size, MADV_HUGEPAGE) == 0) {
+            pool->pages = RISKY_POOL_TRANSPARENT_HUGE_PAGES;
+        }
+#endif
+    }
+    pool->arena = arena;
+    return true;
+}
+
+/*
+ * given a pointer to a risky_vm_pool_t, the number of VMs it should hold and
+ * flags, allocate the pool's states and map an arena for all of their RAM.
+ * Returns a status_t with error / success information
+ */
+status_t init_risky_vm_pool(
+    risky_vm_pool_t * pool, size_t capacity, unsigned int flags
+) {
+    bool huge = (flags & RISKY_POOL_HUGE_PAGES) != 0;
+    *pool = (risky_vm_pool_t) {
+        .states = NULL, .capacity = capacity, .arena = NULL,
+        // room for at least one VM, in whole huge pages if using them
+        .arena_size = (capacity + 1) * RISKY_RAM_AMOUNT,
+        .pages = RISKY_POOL_NORMAL_PAGES,
+        .free_states = NULL, .free_count = capacity, .acquired = NULL,
+    };
+    if(huge) {
+        pool->arena_size = (
+            (pool->arena_size + RISKY_HUGE_PAGE_SIZE - 1) /
+            RISKY_HUGE_PAGE_SIZE
+        ) * RISKY_HUGE_PAGE_SIZE;
+    }
+    if(pthread_mutex_init(&pool->lock, NULL) != 0) {
+        return STATUS_FAIL;
+    }
+    pool->states = (risky_vm_state_t *) calloc(
+        capacity + 1, sizeof(risky_vm_state_t)
+    );
+    pool->free_states = (size_t *) calloc(capacity + 1, sizeof(size_t));
+    pool->acquired = (bool *) calloc(capacity + 1, sizeof(bool));
+    if(
+        pool->states == NULL || pool->free_states == NULL ||
+        pool->acquired == NULL || !map_arena(pool, huge)
+    ) {
+        free_risky_vm_pool(pool);
+        return MALLOC_REFUSED;
+    }
+    for(size_t i = 0; i < capacity; i++) {
+        pool->states[i].ram = pool->arena + i * RISKY_RAM_AMOUNT;
+        pool->states[i].pool = pool;
+        // hand out the lowest VMs first
+        pool->free_states[i] = capacity - 1 - i;
+    }
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_vm_pool_t, free the pool's states and arena.
+ * Returns a status_t with error / success information
+ */
+status_t free_risky_vm_pool(risky_vm_pool_t * pool) {
+    if(pool->states != NULL) {
+        for(size_t i = 0; i < pool->capacity; i++) {
+            // snapshots may still be mapped by VMs forked from these
+            if(pool->states[i].image != NULL) {
+                release_risky_ram_image(&pool->states[i]);
+            }
+            free(pool->states[i].cache);
+        }
+    }
+    if(pool->arena != NULL) {
+        munmap(pool->arena, pool->arena_size);
+    }
+    free(pool->states);
+    free(pool->free_states);
+    free(pool->acquired);
+    pthread_mutex_destroy(&pool->lock);
+    pool->states = NULL;
+    pool->arena = NULL;
+    pool->free_states = NULL;
+    pool->acquired = NULL;
+    pool->free_count = 0;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_vm_pool_t and a pointer to a pointer to a
+ * risky_vm_state_t, take a free VM from the pool and store a pointer to it in
+ * the pointer at the given address.
+ * Returns a status_t with error / success information
+ */
+status_t acquire_risky_vm(risky_vm_pool_t * pool, risky_vm_state_t ** state) {
+    pthread_mutex_lock(&pool->lock);
+    if(pool->free_count == 0) {
+        pthread_mutex_unlock(&pool->lock);
+        return STATUS_FAIL;
+    }
+    size_t index = pool->free_states[--pool->free_count];
+    pool->acquired[index] = true;
+    pthread_mutex_unlock(&pool->lock);
+    // everything but RAM and the cache was reset when it was released
+    *state = &pool->states[index];
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_vm_pool_t and a pointer to a risky_vm_state_t
+ * acquired from it, give the VM back to the pool.
+ * Returns a status_t with error / success information
+ */
+status_t release_risky_vm(risky_vm_pool_t * pool, risky_vm_state_t * state) {
+    if(
+        state->pool != pool || state < pool->states ||
+        state >= pool->states + pool->capacity
+    ) {
+        return STATUS_FAIL;
+    }
+    size_t index = (size_t) (state - pool->states);
+    // marking it free up front stops a racing second release clearing it too
+    pthread_mutex_lock(&pool->lock);
+    bool acquired = pool->acquired[index];
+    pool->acquired[index] = false;
+    pthread_mutex_unlock(&pool->lock);
+    if(!acquired) {
+        return STATUS_FAIL;
+    }
+    status_t result = STATUS_SUCCESS;
+    if(state->image != NULL) {
+        // forked RAM is replaced with zero pages in place
+        result = release_risky_ram_image(state);
+    } else {
+        clear_ram(state->ram);
+    }
+    // reset everything else to how init_risky_vm_state() leaves it
+    memset(state->registers, 0, sizeof(state->registers));
+    memset(state->channels, 0, sizeof(state->channels));
+    state->program_counter = 0x0000U;
+    state->operation_flags = 0x00U;
+    state->channel_io = (risky_channel_io_t) { NULL, NULL, NULL, };
+    memset(state->rings, 0, sizeof(state->rings));
+    invalidate_instruction_cache(state);
+    state->ram_written = false;
+    // zero RAM, like that of a new VM, has nothing to checkpoint or reset
+    state->dirty_pages = 0;
+    memset(state->written_lines, 0, sizeof(state->written_lines));
+    pthread_mutex_lock(&pool->lock);
+    pool->free_states[pool->free_count++] = index;
+    pthread_mutex_unlock(&pool->lock);
+    return result;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
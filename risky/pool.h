@@ -0,0 +1,111 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * pool - this compilation unit defines a pool of preallocated RISKY virtual
+ * machine states, which can be acquired and released without allocating.
+ */
+#ifndef SAXBOPHONE_RISKY_POOL_H
+#define SAXBOPHONE_RISKY_POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "core.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// flags for init_risky_vm_pool()
+// back the arena with 2MiB huge pages if possible, fitting 32 VMs in each one
+#define RISKY_POOL_HUGE_PAGES 0x01U
+
+// size of the huge pages asked for by RISKY_POOL_HUGE_PAGES
+#define RISKY_HUGE_PAGE_SIZE (2U * 1024U * 1024U)
+
+// the kinds of pages which can back a pool's arena
+typedef enum risky_pool_pages_t {
+    // the system's normal pages
+    RISKY_POOL_NORMAL_PAGES = 0,
+    // transparent huge pages, which the kernel uses when it can
+    RISKY_POOL_TRANSPARENT_HUGE_PAGES,
+    // explicit huge pages reserved with MAP_HUGETLB
+    RISKY_POOL_HUGETLB_PAGES,
+} risky_pool_pages_t;
+
+// pool struct
+typedef struct risky_vm_pool_t {
+    // the VM states, and how many of them there are
+    risky_vm_state_t * states;
+    size_t capacity;
+    // one contiguous mapping holding the RAM of every VM, one after another
+    risky_ram_t * arena;
+    size_t arena_size;
+    // the kind of pages the arena ended up backed by
+    risky_pool_pages_t pages;
+    // stack of the indices of VMs which are free to be acquired
+    size_t * free_states;
+    size_t free_count;
+    // whether each VM is currently acquired, to catch releasing one twice
+    bool * acquired;
+    // protects the stack of free VMs and which VMs are acquired
+    pthread_mutex_t lock;
+} risky_vm_pool_t;
+
+/*
+ * given a pointer to a risky_vm_pool_t, the number of VMs it should hold and
+ * flags (0 or RISKY_POOL_HUGE_PAGES), allocate the pool's states and map an
+ * arena for all of their RAM. Memory for RAM is only committed as each VM
+ * touches it, except for explicit huge pages, which are reserved up front.
+ * With RISKY_POOL_HUGE_PAGES, explicit huge pages are tried first, then
+ * transparent huge pages, then normal pages; the pool's pages field says
+ * which were used. Packing many VMs into each huge page cuts the TLB misses
+ * of switching between lots of VMs. VMs in a pool of explicit huge pages can't
+ * be forked from, as their RAM can't be remapped a page at a time.
+ * Returns a status_t with error / success information
+ */
+status_t init_risky_vm_pool(
+    risky_vm_pool_t * pool, size_t capacity, unsigned int flags
+);
+
+/*
+ * given a pointer to a risky_vm_pool_t, free the pool's states and arena.
+ * VMs acquired from the pool must not be used after this.
+ * Returns a status_t with error / success information
+ */
+status_t free_risky_vm_pool(risky_vm_pool_t * pool);
+
+/*
+ * given a pointer to a risky_vm_pool_t and a pointer to a pointer to a
+ * risky_vm_state_t, take a free VM from the pool and store a pointer to it in
+ * the pointer at the given address. The VM is in the same state as one just
+ * initialised with init_risky_vm_state(), with all of its RAM zero.
+ * Returns STATUS_FAIL if every VM in the pool has already been acquired.
+ * Returns a status_t with error / success information
+ */
+status_t acquire_risky_vm(risky_vm_pool_t * pool, risky_vm_state_t ** state);
+
+/*
+ * given a pointer to a risky_vm_pool_t and a pointer to a risky_vm_state_t
+ * acquired from it, give the VM back to the pool. All of its RAM is zeroed:
+ * pages which are resident stay committed for the next VM to reuse, as does
+ * its instruction cache, and any others are discarded. free_risky_vm_state()
+ * calls this for pooled VMs. Returns STATUS_FAIL without touching the VM if it
+ * isn't currently acquired, such as when it has already been released.
+ * Returns a status_t with error / success information
+ */
+status_t release_risky_vm(risky_vm_pool_t * pool, risky_vm_state_t * state);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+// end of header file
+#endif
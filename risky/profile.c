@@ -0,0 +1,312 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * profile - this compilation unit defines an instruction profile of a RISKY
+ * virtual machine, as collected by run_risky_vm_profiled(), and functions for
+ * reporting where a program spends its time in terms of its basic blocks.
+ */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cache.h"
+#include "core.h"
+#include "decoder.h"
+#include "profile.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * given a pointer to a risky_profile_t, allocate its storage, with every
+ * count zeroed.
+ * Returns a status_t with error / success information
+ */
+status_t init_risky_profile(risky_profile_t * profile) {
+    *profile = (risky_profile_t) { .counts = NULL, .entries = NULL, };
+    profile->counts = (uint64_t *) calloc(RISKY_RAM_AMOUNT, sizeof(uint64_t));
+    profile->entries = (uint64_t *) calloc(RISKY_RAM_AMOUNT, sizeof(uint64_t));
+    if(profile->counts == NULL || profile->entries == NULL) {
+        free_risky_profile(profile);
+        return MALLOC_REFUSED;
+    }
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_profile_t, free its storage.
+ * Returns a status_t with error / success information
+ */
+status_t free_risky_profile(risky_profile_t * profile) {
+    free(profile->counts);
+    free(profile->entries);
+    profile->counts = NULL;
+    profile->entries = NULL;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * private function - decodes the instruction at the given address of the
+ * VM's RAM, which may wrap around the end of it
+ */
+static void read_instruction(
+    const risky_vm_state_t * state, risky_ram_address_t address,
+    risky_instruction_t * instruction
+) {
+    risky_raw_instruction_t raw;
+    for(size_t i = 0; i < RISKY_INSTRUCTION_SIZE; i++) {
+        raw.bytes[i] = state->ram[(risky_ram_address_t) (address + i)];
+    }
+    decode_instruction_from_raw(&raw, instruction);
+}
+
+/*
+ * private function - returns whether the instruction at the given address
+ * ends a basic block, by transferring control or halting
+ */
+static bool ends_block(
+    const risky_vm_state_t * state, risky_ram_address_t address
+) {
+    risky_opcode_t opcode = (risky_opcode_t) (state->ram[address] >> 3);
+    return opcode == JMP || opcode == BRA || opcode == HLT;
+}
+
+/*
+ * private function - returns whether an executed instruction at the given
+ * address starts a basic block
+ */
+static bool starts_block(
+    const risky_profile_t * profile, const risky_vm_state_t * state,
+    risky_ram_address_t address
+) {
+    risky_ram_address_t previous = (risky_ram_address_t) (
+        address - RISKY_INSTRUCTION_SIZE
+    );
+    return
+        profile->entries[address] != 0 || profile->counts[previous] == 0 ||
+        ends_block(state, previous);
+}
+
+/*
+ * private function - fills in the basic block which starts at the given
+ * address
+ */
+static void measure_block(
+    const risky_profile_t * profile, const risky_vm_state_t * state,
+    risky_ram_address_t start, risky_profile_block_t * block
+) {
+    *block = (risky_profile_block_t) {
+        .start = start, .length = 1, .runs = profile->counts[start],
+        .executed = profile->counts[start],
+    };
+    risky_ram_address_t address = start;
+    while(
+        !ends_block(state, address) && block->length < RISKY_INSTRUCTION_SLOTS
+    ) {
+        address = (risky_ram_address_t) (address + RISKY_INSTRUCTION_SIZE);
+        if(
+            profile->counts[address] == 0 ||
+            starts_block(profile, state, address)
+        ) {
+            break;
+        }
+        block->length++;
+        block->executed += profile->counts[address];
+    }
+}
+
+// private function - orders blocks hottest first, then by address
+static int compare_blocks(const void * a, const void * b) {
+    const risky_profile_block_t * x = (const risky_profile_block_t *) a;
+    const risky_profile_block_t * y = (const risky_profile_block_t *) b;
+    if(x->executed != y->executed) {
+        return (x->executed > y->executed) ? -1 : 1;
+    }
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+/*
+ * given a pointer to a risky_profile_t, a pointer to the risky_vm_state_t it
+ * was collected from, a pointer to a pointer to risky_profile_block_t and a
+ * pointer to a size_t, split the executed instructions into basic blocks and
+ * store a newly allocated array of them, hottest first, and the number of
+ * them. The caller must free() the array.
+ * Returns a status_t with error / success information
+ */
+status_t find_risky_profile_blocks(
+    const risky_profile_t * profile, const risky_vm_state_t * state,
+    risky_profile_block_t ** blocks, size_t * count
+) {
+    *blocks = NULL;
+    *count = 0;
+    for(size_t address = 0; address < RISKY_RAM_AMOUNT; address++) {
+        if(
+            profile->counts[address] != 0 &&
+            starts_block(profile, state, (risky_ram_address_t) address)
+        ) {
+            (*count)++;
+        }
+    }
+    if(*count == 0) {
+        return STATUS_SUCCESS;
+    }
+    *blocks = (risky_profile_block_t *) malloc(
+        *count * sizeof(risky_profile_block_t)
+    );
+    if(*blocks == NULL) {
+        *count = 0;
+        return MALLOC_REFUSED;
+    }
+    size_t found = 0;
+    for(size_t address = 0; address < RISKY_RAM_AMOUNT; address++) {
+        if(
+            profile->counts[address] != 0 &&
+            starts_block(profile, state, (risky_ram_address_t) address)
+        ) {
+            measure_block(
+                profile, state, (risky_ram_address_t) address,
+                &(*blocks)[found++]
+            );
+        }
+    }
+    qsort(*blocks, *count, sizeof(risky_profile_block_t), compare_blocks);
+    return STATUS_SUCCESS;
+}
+
+/*
+ * private function - returns the given count as a percentage of the total
+ * number of instructions executed
+ */
+static double percentage(const risky_profile_t * profile, uint64_t count) {
+    return (profile->total != 0) ? 100.0 * count / profile->total : 0.0;
+}
+
+/*
+ * given a pointer to a risky_profile_t, a pointer to the risky_vm_state_t it
+ * was collected from, a number of blocks and a stream, print a report of the
+ * opcodes executed and that many of the hottest basic blocks to the stream.
+ * Returns a status_t with error / success information
+ */
+status_t print_risky_profile(
+    const risky_profile_t * profile, const risky_vm_state_t * state,
+    size_t top, FILE * stream
+) {
+    fprintf(
+        stream, "%" PRIu64 " instructions executed\n\n", profile->total
+    );
+    // opcodes, most executed first
+    bool printed[RISKY_OPCODE_COUNT] = { false, };
+    fprintf(stream, "opcode         executed  percent\n");
+    for(;;) {
+        size_t best = RISKY_OPCODE_COUNT;
+        for(size_t i = 0; i < RISKY_OPCODE_COUNT; i++) {
+            if(
+                !printed[i] && profile->opcodes[i] != 0 && (
+                    best == RISKY_OPCODE_COUNT ||
+                    profile->opcodes[i] > profile->opcodes[best]
+                )
+            ) {
+                best = i;
+            }
+        }
+        if(best == RISKY_OPCODE_COUNT) {
+            break;
+        }
+        printed[best] = true;
+        fprintf(
+            stream, "%-6s %16" PRIu64 " %7.2f%%\n",
+            get_risky_opcode_mnemonic((risky_opcode_t) best),
+            profile->opcodes[best], percentage(profile, profile->opcodes[best])
+        );
+    }
+    risky_profile_block_t * blocks = NULL;
+    size_t count = 0;
+    status_t result = find_risky_profile_blocks(
+        profile, state, &blocks, &count
+    );
+    if(result != STATUS_SUCCESS) {
+        return result;
+    }
+    if(top > count) {
+        top = count;
+    }
+    fprintf(stream, "\nhottest %zu of %zu basic blocks\n", top, count);
+    for(size_t i = 0; i < top; i++) {
+        risky_profile_block_t * block = &blocks[i];
+        fprintf(
+            stream,
+            "\nblock 0x%04x: %zu instructions, entered %" PRIu64 " times, "
+            "%" PRIu64 " instructions executed (%.2f%%)\n",
+            (unsigned int) block->start, block->length, block->runs,
+            block->executed, percentage(profile, block->executed)
+        );
+        for(size_t j = 0; j < block->length; j++) {
+            risky_ram_address_t address = (risky_ram_address_t) (
+                block->start + j * RISKY_INSTRUCTION_SIZE
+            );
+            risky_instruction_t instruction;
+            read_instruction(state, address, &instruction);
+            char text[RISKY_DISASSEMBLY_SIZE];
+            disassemble_instruction(&instruction, text, sizeof(text));
+            fprintf(
+                stream, "    0x%04x %16" PRIu64 "  %s\n",
+                (unsigned int) address, profile->counts[address], text
+            );
+        }
+    }
+    free(blocks);
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_profile_t, a pointer to the risky_vm_state_t it
+ * was collected from, the name of the program and a stream, write the profile
+ * to the stream in the collapsed stack format read by flame graph tools.
+ * Returns a status_t with error / success information
+ */
+status_t write_risky_profile_stacks(
+    const risky_profile_t * profile, const risky_vm_state_t * state,
+    const char * name, FILE * stream
+) {
+    risky_profile_block_t * blocks = NULL;
+    size_t count = 0;
+    status_t result = find_risky_profile_blocks(
+        profile, state, &blocks, &count
+    );
+    if(result != STATUS_SUCCESS) {
+        return result;
+    }
+    for(size_t i = 0; i < count; i++) {
+        risky_profile_block_t * block = &blocks[i];
+        for(size_t j = 0; j < block->length; j++) {
+            risky_ram_address_t address = (risky_ram_address_t) (
+                block->start + j * RISKY_INSTRUCTION_SIZE
+            );
+            risky_instruction_t instruction;
+            read_instruction(state, address, &instruction);
+            char text[RISKY_DISASSEMBLY_SIZE];
+            disassemble_instruction(&instruction, text, sizeof(text));
+            fprintf(
+                stream, "%s;block 0x%04x;0x%04x %s %" PRIu64 "\n", name,
+                (unsigned int) block->start, (unsigned int) address, text,
+                profile->counts[address]
+            );
+        }
+    }
+    free(blocks);
+    return (ferror(stream) == 0) ? STATUS_SUCCESS : STATUS_FAIL;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
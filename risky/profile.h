@@ -0,0 +1,119 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * profile - this compilation unit defines an instruction profile of a RISKY
+ * virtual machine, as collected by run_risky_vm_profiled(), and functions for
+ * reporting where a program spends its time in terms of its basic blocks.
+ */
+#ifndef SAXBOPHONE_RISKY_PROFILE_H
+#define SAXBOPHONE_RISKY_PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "core.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of RISKY opcodes
+#define RISKY_OPCODE_COUNT 32
+
+// profile struct, filled in by run_risky_vm_profiled()
+typedef struct risky_profile_t {
+    // number of times the instruction at each RAM address was executed
+    uint64_t * counts;
+    /*
+     * number of times execution arrived at each RAM address other than by
+     * falling through from the instruction before it
+     */
+    uint64_t * entries;
+    // number of times each opcode was executed
+    uint64_t opcodes[RISKY_OPCODE_COUNT];
+    // total number of instructions executed
+    uint64_t total;
+} risky_profile_t;
+
+// a basic block found in a profile, and how often it was executed
+typedef struct risky_profile_block_t {
+    // address of the first instruction of the block
+    risky_ram_address_t start;
+    // number of instructions in the block
+    size_t length;
+    // number of times the first instruction of the block was executed
+    uint64_t runs;
+    // number of instructions executed in the block altogether
+    uint64_t executed;
+} risky_profile_block_t;
+
+/*
+ * given a pointer to a risky_profile_t, allocate its storage, with every
+ * count zeroed.
+ * Returns a status_t with error / success information
+ */
+status_t init_risky_profile(risky_profile_t * profile);
+
+/*
+ * given a pointer to a risky_profile_t, free its storage.
+ * Returns a status_t with error / success information
+ */
+status_t free_risky_profile(risky_profile_t * profile);
+
+/*
+ * given a pointer to a risky_profile_t, a pointer to the risky_vm_state_t it
+ * was collected from, a pointer to a pointer to risky_profile_block_t and a
+ * pointer to a size_t, split the executed instructions into basic blocks and
+ * store a newly allocated array of them, hottest (most instructions executed)
+ * first, and the number of them. The caller must free() the array.
+ * A block starts wherever execution arrived other than by falling through,
+ * and ends at a JMP, BRA or HLT, or just before the start of another block.
+ * Instructions are read from the VM's RAM as it is now, so the blocks of code
+ * that modified itself are only approximate.
+ * Returns a status_t with error / success information
+ */
+status_t find_risky_profile_blocks(
+    const risky_profile_t * profile, const risky_vm_state_t * state,
+    risky_profile_block_t ** blocks, size_t * count
+);
+
+/*
+ * given a pointer to a risky_profile_t, a pointer to the risky_vm_state_t it
+ * was collected from, a number of blocks and a stream, print a report of the
+ * profile to the stream: how many times each opcode was executed, then that
+ * many of the hottest basic blocks, with the disassembly of each instruction
+ * and how many times it was executed.
+ * Returns a status_t with error / success information
+ */
+status_t print_risky_profile(
+    const risky_profile_t * profile, const risky_vm_state_t * state,
+    size_t top, FILE * stream
+);
+
+/*
+ * given a pointer to a risky_profile_t, a pointer to the risky_vm_state_t it
+ * was collected from, the name of the program and a stream, write the profile
+ * to the stream in the collapsed stack format read by flame graph tools: a
+ * line for each executed instruction, giving the program name, its basic
+ * block and the instruction as a stack of frames, then how many times it was
+ * executed.
+ * Returns a status_t with error / success information
+ */
+status_t write_risky_profile_stacks(
+    const risky_profile_t * profile, const risky_vm_state_t * state,
+    const char * name, FILE * stream
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+// end of header file
+#endif
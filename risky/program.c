@@ -0,0 +1,464 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * program - this compilation unit defines the versioned binary container
+ * format for RISKY programs, and functions for saving and loading it.
+ */
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "core.h"
+#include "packed.h"
+#include "program.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// the magic bytes every program starts with
+static const risky_byte_t MAGIC[4] = { 'R', 'S', 'K', 'Y', };
+
+// starting value and multiplier of the 32-bit FNV-1a checksum
+#define FNV_OFFSET_BASIS 0x811c9dc5U
+#define FNV_PRIME 0x01000193U
+
+/*
+ * private function - returns the checksum of the given bytes, continuing on
+ * from the given checksum
+ */
+static uint32_t checksum(
+    uint32_t hash, const risky_byte_t * bytes, size_t size
+) {
+    for(size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+// private function - reads a big-endian 16-bit number from the given bytes
+static uint16_t read_16(const risky_byte_t * bytes) {
+    return (uint16_t) ((bytes[0] << 8) | bytes[1]);
+}
+
+// private function - reads a big-endian 32-bit number from the given bytes
+static uint32_t read_32(const risky_byte_t * bytes) {
+    return (
+        ((uint32_t) bytes[0] << 24) | ((uint32_t) bytes[1] << 16) |
+        ((uint32_t) bytes[2] << 8) | (uint32_t) bytes[3]
+    );
+}
+
+// private function - writes a big-endian 16-bit number to the given bytes
+static void write_16(risky_byte_t * bytes, uint16_t value) {
+    bytes[0] = (risky_byte_t) (value >> 8);
+    bytes[1] = (risky_byte_t) (value & 0xffU);
+}
+
+// private function - writes a big-endian 32-bit number to the given bytes
+static void write_32(risky_byte_t * bytes, uint32_t value) {
+    write_16(bytes, (uint16_t) (value >> 16));
+    write_16(bytes + 2, (uint16_t) (value & 0xffffU));
+}
+
+/*
+ * private function - returns the number of instructions a predecoded section
+ * of the given code section holds, zero if it can't be predecoded
+ */
+static size_t predecoded_count(const risky_program_section_t * section) {
+    if(
+        section->type != RISKY_SECTION_CODE ||
+        section->address % RISKY_INSTRUCTION_SIZE != 0
+    ) {
+        return 0;
+    }
+    return section->size / RISKY_INSTRUCTION_SIZE;
+}
+
+/*
+ * private function - writes a predecoded section of the given number of
+ * instructions in the VM's RAM from the given address to the given bytes.
+ * Returns a status_t with error / success information
+ */
+static status_t write_predecoded(
+    risky_vm_state_t * state, risky_ram_address_t address, size_t count,
+    risky_byte_t * bytes
+) {
+    write_32(
+        bytes,
+        checksum(
+            FNV_OFFSET_BASIS, state->ram + address,
+            count * RISKY_INSTRUCTION_SIZE
+        )
+    );
+    bytes += 4;
+    for(size_t i = 0; i < count; i++) {
+        risky_raw_instruction_t raw;
+        memcpy(
+            raw.bytes, state->ram + address + i * RISKY_INSTRUCTION_SIZE,
+            RISKY_INSTRUCTION_SIZE
+        );
+        risky_packed_instruction_t packed;
+        status_t result = decode_packed_instruction_from_raw(&raw, &packed);
+        if(result != STATUS_SUCCESS) {
+            return result;
+        }
+        bytes[0] = packed.operation;
+        bytes[1] = packed.r;
+        bytes[2] = packed.a;
+        bytes[3] = packed.b;
+        write_16(bytes + 4, packed.l);
+        bytes[6] = bytes[7] = 0x00U;
+        bytes += RISKY_PROGRAM_PREDECODED_SIZE;
+    }
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to some bytes and the number of them, returns whether they
+ * start with the magic bytes of a program
+ */
+bool is_risky_program(const risky_byte_t * bytes, size_t size) {
+    return size >= sizeof(MAGIC) && memcmp(bytes, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+/*
+ * given a pointer to an initialised risky_vm_state_t, a pointer to an array
+ * of risky_program_section_t and the number of them, a flag for whether to
+ * predecode the code sections and a pointer to a pointer to risky_byte_t and
+ * a pointer to size_t, encode a program of the given ranges of the VM's RAM.
+ * Returns a status_t with error / success information
+ */
+status_t encode_risky_program(
+    risky_vm_state_t * state,
+    const risky_program_section_t * sections, size_t count, bool predecode,
+    risky_byte_t ** bytes, size_t * size
+) {
+    // work out how big the program will be
+    size_t table_count = count;
+    size_t data_size = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(
+            (
+                sections[i].type != RISKY_SECTION_CODE &&
+                sections[i].type != RISKY_SECTION_DATA
+            ) ||
+            sections[i].size >
+            (size_t) RISKY_RAM_AMOUNT - sections[i].address
+        ) {
+            return STATUS_FAIL;
+        }
+        data_size += sections[i].size;
+        if(predecode && predecoded_count(&sections[i]) != 0) {
+            table_count++;
+            data_size += (
+                4 + predecoded_count(&sections[i]) *
+                RISKY_PROGRAM_PREDECODED_SIZE
+            );
+        }
+    }
+    if(table_count > UINT16_MAX) {
+        return STATUS_FAIL;
+    }
+    size_t payload_size = table_count * RISKY_PROGRAM_SECTION_SIZE + data_size;
+    risky_byte_t * program = (risky_byte_t *) malloc(
+        RISKY_PROGRAM_HEADER_SIZE + payload_size
+    );
+    if(program == NULL) {
+        return MALLOC_REFUSED;
+    }
+    // fill in the section table and data together
+    risky_byte_t * entry = program + RISKY_PROGRAM_HEADER_SIZE;
+    risky_byte_t * data = entry + table_count * RISKY_PROGRAM_SECTION_SIZE;
+    for(size_t i = 0; i < count; i++) {
+        entry[0] = (risky_byte_t) sections[i].type;
+        entry[1] = 0x00U;
+        write_16(entry + 2, sections[i].address);
+        write_32(entry + 4, (uint32_t) sections[i].size);
+        entry += RISKY_PROGRAM_SECTION_SIZE;
+        memcpy(data, state->ram + sections[i].address, sections[i].size);
+        data += sections[i].size;
+        size_t instructions = predecoded_count(&sections[i]);
+        if(!predecode || instructions == 0) {
+            continue;
+        }
+        size_t predecoded_size = (
+            4 + instructions * RISKY_PROGRAM_PREDECODED_SIZE
+        );
+        entry[0] = (risky_byte_t) RISKY_SECTION_PREDECODED;
+        entry[1] = 0x00U;
+        write_16(entry + 2, sections[i].address);
+        write_32(entry + 4, (uint32_t) predecoded_size);
+        entry += RISKY_PROGRAM_SECTION_SIZE;
+        status_t result = write_predecoded(
+            state, sections[i].address, instructions, data
+        );
+        if(result != STATUS_SUCCESS) {
+            free(program);
+            return result;
+        }
+        data += predecoded_size;
+    }
+    // the header goes last, as it holds the checksum of everything else
+    memcpy(program, MAGIC, sizeof(MAGIC));
+    program[4] = VERSION.major;
+    program[5] = VERSION.minor;
+    program[6] = VERSION.patch;
+    program[7] = 0x00U;
+    write_16(program + 8, state->program_counter);
+    write_16(program + 10, (uint16_t) table_count);
+    write_32(program + 12, (uint32_t) payload_size);
+    write_32(
+        program + 16,
+        checksum(
+            FNV_OFFSET_BASIS, program + RISKY_PROGRAM_HEADER_SIZE,
+            payload_size
+        )
+    );
+    *bytes = program;
+    *size = RISKY_PROGRAM_HEADER_SIZE + payload_size;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * private function - given a pointer to the section table of a program, the
+ * number of sections and the number of bytes of section data, returns whether
+ * every section is valid and the sizes add up
+ */
+static bool valid_section_table(
+    const risky_byte_t * table, size_t count, size_t data_size
+) {
+    size_t total = 0;
+    for(size_t i = 0; i < count; i++) {
+        const risky_byte_t * entry = table + i * RISKY_PROGRAM_SECTION_SIZE;
+        size_t address = read_16(entry + 2);
+        size_t size = read_32(entry + 4);
+        switch(entry[0]) {
+            case RISKY_SECTION_CODE:
+            case RISKY_SECTION_DATA:
+                if(size > (size_t) RISKY_RAM_AMOUNT - address) {
+                    return false;
+                }
+                break;
+            case RISKY_SECTION_PREDECODED:
+                if(
+                    address % RISKY_INSTRUCTION_SIZE != 0 || size < 4 ||
+                    (size - 4) % RISKY_PROGRAM_PREDECODED_SIZE != 0 ||
+                    (size - 4) / RISKY_PROGRAM_PREDECODED_SIZE >
+                    ((size_t) RISKY_RAM_AMOUNT - address) /
+                    RISKY_INSTRUCTION_SIZE
+                ) {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+        if(size > data_size - total) {
+            return false;
+        }
+        total += size;
+    }
+    return total == data_size;
+}
+
+/*
+ * private function - given a pointer to an initialised risky_vm_state_t, the
+ * load address and data of a predecoded section, its size, whether it may be
+ * used and the checksum so far, stores its instructions in the VM's cache if
+ * they are usable and still match RAM.
+ * Returns the checksum continued over the section's data, and stores whether
+ * the instructions were used in the given bool
+ */
+static uint32_t load_predecoded(
+    risky_vm_state_t * state, risky_ram_address_t address,
+    const risky_byte_t * data, size_t size, bool usable, bool * used,
+    uint32_t hash
+) {
+    size_t count = (size - 4) / RISKY_PROGRAM_PREDECODED_SIZE;
+    *used = usable && read_32(data) == checksum(
+        FNV_OFFSET_BASIS, state->ram + address, count * RISKY_INSTRUCTION_SIZE
+    );
+    hash = checksum(hash, data, 4);
+    data += 4;
+    for(size_t i = 0; i < count; i++) {
+        hash = checksum(hash, data, RISKY_PROGRAM_PREDECODED_SIZE);
+        if(*used) {
+            risky_packed_instruction_t packed = {
+                .operation = data[0],
+                .r = data[1], .a = data[2], .b = data[3],
+                .l = read_16(data + 4),
+                .fused = 0, .reserved = 0,
+            };
+            risky_ram_address_t slot = (risky_ram_address_t) (
+                address + i * RISKY_INSTRUCTION_SIZE
+            );
+            if(
+                prime_cached_instruction(state, slot, &packed) !=
+                STATUS_SUCCESS
+            ) {
+                // the rest are decoded as usual
+                *used = false;
+            }
+        }
+        data += RISKY_PROGRAM_PREDECODED_SIZE;
+    }
+    return hash;
+}
+
+/*
+ * given a pointer to an initialised risky_vm_state_t, a pointer to the bytes
+ * of a program and the number of them, and a pointer to a bool (or NULL),
+ * load the program into the VM in a single pass over it.
+ * Returns a status_t with error / success information
+ */
+status_t decode_risky_program(
+    risky_vm_state_t * state, const risky_byte_t * bytes, size_t size,
+    bool * predecoded
+) {
+    if(
+        size < RISKY_PROGRAM_HEADER_SIZE || !is_risky_program(bytes, size) ||
+        bytes[4] != VERSION.major
+    ) {
+        return STATUS_FAIL;
+    }
+    // predecoded instructions are only trusted from this exact version
+    bool usable = bytes[5] == VERSION.minor && bytes[6] == VERSION.patch;
+    size_t count = read_16(bytes + 10);
+    size_t payload_size = read_32(bytes + 12);
+    const risky_byte_t * table = bytes + RISKY_PROGRAM_HEADER_SIZE;
+    if(
+        payload_size != size - RISKY_PROGRAM_HEADER_SIZE ||
+        payload_size < count * RISKY_PROGRAM_SECTION_SIZE ||
+        !valid_section_table(
+            table, count, payload_size - count * RISKY_PROGRAM_SECTION_SIZE
+        )
+    ) {
+        return STATUS_FAIL;
+    }
+    // the table is checked, now copy and check the data in the same pass
+    invalidate_instruction_cache(state);
+    bool any_used = false;
+    uint32_t hash = checksum(
+        FNV_OFFSET_BASIS, table, count * RISKY_PROGRAM_SECTION_SIZE
+    );
+    const risky_byte_t * data = table + count * RISKY_PROGRAM_SECTION_SIZE;
+    for(size_t i = 0; i < count; i++) {
+        const risky_byte_t * entry = table + i * RISKY_PROGRAM_SECTION_SIZE;
+        risky_ram_address_t address = read_16(entry + 2);
+        size_t section_size = read_32(entry + 4);
+        if(entry[0] == RISKY_SECTION_PREDECODED) {
+            bool used;
+            hash = load_predecoded(
+                state, address, data, section_size, usable, &used, hash
+            );
+            any_used = any_used || used;
+        } else {
+            risky_byte_t * ram = state->ram + address;
+            for(size_t j = 0; j < section_size; j++) {
+                ram[j] = data[j];
+                hash = (hash ^ data[j]) * FNV_PRIME;
+            }
+            // this may overwrite instructions already predecoded
+            invalidate_cached_instructions(state, address, section_size);
+        }
+        data += section_size;
+    }
+    if(hash != read_32(bytes + 16)) {
+        memset(state->ram, 0, RISKY_RAM_AMOUNT);
+        invalidate_instruction_cache(state);
+        return STATUS_FAIL;
+    }
+    state->program_counter = read_16(bytes + 8);
+    if(predecoded != NULL) {
+        *predecoded = any_used;
+    }
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to an initialised risky_vm_state_t, a pointer to an array
+ * of risky_program_section_t, the number of them, a flag for whether to
+ * predecode the code sections and a path to a file, save a program of the
+ * given ranges of the VM's RAM to the file.
+ * Returns a status_t with error / success information
+ */
+status_t save_risky_program(
+    risky_vm_state_t * state,
+    const risky_program_section_t * sections, size_t count, bool predecode,
+    const char * path
+) {
+    risky_byte_t * bytes;
+    size_t size;
+    status_t result = encode_risky_program(
+        state, sections, count, predecode, &bytes, &size
+    );
+    if(result != STATUS_SUCCESS) {
+        return result;
+    }
+    FILE * file = fopen(path, "wb");
+    if(file == NULL) {
+        free(bytes);
+        return STATUS_FAIL;
+    }
+    bool written = fwrite(bytes, 1, size, file) == size;
+    free(bytes);
+    if(fclose(file) != 0 || !written) {
+        return STATUS_FAIL;
+    }
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to an initialised risky_vm_state_t, a path to a file and a
+ * pointer to a bool (or NULL), map the file and load the program it holds
+ * into the VM.
+ * Returns a status_t with error / success information
+ */
+status_t load_risky_program(
+    risky_vm_state_t * state, const char * path, bool * predecoded
+) {
+    int descriptor = open(path, O_RDONLY | O_CLOEXEC);
+    if(descriptor == -1) {
+        return STATUS_FAIL;
+    }
+    struct stat status;
+    if(
+        fstat(descriptor, &status) != 0 ||
+        status.st_size < RISKY_PROGRAM_HEADER_SIZE
+    ) {
+        close(descriptor);
+        return STATUS_FAIL;
+    }
+    size_t size = (size_t) status.st_size;
+    void * mapping = mmap(
+        NULL, size, PROT_READ, MAP_PRIVATE, descriptor, 0
+    );
+    close(descriptor);
+    if(mapping == MAP_FAILED) {
+        return STATUS_FAIL;
+    }
+    status_t result = decode_risky_program(
+        state, (const risky_byte_t *) mapping, size, predecoded
+    );
+    munmap(mapping, size);
+    return result;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
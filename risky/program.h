@@ -0,0 +1,150 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * program - this compilation unit defines the versioned binary container
+ * format for RISKY programs, and functions for saving and loading it.
+ *
+ * All numbers are big-endian. A program starts with a header:
+ *
+ *   offset  size  field
+ *        0     4  magic, the bytes "RSKY"
+ *        4     3  VERSION of RISKY the program was saved with: major, minor,
+ *                 patch
+ *        7     1  reserved, zero
+ *        8     2  entry point, the initial program counter
+ *       10     2  number of sections
+ *       12     4  number of bytes after the header (the payload)
+ *       16     4  checksum of the payload (32-bit FNV-1a)
+ *
+ * followed by the payload: a table of sections, eight bytes each:
+ *
+ *        0     1  section type (a risky_section_type_t)
+ *        1     1  reserved, zero
+ *        2     2  load address in RAM
+ *        4     4  number of bytes of section data
+ *
+ * followed by the data of each section in the same order as the table.
+ * Code and data sections are copied to RAM at their load address. A
+ * predecoded section holds the packed form (see the packed module) of the
+ * instructions in each 4-byte slot of RAM from its load address, preceded by
+ * the 32-bit FNV-1a checksum of the bytes of RAM they were decoded from. Each
+ * packed instruction is stored as its operation, r, a and b bytes, then l,
+ * then two zero bytes.
+ */
+#ifndef SAXBOPHONE_RISKY_PROGRAM_H
+#define SAXBOPHONE_RISKY_PROGRAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// size of the header of a program, in bytes
+#define RISKY_PROGRAM_HEADER_SIZE 20
+// size of each entry in the section table of a program, in bytes
+#define RISKY_PROGRAM_SECTION_SIZE 8
+// size of each instruction in a predecoded section, in bytes
+#define RISKY_PROGRAM_PREDECODED_SIZE 8
+
+// types of section in a program
+typedef enum risky_section_type_t {
+    RISKY_SECTION_CODE = 1,
+    RISKY_SECTION_DATA,
+    RISKY_SECTION_PREDECODED,
+} risky_section_type_t;
+
+// a range of RAM to save as a code or data section of a program
+typedef struct risky_program_section_t {
+    // RISKY_SECTION_CODE or RISKY_SECTION_DATA
+    risky_section_type_t type;
+    // address of the first byte of the section
+    risky_ram_address_t address;
+    // number of bytes in the section, which must not run past the end of RAM
+    size_t size;
+} risky_program_section_t;
+
+/*
+ * given a pointer to some bytes and the number of them, returns whether they
+ * start with the magic bytes of a program
+ */
+bool is_risky_program(const risky_byte_t * bytes, size_t size);
+
+/*
+ * given a pointer to an initialised risky_vm_state_t, a pointer to an array
+ * of risky_program_section_t and the number of them, a flag for whether to
+ * predecode the code sections and a pointer to a pointer to risky_byte_t and
+ * a pointer to size_t, encode a program of the given ranges of the VM's RAM,
+ * with its program counter as the entry point. If predecode is true, each
+ * code section at a 4-byte aligned address is followed by a predecoded
+ * section holding its decoded instructions.
+ * A pointer to the program (which the caller must free()) and its size in
+ * bytes are stored at the last two given addresses.
+ * Returns a status_t with error / success information
+ */
+status_t encode_risky_program(
+    risky_vm_state_t * state,
+    const risky_program_section_t * sections, size_t count, bool predecode,
+    risky_byte_t ** bytes, size_t * size
+);
+
+/*
+ * given a pointer to an initialised risky_vm_state_t, a pointer to the bytes
+ * of a program and the number of them, and a pointer to a bool (or NULL),
+ * load the program into the VM in a single pass over it: its sections are
+ * copied over the VM's RAM and its program counter set to the entry point.
+ * Programs saved with a different major VERSION are rejected.
+ * The instructions of a predecoded section are stored straight into the VM's
+ * instruction cache, so they never need decoding. They are only used if the
+ * program was saved with exactly this VERSION of RISKY and RAM still holds
+ * the bytes they were decoded from, otherwise they are ignored and the
+ * instructions are decoded as they are fetched as usual. Whether any were
+ * used is stored in the bool, if given.
+ * If the program is invalid, the VM's RAM may have been partly written to:
+ * it is cleared to zeroes if the checksum doesn't match.
+ * Returns a status_t with error / success information
+ */
+status_t decode_risky_program(
+    risky_vm_state_t * state, const risky_byte_t * bytes, size_t size,
+    bool * predecoded
+);
+
+/*
+ * given a pointer to an initialised risky_vm_state_t, a pointer to an array
+ * of risky_program_section_t, the number of them, a flag for whether to
+ * predecode the code sections and a path to a file, save a program of the
+ * given ranges of the VM's RAM to the file, as encode_risky_program() does.
+ * Returns a status_t with error / success information
+ */
+status_t save_risky_program(
+    risky_vm_state_t * state,
+    const risky_program_section_t * sections, size_t count, bool predecode,
+    const char * path
+);
+
+/*
+ * given a pointer to an initialised risky_vm_state_t, a path to a file and a
+ * pointer to a bool (or NULL), map the file and load the program it holds
+ * into the VM, as decode_risky_program() does.
+ * Returns a status_t with error / success information
+ */
+status_t load_risky_program(
+    risky_vm_state_t * state, const char * path, bool * predecoded
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+// end of header file
+#endif
@@ -0,0 +1,231 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * replay - this compilation unit defines logs of the data channel input of a
+ * RISKY virtual machine, so that a run can be recorded and then repeated
+ * exactly without the sources the input came from.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core.h"
+#include "replay.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// the magic bytes every log file starts with
+static const risky_byte_t REPLAY_MAGIC[4] = { 'R', 'R', 'P', 'L', };
+
+// largest number of bytes one event takes up when encoded
+#define MAX_EVENT_SIZE 14U
+// number of bytes of events allocated for a log at first
+#define INITIAL_CAPACITY 4096U
+
+/*
+ * given a pointer to a risky_replay_log_t, initialise it with no events.
+ * Returns a status_t with error / success information
+ */
+status_t init_risky_replay_log(risky_replay_log_t * log) {
+    *log = (risky_replay_log_t) {
+        .bytes = NULL, .size = 0, .capacity = 0, .position = 0, .last = 0,
+        .executed = 0,
+    };
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_replay_log_t, free its storage.
+ * Returns a status_t with error / success information
+ */
+status_t free_risky_replay_log(risky_replay_log_t * log) {
+    free(log->bytes);
+    return init_risky_replay_log(log);
+}
+
+/*
+ * given a pointer to a risky_replay_log_t, go back to the start of its events.
+ * Returns a status_t with error / success information
+ */
+status_t rewind_risky_replay_log(risky_replay_log_t * log) {
+    log->position = 0;
+    log->last = 0;
+    log->executed = 0;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_replay_log_t and a pointer to a
+ * risky_replay_event_t, append the event to the log.
+ * Returns a status_t with error / success information
+ */
+status_t append_risky_replay_event(
+    risky_replay_log_t * log, const risky_replay_event_t * event
+) {
+    if(event->count < log->last) {
+        return STATUS_FAIL;
+    }
+    // grow the storage by doubling it, so appending takes constant time
+    if(log->capacity - log->size < MAX_EVENT_SIZE) {
+        size_t capacity =
+            (log->capacity == 0) ? INITIAL_CAPACITY : log->capacity * 2;
+        risky_byte_t * bytes = (risky_byte_t *) realloc(log->bytes, capacity);
+        if(bytes == NULL) {
+            return MALLOC_REFUSED;
+        }
+        log->bytes = bytes;
+        log->capacity = capacity;
+    }
+    risky_byte_t * cursor = &log->bytes[log->size];
+    uint64_t delta = event->count - log->last;
+    // seven bits at a time, the top bit set on all but the last byte
+    do {
+        risky_byte_t bits = (risky_byte_t) (delta & 0x7fU);
+        delta >>= 7;
+        *cursor++ = (delta != 0) ? (bits | 0x80U) : bits;
+    } while(delta != 0);
+    *cursor++ = (risky_byte_t) event->opcode;
+    *cursor++ = event->channel;
+    if(event->opcode == REA) {
+        *cursor++ = (risky_byte_t) (event->value >> 8);
+    }
+    *cursor++ = (risky_byte_t) event->value;
+    log->size = (size_t) (cursor - log->bytes);
+    log->last = event->count;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_replay_log_t and a pointer to a
+ * risky_replay_event_t, decode the next event to be replayed from the log
+ * into it and move on to the one after.
+ * Returns a status_t with error / success information
+ */
+status_t next_risky_replay_event(
+    risky_replay_log_t * log, risky_replay_event_t * event
+) {
+    size_t position = log->position;
+    uint64_t delta = 0;
+    for(unsigned int shift = 0; ; shift += 7) {
+        if(position == log->size || shift > 63) {
+            return STATUS_FAIL;
+        }
+        risky_byte_t bits = log->bytes[position++];
+        delta |= (uint64_t) (bits & 0x7fU) << shift;
+        if(!(bits & 0x80U)) {
+            break;
+        }
+    }
+    if(log->size - position < 2) {
+        return STATUS_FAIL;
+    }
+    event->opcode = (risky_opcode_t) log->bytes[position++];
+    event->channel = log->bytes[position++];
+    if(event->opcode == REA) {
+        if(log->size - position < 2) {
+            return STATUS_FAIL;
+        }
+        event->value = (risky_word_t) (log->bytes[position] << 8);
+        event->value |= log->bytes[position + 1];
+        position += 2;
+    } else if(event->opcode == QDC) {
+        if(position == log->size) {
+            return STATUS_FAIL;
+        }
+        event->value = log->bytes[position++];
+    } else {
+        return STATUS_FAIL;
+    }
+    event->count = log->last + delta;
+    log->last = event->count;
+    log->position = position;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_replay_log_t and the path of a file, write the
+ * log's events to the file, with a header.
+ * Returns a status_t with error / success information
+ */
+status_t save_risky_replay_log(
+    const risky_replay_log_t * log, const char * path
+) {
+    const risky_byte_t header[RISKY_REPLAY_HEADER_SIZE] = {
+        REPLAY_MAGIC[0], REPLAY_MAGIC[1], REPLAY_MAGIC[2], REPLAY_MAGIC[3],
+        RISKY_REPLAY_VERSION_MAJOR, RISKY_REPLAY_VERSION_MINOR, 0, 0,
+    };
+    FILE * file = fopen(path, "wb");
+    if(file == NULL) {
+        return STATUS_FAIL;
+    }
+    bool written = (
+        fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+        fwrite(log->bytes, 1, log->size, file) == log->size
+    );
+    if(fclose(file) != 0 || !written) {
+        return STATUS_FAIL;
+    }
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_replay_log_t and the path of a file, initialise
+ * the log with the events saved in the file, ready to be replayed from the
+ * first one.
+ * Returns a status_t with error / success information
+ */
+status_t load_risky_replay_log(risky_replay_log_t * log, const char * path) {
+    init_risky_replay_log(log);
+    FILE * file = fopen(path, "rb");
+    if(file == NULL) {
+        return STATUS_FAIL;
+    }
+    risky_byte_t header[RISKY_REPLAY_HEADER_SIZE];
+    long end = -1;
+    if(
+        fread(header, 1, sizeof(header), file) == sizeof(header) &&
+        memcmp(header, REPLAY_MAGIC, sizeof(REPLAY_MAGIC)) == 0 &&
+        header[4] == RISKY_REPLAY_VERSION_MAJOR &&
+        fseek(file, 0, SEEK_END) == 0
+    ) {
+        end = ftell(file);
+    }
+    if(end < RISKY_REPLAY_HEADER_SIZE) {
+        fclose(file);
+        return STATUS_FAIL;
+    }
+    size_t size = (size_t) end - RISKY_REPLAY_HEADER_SIZE;
+    // one spare byte, so an empty log still has some storage
+    log->bytes = (risky_byte_t *) malloc(size + 1);
+    if(log->bytes == NULL) {
+        fclose(file);
+        return MALLOC_REFUSED;
+    }
+    log->capacity = size + 1;
+    bool read = (
+        fseek(file, RISKY_REPLAY_HEADER_SIZE, SEEK_SET) == 0 &&
+        fread(log->bytes, 1, size, file) == size
+    );
+    fclose(file);
+    if(!read) {
+        free_risky_replay_log(log);
+        return STATUS_FAIL;
+    }
+    log->size = size;
+    return STATUS_SUCCESS;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
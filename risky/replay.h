@@ -0,0 +1,135 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * replay - this compilation unit defines logs of the data channel input of a
+ * RISKY virtual machine: run_risky_vm_recorded() logs the result of every REA
+ * and QDC instruction executed, along with the number of instructions executed
+ * before it, and run_risky_vm_replayed() feeds those results back, so that the
+ * run can be repeated exactly without the sources the input came from.
+ *
+ * A log file starts with an 8-byte header: the magic bytes "RRPL", the major
+ * and minor version of the log format and two reserved bytes. Each event
+ * follows as the number of instructions executed since the event before it
+ * (as an unsigned LEB128 number), the opcode of the instruction, the number of
+ * its channel, then the result: two big-endian bytes for REA, one for QDC.
+ */
+#ifndef SAXBOPHONE_RISKY_REPLAY_H
+#define SAXBOPHONE_RISKY_REPLAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// version of the log file format
+#define RISKY_REPLAY_VERSION_MAJOR 1
+#define RISKY_REPLAY_VERSION_MINOR 0
+// size of the header at the start of a log file, in bytes
+#define RISKY_REPLAY_HEADER_SIZE 8
+
+// one REA or QDC instruction executed, and its result
+typedef struct risky_replay_event_t {
+    // number of instructions executed before it since recording began
+    uint64_t count;
+    // REA or QDC
+    risky_opcode_t opcode;
+    // the channel it read or queried
+    risky_channel_t channel;
+    // the value it stored in its register
+    risky_word_t value;
+} risky_replay_event_t;
+
+// replay log struct, the encoded events one after the other
+typedef struct risky_replay_log_t {
+    // the encoded events
+    risky_byte_t * bytes;
+    // number of bytes of events
+    size_t size;
+    // number of bytes allocated for them
+    size_t capacity;
+    // offset of the next event to be replayed
+    size_t position;
+    // instruction count of the last event appended or replayed
+    uint64_t last;
+    /*
+     * number of instructions executed so far by the runs recording or
+     * replaying the log, so that a VM which stopped can be resumed
+     */
+    uint64_t executed;
+} risky_replay_log_t;
+
+/*
+ * given a pointer to a risky_replay_log_t, initialise it with no events.
+ * Returns a status_t with error / success information
+ */
+status_t init_risky_replay_log(risky_replay_log_t * log);
+
+/*
+ * given a pointer to a risky_replay_log_t, free its storage.
+ * Returns a status_t with error / success information
+ */
+status_t free_risky_replay_log(risky_replay_log_t * log);
+
+/*
+ * given a pointer to a risky_replay_log_t, go back to the start of its events,
+ * so that the run they were recorded from can be replayed from the beginning.
+ * Returns a status_t with error / success information
+ */
+status_t rewind_risky_replay_log(risky_replay_log_t * log);
+
+/*
+ * given a pointer to a risky_replay_log_t and a pointer to a
+ * risky_replay_event_t, which must not have happened before the last event in
+ * the log, append the event to the log.
+ * Returns a status_t with error / success information
+ */
+status_t append_risky_replay_event(
+    risky_replay_log_t * log, const risky_replay_event_t * event
+);
+
+/*
+ * given a pointer to a risky_replay_log_t and a pointer to a
+ * risky_replay_event_t, decode the next event to be replayed from the log
+ * into it and move on to the one after.
+ * Returns a status_t with error / success information, failing if there are
+ * no more events or the next one is malformed
+ */
+status_t next_risky_replay_event(
+    risky_replay_log_t * log, risky_replay_event_t * event
+);
+
+/*
+ * given a pointer to a risky_replay_log_t and the path of a file, write the
+ * log's events to the file, with a header.
+ * Returns a status_t with error / success information
+ */
+status_t save_risky_replay_log(
+    const risky_replay_log_t * log, const char * path
+);
+
+/*
+ * given a pointer to a risky_replay_log_t and the path of a file, initialise
+ * the log with the events saved in the file, ready to be replayed from the
+ * first one.
+ * Returns a status_t with error / success information, failing if the file
+ * isn't a log of a version this can read
+ */
+status_t load_risky_replay_log(risky_replay_log_t * log, const char * path);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+// end of header file
+#endif
@@ -43,6 +43,8 @@ typedef uint16_t risky_word_t;
 #define RISKY_REGISTER_COUNT 256
 // amount of RAM the RISKY VM has, in bytes
 #define RISKY_RAM_AMOUNT 65536
+// number of data channels
+#define RISKY_CHANNEL_COUNT 256
 
 extern const version_t VERSION;
 
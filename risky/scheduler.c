@@ -0,0 +1,570 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * scheduler - this compilation unit defines a scheduler which runs many RISKY
+ * virtual machines on a pool of worker threads, giving each VM a quantum of
+ * instructions at a time and balancing the VMs between workers by stealing.
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "core.h"
+#include "interpreter.h"
+#include "risky.h"
+#include "scheduler.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// the scheduling states a VM moves between
+enum {
+    // in a worker's queue or the woken queue, waiting to be run
+    TASK_QUEUED = 0,
+    // being run by a worker
+    TASK_RUNNING,
+    // being run by a worker, and woken up while it was running
+    TASK_WOKEN,
+    // blocked on a data channel, waiting to be woken up
+    TASK_PARKED,
+    // halted (or failed), and never run again
+    TASK_HALTED,
+};
+
+/*
+ * each worker owns a work-stealing deque (Chase and Lev, with the memory
+ * orderings of Le et al.). The owner pushes and takes VMs at the bottom while
+ * any other worker may steal them from the top. Every VM is in at most one
+ * queue at once, so each queue has room for all of them and never grows.
+ */
+typedef struct risky_worker_t {
+    int64_t top;
+    risky_byte_t top_padding[RISKY_CACHE_LINE - sizeof(int64_t)];
+    int64_t bottom;
+    risky_byte_t bottom_padding[RISKY_CACHE_LINE - sizeof(int64_t)];
+    // the queued VM indices, a power of two of them
+    size_t * slots;
+    size_t mask;
+    // counters, written only by the worker itself but read at any time
+    risky_worker_stats_t stats;
+    // state used for choosing which worker to steal from next
+    uint64_t random;
+    risky_scheduler_t * scheduler;
+    pthread_t thread;
+    risky_byte_t padding[RISKY_CACHE_LINE];
+} risky_worker_t;
+
+// results of trying to take a VM from a queue
+typedef enum queue_result_t {
+    QUEUE_EMPTY,
+    QUEUE_TAKEN,
+    // another worker took the VM first, so the queue may not be empty
+    QUEUE_CONTENDED,
+} queue_result_t;
+
+// private function - returns the current time in nanoseconds
+static uint64_t nanoseconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000U + (uint64_t) now.tv_nsec;
+}
+
+/*
+ * private function - adds to one of a worker's counters. Only the worker
+ * writes them, so this doesn't need to be an atomic read-modify-write
+ */
+static void add_stat(uint64_t * counter, uint64_t amount) {
+    __atomic_store_n(
+        counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + amount,
+        __ATOMIC_RELAXED
+    );
+}
+
+// private function - pushes a VM onto the bottom of a worker's own queue
+static void push_task(risky_worker_t * worker, size_t task) {
+    int64_t bottom = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED);
+    __atomic_store_n(
+        &worker->slots[(size_t) bottom & worker->mask], task, __ATOMIC_RELAXED
+    );
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELAXED);
+}
+
+// private function - takes a VM from the bottom of a worker's own queue
+static queue_result_t take_task(risky_worker_t * worker, size_t * task) {
+    int64_t bottom = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&worker->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t top = __atomic_load_n(&worker->top, __ATOMIC_RELAXED);
+    if(top > bottom) {
+        __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return QUEUE_EMPTY;
+    }
+    *task = __atomic_load_n(
+        &worker->slots[(size_t) bottom & worker->mask], __ATOMIC_RELAXED
+    );
+    if(top == bottom) {
+        // the last VM in the queue, which a thief may be stealing too
+        bool won = __atomic_compare_exchange_n(
+            &worker->top, &top, top + 1, false,
+            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED
+        );
+        __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return won ? QUEUE_TAKEN : QUEUE_EMPTY;
+    }
+    return QUEUE_TAKEN;
+}
+
+// private function - steals a VM from the top of another worker's queue
+static queue_result_t steal_task(risky_worker_t * victim, size_t * task) {
+    int64_t top = __atomic_load_n(&victim->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t bottom = __atomic_load_n(&victim->bottom, __ATOMIC_ACQUIRE);
+    if(top >= bottom) {
+        return QUEUE_EMPTY;
+    }
+    *task = __atomic_load_n(
+        &victim->slots[(size_t) top & victim->mask], __ATOMIC_RELAXED
+    );
+    if(
+        !__atomic_compare_exchange_n(
+            &victim->top, &top, top + 1, false,
+            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED
+        )
+    ) {
+        return QUEUE_CONTENDED;
+    }
+    return QUEUE_TAKEN;
+}
+
+// private function - returns whether any VM is waiting in any queue
+static bool is_work_queued(risky_scheduler_t * scheduler) {
+    if(__atomic_load_n(&scheduler->woken_count, __ATOMIC_SEQ_CST) != 0) {
+        return true;
+    }
+    for(size_t i = 0; i < scheduler->worker_count; i++) {
+        risky_worker_t * worker = &scheduler->workers[i];
+        if(
+            __atomic_load_n(&worker->top, __ATOMIC_SEQ_CST) <
+            __atomic_load_n(&worker->bottom, __ATOMIC_SEQ_CST)
+        ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * private function - wakes up one sleeping worker, if there are any, after a
+ * VM has been queued
+ */
+static void notify_worker(risky_scheduler_t * scheduler) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&scheduler->sleeping, __ATOMIC_SEQ_CST) != 0) {
+        pthread_mutex_lock(&scheduler->lock);
+        pthread_cond_signal(&scheduler->wakeup);
+        pthread_mutex_unlock(&scheduler->lock);
+    }
+}
+
+/*
+ * private function - called when a VM stops being queued or run, which wakes
+ * up every sleeping worker if that was the last one so that the run can end
+ */
+static void deactivate_task(risky_scheduler_t * scheduler) {
+    if(__atomic_sub_fetch(&scheduler->active, 1, __ATOMIC_SEQ_CST) == 0) {
+        pthread_mutex_lock(&scheduler->lock);
+        pthread_cond_broadcast(&scheduler->wakeup);
+        pthread_mutex_unlock(&scheduler->lock);
+    }
+}
+
+// private function - returns the next random number for a worker
+static uint64_t next_random(risky_worker_t * worker) {
+    // xorshift64
+    worker->random ^= worker->random << 13;
+    worker->random ^= worker->random >> 7;
+    worker->random ^= worker->random << 17;
+    return worker->random;
+}
+
+/*
+ * private function - finds a VM for a worker to run, looking in its own queue
+ * first, then for VMs which have been woken up, and then in the queues of the
+ * other workers, starting from a random one.
+ * Returns whether a VM was found
+ */
+static bool find_task(risky_worker_t * worker, size_t * task) {
+    risky_scheduler_t * scheduler = worker->scheduler;
+    if(take_task(worker, task) == QUEUE_TAKEN) {
+        return true;
+    }
+    if(__atomic_load_n(&scheduler->woken_count, __ATOMIC_ACQUIRE) != 0) {
+        bool found = false;
+        pthread_mutex_lock(&scheduler->lock);
+        if(scheduler->woken_count != 0) {
+            size_t woken_count = scheduler->woken_count - 1;
+            *task = scheduler->woken[woken_count];
+            __atomic_store_n(
+                &scheduler->woken_count, woken_count, __ATOMIC_SEQ_CST
+            );
+            found = true;
+        }
+        pthread_mutex_unlock(&scheduler->lock);
+        if(found) {
+            return true;
+        }
+    }
+    bool contended;
+    do {
+        contended = false;
+        size_t first = (size_t) (next_random(worker) % scheduler->worker_count);
+        for(size_t i = 0; i < scheduler->worker_count; i++) {
+            risky_worker_t * victim = &scheduler->workers[
+                (first + i) % scheduler->worker_count
+            ];
+            if(victim == worker) {
+                continue;
+            }
+            queue_result_t result = steal_task(victim, task);
+            if(result == QUEUE_TAKEN) {
+                add_stat(&worker->stats.steals, 1);
+                return true;
+            }
+            contended |= (result == QUEUE_CONTENDED);
+        }
+    } while(contended);
+    return false;
+}
+
+/*
+ * private function - puts a worker to sleep until a VM may have been queued.
+ * Returns false if the run is over because no VM is runnable, true otherwise
+ */
+static bool wait_for_task(risky_worker_t * worker) {
+    risky_scheduler_t * scheduler = worker->scheduler;
+    bool running = true;
+    pthread_mutex_lock(&scheduler->lock);
+    if(
+        !scheduler->finished &&
+        __atomic_load_n(&scheduler->active, __ATOMIC_SEQ_CST) == 0
+    ) {
+        scheduler->finished = true;
+        pthread_cond_broadcast(&scheduler->wakeup);
+    }
+    if(scheduler->finished) {
+        running = false;
+    } else {
+        __atomic_add_fetch(&scheduler->sleeping, 1, __ATOMIC_SEQ_CST);
+        // a VM queued before we started sleeping won't have notified us
+        if(!is_work_queued(scheduler)) {
+            pthread_cond_wait(&scheduler->wakeup, &scheduler->lock);
+        }
+        __atomic_sub_fetch(&scheduler->sleeping, 1, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+    return running;
+}
+
+/*
+ * private function - runs one VM for up to a quantum of instructions, then
+ * requeues, parks or retires it depending on why it stopped.
+ * Returns a status_t with error / success information
+ */
+static status_t run_task(risky_worker_t * worker, size_t task) {
+    risky_scheduler_t * scheduler = worker->scheduler;
+    risky_vm_state_t * state = scheduler->states[task];
+    __atomic_store_n(
+        &scheduler->task_states[task], TASK_RUNNING, __ATOMIC_SEQ_CST
+    );
+    risky_stop_reason_t reason = RISKY_STOP_NONE;
+    uint64_t executed = 0;
+    status_t result = run_risky_vm_for(
+        state, scheduler->quantum, &executed, &reason
+    );
+    add_stat(&worker->stats.instructions, executed);
+    add_stat(&worker->stats.quanta, 1);
+    scheduler->reasons[task] = reason;
+    if(result != STATUS_SUCCESS || reason == RISKY_STOP_HALTED) {
+        __atomic_store_n(
+            &scheduler->task_states[task], TASK_HALTED, __ATOMIC_SEQ_CST
+        );
+        deactivate_task(scheduler);
+        return result;
+    }
+    int expected = TASK_RUNNING;
+    if(
+        reason == RISKY_STOP_BLOCKED &&
+        __atomic_compare_exchange_n(
+            &scheduler->task_states[task], &expected, TASK_PARKED, false,
+            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST
+        )
+    ) {
+        add_stat(&worker->stats.parks, 1);
+        deactivate_task(scheduler);
+        return result;
+    }
+    // the quantum ran out, or the VM was woken while it was blocking
+    __atomic_store_n(
+        &scheduler->task_states[task], TASK_QUEUED, __ATOMIC_SEQ_CST
+    );
+    push_task(worker, task);
+    notify_worker(scheduler);
+    return result;
+}
+
+/*
+ * private function - the body of each worker thread, which runs VMs until no
+ * VM is runnable
+ */
+static void * run_worker(void * argument) {
+    risky_worker_t * worker = (risky_worker_t *) argument;
+    risky_scheduler_t * scheduler = worker->scheduler;
+    uint64_t last = nanoseconds();
+    for(;;) {
+        size_t task;
+        if(!find_task(worker, &task)) {
+            if(!wait_for_task(worker)) {
+                break;
+            }
+            continue;
+        }
+        uint64_t start = nanoseconds();
+        add_stat(&worker->stats.idle_nanoseconds, start - last);
+        status_t result = run_task(worker, task);
+        if(result != STATUS_SUCCESS) {
+            pthread_mutex_lock(&scheduler->lock);
+            scheduler->result = result;
+            pthread_mutex_unlock(&scheduler->lock);
+        }
+        last = nanoseconds();
+        add_stat(&worker->stats.busy_nanoseconds, last - start);
+    }
+    add_stat(&worker->stats.idle_nanoseconds, nanoseconds() - last);
+    return NULL;
+}
+
+/*
+ * given a pointer to a risky_scheduler_t, an array of pointers to initialised
+ * risky_vm_state_t, the number of them, the number of worker threads to use
+ * (0 for one per online processor) and the number of instructions each VM
+ * should run for before another VM gets a turn on its worker (0 for
+ * RISKY_SCHEDULER_DEFAULT_QUANTUM), allocate the scheduler's storage and
+ * queue every VM to be run.
+ * Returns a status_t with error / success information
+ */
+status_t init_risky_scheduler(
+    risky_scheduler_t * scheduler, risky_vm_state_t ** states, size_t count,
+    size_t worker_count, uint64_t quantum
+) {
+    if(worker_count == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = (online > 0) ? (size_t) online : 1;
+    }
+    *scheduler = (risky_scheduler_t) {
+        .states = states,
+        .count = count,
+        .quantum = (quantum != 0) ? quantum : RISKY_SCHEDULER_DEFAULT_QUANTUM,
+        .worker_count = worker_count,
+        .active = count,
+        .result = STATUS_SUCCESS,
+    };
+    if(
+        pthread_mutex_init(&scheduler->lock, NULL) != 0 ||
+        pthread_cond_init(&scheduler->wakeup, NULL) != 0
+    ) {
+        return STATUS_FAIL;
+    }
+    // every queue can hold every VM, rounded up to a power of two
+    size_t capacity = 1;
+    while(capacity < count) {
+        capacity *= 2;
+    }
+    scheduler->reasons = (risky_stop_reason_t *) calloc(
+        count + 1, sizeof(risky_stop_reason_t)
+    );
+    scheduler->task_states = (int *) calloc(count + 1, sizeof(int));
+    scheduler->woken = (size_t *) calloc(count + 1, sizeof(size_t));
+    void * workers = NULL;
+    if(
+        posix_memalign(
+            &workers, RISKY_CACHE_LINE, worker_count * sizeof(risky_worker_t)
+        ) == 0
+    ) {
+        scheduler->workers = (risky_worker_t *) workers;
+        for(size_t i = 0; i < worker_count; i++) {
+            scheduler->workers[i] = (risky_worker_t) {
+                .mask = capacity - 1,
+                .random = (i + 1) * 0x9e3779b97f4a7c15U,
+                .scheduler = scheduler,
+            };
+            scheduler->workers[i].slots = (size_t *) calloc(
+                capacity, sizeof(size_t)
+            );
+            if(scheduler->workers[i].slots == NULL) {
+                scheduler->worker_count = i + 1;
+                free_risky_scheduler(scheduler);
+                return MALLOC_REFUSED;
+            }
+        }
+    }
+    if(
+        scheduler->reasons == NULL || scheduler->task_states == NULL ||
+        scheduler->woken == NULL || scheduler->workers == NULL
+    ) {
+        free_risky_scheduler(scheduler);
+        return MALLOC_REFUSED;
+    }
+    // deal the VMs out between the workers to begin with
+    for(size_t i = 0; i < count; i++) {
+        push_task(&scheduler->workers[i % worker_count], i);
+    }
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_scheduler_t, free the scheduler's storage. The
+ * VMs themselves are not freed.
+ * Returns a status_t with error / success information
+ */
+status_t free_risky_scheduler(risky_scheduler_t * scheduler) {
+    if(scheduler->workers != NULL) {
+        for(size_t i = 0; i < scheduler->worker_count; i++) {
+            free(scheduler->workers[i].slots);
+        }
+    }
+    pthread_mutex_destroy(&scheduler->lock);
+    pthread_cond_destroy(&scheduler->wakeup);
+    free(scheduler->workers);
+    free(scheduler->reasons);
+    free(scheduler->task_states);
+    free(scheduler->woken);
+    scheduler->workers = NULL;
+    scheduler->reasons = NULL;
+    scheduler->task_states = NULL;
+    scheduler->woken = NULL;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_scheduler_t, run its VMs on the worker threads
+ * until none of them are runnable, storing the reason each one stopped in the
+ * scheduler's reasons array.
+ * The calling thread becomes the first worker. If any other worker's thread
+ * can't be started, its VMs are stolen by the workers that did start.
+ * Returns a status_t with error / success information
+ */
+status_t run_risky_scheduler(risky_scheduler_t * scheduler) {
+    pthread_mutex_lock(&scheduler->lock);
+    scheduler->finished = false;
+    scheduler->result = STATUS_SUCCESS;
+    pthread_mutex_unlock(&scheduler->lock);
+    bool * started = (bool *) calloc(scheduler->worker_count, sizeof(bool));
+    if(started == NULL) {
+        return MALLOC_REFUSED;
+    }
+    for(size_t i = 1; i < scheduler->worker_count; i++) {
+        started[i] = pthread_create(
+            &scheduler->workers[i].thread, NULL, run_worker,
+            &scheduler->workers[i]
+        ) == 0;
+    }
+    run_worker(&scheduler->workers[0]);
+    for(size_t i = 1; i < scheduler->worker_count; i++) {
+        if(started[i]) {
+            pthread_join(scheduler->workers[i].thread, NULL);
+        }
+    }
+    free(started);
+    return scheduler->result;
+}
+
+/*
+ * given a pointer to a risky_scheduler_t and the index of one of its VMs,
+ * make that VM runnable again if it is parked, so that it retries the REA or
+ * WRI it blocked on. If the VM is still running, it will retry as soon as it
+ * blocks instead of being parked.
+ * Returns a status_t with error / success information
+ */
+status_t wake_risky_scheduler_vm(risky_scheduler_t * scheduler, size_t vm) {
+    if(vm >= scheduler->count) {
+        return STATUS_FAIL;
+    }
+    int * task_state = &scheduler->task_states[vm];
+    for(;;) {
+        int expected = __atomic_load_n(task_state, __ATOMIC_SEQ_CST);
+        if(expected == TASK_PARKED) {
+            if(
+                __atomic_compare_exchange_n(
+                    task_state, &expected, TASK_QUEUED, false,
+                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST
+                )
+            ) {
+                pthread_mutex_lock(&scheduler->lock);
+                __atomic_add_fetch(&scheduler->active, 1, __ATOMIC_SEQ_CST);
+                scheduler->woken[scheduler->woken_count] = vm;
+                __atomic_store_n(
+                    &scheduler->woken_count, scheduler->woken_count + 1,
+                    __ATOMIC_SEQ_CST
+                );
+                pthread_cond_signal(&scheduler->wakeup);
+                pthread_mutex_unlock(&scheduler->lock);
+                return STATUS_SUCCESS;
+            }
+        } else if(expected == TASK_RUNNING) {
+            if(
+                __atomic_compare_exchange_n(
+                    task_state, &expected, TASK_WOKEN, false,
+                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST
+                )
+            ) {
+                return STATUS_SUCCESS;
+            }
+        } else {
+            // already queued, already woken or halted
+            return STATUS_SUCCESS;
+        }
+    }
+}
+
+/*
+ * given a pointer to a risky_scheduler_t, the index of one of its workers and
+ * a pointer to a risky_worker_stats_t, store a snapshot of that worker's
+ * counters.
+ * Returns a status_t with error / success information
+ */
+status_t get_risky_worker_stats(
+    risky_scheduler_t * scheduler, size_t worker, risky_worker_stats_t * stats
+) {
+    if(worker >= scheduler->worker_count) {
+        return STATUS_FAIL;
+    }
+    risky_worker_stats_t * counters = &scheduler->workers[worker].stats;
+    stats->busy_nanoseconds = __atomic_load_n(
+        &counters->busy_nanoseconds, __ATOMIC_RELAXED
+    );
+    stats->idle_nanoseconds = __atomic_load_n(
+        &counters->idle_nanoseconds, __ATOMIC_RELAXED
+    );
+    stats->instructions = __atomic_load_n(
+        &counters->instructions, __ATOMIC_RELAXED
+    );
+    stats->quanta = __atomic_load_n(&counters->quanta, __ATOMIC_RELAXED);
+    stats->steals = __atomic_load_n(&counters->steals, __ATOMIC_RELAXED);
+    stats->parks = __atomic_load_n(&counters->parks, __ATOMIC_RELAXED);
+    return STATUS_SUCCESS;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,138 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * scheduler - this compilation unit defines a scheduler which runs many RISKY
+ * virtual machines on a pool of worker threads, giving each VM a quantum of
+ * instructions at a time and balancing the VMs between workers by stealing.
+ */
+#ifndef SAXBOPHONE_RISKY_SCHEDULER_H
+#define SAXBOPHONE_RISKY_SCHEDULER_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core.h"
+#include "interpreter.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of instructions each VM runs for before it is rescheduled by default
+#define RISKY_SCHEDULER_DEFAULT_QUANTUM 10000U
+
+// counters kept by each worker thread, accumulated over every run
+typedef struct risky_worker_stats_t {
+    // time spent running VMs, and time spent looking for a VM to run
+    uint64_t busy_nanoseconds;
+    uint64_t idle_nanoseconds;
+    // number of instructions executed and quanta run
+    uint64_t instructions;
+    uint64_t quanta;
+    // number of VMs taken from other workers' queues
+    uint64_t steals;
+    // number of times a VM blocked on a data channel and was parked
+    uint64_t parks;
+} risky_worker_stats_t;
+
+// per-worker queue and counters, defined in the scheduler module
+struct risky_worker_t;
+
+// scheduler struct
+typedef struct risky_scheduler_t {
+    // the VMs being scheduled, and how many of them there are
+    risky_vm_state_t ** states;
+    size_t count;
+    // the reason each VM last stopped (RISKY_STOP_NONE if it hasn't yet)
+    risky_stop_reason_t * reasons;
+    // number of instructions each VM runs for before it is rescheduled
+    uint64_t quantum;
+    // the worker threads, and how many of them there are
+    struct risky_worker_t * workers;
+    size_t worker_count;
+    // the scheduling state of each VM, only accessed atomically
+    int * task_states;
+    // VMs which have been woken up, waiting for any worker to take them
+    size_t * woken;
+    size_t woken_count;
+    // number of VMs which are either queued or being run
+    size_t active;
+    // number of workers waiting for more VMs to become runnable
+    size_t sleeping;
+    // set once no VM is runnable, which ends the current run
+    bool finished;
+    // the first error returned while running any VM during the current run
+    status_t result;
+    // protects woken, finished and waiting on the condition variable below
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+} risky_scheduler_t;
+
+/*
+ * given a pointer to a risky_scheduler_t, an array of pointers to initialised
+ * risky_vm_state_t, the number of them, the number of worker threads to use
+ * (0 for one per online processor) and the number of instructions each VM
+ * should run for before another VM gets a turn on its worker (0 for
+ * RISKY_SCHEDULER_DEFAULT_QUANTUM), allocate the scheduler's storage and
+ * queue every VM to be run.
+ * Returns a status_t with error / success information
+ */
+status_t init_risky_scheduler(
+    risky_scheduler_t * scheduler, risky_vm_state_t ** states, size_t count,
+    size_t worker_count, uint64_t quantum
+);
+
+/*
+ * given a pointer to a risky_scheduler_t, free the scheduler's storage. The
+ * VMs themselves are not freed.
+ * Returns a status_t with error / success information
+ */
+status_t free_risky_scheduler(risky_scheduler_t * scheduler);
+
+/*
+ * given a pointer to a risky_scheduler_t, run its VMs on the worker threads
+ * until none of them are runnable, storing the reason each one stopped in the
+ * scheduler's reasons array. Halted VMs are finished with. VMs which block on
+ * a data channel (a REA with no data ready or a WRI to a full ring buffer) are
+ * parked without using a worker until they are woken with
+ * wake_risky_scheduler_vm(); if every VM left is parked, this returns, and
+ * may be called again after waking some of them.
+ * Returns a status_t with error / success information
+ */
+status_t run_risky_scheduler(risky_scheduler_t * scheduler);
+
+/*
+ * given a pointer to a risky_scheduler_t and the index of one of its VMs,
+ * make that VM runnable again if it is parked, so that it retries the REA or
+ * WRI it blocked on. If the VM is still running, it will retry as soon as it
+ * blocks instead of being parked. This may be called from any thread,
+ * including from the channel callbacks of another VM being run by the
+ * scheduler.
+ * Returns a status_t with error / success information
+ */
+status_t wake_risky_scheduler_vm(risky_scheduler_t * scheduler, size_t vm);
+
+/*
+ * given a pointer to a risky_scheduler_t, the index of one of its workers and
+ * a pointer to a risky_worker_stats_t, store a snapshot of that worker's
+ * counters. This may be called while the scheduler is running.
+ * Returns a status_t with error / success information
+ */
+status_t get_risky_worker_stats(
+    risky_scheduler_t * scheduler, size_t worker, risky_worker_stats_t * stats
+);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+// end of header file
+#endif
@@ -0,0 +1,179 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * trace - this compilation unit defines binary execution traces of a RISKY
+ * virtual machine: run_risky_vm_traced() appends a fixed-size record of each
+ * instruction executed to a lock-free ring buffer, which a background thread
+ * flushes to a trace file.
+ */
+// nanosleep() is a POSIX extension
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "channel.h"
+#include "core.h"
+#include "risky.h"
+#include "trace.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// the magic bytes every trace file starts with
+static const risky_byte_t TRACE_MAGIC[4] = { 'R', 'T', 'R', 'C', };
+
+/*
+ * how long the thread sleeps when it finds the ring empty, in nanoseconds. A
+ * full ring holds several milliseconds of records, so this can be fairly long
+ */
+#define FLUSH_INTERVAL 1000000L
+
+/*
+ * private function - the body of a trace's background thread, writing the
+ * records on its ring buffer to its file straight from the ring's storage
+ * until the trace is closed and the ring is empty. If writing ever fails, the
+ * rest of the records are still taken off the ring (so the VM never waits for
+ * the thread forever) but thrown away.
+ */
+static void * flush_trace(void * argument) {
+    risky_trace_t * trace = (risky_trace_t *) argument;
+    const struct timespec interval = {
+        .tv_sec = 0, .tv_nsec = FLUSH_INTERVAL,
+    };
+    size_t tail = trace->tail;
+    bool failed = false;
+    for(;;) {
+        // look at closing first, so the head seen after it is the last one
+        bool closing = __atomic_load_n(&trace->closing, __ATOMIC_ACQUIRE);
+        size_t head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+        if(head == tail) {
+            if(closing) {
+                break;
+            }
+            nanosleep(&interval, NULL);
+            continue;
+        }
+        // the records may wrap around the end of the storage
+        size_t start = tail & (RISKY_TRACE_RING_SIZE - 1);
+        size_t count = head - tail;
+        if(count > RISKY_TRACE_RING_SIZE - start) {
+            count = RISKY_TRACE_RING_SIZE - start;
+        }
+        const risky_byte_t * bytes =
+            (const risky_byte_t *) &trace->records[start];
+        if(
+            !failed && !write_risky_bytes(
+                trace->descriptor, bytes, count * sizeof(risky_trace_record_t)
+            )
+        ) {
+            failed = true;
+        }
+        tail += count;
+        __atomic_store_n(&trace->tail, tail, __ATOMIC_RELEASE);
+    }
+    trace->failed = failed;
+    return NULL;
+}
+
+/*
+ * given a pointer to a risky_trace_t, all of whose records have been
+ * published, wait until there is room for more records on its ring buffer.
+ * Returns the number of records which will have been appended to the trace
+ * once the ring buffer is full again
+ */
+size_t wait_for_risky_trace(risky_trace_t * trace) {
+    for(;;) {
+        size_t tail = __atomic_load_n(&trace->tail, __ATOMIC_ACQUIRE);
+        if(trace->head - tail < RISKY_TRACE_RING_SIZE) {
+            return tail + RISKY_TRACE_RING_SIZE;
+        }
+        // give the thread a chance to run if it shares this core
+        sched_yield();
+    }
+}
+
+/*
+ * given a pointer to a risky_trace_t and the path of a file, create (or
+ * truncate) the file, write the trace header to it and start a thread which
+ * writes the records of the trace to it as they are appended.
+ * Returns a status_t with error / success information
+ */
+status_t open_risky_trace(risky_trace_t * trace, const char * path) {
+    memset(trace, 0, sizeof(risky_trace_t));
+    trace->records = (risky_trace_record_t *) malloc(
+        RISKY_TRACE_RING_SIZE * sizeof(risky_trace_record_t)
+    );
+    if(trace->records == NULL) {
+        return MALLOC_REFUSED;
+    }
+    trace->descriptor = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(trace->descriptor == -1) {
+        free(trace->records);
+        trace->records = NULL;
+        return STATUS_FAIL;
+    }
+    const risky_byte_t header[RISKY_TRACE_HEADER_SIZE] = {
+        TRACE_MAGIC[0], TRACE_MAGIC[1], TRACE_MAGIC[2], TRACE_MAGIC[3],
+        RISKY_TRACE_VERSION_MAJOR, RISKY_TRACE_VERSION_MINOR,
+        (risky_byte_t) sizeof(risky_trace_record_t), 0,
+    };
+    if(
+        !write_risky_bytes(trace->descriptor, header, sizeof(header)) ||
+        pthread_create(&trace->thread, NULL, flush_trace, trace) != 0
+    ) {
+        close(trace->descriptor);
+        free(trace->records);
+        trace->records = NULL;
+        return STATUS_FAIL;
+    }
+    return STATUS_SUCCESS;
+}
+
+/*
+ * given a pointer to a risky_trace_t, wait for every record appended to it to
+ * be written to its file, then stop its thread and close the file.
+ * Returns a status_t with error / success information
+ */
+status_t close_risky_trace(risky_trace_t * trace) {
+    __atomic_store_n(&trace->closing, true, __ATOMIC_RELEASE);
+    status_t result = STATUS_SUCCESS;
+    if(pthread_join(trace->thread, NULL) != 0 || trace->failed) {
+        result = STATUS_FAIL;
+    }
+    if(close(trace->descriptor) != 0) {
+        result = STATUS_FAIL;
+    }
+    free(trace->records);
+    trace->records = NULL;
+    return result;
+}
+
+/*
+ * given a pointer to some bytes and the number of them, returns whether they
+ * start with a valid header of a trace file of a version this can read
+ */
+bool is_risky_trace(const risky_byte_t * bytes, size_t size) {
+    return (
+        size >= RISKY_TRACE_HEADER_SIZE &&
+        memcmp(bytes, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0 &&
+        bytes[4] == RISKY_TRACE_VERSION_MAJOR &&
+        bytes[6] == sizeof(risky_trace_record_t)
+    );
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,130 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * trace - this compilation unit defines binary execution traces of a RISKY
+ * virtual machine: run_risky_vm_traced() appends a fixed-size record of each
+ * instruction executed to a lock-free ring buffer, which a background thread
+ * flushes to a trace file.
+ *
+ * A trace file starts with an 8-byte header: the magic bytes "RTRC", the
+ * major and minor version of the trace format, the size of each record in
+ * bytes and a reserved byte. The records follow back to back, each laid out
+ * exactly as risky_trace_record_t, so the ring buffer is written out as-is.
+ */
+#ifndef SAXBOPHONE_RISKY_TRACE_H
+#define SAXBOPHONE_RISKY_TRACE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "channel.h"
+#include "core.h"
+#include "risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// version of the trace file format
+#define RISKY_TRACE_VERSION_MAJOR 1
+#define RISKY_TRACE_VERSION_MINOR 0
+// size of the header at the start of a trace file, in bytes
+#define RISKY_TRACE_HEADER_SIZE 8
+// number of records the ring buffer of a trace holds, a power of two
+#define RISKY_TRACE_RING_SIZE 1048576U
+// number of records appended to a trace between publishing them, at most
+#define RISKY_TRACE_BATCH 1024U
+// set in the flags of a record if the instruction wrote its register
+#define RISKY_TRACE_WROTE_REGISTER 0x01U
+
+// the record of one instruction executed, exactly as it is stored in a file
+typedef struct risky_trace_record_t {
+    // address of the instruction, big-endian
+    risky_byte_t address[2];
+    // the raw bytes of the instruction, as fetched from RAM
+    risky_byte_t raw[4];
+    // number of the instruction's destination register
+    risky_byte_t destination;
+    // RISKY_TRACE_WROTE_REGISTER, if the instruction wrote to it
+    risky_byte_t flags;
+    // the new value of the destination register, big-endian
+    risky_byte_t value[2];
+} risky_trace_record_t;
+
+/*
+ * a trace being written, with a ring buffer of records between the VM (the
+ * producer) and a background thread writing them to the file (the consumer)
+ */
+typedef struct risky_trace_t {
+    // storage for the records, RISKY_TRACE_RING_SIZE of them
+    risky_trace_record_t * records;
+    // descriptor of the trace file
+    int descriptor;
+    // the thread writing records to the file
+    pthread_t thread;
+    // number of records ever published, only changed by the producer
+    size_t head;
+    // set by the producer when the trace is being closed
+    bool closing;
+    risky_byte_t producer_padding[RISKY_CACHE_LINE];
+    // number of records ever written to the file, only changed by the thread
+    size_t tail;
+    // set by the thread if it couldn't write some records to the file
+    bool failed;
+    risky_byte_t consumer_padding[RISKY_CACHE_LINE];
+} risky_trace_t;
+
+/*
+ * given a pointer to a risky_trace_t and the number of records ever appended
+ * to it, publish them to the thread writing them to the file. The producer
+ * fills in records on the ring directly, only publishing them every
+ * RISKY_TRACE_BATCH records or so, as publishing them one at a time would
+ * cost more than writing them.
+ */
+static inline void publish_risky_trace(risky_trace_t * trace, size_t head) {
+    __atomic_store_n(&trace->head, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * given a pointer to a risky_trace_t, all of whose records have been
+ * published, wait until there is room for more records on its ring buffer,
+ * which only happens if the file can't keep up.
+ * Returns the number of records which will have been appended to the trace
+ * once the ring buffer is full again
+ */
+size_t wait_for_risky_trace(risky_trace_t * trace);
+
+/*
+ * given a pointer to a risky_trace_t and the path of a file, create (or
+ * truncate) the file, write the trace header to it and start a thread which
+ * writes the records of the trace to it as they are appended.
+ * Returns a status_t with error / success information
+ */
+status_t open_risky_trace(risky_trace_t * trace, const char * path);
+
+/*
+ * given a pointer to a risky_trace_t, wait for every record appended to it to
+ * be written to its file, then stop its thread and close the file.
+ * Returns a status_t with error / success information, failing if any record
+ * couldn't be written
+ */
+status_t close_risky_trace(risky_trace_t * trace);
+
+/*
+ * given a pointer to some bytes and the number of them, returns whether they
+ * start with a valid header of a trace file of a version this can read
+ */
+bool is_risky_trace(const risky_byte_t * bytes, size_t size);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+// end of header file
+#endif
@@ -0,0 +1,675 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * This compilation unit provides a command-line program which runs a suite of
+ * microbenchmarks of the RISKY library and reports the results as JSON on
+ * standard output, so that they can be compared between releases to catch
+ * performance regressions. Unlike the programs in the benchmarks directory,
+ * which each compare ways of doing one thing, this measures a fixed set of
+ * operations the same way every time. It can also report the host's hardware
+ * performance counters for each benchmark, where the host allows it.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "risky/core.h"
+#include "risky/counters.h"
+#include "risky/decoder.h"
+#include "risky/encoder.h"
+#include "risky/interpreter.h"
+#include "risky/risky.h"
+#include "tests/instructions.h"
+#include "tests/timing.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// each benchmark is repeated until it has run for at least this long
+#define MINIMUM_SECONDS 0.2
+// number of raw instructions decoded by each iteration of a decode benchmark
+#define DECODE_BATCH 1024U
+// number of copies of the instruction measured in an opcode benchmark's loop
+#define OPCODE_BODY 60U
+// number of times an opcode benchmark's loop goes round in each iteration
+#define OPCODE_ROUNDS 1000U
+// registers used by the loop around an opcode benchmark's instructions
+#define LOOP_COUNTER 250U
+#define LOOP_ONE 251U
+#define LOOP_START 252U
+#define LOOP_CONDITION 253U
+#define LOOP_ZERO 254U
+// first of the registers holding a target address for each JMP measured
+#define JUMP_TARGETS 100U
+
+// options given on the command line
+typedef struct bench_options_t {
+    // only run benchmarks whose name contains this (NULL to run them all)
+    const char * filter;
+    // whether to read hardware performance counters
+    bool counters;
+} bench_options_t;
+
+// type of the interpreter functions benchmarks can run a VM with
+typedef status_t (* runner_t)(risky_vm_state_t *, risky_stop_reason_t *);
+
+// function which runs a benchmark's operation the given number of times
+typedef status_t (* bench_body_t)(void * context, uint64_t iterations);
+
+// a benchmark, and what it measures
+typedef struct bench_t {
+    // name of the benchmark in the results
+    const char * name;
+    // the operation being measured, and what to pass to it
+    bench_body_t body;
+    void * context;
+    // number of operations (instructions, for VM runs) in each iteration
+    uint64_t operations;
+    /*
+     * the interpreter dispatch strategy, for benchmarks whose operations are
+     * VM instructions (NULL otherwise)
+     */
+    const char * dispatch;
+} bench_t;
+
+// context of the benchmarks which run a VM
+typedef struct vm_context_t {
+    risky_vm_state_t state;
+    // address execution starts at for each iteration
+    risky_ram_address_t entry;
+    // the interpreter to run it with
+    runner_t run;
+} vm_context_t;
+
+// context of the benchmarks which decode instructions
+typedef struct decode_context_t {
+    risky_raw_instruction_t raw[DECODE_BATCH];
+    // combined from every decoded instruction, so none can be optimised out
+    uint64_t checksum;
+} decode_context_t;
+
+// prints how to use the program to the given stream
+static void print_usage(FILE * stream, const char * name) {
+    fprintf(
+        stream,
+        "usage: %s [--help] [--filter TEXT] [--counters]\n"
+        "\n"
+        "Runs the RISKY benchmark suite and prints the results as JSON on\n"
+        "standard output: for each benchmark, the nanoseconds per operation\n"
+        "and, for those which run a VM, the instructions executed per second.\n"
+        "\n"
+        "  --help         print this message and exit\n"
+        "  --filter TEXT  only run the benchmarks whose names contain TEXT\n"
+        "  --counters     also report the host's hardware performance\n"
+        "                 counters per operation, and for VM runs the host\n"
+        "                 cycles per guest instruction and branch miss rate\n"
+        "                 (left out if the host doesn't allow them)\n",
+        name
+    );
+}
+
+/*
+ * private function - parses the command-line arguments into the given options.
+ * Returns 0 if the benchmarks should run, 1 if the arguments are invalid, or
+ * -1 if the program should exit successfully without running them
+ */
+static int parse_arguments(
+    int argc, char * argv[], bench_options_t * options
+) {
+    *options = (bench_options_t) { .filter = NULL, .counters = false, };
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--help") == 0) {
+            print_usage(stdout, argv[0]);
+            return -1;
+        } else if(strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            options->filter = argv[++i];
+        } else if(strcmp(argv[i], "--counters") == 0) {
+            options->counters = true;
+        } else {
+            fprintf(stderr, "%s: invalid argument '%s'\n", argv[0], argv[i]);
+            print_usage(stderr, argv[0]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// private function - channel read callback, which always has a word ready
+static bool read_word(
+    void * context, risky_channel_t channel, risky_word_t * data
+) {
+    (void) context;
+    *data = channel;
+    return true;
+}
+
+// private function - channel write callback, which discards the word
+static void write_word(
+    void * context, risky_channel_t channel, risky_word_t data
+) {
+    (void) context;
+    (void) channel;
+    (void) data;
+}
+
+// private function - benchmark body, decodes a batch of raw instructions
+static status_t decode_body(void * context, uint64_t iterations) {
+    decode_context_t * decode = (decode_context_t *) context;
+    for(uint64_t i = 0; i < iterations; i++) {
+        for(size_t j = 0; j < DECODE_BATCH; j++) {
+            risky_instruction_t instruction;
+            status_t result = decode_instruction_from_raw(
+                &decode->raw[j], &instruction
+            );
+            if(result != STATUS_SUCCESS) {
+                return result;
+            }
+            decode->checksum += instruction.r + instruction.l;
+        }
+    }
+    return STATUS_SUCCESS;
+}
+
+// private function - benchmark body, initialises and frees a VM state
+static status_t churn_body(void * context, uint64_t iterations) {
+    (void) context;
+    for(uint64_t i = 0; i < iterations; i++) {
+        risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+        status_t result = init_risky_vm_state(&state);
+        if(result != STATUS_SUCCESS) {
+            return result;
+        }
+        free_risky_vm_state(&state);
+    }
+    return STATUS_SUCCESS;
+}
+
+// private function - benchmark body, runs a VM from its entry until it halts
+static status_t run_body(void * context, uint64_t iterations) {
+    vm_context_t * vm = (vm_context_t *) context;
+    for(uint64_t i = 0; i < iterations; i++) {
+        risky_stop_reason_t reason;
+        vm->state.program_counter = vm->entry;
+        status_t result = vm->run(&vm->state, &reason);
+        if(result != STATUS_SUCCESS) {
+            return result;
+        }
+        if(reason != RISKY_STOP_HALTED) {
+            return STATUS_FAIL;
+        }
+    }
+    return STATUS_SUCCESS;
+}
+
+/*
+ * private function - runs the VM once from its entry to find how many
+ * instructions one iteration of a run_body() benchmark executes.
+ * Returns 0 if it doesn't halt
+ */
+static uint64_t count_instructions(vm_context_t * vm) {
+    risky_stop_reason_t reason;
+    uint64_t executed = 0;
+    vm->state.program_counter = vm->entry;
+    status_t result = run_risky_vm_for(
+        &vm->state, UINT64_MAX, &executed, &reason
+    );
+    if(result != STATUS_SUCCESS || reason != RISKY_STOP_HALTED) {
+        return 0;
+    }
+    return executed;
+}
+
+/*
+ * private function - returns the instruction measured by the benchmark of the
+ * given opcode, the given copy of it in the loop body starting at the given
+ * address. Register 1 holds 1000, register 2 holds 7, register 3 a free
+ * address, channel 1 is an active write channel and channel 2 an active read
+ * one, and results go to register 10
+ */
+static risky_instruction_t opcode_instruction(
+    risky_opcode_t opcode, size_t copy
+) {
+    switch(opcode) {
+        case NOP:
+            return op(NOP, 0, 0, 0, 0);
+        case JMP:
+            // each JMP jumps to the instruction straight after it
+            return op(JMP, 0, (risky_byte_t) (JUMP_TARGETS + copy), 0, 0);
+        case BRA:
+            // never taken, as a taken branch is the same work as a JMP
+            return op(BRA, 0, LOOP_START, LOOP_ZERO, 0);
+        case INC:
+        case DEC:
+        case NOT:
+        case ROT:
+        case COP:
+            return op(opcode, 0x06U, 10, 1, 0);
+        case QOP:
+            return op(QOP, 0x07U, 10, 0, 0);
+        case SET:
+            return set(10, 0x1234U);
+        case LOD:
+            return op(LOD, 0x06U, 10, 3, 0);
+        case SAV:
+            return op(SAV, 0x06U, 1, 3, 0);
+        case QDC:
+            return op(QDC, 0, 10, 1, 0);
+        case CDC:
+            return op(CDC, 0, 1, 1, 1);
+        case REA:
+            return op(REA, 0, 10, 2, 0);
+        case WRI:
+            return op(WRI, 0, 1, 1, 0);
+        default:
+            // every other instruction takes two operands and a result
+            return op(opcode, 0x07U, 10, 1, 2);
+    }
+}
+
+/*
+ * private function - loads the benchmark of the given opcode into the VM: a
+ * loop of OPCODE_ROUNDS rounds of OPCODE_BODY copies of the instruction, then
+ * a HLT. HLT is measured on its own, as the cost of stopping the VM.
+ */
+static void load_opcode_program(vm_context_t * vm, risky_opcode_t opcode) {
+    vm->entry = 0x0000U;
+    if(opcode == HLT) {
+        risky_instruction_t halt = op(HLT, 0, 0, 0, 0);
+        encode_program(vm->state.ram, &halt, 1);
+        return;
+    }
+    // the setup before the loop, padded out to this many instructions
+    const size_t body = 12 + OPCODE_BODY;
+    risky_instruction_t program[12 + OPCODE_BODY * 2 + 4];
+    size_t count = 0;
+    program[count++] = set(1, 1000);
+    program[count++] = set(2, 7);
+    program[count++] = set(3, 0x8000U);
+    program[count++] = set(LOOP_COUNTER, OPCODE_ROUNDS);
+    program[count++] = set(LOOP_ONE, 1);
+    program[count++] = set(LOOP_START, (risky_word_t) (body * 4));
+    program[count++] = set(LOOP_ZERO, 0);
+    program[count++] = op(CDC, 0, 1, 1, 1);
+    program[count++] = op(CDC, 0, 2, 0, 1);
+    for(size_t i = 0; i < OPCODE_BODY; i++) {
+        program[count++] = set(
+            (risky_byte_t) (JUMP_TARGETS + i),
+            (risky_word_t) ((body + i + 1) * 4)
+        );
+    }
+    while(count != body) {
+        program[count++] = op(NOP, 0, 0, 0, 0);
+    }
+    // the loop body
+    for(size_t i = 0; i < OPCODE_BODY; i++) {
+        program[count++] = opcode_instruction(opcode, i);
+    }
+    program[count++] = op(
+        SUB, 0x07U, LOOP_COUNTER, LOOP_COUNTER, LOOP_ONE
+    );
+    program[count++] = op(
+        NEQ, 0x03U, LOOP_CONDITION, LOOP_COUNTER, LOOP_ZERO
+    );
+    program[count++] = op(BRA, 0, LOOP_START, LOOP_CONDITION, 0);
+    program[count++] = op(HLT, 0, 0, 0, 0);
+    encode_program(vm->state.ram, program, count);
+}
+
+/*
+ * private function - loads fibonacci.asm into the VM, with the call and
+ * return addresses it jumps to held in registers. It writes the fibonacci
+ * numbers below 100 to channel 1.
+ */
+static void load_fibonacci_program(vm_context_t * vm) {
+    // addresses of the labels
+    const risky_word_t main_1 = 0x0014U, main_2 = 0x001cU, end = 0x0030U;
+    const risky_word_t setup = 0x0034U, fibonacci = 0x0054U;
+    risky_instruction_t program[] = {
+        // main:
+        set(20, setup),
+        set(21, fibonacci),
+        set(22, end),
+        set(4, main_1),
+        op(JMP, 0, 20, 0, 0),
+        // main#1:
+        set(4, main_2),
+        op(JMP, 0, 21, 0, 0),
+        // main#2: write out c if it is less than 100
+        op(GTN, 0x07U, 5, 3, 0),
+        op(BRA, 0x04U, 22, 5, 0),
+        op(WRI, 0, 1, 3, 0),
+        set(4, main_1),
+        op(JMP, 0, 21, 0, 0),
+        // end:
+        op(HLT, 0, 0, 0, 0),
+        // setup:
+        set(0, 100),
+        set(1, 1),
+        set(2, 1),
+        set(3, 0),
+        op(CDC, 0, 1, 1, 1),
+        op(WRI, 0, 1, 1, 0),
+        op(WRI, 0, 1, 2, 0),
+        op(JMP, 0, 4, 0, 0),
+        // fibonacci:
+        op(ADD, 0x07U, 3, 1, 2),
+        op(COP, 0x06U, 1, 2, 0),
+        op(COP, 0x06U, 2, 3, 0),
+        op(JMP, 0, 4, 0, 0),
+    };
+    vm->entry = 0x0000U;
+    encode_program(
+        vm->state.ram, program, sizeof(program) / sizeof(program[0])
+    );
+}
+
+// private function - loads a loop counting down from 60000 into the VM
+static void load_countdown_program(vm_context_t * vm) {
+    risky_instruction_t program[] = {
+        set(1, 60000),
+        set(2, 1),
+        set(3, 0x0010U),
+        set(6, 0),
+        op(SUB, 0x07U, 1, 1, 2),
+        op(NEQ, 0x03U, 5, 1, 6),
+        op(BRA, 0x00U, 3, 5, 0),
+        op(HLT, 0, 0, 0, 0),
+    };
+    vm->entry = 0x0000U;
+    encode_program(
+        vm->state.ram, program, sizeof(program) / sizeof(program[0])
+    );
+}
+
+/*
+ * private function - loads a loop copying 16KiB of RAM from 0x8000 to 0xc000
+ * a word at a time into the VM
+ */
+static void load_copy_program(vm_context_t * vm) {
+    risky_instruction_t program[] = {
+        set(1, 0x8000U),
+        set(2, 0xc000U),
+        set(3, 2),
+        set(4, 0xc000U),
+        set(6, 0x0014U),
+        // loop:
+        op(LOD, 0x06U, 5, 1, 0),
+        op(SAV, 0x06U, 5, 2, 0),
+        op(ADD, 0x07U, 1, 1, 3),
+        op(ADD, 0x07U, 2, 2, 3),
+        op(NEQ, 0x03U, 7, 1, 4),
+        op(BRA, 0x00U, 6, 7, 0),
+        op(HLT, 0, 0, 0, 0),
+    };
+    vm->entry = 0x0000U;
+    encode_program(
+        vm->state.ram, program, sizeof(program) / sizeof(program[0])
+    );
+}
+
+/*
+ * private function - prints the hardware performance counters of the last run
+ * of the benchmark, per operation, as members of its JSON object
+ */
+static void print_counters(
+    const bench_t * bench, const risky_counters_t * counters,
+    double operations
+) {
+    printf(", \"counters\": {");
+    for(size_t i = 0; i < RISKY_COUNTER_COUNT; i++) {
+        printf(
+            "%s\"%s\": ", (i == 0) ? "" : ", ",
+            get_risky_counter_name((risky_counter_t) i)
+        );
+        if(counters->counted[i]) {
+            printf("%.4f", (double) counters->values[i] / operations);
+        } else {
+            printf("null");
+        }
+    }
+    printf("}");
+    if(bench->dispatch == NULL) {
+        return;
+    }
+    // the figures which tell how well the host copes with each dispatch
+    if(counters->counted[RISKY_COUNTER_CYCLES]) {
+        printf(
+            ", \"host_cycles_per_instruction\": %.3f",
+            (double) counters->values[RISKY_COUNTER_CYCLES] / operations
+        );
+    }
+    if(
+        counters->counted[RISKY_COUNTER_BRANCHES] &&
+        counters->counted[RISKY_COUNTER_BRANCH_MISSES] &&
+        counters->values[RISKY_COUNTER_BRANCHES] != 0
+    ) {
+        printf(
+            ", \"branch_miss_rate\": %.5f",
+            (double) counters->values[RISKY_COUNTER_BRANCH_MISSES] /
+            (double) counters->values[RISKY_COUNTER_BRANCHES]
+        );
+    }
+}
+
+/*
+ * private function - runs the benchmark for enough iterations to take at
+ * least MINIMUM_SECONDS, reading the given hardware performance counters
+ * (unless NULL) while it runs, then prints its result as a JSON object.
+ * Returns a status_t with error / success information
+ */
+static status_t run_benchmark(
+    const bench_t * bench, risky_counters_t * counters, bool first
+) {
+    uint64_t iterations = 1;
+    double elapsed = 0.0;
+    for(;;) {
+        // the counters of every run but the last are simply overwritten
+        if(counters != NULL) {
+            start_risky_counters(counters);
+        }
+        double start = seconds();
+        status_t result = bench->body(bench->context, iterations);
+        elapsed = seconds() - start;
+        if(counters != NULL) {
+            stop_risky_counters(counters);
+        }
+        if(result != STATUS_SUCCESS) {
+            return result;
+        }
+        if(elapsed >= MINIMUM_SECONDS) {
+            break;
+        }
+        // aim a little past the minimum, so as to only need one more try
+        uint64_t scale = (elapsed > 0.0)
+            ? (uint64_t) (MINIMUM_SECONDS * 1.2 / elapsed) + 1 : 100;
+        iterations *= (scale < 100) ? scale : 100;
+    }
+    double operations = (double) iterations * (double) bench->operations;
+    printf(
+        "%s\n    {\"name\": \"%s\", \"iterations\": %llu, "
+        "\"operations\": %.0f, \"ns_per_op\": %.3f",
+        first ? "" : ",", bench->name, (unsigned long long) iterations,
+        operations, elapsed * 1e9 / operations
+    );
+    if(bench->dispatch != NULL) {
+        printf(
+            ", \"dispatch\": \"%s\", \"instructions_per_second\": %.0f",
+            bench->dispatch, operations / elapsed
+        );
+    }
+    if(counters != NULL) {
+        print_counters(bench, counters, operations);
+    }
+    printf("}");
+    return STATUS_SUCCESS;
+}
+
+/*
+ * private function - runs the benchmark if it isn't excluded by the filter,
+ * printing its result, with the given counters unless they are NULL.
+ * Returns false if the benchmark failed
+ */
+static bool run_filtered(
+    const bench_options_t * options, risky_counters_t * counters,
+    const bench_t * bench, size_t * count
+) {
+    if(
+        options->filter != NULL && strstr(bench->name, options->filter) == NULL
+    ) {
+        return true;
+    }
+    if(run_benchmark(bench, counters, *count == 0) != STATUS_SUCCESS) {
+        fprintf(stderr, "benchmark %s failed\n", bench->name);
+        return false;
+    }
+    (*count)++;
+    fflush(stdout);
+    return true;
+}
+
+/*
+ * private function - initialises the VM of a benchmark, with channel
+ * callbacks which never block.
+ * Returns a status_t with error / success information
+ */
+static status_t init_vm_context(vm_context_t * vm, runner_t run) {
+    vm->state = (risky_vm_state_t) { .registers = {0}, .ram = NULL, };
+    vm->entry = 0x0000U;
+    vm->run = run;
+    status_t result = init_risky_vm_state(&vm->state);
+    vm->state.channel_io = (risky_channel_io_t) {
+        .read = read_word, .write = write_word, .context = NULL,
+    };
+    return result;
+}
+
+int main(int argc, char * argv[]) {
+    bench_options_t options;
+    int parsed = parse_arguments(argc, argv, &options);
+    if(parsed != 0) {
+        return (parsed < 0) ? 0 : 1;
+    }
+    // counters which can't be read are reported as null, not as an error
+    risky_counters_t counter_storage;
+    risky_counters_t * counters = NULL;
+    if(options.counters) {
+        counters = &counter_storage;
+        init_risky_counters(counters);
+        if(!risky_counters_available(counters)) {
+            fprintf(
+                stderr, "%s: hardware performance counters are not "
+                "available on this host\n", argv[0]
+            );
+        }
+    }
+    bool success = true;
+    size_t count = 0;
+    char name[64];
+    printf(
+        "{\n  \"version\": \"%s\",\n  \"counters\": %s,\n"
+        "  \"benchmarks\": [",
+        RISKY_VERSION_STRING,
+        (counters != NULL && risky_counters_available(counters))
+            ? "true" : "false"
+    );
+    // decoding each opcode, with a variety of operands
+    static decode_context_t decode;
+    for(unsigned int opcode = 0; opcode < 32 && success; opcode++) {
+        for(size_t i = 0; i < DECODE_BATCH; i++) {
+            decode.raw[i] = (risky_raw_instruction_t) {{
+                (risky_byte_t) ((opcode << 3) | (i % 8)),
+                (risky_byte_t) i, (risky_byte_t) (i * 7),
+                (risky_byte_t) (i * 13),
+            }};
+        }
+        snprintf(
+            name, sizeof(name), "decode/%s",
+            get_risky_opcode_mnemonic((risky_opcode_t) opcode)
+        );
+        bench_t bench = { name, decode_body, &decode, DECODE_BATCH, NULL, };
+        success = run_filtered(&options, counters, &bench, &count);
+    }
+    // creating and destroying VMs
+    if(success) {
+        bench_t bench = { "state/init_free", churn_body, NULL, 1, NULL, };
+        success = run_filtered(&options, counters, &bench, &count);
+    }
+    // executing each opcode, in a loop of the same instruction
+    for(unsigned int opcode = 0; opcode < 32 && success; opcode++) {
+        vm_context_t vm;
+        if(init_vm_context(&vm, run_risky_vm) != STATUS_SUCCESS) {
+            fprintf(stderr, "could not allocate VM state\n");
+            return 1;
+        }
+        load_opcode_program(&vm, (risky_opcode_t) opcode);
+        snprintf(
+            name, sizeof(name), "execute/%s",
+            get_risky_opcode_mnemonic((risky_opcode_t) opcode)
+        );
+        bench_t bench = {
+            name, run_body, &vm, count_instructions(&vm), "threaded",
+        };
+        success = bench.operations != 0 && run_filtered(
+            &options, counters, &bench, &count
+        );
+        free_risky_vm_state(&vm.state);
+    }
+    // whole programs
+    struct {
+        const char * name;
+        void (* load)(vm_context_t * vm);
+    } programs[] = {
+        { "program/fibonacci", load_fibonacci_program, },
+        { "program/countdown", load_countdown_program, },
+        { "program/copy", load_copy_program, },
+    };
+    // with each dispatch strategy, which differ most on whole programs
+    struct {
+        const char * name;
+        runner_t run;
+    } strategies[] = {
+        { "threaded", run_risky_vm, },
+        { "switch", run_risky_vm_switch, },
+    };
+    for(size_t i = 0; i < sizeof(programs) / sizeof(programs[0]); i++) {
+        for(size_t j = 0; j < 2 && success; j++) {
+            vm_context_t vm;
+            if(init_vm_context(&vm, strategies[j].run) != STATUS_SUCCESS) {
+                fprintf(stderr, "could not allocate VM state\n");
+                return 1;
+            }
+            programs[i].load(&vm);
+            // each strategy's run of a program is named after both
+            snprintf(
+                name, sizeof(name), "%s/%s", programs[i].name,
+                strategies[j].name
+            );
+            bench_t bench = {
+                name, run_body, &vm, count_instructions(&vm),
+                strategies[j].name,
+            };
+            success = bench.operations != 0 && run_filtered(
+                &options, counters, &bench, &count
+            );
+            free_risky_vm_state(&vm.state);
+        }
+    }
+    printf("\n  ]\n}\n");
+    if(counters != NULL) {
+        free_risky_counters(counters);
+    }
+    return success ? 0 : 1;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
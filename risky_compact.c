@@ -0,0 +1,70 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * This compilation unit provides a command-line program which folds the
+ * deltas of a checkpoint log written by the checkpoint module into the base
+ * checkpoint the log follows on from, leaving the log empty, so that the log
+ * doesn't grow forever and restoring from it stays quick.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "risky/checkpoint.h"
+#include "risky/risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// prints how to use the program to the given stream
+static void print_usage(FILE * stream, const char * name) {
+    fprintf(
+        stream,
+        "usage: %s [--help] BASE LOG\n"
+        "\n"
+        "Folds the deltas in the RISKY checkpoint log in the file LOG into\n"
+        "the checkpoint in the file BASE which the log follows on from, then\n"
+        "empties the log, ready for more deltas to be appended to it.\n"
+        "\n"
+        "  --help  print this message and exit\n",
+        name
+    );
+}
+
+int main(int argc, char * argv[]) {
+    const char * paths[2] = { NULL, NULL, };
+    int count = 0;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--help") == 0) {
+            print_usage(stdout, argv[0]);
+            return 0;
+        } else if((argv[i][0] == '-' && argv[i][1] != '\0') || count == 2) {
+            fprintf(stderr, "%s: invalid argument '%s'\n", argv[0], argv[i]);
+            print_usage(stderr, argv[0]);
+            return 1;
+        } else {
+            paths[count++] = argv[i];
+        }
+    }
+    if(count != 2) {
+        print_usage(stderr, argv[0]);
+        return 1;
+    }
+    if(compact_risky_checkpoint_log(paths[0], paths[1]) != STATUS_SUCCESS) {
+        fprintf(
+            stderr, "%s: could not fold log '%s' into checkpoint '%s'\n",
+            argv[0], paths[1], paths[0]
+        );
+        return 1;
+    }
+    return 0;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,202 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * This compilation unit provides a command-line program which decodes a
+ * binary execution trace written by the trace module (such as with rivm's
+ * --trace option), printing one line per instruction executed: its address,
+ * its disassembly and the new value of the register it wrote, if any.
+ */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "risky/decoder.h"
+#include "risky/risky.h"
+#include "risky/trace.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of records read from the trace file at a time
+#define READ_RECORDS 4096U
+
+// options given on the command line
+typedef struct trace_options_t {
+    // path to the trace file to decode
+    const char * trace;
+    // whether to print only the number of records
+    bool count;
+} trace_options_t;
+
+// prints how to use the program to the given stream
+static void print_usage(FILE * stream, const char * name) {
+    fprintf(
+        stream,
+        "usage: %s [--help] [--count] TRACE\n"
+        "\n"
+        "Decodes the RISKY execution trace in the file TRACE, printing the\n"
+        "address and disassembly of each instruction executed, in order, and\n"
+        "the new value of the register it wrote.\n"
+        "\n"
+        "  --help   print this message and exit\n"
+        "  --count  only print the number of instructions in the trace\n",
+        name
+    );
+}
+
+/*
+ * private function - parses the command-line arguments into the given options.
+ * Returns 0 if the program should run, 1 if the arguments are invalid, or -1
+ * if the program should exit successfully without running
+ */
+static int parse_arguments(
+    int argc, char * argv[], trace_options_t * options
+) {
+    *options = (trace_options_t) { .trace = NULL, .count = false, };
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--help") == 0) {
+            print_usage(stdout, argv[0]);
+            return -1;
+        } else if(strcmp(argv[i], "--count") == 0) {
+            options->count = true;
+        } else if(
+            (argv[i][0] == '-' && argv[i][1] != '\0') || options->trace != NULL
+        ) {
+            fprintf(stderr, "%s: invalid argument '%s'\n", argv[0], argv[i]);
+            print_usage(stderr, argv[0]);
+            return 1;
+        } else {
+            options->trace = argv[i];
+        }
+    }
+    if(options->trace == NULL) {
+        print_usage(stderr, argv[0]);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * private function - prints the given record as a line of text to standard
+ * output.
+ * Returns a status_t with error / success information
+ */
+static status_t print_record(const risky_trace_record_t * record) {
+    risky_raw_instruction_t raw;
+    memcpy(raw.bytes, record->raw, sizeof(raw.bytes));
+    risky_instruction_t instruction;
+    char text[RISKY_DISASSEMBLY_SIZE];
+    status_t result = decode_instruction_from_raw(&raw, &instruction);
+    if(result == STATUS_SUCCESS) {
+        result = disassemble_instruction(&instruction, text, sizeof(text));
+    }
+    if(result != STATUS_SUCCESS) {
+        return result;
+    }
+    printf("0x%02x%02x  ", record->address[0], record->address[1]);
+    if(record->flags & RISKY_TRACE_WROTE_REGISTER) {
+        printf(
+            "%-24s  r%u = 0x%02x%02x\n", text, record->destination,
+            record->value[0], record->value[1]
+        );
+    } else {
+        printf("%s\n", text);
+    }
+    return STATUS_SUCCESS;
+}
+
+int main(int argc, char * argv[]) {
+    trace_options_t options;
+    int parsed = parse_arguments(argc, argv, &options);
+    if(parsed != 0) {
+        return (parsed < 0) ? 0 : 1;
+    }
+    FILE * file = fopen(options.trace, "rb");
+    if(file == NULL) {
+        fprintf(
+            stderr, "%s: could not open trace '%s'\n", argv[0], options.trace
+        );
+        return 1;
+    }
+    risky_byte_t header[RISKY_TRACE_HEADER_SIZE];
+    size_t size = fread(header, 1, sizeof(header), file);
+    if(!is_risky_trace(header, size)) {
+        fprintf(
+            stderr, "%s: '%s' is not a RISKY trace this can read\n", argv[0],
+            options.trace
+        );
+        fclose(file);
+        return 1;
+    }
+    /*
+     * a trace which was cut short may end part of the way through a record,
+     * which is left out, as fread() only returns whole records
+     */
+    long end = -1;
+    if(fseek(file, 0, SEEK_END) == 0) {
+        end = ftell(file);
+    }
+    if(end < 0 || fseek(file, RISKY_TRACE_HEADER_SIZE, SEEK_SET) != 0) {
+        fprintf(
+            stderr, "%s: could not read trace '%s'\n", argv[0], options.trace
+        );
+        fclose(file);
+        return 1;
+    }
+    size_t partial = (size_t) (end - RISKY_TRACE_HEADER_SIZE) %
+        sizeof(risky_trace_record_t);
+    static risky_trace_record_t records[READ_RECORDS];
+    uint64_t total = 0;
+    status_t result = STATUS_SUCCESS;
+    size_t count;
+    while(
+        result == STATUS_SUCCESS &&
+        (count = fread(records, sizeof(records[0]), READ_RECORDS, file)) != 0
+    ) {
+        for(size_t i = 0; i < count && !options.count; i++) {
+            result = print_record(&records[i]);
+            if(result != STATUS_SUCCESS) {
+                fprintf(
+                    stderr, "%s: could not decode record %" PRIu64 "\n",
+                    argv[0], total + i
+                );
+                break;
+            }
+        }
+        total += count;
+    }
+    if(ferror(file)) {
+        fprintf(
+            stderr, "%s: could not read trace '%s'\n", argv[0], options.trace
+        );
+        result = STATUS_FAIL;
+    }
+    fclose(file);
+    if(result != STATUS_SUCCESS) {
+        return 1;
+    }
+    if(partial != 0) {
+        fprintf(
+            stderr, "%s: warning: trace '%s' is truncated, ignoring the %zu "
+            "byte(s) of its last record\n", argv[0], options.trace, partial
+        );
+    }
+    if(options.count) {
+        printf("%" PRIu64 "\n", total);
+    }
+    return 0;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -5,19 +5,496 @@
  *
  * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
  *
- * This compilation unit currently does nothing, but will eventually provide a
- * command-line program with which to run an instance of the RISKY virtual
- * machine.
+ * This compilation unit provides a command-line program with which to run an
+ * instance of the RISKY virtual machine. The program file is either a program
+ * in the container format of the program module, or raw bytecode which is
+ * mapped as the initial contents of RAM. Every data channel reads words from
+ * standard input and writes them to standard output, each as two big-endian
+ * bytes. The program can optionally be profiled or traced while it runs, and
+ * the host's hardware performance counters read. Its channel input can be
+ * recorded, then replayed to repeat the run exactly. The VM can be saved to a
+ * checkpoint file when it stops, and a checkpoint file run in place of a
+ * program to carry on from where it left off.
  */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "risky/checkpoint.h"
+#include "risky/core.h"
+#include "risky/counters.h"
+#include "risky/image.h"
+#include "risky/interpreter.h"
+#include "risky/profile.h"
+#include "risky/program.h"
+#include "risky/replay.h"
 #include "risky/risky.h"
+#include "risky/trace.h"
 
 
 #ifdef __cplusplus
 extern "C"{
 #endif
 
-int main() {
-    // TODO: Write source code...
+// number of hot blocks reported when profiling, unless told otherwise
+#define DEFAULT_TOP_BLOCKS 10U
+
+// options given on the command line
+typedef struct rivm_options_t {
+    // path to the file of bytecode to run
+    const char * program;
+    // path to write collapsed profile stacks to (NULL if not profiling)
+    const char * profile;
+    // number of hot blocks to report when profiling
+    size_t top;
+    // path to write a binary execution trace to (NULL if not tracing)
+    const char * trace;
+    // path to record the program's channel input to (NULL if not recording)
+    const char * record;
+    // path to replay the program's channel input from (NULL if not replaying)
+    const char * replay;
+    // path to save a checkpoint of the VM to when it stops (NULL if not)
+    const char * checkpoint;
+    // whether to report the host's hardware performance counters
+    bool counters;
+} rivm_options_t;
+
+// prints how to use the program to the given stream
+static void print_usage(FILE * stream, const char * name) {
+    fprintf(
+        stream,
+        "usage: %s [--help] [--profile FILE [--top N] | --trace FILE]\n"
+        "       [--record FILE | --replay FILE] [--checkpoint FILE]\n"
+        "       [--counters] PROGRAM\n"
+        "\n"
+        "Runs the RISKY program in the file PROGRAM until it halts. PROGRAM\n"
+        "is either a RISKY program file, a checkpoint of a VM to carry on\n"
+        "running or raw bytecode (at most 64KiB, mapped as the initial\n"
+        "contents of RAM). Data channels read from standard input and write\n"
+        "to standard output, a word at a time as two big-endian bytes.\n"
+        "\n"
+        "  --help          print this message and exit\n"
+        "  --profile FILE  count the instructions executed, report the\n"
+        "                  hottest basic blocks on standard error and write\n"
+        "                  collapsed stacks for flame graphs to FILE\n"
+        "  --top N         report the N hottest basic blocks (default %u)\n"
+        "  --trace FILE    write a binary trace of every instruction executed\n"
+        "                  to FILE, which risky_trace decodes\n"
+        "  --record FILE   log every word read from a channel, and every\n"
+        "                  channel state queried, to FILE\n"
+        "  --replay FILE   take the words read from channels and the channel\n"
+        "                  states queried from a log recorded to FILE instead\n"
+        "                  of standard input, repeating the recorded run\n"
+        "  --checkpoint FILE\n"
+        "                  save the whole state of the VM to FILE when the\n"
+        "                  program stops, which can be run as PROGRAM later\n"
+        "  --counters      report the host's hardware performance counters\n"
+        "                  for the run on standard error, if it allows them\n",
+        name, DEFAULT_TOP_BLOCKS
+    );
+}
+
+/*
+ * private function - parses the command-line arguments into the given options.
+ * Returns 0 if the program should run, 1 if the arguments are invalid, or -1
+ * if the program should exit successfully without running
+ */
+static int parse_arguments(
+    int argc, char * argv[], rivm_options_t * options
+) {
+    *options = (rivm_options_t) {
+        .program = NULL, .profile = NULL, .top = DEFAULT_TOP_BLOCKS,
+        .trace = NULL, .record = NULL, .replay = NULL, .checkpoint = NULL,
+        .counters = false,
+    };
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--help") == 0) {
+            print_usage(stdout, argv[0]);
+            return -1;
+        } else if(strcmp(argv[i], "--counters") == 0) {
+            options->counters = true;
+        } else if(
+            strcmp(argv[i], "--profile") == 0 ||
+            strcmp(argv[i], "--top") == 0 || strcmp(argv[i], "--trace") == 0 ||
+            strcmp(argv[i], "--record") == 0 ||
+            strcmp(argv[i], "--replay") == 0 ||
+            strcmp(argv[i], "--checkpoint") == 0
+        ) {
+            if(i + 1 == argc) {
+                fprintf(
+                    stderr, "%s: option '%s' needs a value\n", argv[0],
+                    argv[i]
+                );
+                return 1;
+            }
+            const char * value = argv[++i];
+            if(strcmp(argv[i - 1], "--profile") == 0) {
+                options->profile = value;
+                continue;
+            }
+            if(strcmp(argv[i - 1], "--trace") == 0) {
+                options->trace = value;
+                continue;
+            }
+            if(strcmp(argv[i - 1], "--record") == 0) {
+                options->record = value;
+                continue;
+            }
+            if(strcmp(argv[i - 1], "--replay") == 0) {
+                options->replay = value;
+                continue;
+            }
+            if(strcmp(argv[i - 1], "--checkpoint") == 0) {
+                options->checkpoint = value;
+                continue;
+            }
+            char * end = NULL;
+            options->top = (size_t) strtoul(value, &end, 10);
+            if(value[0] < '0' || value[0] > '9' || *end != '\0') {
+                fprintf(
+                    stderr, "%s: invalid number of blocks '%s'\n", argv[0],
+                    value
+                );
+                return 1;
+            }
+        } else if(argv[i][0] == '-' && argv[i][1] != '\0') {
+            fprintf(stderr, "%s: unknown option '%s'\n", argv[0], argv[i]);
+            return 1;
+        } else if(options->program != NULL) {
+            fprintf(stderr, "%s: only one program may be given\n", argv[0]);
+            return 1;
+        } else {
+            options->program = argv[i];
+        }
+    }
+    if(options->program == NULL) {
+        print_usage(stderr, argv[0]);
+        return 1;
+    }
+    int modes = (options->profile != NULL) + (options->trace != NULL) +
+        (options->record != NULL) + (options->replay != NULL);
+    if(modes > 1) {
+        fprintf(
+            stderr, "%s: only one of --profile, --trace, --record and "
+            "--replay may be given\n", argv[0]
+        );
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * private function - loads the program file at the given path into the VM,
+ * as a program in the container format or a checkpoint if it starts with
+ * their magic bytes, otherwise as raw bytecode.
+ * Returns a status_t with error / success information
+ */
+static status_t load_program(risky_vm_state_t * state, const char * path) {
+    FILE * file = fopen(path, "rb");
+    if(file == NULL) {
+        return STATUS_FAIL;
+    }
+    risky_byte_t magic[4];
+    size_t size = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+    if(is_risky_program(magic, size)) {
+        return load_risky_program(state, path, NULL);
+    }
+    if(is_risky_checkpoint(magic, size)) {
+        return restore_risky_vm_checkpoint(state, path);
+    }
+    return load_risky_program_file(state, path);
+}
+
+/*
+ * private function - channel read callback, reads the next word from standard
+ * input. Returns false once standard input has run out
+ */
+static bool read_word(
+    void * context, risky_channel_t channel, risky_word_t * data
+) {
+    (void) context;
+    (void) channel;
+    int high = getchar();
+    int low = (high == EOF) ? EOF : getchar();
+    if(low == EOF) {
+        return false;
+    }
+    *data = (risky_word_t) ((high << 8) | low);
+    return true;
+}
+
+// private function - channel write callback, writes a word to standard output
+static void write_word(
+    void * context, risky_channel_t channel, risky_word_t data
+) {
+    (void) context;
+    (void) channel;
+    putchar(data >> 8);
+    putchar(data & 0xffU);
+}
+
+/*
+ * private function - prints the given hardware performance counters of a run
+ * which executed the given number of guest instructions to standard error
+ */
+static void print_counters(
+    const risky_counters_t * counters, uint64_t executed, const char * name
+) {
+    if(!risky_counters_available(counters)) {
+        fprintf(
+            stderr, "%s: hardware performance counters are not available on "
+            "this host\n", name
+        );
+        return;
+    }
+    fprintf(
+        stderr, "\nhost counters for %" PRIu64 " guest instructions\n",
+        executed
+    );
+    for(size_t i = 0; i < RISKY_COUNTER_COUNT; i++) {
+        if(!counters->counted[i]) {
+            fprintf(
+                stderr, "%-22s %16s\n",
+                get_risky_counter_name((risky_counter_t) i), "not counted"
+            );
+            continue;
+        }
+        fprintf(
+            stderr, "%-22s %16" PRIu64 "  %10.3f per guest instruction\n",
+            get_risky_counter_name((risky_counter_t) i), counters->values[i],
+            (executed != 0) ? (double) counters->values[i] / executed : 0.0
+        );
+    }
+    if(
+        counters->counted[RISKY_COUNTER_BRANCHES] &&
+        counters->counted[RISKY_COUNTER_BRANCH_MISSES] &&
+        counters->values[RISKY_COUNTER_BRANCHES] != 0
+    ) {
+        fprintf(
+            stderr, "branch miss rate %.3f%%\n",
+            100.0 * counters->values[RISKY_COUNTER_BRANCH_MISSES] /
+            counters->values[RISKY_COUNTER_BRANCHES]
+        );
+    }
+}
+
+/*
+ * private function - runs the VM until it stops, writing a trace of every
+ * instruction executed to the file at the given path and counting them with
+ * the given counters (unless NULL).
+ * Returns a status_t with error / success information
+ */
+static status_t run_traced(
+    risky_vm_state_t * state, const char * path, risky_counters_t * counters,
+    risky_stop_reason_t * reason, uint64_t * executed, const char * name
+) {
+    risky_trace_t trace;
+    if(open_risky_trace(&trace, path) != STATUS_SUCCESS) {
+        fprintf(stderr, "%s: could not open trace '%s'\n", name, path);
+        return STATUS_FAIL;
+    }
+    if(counters != NULL) {
+        start_risky_counters(counters);
+    }
+    status_t result = run_risky_vm_traced(state, &trace, reason);
+    if(counters != NULL) {
+        stop_risky_counters(counters);
+    }
+    *executed = trace.head;
+    if(close_risky_trace(&trace) != STATUS_SUCCESS) {
+        fprintf(stderr, "%s: could not write trace '%s'\n", name, path);
+        result = STATUS_FAIL;
+    }
+    return result;
+}
+
+/*
+ * private function - runs the VM until it stops, recording its channel input
+ * to the file at the given path if recording, or replaying it from the file
+ * otherwise, and counting the instructions executed with the given counters
+ * (unless NULL).
+ * Returns a status_t with error / success information
+ */
+static status_t run_replay(
+    risky_vm_state_t * state, const char * path, bool recording,
+    risky_counters_t * counters, risky_stop_reason_t * reason,
+    uint64_t * executed, const char * name
+) {
+    risky_replay_log_t log;
+    if(recording) {
+        init_risky_replay_log(&log);
+    } else if(load_risky_replay_log(&log, path) != STATUS_SUCCESS) {
+        fprintf(stderr, "%s: could not load replay log '%s'\n", name, path);
+        return STATUS_FAIL;
+    }
+    if(counters != NULL) {
+        start_risky_counters(counters);
+    }
+    status_t result = recording
+        ? run_risky_vm_recorded(state, &log, reason)
+        : run_risky_vm_replayed(state, &log, reason);
+    if(counters != NULL) {
+        stop_risky_counters(counters);
+    }
+    *executed = log.executed;
+    if(!recording && result != STATUS_SUCCESS) {
+        fprintf(
+            stderr, "%s: run diverged from replay log '%s' after %" PRIu64
+            " instructions\n", name, path, log.executed
+        );
+    }
+    // a log is still saved after an error, as the run so far may be useful
+    if(recording && save_risky_replay_log(&log, path) != STATUS_SUCCESS) {
+        fprintf(stderr, "%s: could not save replay log '%s'\n", name, path);
+        result = STATUS_FAIL;
+    }
+    free_risky_replay_log(&log);
+    return result;
+}
+
+/*
+ * private function - runs the VM until it stops, counting the instructions
+ * executed with the given counters (unless NULL). With a profile file in the
+ * options, the run collects a profile, which is then reported on standard
+ * error and its collapsed stacks written to the file. With a trace file, a
+ * trace of the run is written to it instead, and with a replay log, the
+ * program's channel input is recorded to it or replayed from it.
+ * Returns a status_t with error / success information
+ */
+static status_t run_program(
+    risky_vm_state_t * state, const rivm_options_t * options,
+    risky_counters_t * counters, risky_stop_reason_t * reason,
+    uint64_t * executed, const char * name
+) {
+    if(options->trace != NULL) {
+        return run_traced(
+            state, options->trace, counters, reason, executed, name
+        );
+    }
+    if(options->record != NULL) {
+        return run_replay(
+            state, options->record, true, counters, reason, executed, name
+        );
+    }
+    if(options->replay != NULL) {
+        return run_replay(
+            state, options->replay, false, counters, reason, executed, name
+        );
+    }
+    if(options->profile == NULL) {
+        if(counters != NULL) {
+            start_risky_counters(counters);
+        }
+        status_t result = run_risky_vm_for(
+            state, UINT64_MAX, executed, reason
+        );
+        if(counters != NULL) {
+            stop_risky_counters(counters);
+        }
+        return result;
+    }
+    FILE * stacks = fopen(options->profile, "w");
+    if(stacks == NULL) {
+        fprintf(
+            stderr, "%s: could not open profile '%s'\n", name,
+            options->profile
+        );
+        return STATUS_FAIL;
+    }
+    risky_profile_t profile;
+    status_t result = init_risky_profile(&profile);
+    if(result == STATUS_SUCCESS) {
+        if(counters != NULL) {
+            start_risky_counters(counters);
+        }
+        result = run_risky_vm_profiled(state, &profile, reason);
+        if(counters != NULL) {
+            stop_risky_counters(counters);
+        }
+        *executed = profile.total;
+    }
+    if(result == STATUS_SUCCESS) {
+        result = print_risky_profile(&profile, state, options->top, stderr);
+    }
+    if(result == STATUS_SUCCESS) {
+        result = write_risky_profile_stacks(
+            &profile, state, options->program, stacks
+        );
+    }
+    if(fclose(stacks) != 0 && result == STATUS_SUCCESS) {
+        result = STATUS_FAIL;
+    }
+    free_risky_profile(&profile);
+    return result;
+}
+
+int main(int argc, char * argv[]) {
+    rivm_options_t options;
+    int parsed = parse_arguments(argc, argv, &options);
+    if(parsed != 0) {
+        return (parsed < 0) ? 0 : 1;
+    }
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        fprintf(stderr, "%s: could not allocate VM state\n", argv[0]);
+        return 1;
+    }
+    if(load_program(&state, options.program) != STATUS_SUCCESS) {
+        fprintf(
+            stderr, "%s: could not load program '%s'\n", argv[0],
+            options.program
+        );
+        free_risky_vm_state(&state);
+        return 1;
+    }
+    state.channel_io = (risky_channel_io_t) {
+        .read = read_word, .write = write_word, .context = NULL,
+    };
+    risky_counters_t counters;
+    if(options.counters) {
+        init_risky_counters(&counters);
+    }
+    risky_stop_reason_t reason;
+    uint64_t executed = 0;
+    status_t result = run_program(
+        &state, &options, options.counters ? &counters : NULL, &reason,
+        &executed, argv[0]
+    );
+    fflush(stdout);
+    bool saved = true;
+    if(result == STATUS_SUCCESS && options.checkpoint != NULL) {
+        saved = save_risky_vm_checkpoint(
+            &state, options.checkpoint
+        ) == STATUS_SUCCESS;
+        if(!saved) {
+            fprintf(
+                stderr, "%s: could not save checkpoint '%s'\n", argv[0],
+                options.checkpoint
+            );
+        }
+    }
+    if(options.counters) {
+        print_counters(&counters, executed, argv[0]);
+        free_risky_counters(&counters);
+    }
+    free_risky_vm_state(&state);
+    if(result != STATUS_SUCCESS) {
+        fprintf(stderr, "%s: error running program\n", argv[0]);
+        return 1;
+    }
+    if(!saved) {
+        return 1;
+    }
+    if(reason == RISKY_STOP_BLOCKED) {
+        // the program wanted more input than there was
+        fprintf(stderr, "%s: program blocked at end of input\n", argv[0]);
+        return 2;
+    }
     return 0;
 }
 
@@ -0,0 +1,236 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains unit tests for the baseline module
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "../risky/baseline.h"
+#include "../risky/cache.h"
+#include "../risky/core.h"
+#include "../risky/fork.h"
+#include "../risky/interpreter.h"
+#include "../risky/risky.h"
+#include "../unit_test_harness/harness.h"
+#include "instructions.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * test helper function - initialises a VM with a program which stores
+ * register 3 over the start of its own fourth instruction (an INC of register
+ * 4), then halts, unless it has been turned into something else
+ */
+static status_t init_rewriter(risky_vm_state_t * state) {
+    *state = (risky_vm_state_t) { .registers = {0}, .ram = NULL, };
+    status_t result = init_risky_vm_state(state);
+    if(result != STATUS_SUCCESS) {
+        return result;
+    }
+    risky_instruction_t program[] = {
+        op(SET, 0x04U, 2, 0, 0),
+        op(SAV, 0x06U, 3, 2, 0),
+        op(NOP, 0x00U, 0, 0, 0),
+        op(INC, 0x06U, 4, 4, 0),
+        op(HLT, 0x00U, 0, 0, 0),
+    };
+    program[0].l = 0x000cU;
+    encode_program(state->ram, program, 5);
+    // the opcode byte of HLT and register 0
+    state->registers[3] = (risky_register_t) (HLT << 11);
+    state->channels[5] = RISKY_CHANNEL_ACTIVE;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Resetting a VM should undo everything it has done since the baseline was
+ * captured, including writes to RAM, however many times it is reset.
+ */
+test_result_t test_reset_risky_vm_to_baseline() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_vm_state_t state;
+    if(init_rewriter(&state) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    risky_baseline_t baseline;
+    if(capture_risky_baseline(&baseline, &state) != STATUS_SUCCESS) {
+        free_risky_vm_state(&state);
+        test.result = TEST_ERROR;
+        return test;
+    }
+    risky_vm_state_t original;
+    if(init_rewriter(&original) != STATUS_SUCCESS) {
+        free_risky_baseline(&baseline);
+        free_risky_vm_state(&state);
+        test.result = TEST_ERROR;
+        return test;
+    }
+    test.result = TEST_SUCCESS;
+    for(unsigned int i = 0; i < 3; i++) {
+        risky_stop_reason_t reason;
+        state.channels[5] = 0x00U;
+        state.registers[200] = 0xffffU;
+        if(
+            run_risky_vm(&state, &reason) != STATUS_SUCCESS ||
+            reason != RISKY_STOP_HALTED || state.registers[4] != 0 ||
+            reset_risky_vm_to_baseline(&state, &baseline) != STATUS_SUCCESS ||
+            memcmp(
+                state.registers, original.registers, sizeof(state.registers)
+            ) != 0 ||
+            memcmp(state.ram, original.ram, RISKY_RAM_AMOUNT) != 0 ||
+            memcmp(
+                state.channels, original.channels, sizeof(state.channels)
+            ) != 0 ||
+            state.program_counter != original.program_counter
+        ) {
+            test.result = TEST_FAIL;
+        }
+    }
+    free_risky_vm_state(&original);
+    free_risky_baseline(&baseline);
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * Instructions decoded from RAM written to since the baseline was captured
+ * should be decoded again from the baseline's RAM once the VM is reset.
+ */
+test_result_t test_reset_invalidates_cache() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_vm_state_t state;
+    if(init_rewriter(&state) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    risky_baseline_t baseline;
+    if(capture_risky_baseline(&baseline, &state) != STATUS_SUCCESS) {
+        free_risky_vm_state(&state);
+        test.result = TEST_ERROR;
+        return test;
+    }
+    // the HLT written over the INC is decoded and cached
+    risky_stop_reason_t reason;
+    status_t result = run_risky_vm(&state, &reason);
+    if(result == STATUS_SUCCESS) {
+        result = reset_risky_vm_to_baseline(&state, &baseline);
+    }
+    // so the INC is only run if the reset threw the HLT away
+    state.program_counter = 0x000cU;
+    if(result == STATUS_SUCCESS) {
+        result = run_risky_vm(&state, &reason);
+    }
+    test.result = (
+        result == STATUS_SUCCESS && reason == RISKY_STOP_HALTED &&
+        state.registers[4] == 1
+    ) ? TEST_SUCCESS : TEST_FAIL;
+    free_risky_baseline(&baseline);
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * Forking a VM shouldn't count as writing to its RAM, so resetting it
+ * afterwards should still only copy back the line it wrote to itself.
+ */
+test_result_t test_reset_after_fork() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_vm_state_t state, child;
+    if(init_rewriter(&state) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    risky_baseline_t baseline;
+    if(capture_risky_baseline(&baseline, &state) != STATUS_SUCCESS) {
+        free_risky_vm_state(&state);
+        test.result = TEST_ERROR;
+        return test;
+    }
+    risky_stop_reason_t reason;
+    if(
+        run_risky_vm(&state, &reason) != STATUS_SUCCESS ||
+        fork_risky_vm(&state, &child) != STATUS_SUCCESS
+    ) {
+        free_risky_baseline(&baseline);
+        free_risky_vm_state(&state);
+        test.result = TEST_ERROR;
+        return test;
+    }
+    // only the first line, which holds the rewritten instruction
+    test.result = state.written_lines[0] == 0x0000000000000001U ?
+        TEST_SUCCESS : TEST_FAIL;
+    for(size_t i = 1; i < RISKY_WRITE_LINE_WORDS; i++) {
+        if(state.written_lines[i] != 0) {
+            test.result = TEST_FAIL;
+        }
+    }
+    if(
+        reset_risky_vm_to_baseline(&state, &baseline) != STATUS_SUCCESS ||
+        memcmp(state.ram, baseline.ram, RISKY_RAM_AMOUNT) != 0
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_vm_state(&child);
+    free_risky_baseline(&baseline);
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * Writes to RAM should be tracked a line at a time, with a write straddling
+ * the end of RAM marking the last and first lines.
+ */
+test_result_t test_written_lines() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    invalidate_cached_instructions(&state, 0x0040U, 1);
+    invalidate_cached_instructions(&state, 0xffffU, 2);
+    test.result = (
+        state.written_lines[0] == 0x0000000000000003U &&
+        state.written_lines[RISKY_WRITE_LINE_WORDS - 1] ==
+            0x8000000000000000U
+    ) ? TEST_SUCCESS : TEST_FAIL;
+    for(size_t i = 1; i < RISKY_WRITE_LINE_WORDS - 1; i++) {
+        if(state.written_lines[i] != 0) {
+            test.result = TEST_FAIL;
+        }
+    }
+    free_risky_vm_state(&state);
+    return test;
+}
+
+int main() {
+    // initialise test suite
+    test_suite_t suite = init_test_suite();
+    // add test cases
+    add_test_case(test_reset_risky_vm_to_baseline, &suite);
+    add_test_case(test_reset_invalidates_cache, &suite);
+    add_test_case(test_reset_after_fork, &suite);
+    add_test_case(test_written_lines, &suite);
+    // run test suite
+    run_test_suite(&suite);
+    // return test suite status
+    return suite.result ? 0 : 1;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
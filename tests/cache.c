@@ -0,0 +1,293 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains unit tests for the cache module
+ */
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../risky/cache.h"
+#include "../risky/core.h"
+#include "../risky/packed.h"
+#include "../risky/risky.h"
+#include "../unit_test_harness/harness.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * test helper function - writes the four given bytes into the RAM of the given
+ * VM state, starting at the given address
+ */
+static void write_raw_bytes(
+    risky_vm_state_t * state, risky_ram_address_t address,
+    risky_byte_t a, risky_byte_t b, risky_byte_t c, risky_byte_t d
+) {
+    state->ram[address] = a;
+    state->ram[address + 1] = b;
+    state->ram[address + 2] = c;
+    state->ram[address + 3] = d;
+}
+
+/*
+ * Function fetch_instruction should decode the instruction at the given
+ * address, allocating the cache the first time it is called.
+ */
+test_result_t test_fetch_instruction() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    // SET 0x2a 0xbeef, with a flag set
+    write_raw_bytes(&state, 0x0100U, (SET << 3) | 0x04U, 0x2aU, 0xbeU, 0xefU);
+    risky_packed_instruction_t * instruction = NULL;
+
+    status_t result = fetch_instruction(&state, 0x0100U, &instruction);
+
+    if(result != STATUS_SUCCESS || state.cache == NULL) {
+        test.result = TEST_ERROR;
+    } else if(
+        packed_opcode(instruction) != SET || !packed_a_flag(instruction) ||
+        instruction->r != 0x2aU || instruction->l != 0xbeefU
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * Function fetch_instruction should not decode an instruction again if its
+ * slot has not been invalidated since the last fetch, even if RAM has changed.
+ */
+test_result_t test_fetch_instruction_is_cached() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    write_raw_bytes(&state, 0x0010U, ADD << 3, 0x01U, 0x02U, 0x03U);
+    risky_packed_instruction_t * instruction = NULL;
+    fetch_instruction(&state, 0x0010U, &instruction);
+    // overwrite RAM behind the cache's back
+    write_raw_bytes(&state, 0x0010U, SUB << 3, 0x04U, 0x05U, 0x06U);
+
+    status_t result = fetch_instruction(&state, 0x0010U, &instruction);
+
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+    } else if(packed_opcode(instruction) != ADD || instruction->r != 0x01U) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * Function invalidate_cached_instructions should cause only the slots that the
+ * given range of RAM overlaps (and the one before them) to be decoded again on
+ * the next fetch.
+ */
+test_result_t test_invalidate_cached_instructions() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    write_raw_bytes(&state, 0x0010U, ADD << 3, 0x01U, 0x02U, 0x03U);
+    write_raw_bytes(&state, 0x0014U, ADD << 3, 0x01U, 0x02U, 0x03U);
+    risky_packed_instruction_t * instruction = NULL;
+    fetch_instruction(&state, 0x0010U, &instruction);
+    fetch_instruction(&state, 0x0014U, &instruction);
+    // overwrite both instructions, but only invalidate the first
+    write_raw_bytes(&state, 0x0010U, SUB << 3, 0x04U, 0x05U, 0x06U);
+    write_raw_bytes(&state, 0x0014U, SUB << 3, 0x04U, 0x05U, 0x06U);
+    // a 16-bit write to the last two bytes of the first slot
+    invalidate_cached_instructions(&state, 0x0012U, 2);
+
+    status_t result = fetch_instruction(&state, 0x0010U, &instruction);
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+    } else if(packed_opcode(instruction) != SUB || instruction->r != 0x04U) {
+        test.result = TEST_FAIL;
+    }
+    result = fetch_instruction(&state, 0x0014U, &instruction);
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+    } else if(packed_opcode(instruction) != ADD) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * Function fetch_instruction should correctly decode instructions which are
+ * not aligned to a 4-byte boundary, including those that wrap around RAM.
+ */
+test_result_t test_fetch_unaligned_instruction() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    // COP 0x11 0x22, straddling the end and start of RAM
+    state.ram[0xfffeU] = (COP << 3) | 0x06U;
+    state.ram[0xffffU] = 0x11U;
+    state.ram[0x0000U] = 0x22U;
+    state.ram[0x0001U] = 0x33U;
+    risky_packed_instruction_t * instruction = NULL;
+
+    status_t result = fetch_instruction(&state, 0xfffeU, &instruction);
+
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+    } else if(
+        packed_opcode(instruction) != COP || !packed_a_flag(instruction) ||
+        !packed_b_flag(instruction) || instruction->r != 0x11U ||
+        instruction->a != 0x22U || instruction->b != 0
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * Function fetch_instruction should fuse an instruction with the one after it
+ * when they form one of the fused pairs, decoding the second as well, and
+ * fuse the second with the one after it in turn.
+ */
+test_result_t test_fetch_instruction_fuses() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    // INC r1, NEQ r2 r1 r3, BRA r4 r2, ADD r1 r1 r1
+    write_raw_bytes(&state, 0x0100U, INC << 3, 0x01U, 0x01U, 0x00U);
+    write_raw_bytes(&state, 0x0104U, NEQ << 3, 0x02U, 0x01U, 0x03U);
+    write_raw_bytes(&state, 0x0108U, BRA << 3, 0x04U, 0x02U, 0x00U);
+    write_raw_bytes(&state, 0x010cU, ADD << 3, 0x01U, 0x01U, 0x01U);
+    // SET in the last slot, which would be fused with the JMP after it
+    write_raw_bytes(&state, 0xfffcU, (SET << 3) | 0x04U, 0x01U, 0x00U, 0x00U);
+    write_raw_bytes(&state, 0x0000U, JMP << 3, 0x01U, 0x00U, 0x00U);
+    risky_packed_instruction_t * instruction = NULL;
+
+    status_t result = fetch_instruction(&state, 0x0100U, &instruction);
+
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+    } else if(
+        instruction->fused != RISKY_FUSED_NEQ ||
+        packed_opcode(instruction + 1) != NEQ ||
+        (instruction + 1)->fused != RISKY_FUSED_BRA ||
+        !(state.cache->valid[0x0104U / 4 / 64] & (1ULL << (0x0104U / 4 % 64)))
+    ) {
+        test.result = TEST_FAIL;
+    }
+    result = fetch_instruction(&state, 0x0108U, &instruction);
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+    } else if(instruction->fused != RISKY_FUSED_NONE) {
+        test.result = TEST_FAIL;
+    }
+    result = fetch_instruction(&state, 0xfffcU, &instruction);
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+    } else if(instruction->fused != RISKY_FUSED_NONE) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * Function invalidate_cached_instructions should cause an instruction fused
+ * with the first one in the given range of RAM to be decoded (and fused) again
+ * on the next fetch, as the pair may no longer be fused.
+ */
+test_result_t test_invalidate_fused_instruction() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    // SET r1 0x0200, JMP r1
+    write_raw_bytes(&state, 0x0020U, (SET << 3) | 0x04U, 0x01U, 0x02U, 0x00U);
+    write_raw_bytes(&state, 0x0024U, JMP << 3, 0x01U, 0x00U, 0x00U);
+    risky_packed_instruction_t * instruction = NULL;
+    fetch_instruction(&state, 0x0020U, &instruction);
+    // overwrite the JMP, which the SET was fused with
+    write_raw_bytes(&state, 0x0024U, NOP << 3, 0x00U, 0x00U, 0x00U);
+    invalidate_cached_instructions(&state, 0x0024U, 4);
+
+    status_t result = fetch_instruction(&state, 0x0020U, &instruction);
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+    } else if(
+        packed_opcode(instruction) != SET ||
+        instruction->fused != RISKY_FUSED_NONE
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_vm_state(&state);
+    return test;
+}
+
+int main() {
+    // initialise test suite
+    test_suite_t suite = init_test_suite();
+    // add test cases
+    add_test_case(test_fetch_instruction, &suite);
+    add_test_case(test_fetch_instruction_is_cached, &suite);
+    add_test_case(test_invalidate_cached_instructions, &suite);
+    add_test_case(test_fetch_unaligned_instruction, &suite);
+    add_test_case(test_fetch_instruction_fuses, &suite);
+    add_test_case(test_invalidate_fused_instruction, &suite);
+    // run test suite
+    run_test_suite(&suite);
+    // return test suite status
+    return suite.result ? 0 : 1;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
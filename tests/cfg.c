@@ -0,0 +1,292 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains unit tests for the cfg module
+ */
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../risky/cfg.h"
+#include "../risky/core.h"
+#include "../risky/risky.h"
+#include "../unit_test_harness/harness.h"
+#include "instructions.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * test helper function - builds the graph of a program which counts down in
+ * a loop, then halts, followed by a NOP which runs off the end of the image
+ */
+static status_t build_loop_cfg(risky_cfg_t * cfg) {
+    risky_instruction_t program[] = {
+        set(1, 10),
+        set(2, 1),
+        // 0x08: loop
+        op(SUB, 0x07U, 1, 1, 2),
+        op(NEQ, 0x03U, 5, 1, 6),
+        set(3, 0x0008U),
+        op(BRA, 0x00U, 3, 5, 0),
+        op(HLT, 0x00U, 0, 0, 0),
+        op(NOP, 0x00U, 0, 0, 0),
+    };
+    risky_ram_t image[sizeof(program) / sizeof(program[0]) * 4];
+    encode_program(image, program, sizeof(program) / sizeof(program[0]));
+    return build_risky_cfg(image, sizeof(image), cfg);
+}
+
+/*
+ * Function build_risky_cfg should split a program into blocks at its entry
+ * point, after each jump and halt and at constant jump targets, and find the
+ * edges between them and the registers they define and use.
+ */
+test_result_t test_build_risky_cfg() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+    risky_cfg_t cfg;
+
+    status_t result = build_loop_cfg(&cfg);
+
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    risky_basic_block_t * blocks = cfg.blocks;
+    if(
+        cfg.count != 4 ||
+        // the setup, which runs on into the loop
+        blocks[0].start != 0x0000U || blocks[0].length != 2 ||
+        blocks[0].exit != RISKY_EXIT_FALL_THROUGH || blocks[0].next != 1 ||
+        blocks[0].taken != RISKY_CFG_NO_BLOCK ||
+        !risky_register_set_has(&blocks[0].defines, 1) ||
+        !risky_register_set_has(&blocks[0].defines, 2) ||
+        risky_register_set_has(&blocks[0].uses, 1) ||
+        // the loop, which branches back to itself
+        blocks[1].start != 0x0008U || blocks[1].length != 4 ||
+        blocks[1].exit != RISKY_EXIT_BRANCH || !blocks[1].target_known ||
+        blocks[1].target != 0x0008U || blocks[1].taken != 1 ||
+        blocks[1].next != 2 ||
+        // the HLT, and the NOP after it
+        blocks[2].start != 0x0018U || blocks[2].exit != RISKY_EXIT_HALT ||
+        blocks[2].next != RISKY_CFG_NO_BLOCK ||
+        blocks[3].start != 0x001cU || blocks[3].exit != RISKY_EXIT_END ||
+        blocks[3].next != RISKY_CFG_NO_BLOCK
+    ) {
+        test.result = TEST_FAIL;
+    }
+    // the loop reads registers 1, 2 and 6 first, and only writes 3 and 5
+    risky_register_set_t * uses = &blocks[1].uses;
+    risky_register_set_t * defines = &blocks[1].defines;
+    if(
+        test.result == TEST_SUCCESS && (
+            !risky_register_set_has(uses, 1) ||
+            !risky_register_set_has(uses, 2) ||
+            !risky_register_set_has(uses, 6) ||
+            risky_register_set_has(uses, 3) ||
+            risky_register_set_has(uses, 5) ||
+            !risky_register_set_has(defines, 1) ||
+            !risky_register_set_has(defines, 3) ||
+            !risky_register_set_has(defines, 5) ||
+            risky_register_set_has(defines, 2)
+        )
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_cfg(&cfg);
+    return test;
+}
+
+/*
+ * Function build_risky_cfg should find jump targets which split blocks that
+ * come before the jump, and only treat the register of a jump as constant if
+ * the last instruction in its block to write to it was a SET.
+ */
+test_result_t test_build_risky_cfg_targets() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+    risky_instruction_t program[] = {
+        op(NOP, 0x00U, 0, 0, 0),
+        // 0x04: only known to start a block once the JMP after it is seen
+        op(NOP, 0x00U, 0, 0, 0),
+        set(4, 0x0004U),
+        op(JMP, 0x00U, 4, 0, 0),
+        // 0x10: register 5 isn't known
+        op(JMP, 0x00U, 5, 0, 0),
+        // 0x14: a known target past the end of the image
+        set(6, 0x0100U),
+        op(JMP, 0x00U, 6, 0, 0),
+        // 0x1c: register 9 is set, but then changed
+        set(9, 0x0000U),
+        op(INC, 0x06U, 9, 9, 0),
+        op(JMP, 0x00U, 9, 0, 0),
+    };
+    risky_ram_t image[sizeof(program) / sizeof(program[0]) * 4];
+    encode_program(image, program, sizeof(program) / sizeof(program[0]));
+    risky_cfg_t cfg;
+
+    status_t result = build_risky_cfg(image, sizeof(image), &cfg);
+
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    risky_basic_block_t * blocks = cfg.blocks;
+    if(
+        cfg.count != 5 ||
+        blocks[0].start != 0x0000U || blocks[0].next != 1 ||
+        blocks[1].start != 0x0004U || blocks[1].length != 3 ||
+        blocks[1].exit != RISKY_EXIT_JUMP || blocks[1].taken != 1 ||
+        blocks[1].next != RISKY_CFG_NO_BLOCK ||
+        blocks[2].start != 0x0010U || blocks[2].target_known ||
+        blocks[2].taken != RISKY_CFG_NO_BLOCK ||
+        blocks[3].start != 0x0014U || !blocks[3].target_known ||
+        blocks[3].target != 0x0100U || blocks[3].taken != RISKY_CFG_NO_BLOCK ||
+        blocks[4].start != 0x001cU || blocks[4].target_known ||
+        !risky_register_set_has(&blocks[4].defines, 9) ||
+        risky_register_set_has(&blocks[4].uses, 9)
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_cfg(&cfg);
+    return test;
+}
+
+/*
+ * Function build_risky_cfg should not treat the register of a jump as
+ * constant if its target splits the block between the SET and the jump, as
+ * the register could then be set to something else before the jump.
+ */
+test_result_t test_build_risky_cfg_split_set() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+    risky_instruction_t program[] = {
+        set(4, 0x0008U),
+        op(NOP, 0x00U, 0, 0, 0),
+        // 0x08: the target, in between the SET and the JMP
+        op(NOP, 0x00U, 0, 0, 0),
+        op(JMP, 0x00U, 4, 0, 0),
+    };
+    risky_ram_t image[sizeof(program) / sizeof(program[0]) * 4];
+    encode_program(image, program, sizeof(program) / sizeof(program[0]));
+    risky_cfg_t cfg;
+
+    status_t result = build_risky_cfg(image, sizeof(image), &cfg);
+
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    if(
+        cfg.count != 2 ||
+        cfg.blocks[0].length != 2 || cfg.blocks[0].next != 1 ||
+        !risky_register_set_has(&cfg.blocks[0].defines, 4) ||
+        cfg.blocks[1].start != 0x0008U ||
+        cfg.blocks[1].exit != RISKY_EXIT_JUMP ||
+        cfg.blocks[1].target_known ||
+        cfg.blocks[1].taken != RISKY_CFG_NO_BLOCK ||
+        !risky_register_set_has(&cfg.blocks[1].uses, 4)
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_cfg(&cfg);
+    return test;
+}
+
+/*
+ * Function find_risky_basic_block should return the block holding the
+ * instruction at an address, but only for addresses of instructions in the
+ * image.
+ */
+test_result_t test_find_risky_basic_block() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+    risky_cfg_t cfg;
+    if(build_loop_cfg(&cfg) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+
+    if(
+        find_risky_basic_block(&cfg, 0x0000U) != 0 ||
+        find_risky_basic_block(&cfg, 0x0004U) != 0 ||
+        find_risky_basic_block(&cfg, 0x0008U) != 1 ||
+        find_risky_basic_block(&cfg, 0x0014U) != 1 ||
+        find_risky_basic_block(&cfg, 0x001cU) != 3 ||
+        find_risky_basic_block(&cfg, 0x000aU) != RISKY_CFG_NO_BLOCK ||
+        find_risky_basic_block(&cfg, 0x0020U) != RISKY_CFG_NO_BLOCK
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_cfg(&cfg);
+    return test;
+}
+
+/*
+ * Function build_risky_cfg should refuse images bigger than RAM, give no
+ * blocks for an empty image and decode an instruction cut short by the end
+ * of the image as if it were followed by zeroes.
+ */
+test_result_t test_build_risky_cfg_sizes() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+    // a NOP, then the first byte of a HLT
+    risky_ram_t image[] = { NOP << 3, 0x00U, 0x00U, 0x00U, HLT << 3, };
+    risky_cfg_t cfg;
+
+    if(build_risky_cfg(image, RISKY_RAM_AMOUNT + 1, &cfg) != STATUS_FAIL) {
+        test.result = TEST_FAIL;
+    }
+    if(build_risky_cfg(image, 0, &cfg) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+    } else if(cfg.count != 0) {
+        test.result = TEST_FAIL;
+    }
+    if(build_risky_cfg(image, sizeof(image), &cfg) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    if(
+        cfg.count != 1 || cfg.blocks[0].length != 2 ||
+        cfg.blocks[0].exit != RISKY_EXIT_HALT
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_cfg(&cfg);
+    return test;
+}
+
+int main() {
+    // initialise test suite
+    test_suite_t suite = init_test_suite();
+    // add test cases
+    add_test_case(test_build_risky_cfg, &suite);
+    add_test_case(test_build_risky_cfg_targets, &suite);
+    add_test_case(test_build_risky_cfg_split_set, &suite);
+    add_test_case(test_find_risky_basic_block, &suite);
+    add_test_case(test_build_risky_cfg_sizes, &suite);
+    // run test suite
+    run_test_suite(&suite);
+    // return test suite status
+    return suite.result ? 0 : 1;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
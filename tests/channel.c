@@ -0,0 +1,323 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains unit tests for the channel module
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include "../risky/channel.h"
+#include "../risky/core.h"
+#include "../risky/interpreter.h"
+#include "../risky/risky.h"
+#include "../unit_test_harness/harness.h"
+#include "instructions.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of words passed between threads by the concurrency test
+#define THREADED_WORDS 200000U
+
+// test helper function - sink which appends words to an array of them
+static void append_words(
+    void * context, const risky_word_t * words, size_t count
+) {
+    risky_word_t ** end = (risky_word_t **) context;
+    for(size_t i = 0; i < count; i++) {
+        *(*end)++ = words[i];
+    }
+}
+
+// test helper function - thread which pushes a count of words onto a ring
+static void * produce_words(void * context) {
+    risky_channel_ring_t * ring = (risky_channel_ring_t *) context;
+    risky_word_t next = 0;
+    for(size_t i = 0; i < THREADED_WORDS; i++) {
+        while(!push_risky_channel_ring(ring, next)) {
+            // let the consumer run to make room, even if it shares the CPU
+            sched_yield();
+        }
+        next++;
+    }
+    return NULL;
+}
+
+/*
+ * A ring should hold a power of two words, giving them back in the order
+ * they were pushed, in bulk as well as one at a time, wrapping around the end
+ * of its storage.
+ */
+test_result_t test_risky_channel_ring() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_channel_ring_t ring;
+    if(init_risky_channel_ring(&ring, 5) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    risky_word_t in[8] = { 1, 2, 3, 4, 5, 6, 7, 8, };
+    risky_word_t out[8] = { 0 };
+    risky_word_t word = 0;
+
+    // fill it, then empty it partway so the next bulk write wraps around
+    for(size_t i = 0; i < 8; i++) {
+        if(!push_risky_channel_ring(&ring, in[i])) {
+            test.result = TEST_FAIL;
+        }
+    }
+    bool full = !push_risky_channel_ring(&ring, 9);
+    size_t popped = read_risky_channel_ring(&ring, out, 6);
+    size_t pushed = write_risky_channel_ring(&ring, in, 8);
+    size_t remaining = read_risky_channel_ring(&ring, out, 8);
+    bool empty = !pop_risky_channel_ring(&ring, &word);
+
+    if(!full || popped != 6 || pushed != 6 || remaining != 8 || !empty) {
+        test.result = TEST_FAIL;
+    }
+    risky_word_t expected[8] = { 7, 8, 1, 2, 3, 4, 5, 6, };
+    for(size_t i = 0; i < 8; i++) {
+        if(out[i] != expected[i]) {
+            test.result = TEST_FAIL;
+        }
+    }
+    free_risky_channel_ring(&ring);
+    return test;
+}
+
+/*
+ * A VM writing to a channel with a ring should block when the ring is full,
+ * and carry on where it left off once the host has drained it.
+ */
+test_result_t test_wri_ring() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    // writes 0 to 19 to channel 1, then halts
+    risky_instruction_t program[] = {
+        op(SET, 0x04U, 2, 0, 0),
+        op(SET, 0x04U, 5, 0, 0),
+        op(CDC, 0x00U, 1, 1, 1),
+        op(WRI, 0x00U, 1, 3, 0),
+        op(INC, 0x06U, 3, 3, 0),
+        op(DEC, 0x06U, 2, 2, 0),
+        op(BRA, 0x04U, 5, 2, 0),
+        op(HLT, 0x00U, 0, 0, 0),
+    };
+    program[0].l = 20;
+    program[1].l = 12;
+    risky_vm_state_t state;
+    risky_channel_ring_t ring;
+    if(
+        init_program(&state, program, 8) != STATUS_SUCCESS ||
+        init_risky_channel_ring(&ring, 8) != STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    state.rings[1] = &ring;
+    risky_word_t words[20] = { 0 };
+    risky_word_t * end = words;
+    risky_stop_reason_t reason = RISKY_STOP_NONE;
+    size_t blocks = 0;
+
+    while(reason != RISKY_STOP_HALTED && blocks < 10) {
+        if(run_risky_vm(&state, &reason) != STATUS_SUCCESS) {
+            test.result = TEST_ERROR;
+            break;
+        }
+        if(reason == RISKY_STOP_BLOCKED) {
+            blocks++;
+            // the VM waits at the WRI which found the ring full
+            if(state.program_counter != 12) {
+                test.result = TEST_FAIL;
+            }
+        }
+        drain_risky_channel_ring(&ring, append_words, &end);
+    }
+
+    if(reason != RISKY_STOP_HALTED || blocks != 2 || end != words + 20) {
+        test.result = TEST_FAIL;
+    }
+    for(size_t i = 0; i < 20; i++) {
+        if(words[i] != i) {
+            test.result = TEST_FAIL;
+        }
+    }
+    free_risky_vm_state(&state);
+    free_risky_channel_ring(&ring);
+    return test;
+}
+
+/*
+ * A VM reading from a channel with a ring should block when the ring is
+ * empty, and read the words in order once the host has written them.
+ */
+test_result_t test_rea_ring() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_instruction_t program[] = {
+        op(CDC, 0x00U, 0, 0, 1),
+        op(REA, 0x00U, 3, 0, 0),
+        op(REA, 0x00U, 4, 0, 0),
+        op(REA, 0x00U, 6, 0, 0),
+        op(HLT, 0x00U, 0, 0, 0),
+    };
+    risky_vm_state_t state;
+    risky_channel_ring_t ring;
+    if(
+        init_program(&state, program, 5) != STATUS_SUCCESS ||
+        init_risky_channel_ring(&ring, 4) != STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    state.rings[0] = &ring;
+    risky_word_t words[3] = { 0x1234U, 0x5678U, 0x9abcU, };
+    risky_stop_reason_t first, second;
+
+    write_risky_channel_ring(&ring, words, 1);
+    status_t result = run_risky_vm(&state, &first);
+    risky_ram_address_t blocked_at = state.program_counter;
+    write_risky_channel_ring(&ring, words + 1, 2);
+    if(result == STATUS_SUCCESS) {
+        result = run_risky_vm(&state, &second);
+    }
+
+    if(
+        result != STATUS_SUCCESS || first != RISKY_STOP_BLOCKED ||
+        blocked_at != 8 || second != RISKY_STOP_HALTED ||
+        state.registers[3] != 0x1234U || state.registers[4] != 0x5678U ||
+        state.registers[6] != 0x9abcU
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_vm_state(&state);
+    free_risky_channel_ring(&ring);
+    return test;
+}
+
+/*
+ * Flushing a ring to a file descriptor should write its words as big-endian
+ * bytes and leave it empty.
+ */
+test_result_t test_flush_risky_channel_ring() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_channel_ring_t ring;
+    int descriptors[2];
+    if(
+        init_risky_channel_ring(&ring, 4) != STATUS_SUCCESS ||
+        pipe(descriptors) != 0
+    ) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    risky_word_t words[3] = { 0x0102U, 0x0304U, 0xfffeU, };
+    write_risky_channel_ring(&ring, words, 3);
+    risky_byte_t bytes[7] = { 0 };
+    risky_word_t word;
+
+    status_t result = flush_risky_channel_ring(&ring, descriptors[1]);
+    close(descriptors[1]);
+    ssize_t size = read(descriptors[0], bytes, sizeof(bytes));
+    close(descriptors[0]);
+
+    risky_byte_t expected[6] = { 0x01U, 0x02U, 0x03U, 0x04U, 0xffU, 0xfeU, };
+    if(
+        result != STATUS_SUCCESS || size != 6 ||
+        pop_risky_channel_ring(&ring, &word)
+    ) {
+        test.result = TEST_FAIL;
+    }
+    for(size_t i = 0; i < 6; i++) {
+        if(bytes[i] != expected[i]) {
+            test.result = TEST_FAIL;
+        }
+    }
+    free_risky_channel_ring(&ring);
+    return test;
+}
+
+/*
+ * Words pushed onto a ring by one thread should all be popped by another, in
+ * order and without any being lost.
+ */
+test_result_t test_risky_channel_ring_threaded() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_channel_ring_t ring;
+    pthread_t producer;
+    if(init_risky_channel_ring(&ring, 64) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    if(pthread_create(&producer, NULL, produce_words, &ring) != 0) {
+        free_risky_channel_ring(&ring);
+        test.result = TEST_ERROR;
+        return test;
+    }
+    risky_word_t expected = 0;
+    size_t received = 0;
+    risky_word_t words[16];
+
+    while(received < THREADED_WORDS) {
+        size_t count = read_risky_channel_ring(&ring, words, 16);
+        if(count == 0) {
+            // let the producer run to fill it, even if it shares the CPU
+            sched_yield();
+        }
+        for(size_t i = 0; i < count; i++) {
+            if(words[i] != expected++) {
+                test.result = TEST_FAIL;
+            }
+        }
+        received += count;
+    }
+    pthread_join(producer, NULL);
+
+    free_risky_channel_ring(&ring);
+    return test;
+}
+
+int main() {
+    // initialise test suite
+    test_suite_t suite = init_test_suite();
+    // add test cases
+    add_test_case(test_risky_channel_ring, &suite);
+    add_test_case(test_wri_ring, &suite);
+    add_test_case(test_rea_ring, &suite);
+    add_test_case(test_flush_risky_channel_ring, &suite);
+    add_test_case(test_risky_channel_ring_threaded, &suite);
+    // run test suite
+    run_test_suite(&suite);
+    // return test suite status
+    return suite.result ? 0 : 1;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,488 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains unit tests for the checkpoint module
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../risky/cache.h"
+#include "../risky/checkpoint.h"
+#include "../risky/core.h"
+#include "../risky/fork.h"
+#include "../risky/interpreter.h"
+#include "../risky/risky.h"
+#include "../unit_test_harness/harness.h"
+#include "instructions.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * test helper function - initialises a VM with a program which adds register
+ * 1 to the word at 0x2000 and halts, with 0x1000 stored there to begin with,
+ * and some state besides, so that only the first and third pages of RAM are
+ * not zero
+ */
+static status_t init_adder(risky_vm_state_t * state) {
+    *state = (risky_vm_state_t) { .registers = {0}, .ram = NULL, };
+    status_t result = init_risky_vm_state(state);
+    if(result != STATUS_SUCCESS) {
+        return result;
+    }
+    risky_instruction_t program[] = {
+        op(SET, 0x04U, 2, 0, 0),
+        op(LOD, 0x06U, 3, 2, 0),
+        op(ADD, 0x07U, 3, 3, 1),
+        op(SAV, 0x06U, 3, 2, 0),
+        op(HLT, 0x00U, 0, 0, 0),
+    };
+    program[0].l = 0x2000U;
+    encode_program(state->ram, program, 5);
+    state->ram[0x2000] = 0x10U;
+    state->ram[0x2001] = 0x00U;
+    state->registers[1] = 0x0003U;
+    state->registers[255] = 0xabcdU;
+    state->operation_flags = RISKY_OVERFLOW;
+    state->channels[7] = RISKY_CHANNEL_ACTIVE | RISKY_CHANNEL_WRITE;
+    return STATUS_SUCCESS;
+}
+
+// test helper function - returns the word stored at 0x2000 in a VM's RAM
+static risky_word_t result_of(risky_vm_state_t * state) {
+    return (risky_word_t) ((state->ram[0x2000] << 8) | state->ram[0x2001]);
+}
+
+/*
+ * test helper function - returns whether the two VMs have the same
+ * registers, RAM, program counter, operation flags and channel states
+ */
+static bool same_state(risky_vm_state_t * a, risky_vm_state_t * b) {
+    return (
+        memcmp(a->registers, b->registers, sizeof(a->registers)) == 0 &&
+        memcmp(a->ram, b->ram, RISKY_RAM_AMOUNT) == 0 &&
+        a->program_counter == b->program_counter &&
+        a->operation_flags == b->operation_flags &&
+        memcmp(a->channels, b->channels, sizeof(a->channels)) == 0
+    );
+}
+
+/*
+ * test helper function - makes a new empty temporary file, storing its path
+ * in the given buffer. Returns false if it couldn't be made
+ */
+static bool make_file(char * path) {
+    int descriptor = mkstemp(path);
+    if(descriptor == -1) {
+        return false;
+    }
+    close(descriptor);
+    return true;
+}
+
+/*
+ * A VM restored from a checkpoint should have the state it was saved with,
+ * the file should leave out the pages of RAM which are all zero, and running
+ * the restored VM should not change the checkpoint.
+ */
+test_result_t test_checkpoint_round_trip() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_vm_state_t saved;
+    if(init_adder(&saved) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    char path[] = "/tmp/risky-test-XXXXXX";
+    risky_vm_state_t restored = { .registers = {0}, .ram = NULL, };
+    if(
+        !make_file(path) ||
+        save_risky_vm_checkpoint(&saved, path) != STATUS_SUCCESS ||
+        init_risky_vm_state(&restored) != STATUS_SUCCESS
+    ) {
+        unlink(path);
+        free_risky_vm_state(&saved);
+        test.result = TEST_ERROR;
+        return test;
+    }
+    // a header and two pages
+    struct stat status;
+    test.result = (
+        stat(path, &status) == 0 &&
+        status.st_size == RISKY_CHECKPOINT_HEADER_SIZE + 2 * 4096 &&
+        restore_risky_vm_checkpoint(&restored, path) == STATUS_SUCCESS &&
+        same_state(&saved, &restored)
+    ) ? TEST_SUCCESS : TEST_FAIL;
+    risky_stop_reason_t reason;
+    if(
+        test.result == TEST_SUCCESS && (
+            run_risky_vm(&restored, &reason) != STATUS_SUCCESS ||
+            reason != RISKY_STOP_HALTED || result_of(&restored) != 0x1003U
+        )
+    ) {
+        test.result = TEST_FAIL;
+    }
+    // restoring again starts from the saved state, not the one run since
+    if(
+        test.result == TEST_SUCCESS && (
+            restore_risky_vm_checkpoint(&restored, path) != STATUS_SUCCESS ||
+            !same_state(&saved, &restored)
+        )
+    ) {
+        test.result = TEST_FAIL;
+    }
+    unlink(path);
+    free_risky_vm_state(&restored);
+    free_risky_vm_state(&saved);
+    return test;
+}
+
+/*
+ * A checkpoint should be able to be saved over the one a VM was restored
+ * from, while the VM's RAM is still mapped from it.
+ */
+test_result_t test_checkpoint_save_over() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_vm_state_t state;
+    if(init_adder(&state) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    char path[] = "/tmp/risky-test-XXXXXX";
+    if(
+        !make_file(path) ||
+        save_risky_vm_checkpoint(&state, path) != STATUS_SUCCESS ||
+        restore_risky_vm_checkpoint(&state, path) != STATUS_SUCCESS
+    ) {
+        unlink(path);
+        free_risky_vm_state(&state);
+        test.result = TEST_ERROR;
+        return test;
+    }
+    // run twice, checkpointing in between
+    risky_stop_reason_t reason;
+    status_t result = run_risky_vm(&state, &reason);
+    state.program_counter = 0x0000U;
+    if(result == STATUS_SUCCESS) {
+        result = save_risky_vm_checkpoint(&state, path);
+    }
+    if(result == STATUS_SUCCESS) {
+        result = restore_risky_vm_checkpoint(&state, path);
+    }
+    if(result == STATUS_SUCCESS) {
+        result = run_risky_vm(&state, &reason);
+    }
+    test.result = (
+        result == STATUS_SUCCESS && reason == RISKY_STOP_HALTED &&
+        result_of(&state) == 0x1006U
+    ) ? TEST_SUCCESS : TEST_FAIL;
+    unlink(path);
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * Restoring from a file which isn't a whole checkpoint should fail and leave
+ * the VM as it was.
+ */
+test_result_t test_checkpoint_invalid() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_vm_state_t state;
+    risky_vm_state_t original;
+    if(init_adder(&state) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    if(init_adder(&original) != STATUS_SUCCESS) {
+        free_risky_vm_state(&state);
+        test.result = TEST_ERROR;
+        return test;
+    }
+    char path[] = "/tmp/risky-test-XXXXXX";
+    if(
+        !make_file(path) ||
+        save_risky_vm_checkpoint(&state, path) != STATUS_SUCCESS
+    ) {
+        unlink(path);
+        free_risky_vm_state(&original);
+        free_risky_vm_state(&state);
+        test.result = TEST_ERROR;
+        return test;
+    }
+    test.result = TEST_SUCCESS;
+    // missing the last page of RAM
+    if(
+        truncate(path, RISKY_CHECKPOINT_HEADER_SIZE + 4096) != 0 ||
+        restore_risky_vm_checkpoint(&state, path) == STATUS_SUCCESS
+    ) {
+        test.result = TEST_FAIL;
+    }
+    // not a checkpoint at all
+    if(
+        truncate(path, 0) != 0 ||
+        restore_risky_vm_checkpoint(&state, path) == STATUS_SUCCESS
+    ) {
+        test.result = TEST_FAIL;
+    }
+    unlink(path);
+    if(
+        restore_risky_vm_checkpoint(&state, path) == STATUS_SUCCESS ||
+        !same_state(&state, &original)
+    ) {
+        test.result = TEST_FAIL;
+    }
+    const risky_byte_t program[] = { 'R', 'S', 'K', 'Y', };
+    const risky_byte_t checkpoint[] = { 'R', 'C', 'K', 'P', 1, };
+    if(
+        is_risky_checkpoint(program, sizeof(program)) ||
+        is_risky_checkpoint(checkpoint, 3) ||
+        !is_risky_checkpoint(checkpoint, sizeof(checkpoint))
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_vm_state(&original);
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * Writing to RAM by running a VM should mark just the pages written to as
+ * dirty, wrapping around at the end of RAM.
+ */
+test_result_t test_dirty_pages() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_vm_state_t state;
+    if(init_adder(&state) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    risky_stop_reason_t reason;
+    test.result = (
+        state.dirty_pages == 0 &&
+        run_risky_vm(&state, &reason) == STATUS_SUCCESS &&
+        state.dirty_pages == 0x0004U
+    ) ? TEST_SUCCESS : TEST_FAIL;
+    state.dirty_pages = 0;
+    invalidate_cached_instructions(&state, 0xffffU, 2);
+    if(state.dirty_pages != 0x8001U) {
+        test.result = TEST_FAIL;
+    }
+    invalidate_instruction_cache(&state);
+    if(state.dirty_pages != 0xffffU) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * Forking a VM snapshots its RAM without changing it, so it should keep the
+ * pages and lines it has marked as written, and its cached instructions.
+ */
+test_result_t test_dirty_pages_fork() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_vm_state_t state, child;
+    risky_stop_reason_t reason;
+    if(
+        init_adder(&state) != STATUS_SUCCESS ||
+        run_risky_vm(&state, &reason) != STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    uint32_t dirty = state.dirty_pages;
+    uint64_t lines[RISKY_WRITE_LINE_WORDS];
+    memcpy(lines, state.written_lines, sizeof(lines));
+    uint64_t valid = state.cache->valid[0];
+    if(fork_risky_vm(&state, &child) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        free_risky_vm_state(&state);
+        return test;
+    }
+    if(
+        dirty != 0x0004U || state.dirty_pages != dirty ||
+        memcmp(state.written_lines, lines, sizeof(lines)) != 0 ||
+        valid == 0 || state.cache->valid[0] != valid
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_vm_state(&child);
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * Each delta appended to a checkpoint log should hold only the pages and
+ * registers changed since the one before, and a VM restored from the base
+ * and the log, or from the base once the log is folded into it, should have
+ * the state of the VM as of the last delta.
+ */
+test_result_t test_checkpoint_log() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_vm_state_t state;
+    if(init_adder(&state) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    char base[] = "/tmp/risky-test-XXXXXX";
+    char path[] = "/tmp/risky-test-XXXXXX";
+    risky_checkpoint_log_t log;
+    if(
+        !make_file(base) || !make_file(path) ||
+        open_risky_checkpoint_log(&log, &state, base, path) != STATUS_SUCCESS
+    ) {
+        unlink(base);
+        unlink(path);
+        free_risky_vm_state(&state);
+        test.result = TEST_ERROR;
+        return test;
+    }
+    // the adder changes registers 2 and 3 and the word at 0x2000
+    risky_stop_reason_t reason;
+    status_t result = run_risky_vm(&state, &reason);
+    if(result == STATUS_SUCCESS) {
+        result = append_risky_checkpoint_log(&log, &state);
+    }
+    struct stat status;
+    test.result = (
+        result == STATUS_SUCCESS && stat(path, &status) == 0 &&
+        status.st_size == RISKY_CHECKPOINT_LOG_HEADER_SIZE + 10 + 2 * 3 + 4096
+    ) ? TEST_SUCCESS : TEST_FAIL;
+    // nothing but the program counter and a channel changed
+    state.program_counter = 0x0000U;
+    state.channels[0] = RISKY_CHANNEL_ACTIVE;
+    off_t size = status.st_size;
+    if(
+        append_risky_checkpoint_log(&log, &state) != STATUS_SUCCESS ||
+        stat(path, &status) != 0 || status.st_size != size + 10 + 2
+    ) {
+        test.result = TEST_FAIL;
+    }
+    if(run_risky_vm(&state, &reason) == STATUS_SUCCESS) {
+        append_risky_checkpoint_log(&log, &state);
+    }
+    close_risky_checkpoint_log(&log);
+    risky_vm_state_t restored = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&restored) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+    } else {
+        if(
+            result_of(&state) != 0x1006U ||
+            restore_risky_vm_checkpoint(&restored, base) != STATUS_SUCCESS ||
+            apply_risky_checkpoint_log(&restored, path) != STATUS_SUCCESS ||
+            !same_state(&state, &restored)
+        ) {
+            test.result = TEST_FAIL;
+        }
+        // folded into the base, with an empty log left
+        if(
+            compact_risky_checkpoint_log(base, path) != STATUS_SUCCESS ||
+            stat(path, &status) != 0 ||
+            status.st_size != RISKY_CHECKPOINT_LOG_HEADER_SIZE ||
+            restore_risky_vm_checkpoint(&restored, base) != STATUS_SUCCESS ||
+            !same_state(&state, &restored)
+        ) {
+            test.result = TEST_FAIL;
+        }
+        free_risky_vm_state(&restored);
+    }
+    unlink(base);
+    unlink(path);
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * A delta cut short at the end of a checkpoint log should be left out when
+ * the log is applied, with the deltas before it still applied.
+ */
+test_result_t test_checkpoint_log_cut_short() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_vm_state_t state;
+    if(init_adder(&state) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    char base[] = "/tmp/risky-test-XXXXXX";
+    char path[] = "/tmp/risky-test-XXXXXX";
+    risky_checkpoint_log_t log;
+    if(
+        !make_file(base) || !make_file(path) ||
+        open_risky_checkpoint_log(&log, &state, base, path) != STATUS_SUCCESS
+    ) {
+        unlink(base);
+        unlink(path);
+        free_risky_vm_state(&state);
+        test.result = TEST_ERROR;
+        return test;
+    }
+    state.registers[9] = 0x0009U;
+    append_risky_checkpoint_log(&log, &state);
+    struct stat status;
+    stat(path, &status);
+    // the second delta is lost part of the way through its page
+    risky_stop_reason_t reason;
+    run_risky_vm(&state, &reason);
+    append_risky_checkpoint_log(&log, &state);
+    close_risky_checkpoint_log(&log);
+    risky_vm_state_t restored = { .registers = {0}, .ram = NULL, };
+    if(
+        truncate(path, status.st_size + 100) != 0 ||
+        init_risky_vm_state(&restored) != STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+    } else {
+        test.result = (
+            restore_risky_vm_checkpoint(&restored, base) == STATUS_SUCCESS &&
+            apply_risky_checkpoint_log(&restored, path) == STATUS_SUCCESS &&
+            restored.registers[9] == 0x0009U &&
+            restored.registers[3] == 0x0000U &&
+            result_of(&restored) == 0x1000U
+        ) ? TEST_SUCCESS : TEST_FAIL;
+        free_risky_vm_state(&restored);
+    }
+    unlink(base);
+    unlink(path);
+    free_risky_vm_state(&state);
+    return test;
+}
+
+int main() {
+    // initialise test suite
+    test_suite_t suite = init_test_suite();
+    // add test cases
+    add_test_case(test_checkpoint_round_trip, &suite);
+    add_test_case(test_checkpoint_save_over, &suite);
+    add_test_case(test_checkpoint_invalid, &suite);
+    add_test_case(test_dirty_pages, &suite);
+    add_test_case(test_dirty_pages_fork, &suite);
+    add_test_case(test_checkpoint_log, &suite);
+    add_test_case(test_checkpoint_log_cut_short, &suite);
+    // run test suite
+    run_test_suite(&suite);
+    // return test suite status
+    return suite.result ? 0 : 1;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
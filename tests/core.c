@@ -27,7 +27,7 @@ test_result_t test_init_risky_vm_state() {
     test.result = TEST_SUCCESS;
 
     // create risky_vm_state_t struct with all fields set to 0
-    risky_vm_state_t state = {{0}, NULL};
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
 
     // call function with address of state and store result
     status_t result = init_risky_vm_state(&state);
@@ -79,7 +79,7 @@ test_result_t test_free_risky_vm_state() {
     test.result = TEST_SUCCESS;
 
     // create risky_vm_state_t struct with all fields set to 0
-    risky_vm_state_t state = {{0}, NULL};
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
     // allocate memory for struct
     init_risky_vm_state(&state);
     // write some values to RAM and registers
@@ -0,0 +1,103 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains unit tests for the counters module. Hosts
+ * often don't allow hardware performance counters at all, so these only check
+ * what is counted when they do, and that nothing fails when they don't.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../risky/counters.h"
+#include "../risky/risky.h"
+#include "../unit_test_harness/harness.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * Every counter should have a name, and only the valid ones
+ */
+test_result_t test_counter_names() {
+    // initialise test result
+    test_result_t test = TEST;
+    test.result = TEST_SUCCESS;
+    for(size_t i = 0; i < RISKY_COUNTER_COUNT; i++) {
+        if(get_risky_counter_name((risky_counter_t) i) == NULL) {
+            test.result = TEST_FAIL;
+        }
+    }
+    if(get_risky_counter_name(RISKY_COUNTER_COUNT) != NULL) {
+        test.result = TEST_FAIL;
+    }
+    return test;
+}
+
+/*
+ * Counting some work should succeed whether or not the host allows any
+ * counters, only ever report values for counters which are open, and count
+ * some cycles and instructions if those are open
+ */
+test_result_t test_counters_count() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_counters_t counters;
+    if(init_risky_counters(&counters) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    volatile uint64_t sum = 0;
+
+    status_t started = start_risky_counters(&counters);
+    for(uint64_t i = 0; i < 1000000; i++) {
+        sum += i;
+    }
+    status_t stopped = stop_risky_counters(&counters);
+
+    if(started != STATUS_SUCCESS || stopped != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+    } else {
+        test.result = TEST_SUCCESS;
+        for(size_t i = 0; i < RISKY_COUNTER_COUNT; i++) {
+            if(counters.counted[i] && counters.descriptors[i] == -1) {
+                test.result = TEST_FAIL;
+            }
+        }
+        if(
+            (counters.counted[RISKY_COUNTER_CYCLES] &&
+                counters.values[RISKY_COUNTER_CYCLES] == 0) ||
+            (counters.counted[RISKY_COUNTER_INSTRUCTIONS] &&
+                counters.values[RISKY_COUNTER_INSTRUCTIONS] < 1000000)
+        ) {
+            test.result = TEST_FAIL;
+        }
+    }
+    free_risky_counters(&counters);
+    if(risky_counters_available(&counters)) {
+        test.result = TEST_FAIL;
+    }
+    return test;
+}
+
+int main() {
+    // initialise test suite
+    test_suite_t suite = init_test_suite();
+    // add test cases
+    add_test_case(test_counter_names, &suite);
+    add_test_case(test_counters_count, &suite);
+    // run test suite
+    run_test_suite(&suite);
+    // return test suite status
+    return suite.result ? 0 : 1;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
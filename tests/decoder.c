@@ -8,6 +8,9 @@
  * this compilation unit contains unit tests for the decoder module
  */
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "../risky/core.h"
 #include "../risky/decoder.h"
@@ -821,6 +824,118 @@ test_result_t test_decode_wri() {
     return test;
 }
 
+/*
+ * decode_instructions_from_raw should decode every instruction in a batch
+ * exactly the same as decode_instruction_from_raw does one at a time, for
+ * every possible first byte and for batches of any length
+ */
+test_result_t test_decode_instructions_from_raw() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    // every first byte four times over, with varying operand bytes
+    risky_raw_instruction_t raw[1024];
+    risky_instruction_t expected[1024];
+    risky_instruction_t output[1024];
+    uint32_t seed = 0x2545f491U;
+    for(size_t i = 0; i < 1024; i++) {
+        seed = seed * 1103515245U + 12345U;
+        raw[i] = (risky_raw_instruction_t) {
+            .bytes = {
+                (risky_byte_t) i, (risky_byte_t) (seed >> 8),
+                (risky_byte_t) (seed >> 16), (risky_byte_t) (seed >> 24),
+            },
+        };
+        if(
+            decode_instruction_from_raw(&raw[i], &expected[i]) !=
+            STATUS_SUCCESS
+        ) {
+            test.result = TEST_ERROR;
+            return test;
+        }
+    }
+    // short batches exercise the scalar tail of the SIMD decoders
+    size_t counts[] = { 0, 1, 2, 3, 4, 5, 1023, 1024, };
+    for(size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        // fill the output with junk to show every field gets written
+        memset(output, 0xa5, sizeof(output));
+        status_t result = decode_instructions_from_raw(raw, counts[c], output);
+        if(result != STATUS_SUCCESS) {
+            test.result = TEST_ERROR;
+            return test;
+        }
+        for(size_t i = 0; i < counts[c]; i++) {
+            if(!instructions_equal(output[i], expected[i])) {
+                test.result = TEST_FAIL;
+                return test;
+            }
+        }
+        // nothing past the end of the batch should be touched
+        if(counts[c] < 1024 && output[counts[c]].r != 0xa5U) {
+            test.result = TEST_FAIL;
+            return test;
+        }
+    }
+    return test;
+}
+
+/*
+ * Instructions should be disassembled into the form of the assembly language,
+ * with only the operands each one uses, and a buffer too small for the text
+ * should be refused
+ */
+test_result_t test_disassemble_instruction() {
+    // initialise test result
+    test_result_t test = TEST;
+    struct {
+        risky_instruction_t instruction;
+        const char * text;
+    } cases[] = {
+        { { .opcode = HLT, }, "hlt", },
+        { { .opcode = JMP, .r = 4, }, "jmp 4", },
+        { { .opcode = BRA, .a_flag = true, .r = 3, .a = 5, }, "bra.a 3 5", },
+        {
+            {
+                .opcode = SUB, .a_flag = true, .b_flag = true, .c_flag = true,
+                .r = 1, .a = 1, .b = 2,
+            },
+            "sub.abc 1 1 2",
+        },
+        {
+            { .opcode = COP, .b_flag = true, .r = 9, .a = 255, },
+            "cop.b 9 255",
+        },
+        { { .opcode = QOP, .c_flag = true, .r = 8, }, "qop.c 8", },
+        {
+            { .opcode = SET, .a_flag = true, .r = 7, .l = 0xbeefU, },
+            "set.a 7 0xbeef",
+        },
+        { { .opcode = WRI, .r = 1, .a = 2, }, "wri 1 2", },
+    };
+    test.result = TEST_SUCCESS;
+    for(size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        char text[RISKY_DISASSEMBLY_SIZE];
+        status_t result = disassemble_instruction(
+            &cases[i].instruction, text, sizeof(text)
+        );
+        if(result != STATUS_SUCCESS) {
+            test.result = TEST_ERROR;
+        } else if(strcmp(text, cases[i].text) != 0) {
+            test.result = TEST_FAIL;
+        }
+    }
+    char small[4];
+    if(
+        disassemble_instruction(&cases[1].instruction, small, sizeof(small))
+        != STATUS_FAIL
+    ) {
+        test.result = TEST_FAIL;
+    }
+    return test;
+}
+
 int main() {
     // initialise test suite
     test_suite_t suite = init_test_suite();
@@ -857,6 +972,8 @@ int main() {
     add_test_case(test_decode_set, &suite);
     add_test_case(test_decode_rea, &suite);
     add_test_case(test_decode_wri, &suite);
+    add_test_case(test_decode_instructions_from_raw, &suite);
+    add_test_case(test_disassemble_instruction, &suite);
     // run test suite
     run_test_suite(&suite);
     // return test suite status
@@ -0,0 +1,138 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains unit tests for the encoder module
+ */
+#include <stdbool.h>
+
+#include "../risky/core.h"
+#include "../risky/decoder.h"
+#include "../risky/encoder.h"
+#include "../risky/risky.h"
+#include "../unit_test_harness/harness.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * Function encode_instruction_to_raw should produce the bytes described by the
+ * PLAN, with the opcode and flags in the first byte.
+ */
+test_result_t test_encode_instruction_to_raw() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_instruction_t instruction = {
+        .opcode = ADD,
+        .a_flag = true, .b_flag = false, .c_flag = true,
+        .r = 0xcaU, .a = 0xfeU, .b = 0x2dU,
+        .l = 0,
+    };
+    risky_raw_instruction_t raw;
+
+    status_t result = encode_instruction_to_raw(&instruction, &raw);
+
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+    } else if(
+        raw.bytes[0] != ((0x08U << 3) | 0x05U) || raw.bytes[1] != 0xcaU ||
+        raw.bytes[2] != 0xfeU || raw.bytes[3] != 0x2dU
+    ) {
+        test.result = TEST_FAIL;
+    }
+    return test;
+}
+
+/*
+ * Function encode_instruction_to_raw should store the literal value of SET
+ * instructions big-endian in the last two bytes.
+ */
+test_result_t test_encode_set_literal() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_instruction_t instruction = {
+        .opcode = SET,
+        .a_flag = true, .b_flag = false, .c_flag = false,
+        .r = 0x12U, .a = 0, .b = 0,
+        .l = 0xbeefU,
+    };
+    risky_raw_instruction_t raw;
+
+    status_t result = encode_instruction_to_raw(&instruction, &raw);
+
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+    } else if(
+        raw.bytes[0] != ((0x18U << 3) | 0x04U) || raw.bytes[1] != 0x12U ||
+        raw.bytes[2] != 0xbeU || raw.bytes[3] != 0xefU
+    ) {
+        test.result = TEST_FAIL;
+    }
+    return test;
+}
+
+/*
+ * Every raw instruction, once decoded and encoded again, should decode to the
+ * same instruction as it did the first time.
+ */
+test_result_t test_encode_decode_round_trip() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    for(unsigned int first = 0; first < 256; first++) {
+        risky_raw_instruction_t raw = {
+            .bytes = { (risky_byte_t) first, 0x7fU, 0x33U, 0x69U, },
+        };
+        risky_instruction_t decoded, again;
+        risky_raw_instruction_t encoded;
+        if(
+            decode_instruction_from_raw(&raw, &decoded) != STATUS_SUCCESS ||
+            encode_instruction_to_raw(&decoded, &encoded) != STATUS_SUCCESS ||
+            decode_instruction_from_raw(&encoded, &again) != STATUS_SUCCESS
+        ) {
+            test.result = TEST_ERROR;
+            return test;
+        }
+        if(
+            decoded.opcode != again.opcode ||
+            decoded.a_flag != again.a_flag || decoded.b_flag != again.b_flag ||
+            decoded.c_flag != again.c_flag || decoded.r != again.r ||
+            decoded.a != again.a || decoded.b != again.b ||
+            decoded.l != again.l
+        ) {
+            test.result = TEST_FAIL;
+            return test;
+        }
+    }
+    return test;
+}
+
+int main() {
+    // initialise test suite
+    test_suite_t suite = init_test_suite();
+    // add test cases
+    add_test_case(test_encode_instruction_to_raw, &suite);
+    add_test_case(test_encode_set_literal, &suite);
+    add_test_case(test_encode_decode_round_trip, &suite);
+    // run test suite
+    run_test_suite(&suite);
+    // return test suite status
+    return suite.result ? 0 : 1;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
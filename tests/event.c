@@ -0,0 +1,324 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains unit tests for the event module
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../risky/core.h"
+#include "../risky/event.h"
+#include "../risky/interpreter.h"
+#include "../risky/risky.h"
+#include "../unit_test_harness/harness.h"
+#include "instructions.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of words sent down a pipe from one VM to another, more than fit
+#define PIPELINE_WORDS 60000U
+// number of VMs echoing their input to their output
+#define ECHO_VMS 100U
+// number of bytes of input left waiting, more than a ring and buffer hold
+#define BACKLOG_BYTES 16384U
+
+/*
+ * test helper function - initialises a VM which copies every word it reads
+ * from channel 0 to channel 1, forever
+ */
+static status_t init_echo(risky_vm_state_t * state) {
+    risky_instruction_t program[] = {
+        set(5, 12),
+        op(CDC, 0x00U, 0, 0, 1),
+        op(CDC, 0x00U, 1, 1, 1),
+        op(REA, 0x00U, 3, 0, 0),
+        op(WRI, 0x00U, 1, 3, 0),
+        op(JMP, 0x00U, 5, 0, 0),
+    };
+    return init_program(state, program, 6);
+}
+
+/*
+ * One VM writing more words to a pipe than it can hold, and another reading
+ * them from the other end, should both run to completion on one thread, each
+ * being suspended while the other catches up.
+ */
+test_result_t test_event_loop_pipeline() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    // writes 0 to PIPELINE_WORDS - 1 to channel 1
+    risky_instruction_t producer[] = {
+        set(2, PIPELINE_WORDS),
+        set(5, 12),
+        op(CDC, 0x00U, 1, 1, 1),
+        op(WRI, 0x00U, 1, 3, 0),
+        op(INC, 0x06U, 3, 3, 0),
+        op(DEC, 0x06U, 2, 2, 0),
+        op(BRA, 0x04U, 5, 2, 0),
+        op(HLT, 0x00U, 0, 0, 0),
+    };
+    // sums PIPELINE_WORDS words read from channel 0 into register 4
+    risky_instruction_t consumer[] = {
+        set(2, PIPELINE_WORDS),
+        set(5, 12),
+        op(CDC, 0x00U, 0, 0, 1),
+        op(REA, 0x00U, 3, 0, 0),
+        op(ADD, 0x07U, 4, 4, 3),
+        op(DEC, 0x06U, 2, 2, 0),
+        op(BRA, 0x04U, 5, 2, 0),
+        op(HLT, 0x00U, 0, 0, 0),
+    };
+    risky_vm_state_t states[2];
+    risky_vm_state_t * pointers[2] = { &states[0], &states[1], };
+    int descriptors[2];
+    risky_event_loop_t loop;
+    if(
+        init_program(&states[0], producer, 8) != STATUS_SUCCESS ||
+        init_program(&states[1], consumer, 8) != STATUS_SUCCESS ||
+        pipe(descriptors) != 0 ||
+        init_risky_event_loop(&loop, pointers, 2) != STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    if(
+        bind_risky_event_channel(&loop, 0, 1, descriptors[1], true) !=
+        STATUS_SUCCESS ||
+        bind_risky_event_channel(&loop, 1, 0, descriptors[0], false) !=
+        STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+    }
+    close(descriptors[0]);
+    close(descriptors[1]);
+
+    status_t result = run_risky_event_loop(&loop);
+
+    risky_word_t expected = (risky_word_t) (
+        (uint64_t) PIPELINE_WORDS * (PIPELINE_WORDS - 1) / 2
+    );
+    if(
+        result != STATUS_SUCCESS ||
+        loop.reasons[0] != RISKY_STOP_HALTED ||
+        loop.reasons[1] != RISKY_STOP_HALTED ||
+        states[1].registers[4] != expected
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_event_loop(&loop);
+    free_risky_vm_state(&states[0]);
+    free_risky_vm_state(&states[1]);
+    return test;
+}
+
+/*
+ * Many VMs echoing their own pipes should each pass on all of their input,
+ * then finish blocked once their input reaches end of file.
+ */
+test_result_t test_event_loop_echo() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    static risky_vm_state_t states[ECHO_VMS];
+    risky_vm_state_t * pointers[ECHO_VMS];
+    int outputs[ECHO_VMS];
+    for(size_t i = 0; i < ECHO_VMS; i++) {
+        if(init_echo(&states[i]) != STATUS_SUCCESS) {
+            test.result = TEST_ERROR;
+            return test;
+        }
+        pointers[i] = &states[i];
+    }
+    risky_event_loop_t loop;
+    if(init_risky_event_loop(&loop, pointers, ECHO_VMS) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    for(size_t i = 0; i < ECHO_VMS; i++) {
+        int input[2], output[2];
+        if(pipe(input) != 0 || pipe(output) != 0) {
+            test.result = TEST_ERROR;
+            break;
+        }
+        // three words, and an odd byte which is never read
+        risky_byte_t bytes[7] = { 0x00U, (risky_byte_t) i, 0x12U, 0x34U, };
+        bytes[4] = 0xffU;
+        bytes[5] = (risky_byte_t) i;
+        bytes[6] = 0x77U;
+        if(
+            write(input[1], bytes, sizeof(bytes)) != sizeof(bytes) ||
+            bind_risky_event_channel(&loop, i, 0, input[0], false) !=
+            STATUS_SUCCESS ||
+            bind_risky_event_channel(&loop, i, 1, output[1], true) !=
+            STATUS_SUCCESS
+        ) {
+            test.result = TEST_ERROR;
+        }
+        close(input[0]);
+        close(input[1]);
+        close(output[1]);
+        outputs[i] = output[0];
+    }
+
+    status_t result = run_risky_event_loop(&loop);
+
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_FAIL;
+    }
+    for(size_t i = 0; i < ECHO_VMS; i++) {
+        if(loop.reasons[i] != RISKY_STOP_BLOCKED) {
+            test.result = TEST_FAIL;
+        }
+    }
+    free_risky_event_loop(&loop);
+    for(size_t i = 0; i < ECHO_VMS; i++) {
+        risky_byte_t bytes[8] = { 0 };
+        risky_byte_t expected[6] = {
+            0x00U, (risky_byte_t) i, 0x12U, 0x34U, 0xffU, (risky_byte_t) i,
+        };
+        // the loop has closed its copy of the write end, so this ends
+        ssize_t size = read(outputs[i], bytes, sizeof(bytes));
+        if(size != 6) {
+            test.result = TEST_FAIL;
+        }
+        for(size_t j = 0; j < 6; j++) {
+            if(bytes[j] != expected[j]) {
+                test.result = TEST_FAIL;
+            }
+        }
+        close(outputs[i]);
+        free_risky_vm_state(&states[i]);
+    }
+    return test;
+}
+
+/*
+ * A channel bound to a regular file, which epoll can't wait on, should be
+ * read from as though it is always ready.
+ */
+test_result_t test_event_loop_file() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_instruction_t program[] = {
+        op(CDC, 0x00U, 0, 0, 1),
+        op(REA, 0x00U, 3, 0, 0),
+        op(REA, 0x00U, 4, 0, 0),
+        op(HLT, 0x00U, 0, 0, 0),
+    };
+    risky_vm_state_t state;
+    risky_vm_state_t * pointer = &state;
+    char path[] = "/tmp/risky-test-XXXXXX";
+    int descriptor = mkstemp(path);
+    risky_byte_t bytes[4] = { 0xabU, 0xcdU, 0x01U, 0x02U, };
+    risky_event_loop_t loop;
+    if(
+        descriptor == -1 ||
+        write(descriptor, bytes, sizeof(bytes)) != sizeof(bytes) ||
+        lseek(descriptor, 0, SEEK_SET) != 0 ||
+        init_program(&state, program, 4) != STATUS_SUCCESS ||
+        init_risky_event_loop(&loop, &pointer, 1) != STATUS_SUCCESS ||
+        bind_risky_event_channel(&loop, 0, 0, descriptor, false) !=
+        STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    close(descriptor);
+    unlink(path);
+
+    status_t result = run_risky_event_loop(&loop);
+
+    if(
+        result != STATUS_SUCCESS || loop.reasons[0] != RISKY_STOP_HALTED ||
+        state.registers[3] != 0xabcdU || state.registers[4] != 0x0102U
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_event_loop(&loop);
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * A VM blocked on an unbound channel, with more input waiting for one of its
+ * bound channels than fits in that channel's ring, should be left blocked,
+ * rather than the loop waiting forever for room in the ring.
+ */
+test_result_t test_event_loop_full_ring() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    // opens channels 0 and 2, then reads from channel 2, which isn't bound
+    risky_instruction_t program[] = {
+        op(CDC, 0x00U, 0, 0, 1),
+        op(CDC, 0x00U, 2, 0, 1),
+        op(REA, 0x00U, 3, 2, 0),
+        op(HLT, 0x00U, 0, 0, 0),
+    };
+    risky_vm_state_t state;
+    risky_vm_state_t * pointer = &state;
+    int descriptors[2];
+    static risky_byte_t bytes[BACKLOG_BYTES];
+    risky_event_loop_t loop;
+    if(
+        init_program(&state, program, 4) != STATUS_SUCCESS ||
+        pipe(descriptors) != 0 ||
+        write(descriptors[1], bytes, sizeof(bytes)) != sizeof(bytes) ||
+        init_risky_event_loop(&loop, &pointer, 1) != STATUS_SUCCESS ||
+        bind_risky_event_channel(&loop, 0, 0, descriptors[0], false) !=
+        STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    close(descriptors[0]);
+
+    status_t result = run_risky_event_loop(&loop);
+
+    if(result != STATUS_SUCCESS || loop.reasons[0] != RISKY_STOP_BLOCKED) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_event_loop(&loop);
+    close(descriptors[1]);
+    free_risky_vm_state(&state);
+    return test;
+}
+
+int main() {
+    // initialise test suite
+    test_suite_t suite = init_test_suite();
+    // add test cases
+    add_test_case(test_event_loop_pipeline, &suite);
+    add_test_case(test_event_loop_echo, &suite);
+    add_test_case(test_event_loop_file, &suite);
+    add_test_case(test_event_loop_full_ring, &suite);
+    // run test suite
+    run_test_suite(&suite);
+    // return test suite status
+    return suite.result ? 0 : 1;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,178 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains unit tests for the fork module
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "../risky/cache.h"
+#include "../risky/core.h"
+#include "../risky/fork.h"
+#include "../risky/interpreter.h"
+#include "../risky/risky.h"
+#include "../unit_test_harness/harness.h"
+#include "instructions.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * test helper function - initialises a VM with a program which adds register
+ * 1 to the word at 0x2000 and halts, with 0x1000 stored there to begin with
+ */
+static status_t init_adder(risky_vm_state_t * state) {
+    *state = (risky_vm_state_t) { .registers = {0}, .ram = NULL, };
+    status_t result = init_risky_vm_state(state);
+    if(result != STATUS_SUCCESS) {
+        return result;
+    }
+    risky_instruction_t program[] = {
+        op(SET, 0x04U, 2, 0, 0),
+        op(LOD, 0x06U, 3, 2, 0),
+        op(ADD, 0x07U, 3, 3, 1),
+        op(SAV, 0x06U, 3, 2, 0),
+        op(HLT, 0x00U, 0, 0, 0),
+    };
+    program[0].l = 0x2000U;
+    encode_program(state->ram, program, 5);
+    state->ram[0x2000] = 0x10U;
+    state->ram[0x2001] = 0x00U;
+    return STATUS_SUCCESS;
+}
+
+// test helper function - returns the word stored at 0x2000 in a VM's RAM
+static risky_word_t result_of(risky_vm_state_t * state) {
+    return (risky_word_t) ((state->ram[0x2000] << 8) | state->ram[0x2001]);
+}
+
+/*
+ * A forked VM should start as a copy of its parent, and each of them should
+ * then be able to write to RAM without the other seeing it.
+ */
+test_result_t test_fork_risky_vm() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_vm_state_t parent, child;
+    if(init_adder(&parent) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    parent.registers[1] = 0x0034U;
+    parent.operation_flags = RISKY_OVERFLOW;
+    parent.channels[7] = RISKY_CHANNEL_ACTIVE;
+
+    status_t result = fork_risky_vm(&parent, &child);
+
+    risky_stop_reason_t reason;
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        free_risky_vm_state(&parent);
+        return test;
+    }
+    if(
+        memcmp(parent.ram, child.ram, RISKY_RAM_AMOUNT) != 0 ||
+        child.registers[1] != 0x0034U ||
+        child.operation_flags != RISKY_OVERFLOW ||
+        child.channels[7] != RISKY_CHANNEL_ACTIVE ||
+        child.program_counter != parent.program_counter
+    ) {
+        test.result = TEST_FAIL;
+    }
+    child.registers[1] = 0x0200U;
+    if(
+        run_risky_vm(&child, &reason) != STATUS_SUCCESS ||
+        run_risky_vm(&parent, &reason) != STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+    } else if(result_of(&parent) != 0x1034U || result_of(&child) != 0x1200U) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_vm_state(&parent);
+    free_risky_vm_state(&child);
+    return test;
+}
+
+/*
+ * Forking a VM whose RAM has been written to since it was last forked should
+ * give a child with the RAM as it is now, without changing earlier children,
+ * which should outlive their parent.
+ */
+test_result_t test_fork_risky_vm_after_writes() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_vm_state_t parent, first, second, third;
+    if(init_adder(&parent) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    parent.registers[1] = 0x0001U;
+    risky_stop_reason_t reason;
+    if(fork_risky_vm(&parent, &first) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        free_risky_vm_state(&parent);
+        return test;
+    }
+    // the parent writes to its RAM with SAV
+    if(
+        run_risky_vm(&parent, &reason) != STATUS_SUCCESS ||
+        fork_risky_vm(&parent, &second) != STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+        free_risky_vm_state(&parent);
+        free_risky_vm_state(&first);
+        return test;
+    }
+    // and the host writes to it directly
+    parent.ram[0x3000] = 0xaaU;
+    invalidate_cached_instructions(&parent, 0x3000U, 1);
+    if(fork_risky_vm(&parent, &third) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        free_risky_vm_state(&parent);
+        free_risky_vm_state(&first);
+        free_risky_vm_state(&second);
+        return test;
+    }
+    free_risky_vm_state(&parent);
+
+    if(
+        result_of(&first) != 0x1000U || first.ram[0x3000] != 0x00U ||
+        result_of(&second) != 0x1001U || second.ram[0x3000] != 0x00U ||
+        result_of(&third) != 0x1001U || third.ram[0x3000] != 0xaaU
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_vm_state(&first);
+    free_risky_vm_state(&second);
+    free_risky_vm_state(&third);
+    return test;
+}
+
+int main() {
+    // initialise test suite
+    test_suite_t suite = init_test_suite();
+    // add test cases
+    add_test_case(test_fork_risky_vm, &suite);
+    add_test_case(test_fork_risky_vm_after_writes, &suite);
+    // run test suite
+    run_test_suite(&suite);
+    // return test suite status
+    return suite.result ? 0 : 1;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
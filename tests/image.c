@@ -0,0 +1,233 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains unit tests for the image module
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../risky/core.h"
+#include "../risky/image.h"
+#include "../risky/interpreter.h"
+#include "../risky/risky.h"
+#include "../unit_test_harness/harness.h"
+#include "instructions.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * test helper function - writes the given number of bytes to a new temporary
+ * file, storing its path in the given buffer.
+ * Returns false if it couldn't be written
+ */
+static bool write_file(char * path, const risky_byte_t * bytes, size_t size) {
+    int descriptor = mkstemp(path);
+    if(descriptor == -1) {
+        return false;
+    }
+    bool written = write(descriptor, bytes, size) == (ssize_t) size;
+    close(descriptor);
+    return written;
+}
+
+/*
+ * Loading a program file should map its bytes to the start of RAM with zeroes
+ * after them, and VMs loaded from the same file should each be able to write
+ * to their RAM without changing the file or each other.
+ */
+test_result_t test_load_risky_program_file() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    // stores 0xbeef at 0x1ffe, past the end of the file, then halts
+    risky_instruction_t program[] = {
+        { .opcode = SET, .a_flag = true, .r = 1, .l = 0x1ffeU, },
+        { .opcode = SET, .a_flag = true, .r = 2, .l = 0xbeefU, },
+        { .opcode = SAV, .a_flag = true, .b_flag = true, .r = 2, .a = 1, },
+        { .opcode = SAV, .a_flag = true, .b_flag = true, .r = 2, .a = 3, },
+        { .opcode = HLT, },
+    };
+    // a file which doesn't end on a page boundary
+    risky_byte_t bytes[5 * 4 + 3] = { 0 };
+    encode_program(bytes, program, 5);
+    bytes[22] = 0x77U;
+    char path[] = "/tmp/risky-test-XXXXXX";
+    if(!write_file(path, bytes, sizeof(bytes))) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    risky_vm_state_t first = { .registers = {0}, .ram = NULL, };
+    risky_vm_state_t second = { .registers = {0}, .ram = NULL, };
+    if(
+        init_risky_vm_state(&first) != STATUS_SUCCESS ||
+        init_risky_vm_state(&second) != STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+        unlink(path);
+        return test;
+    }
+
+    status_t result = load_risky_program_file(&first, path);
+
+    if(
+        result != STATUS_SUCCESS ||
+        load_risky_program_file(&second, path) != STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+    } else {
+        for(size_t i = 0; i < RISKY_RAM_AMOUNT; i++) {
+            risky_byte_t expected = (i < sizeof(bytes)) ? bytes[i] : 0x00U;
+            if(first.ram[i] != expected) {
+                test.result = TEST_FAIL;
+                break;
+            }
+        }
+        // the first VM also writes to register 3's address, 0x0000
+        risky_stop_reason_t reason;
+        if(run_risky_vm(&first, &reason) != STATUS_SUCCESS) {
+            test.result = TEST_ERROR;
+        } else if(
+            reason != RISKY_STOP_HALTED ||
+            first.ram[0x1ffe] != 0xbeU || first.ram[0x1fff] != 0xefU ||
+            first.ram[0x0000] != 0xbeU ||
+            second.ram[0x1ffe] != 0x00U || second.ram[0x0000] != bytes[0]
+        ) {
+            test.result = TEST_FAIL;
+        }
+    }
+    free_risky_vm_state(&first);
+    free_risky_vm_state(&second);
+    // the file itself should be unchanged
+    FILE * file = fopen(path, "rb");
+    if(file == NULL || fgetc(file) != bytes[0]) {
+        test.result = TEST_FAIL;
+    }
+    if(file != NULL) {
+        fclose(file);
+    }
+    unlink(path);
+    return test;
+}
+
+/*
+ * Loading a program file which doesn't exist or is too big to fit in RAM
+ * should fail, leaving the VM's RAM as it was.
+ */
+test_result_t test_load_risky_program_file_invalid() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_byte_t * bytes = (risky_byte_t *) calloc(RISKY_RAM_AMOUNT + 1, 1);
+    char path[] = "/tmp/risky-test-XXXXXX";
+    if(bytes == NULL || !write_file(path, bytes, RISKY_RAM_AMOUNT + 1)) {
+        free(bytes);
+        test.result = TEST_ERROR;
+        return test;
+    }
+    free(bytes);
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        unlink(path);
+        return test;
+    }
+    state.ram[0] = 0x42U;
+
+    status_t too_big = load_risky_program_file(&state, path);
+    status_t missing = load_risky_program_file(&state, "/nonexistent/risky");
+
+    if(
+        too_big == STATUS_SUCCESS || missing == STATUS_SUCCESS ||
+        state.ram[0] != 0x42U || state.image != NULL
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_vm_state(&state);
+    unlink(path);
+    return test;
+}
+
+/*
+ * Mapping an image which can't be mapped over RAM which is already a mapping
+ * should fail, leaving the VM's RAM and image as they were.
+ */
+test_result_t test_map_risky_ram_image_invalid() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_byte_t bytes[4] = { 0x12U, 0x34U, 0x56U, 0x78U, };
+    char path[] = "/tmp/risky-test-XXXXXX";
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    int descriptors[2];
+    if(
+        !write_file(path, bytes, sizeof(bytes)) ||
+        init_risky_vm_state(&state) != STATUS_SUCCESS ||
+        load_risky_program_file(&state, path) != STATUS_SUCCESS ||
+        pipe(descriptors) != 0
+    ) {
+        test.result = TEST_ERROR;
+        unlink(path);
+        return test;
+    }
+    unlink(path);
+    close(descriptors[1]);
+    state.ram[0x2000] = 0x42U;
+    risky_ram_image_t * loaded = state.image;
+    // a pipe can't be mapped, so mapping the page held in it fails
+    risky_ram_image_t * image;
+    if(
+        open_risky_ram_image_pages(descriptors[0], 0, 0x0002U, &image) !=
+        STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+        close(descriptors[0]);
+        free_risky_vm_state(&state);
+        return test;
+    }
+
+    status_t result = map_risky_ram_image(&state, image);
+
+    if(
+        result == STATUS_SUCCESS || state.image != loaded ||
+        state.ram[0] != 0x12U || state.ram[3] != 0x78U ||
+        state.ram[0x2000] != 0x42U
+    ) {
+        test.result = TEST_FAIL;
+    }
+    drop_risky_ram_image(image);
+    free_risky_vm_state(&state);
+    return test;
+}
+
+int main() {
+    // initialise test suite
+    test_suite_t suite = init_test_suite();
+    // add test cases
+    add_test_case(test_load_risky_program_file, &suite);
+    add_test_case(test_load_risky_program_file_invalid, &suite);
+    add_test_case(test_map_risky_ram_image_invalid, &suite);
+    // run test suite
+    run_test_suite(&suite);
+    // return test suite status
+    return suite.result ? 0 : 1;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
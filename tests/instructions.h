@@ -0,0 +1,89 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * instructions - this header contains helper functions shared by the unit
+ * tests and benchmarks for writing RISKY programs as arrays of instructions
+ * and encoding them into RAM with encode_instruction_to_raw().
+ */
+#ifndef SAXBOPHONE_RISKY_TESTS_INSTRUCTIONS_H
+#define SAXBOPHONE_RISKY_TESTS_INSTRUCTIONS_H
+
+#include <stddef.h>
+
+#include "../risky/core.h"
+#include "../risky/encoder.h"
+#include "../risky/risky.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * test helper function - returns an instruction with the given opcode, flags
+ * (in the same bit order as the raw format) and register operands
+ */
+static inline risky_instruction_t op(
+    risky_opcode_t opcode, risky_byte_t flags,
+    risky_byte_t r, risky_byte_t a, risky_byte_t b
+) {
+    return (risky_instruction_t) {
+        .opcode = opcode,
+        .a_flag = flags & 0x04U, .b_flag = flags & 0x02U,
+        .c_flag = flags & 0x01U,
+        .r = r, .a = a, .b = b,
+        .l = 0,
+    };
+}
+
+/*
+ * test helper function - returns a 16-bit SET instruction for the given
+ * register and literal value
+ */
+static inline risky_instruction_t set(risky_byte_t r, risky_word_t l) {
+    risky_instruction_t instruction = op(SET, 0x04U, r, 0, 0);
+    instruction.l = l;
+    return instruction;
+}
+
+/*
+ * test helper function - encodes the given number of instructions into the
+ * given RAM (or program image), one after another from its start
+ */
+static inline void encode_program(
+    risky_ram_t * ram, risky_instruction_t * program, size_t count
+) {
+    for(size_t i = 0; i < count; i++) {
+        encode_instruction_to_raw(
+            &program[i], (risky_raw_instruction_t *) &ram[i * 4]
+        );
+    }
+}
+
+/*
+ * test helper function - initialises a VM with the given program of the
+ * given number of instructions at the start of its RAM.
+ * Returns a status_t with error / success information
+ */
+static inline status_t init_program(
+    risky_vm_state_t * state, risky_instruction_t * program, size_t count
+) {
+    *state = (risky_vm_state_t) { .registers = {0}, .ram = NULL, };
+    status_t result = init_risky_vm_state(state);
+    if(result != STATUS_SUCCESS) {
+        return result;
+    }
+    encode_program(state->ram, program, count);
+    return STATUS_SUCCESS;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+// end of header file
+#endif
@@ -0,0 +1,605 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains unit tests for the interpreter module
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../risky/core.h"
+#include "../risky/encoder.h"
+#include "../risky/interpreter.h"
+#include "../risky/risky.h"
+#include "../unit_test_harness/harness.h"
+#include "instructions.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// type of the functions under test, so each test can be run with both
+typedef status_t (* runner_t)(risky_vm_state_t *, risky_stop_reason_t *);
+
+/*
+ * test helper function - encodes the given instructions into the RAM of the
+ * given VM state, starting at the given address
+ */
+static void load_program(
+    risky_vm_state_t * state, risky_ram_address_t address,
+    risky_instruction_t * program, size_t count
+) {
+    for(size_t i = 0; i < count; i++) {
+        risky_raw_instruction_t raw;
+        encode_instruction_to_raw(&program[i], &raw);
+        for(size_t j = 0; j < 4; j++) {
+            state->ram[address + i * 4 + j] = raw.bytes[j];
+        }
+    }
+}
+
+/*
+ * test helper function - runs the given test body once with each of the two
+ * interpreter dispatch strategies, returning the worst of the two results
+ */
+static test_status_t run_with_both(test_status_t (* body)(runner_t)) {
+    test_status_t threaded = body(run_risky_vm);
+    test_status_t switched = body(run_risky_vm_switch);
+    return (threaded != TEST_SUCCESS) ? threaded : switched;
+}
+
+// test body for test_run_halts
+static test_status_t run_halts(runner_t run) {
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        return TEST_ERROR;
+    }
+    risky_instruction_t program[] = {
+        op(NOP, 0, 0, 0, 0), op(HLT, 0, 0, 0, 0),
+    };
+    load_program(&state, 0x0000U, program, 2);
+    risky_stop_reason_t reason = RISKY_STOP_NONE;
+    test_status_t test = TEST_SUCCESS;
+
+    status_t result = run(&state, &reason);
+
+    if(result != STATUS_SUCCESS) {
+        test = TEST_ERROR;
+    } else if(reason != RISKY_STOP_HALTED || state.program_counter != 4) {
+        test = TEST_FAIL;
+    }
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * Running a VM should stop at HLT, leaving the program counter pointing at it
+ */
+test_result_t test_run_halts() {
+    // initialise test result
+    test_result_t test = TEST;
+    test.result = run_with_both(run_halts);
+    return test;
+}
+
+// test body for test_run_arithmetic
+static test_status_t run_arithmetic(runner_t run) {
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        return TEST_ERROR;
+    }
+    risky_instruction_t program[] = {
+        set(1, 200),
+        set(2, 100),
+        // 8-bit add, overflows
+        op(ADD, 0x00U, 3, 1, 2),
+        op(QOP, 0x04U, 4, 0, 0),
+        // 16-bit add, doesn't overflow
+        op(ADD, 0x04U, 5, 1, 2),
+        op(QOP, 0x04U, 6, 0, 0),
+        // 16-bit subtract, underflows
+        op(SUB, 0x07U, 7, 2, 1),
+        op(QOP, 0x02U, 8, 0, 0),
+        op(HLT, 0, 0, 0, 0),
+    };
+    load_program(&state, 0x0000U, program, 9);
+    risky_stop_reason_t reason = RISKY_STOP_NONE;
+    test_status_t test = TEST_SUCCESS;
+
+    status_t result = run(&state, &reason);
+
+    if(result != STATUS_SUCCESS || reason != RISKY_STOP_HALTED) {
+        test = TEST_ERROR;
+    } else if(
+        state.registers[3] != 44 || state.registers[4] != 1 ||
+        state.registers[5] != 300 || state.registers[6] != 0 ||
+        state.registers[7] != 0xff9cU || state.registers[8] != 1
+    ) {
+        test = TEST_FAIL;
+    }
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * Arithmetic instructions should respect the width flags of their registers
+ * and raise operation flags which QOP can query
+ */
+test_result_t test_run_arithmetic() {
+    // initialise test result
+    test_result_t test = TEST;
+    test.result = run_with_both(run_arithmetic);
+    return test;
+}
+
+// test body for test_run_loop
+static test_status_t run_loop(runner_t run) {
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        return TEST_ERROR;
+    }
+    risky_instruction_t program[] = {
+        set(1, 1000),
+        set(2, 1),
+        set(3, 0x000cU),
+        // loop: count down register 1 until it is zero
+        op(SUB, 0x07U, 1, 1, 2),
+        op(NEQ, 0x03U, 5, 1, 6),
+        op(BRA, 0x00U, 3, 5, 0),
+        op(HLT, 0, 0, 0, 0),
+    };
+    load_program(&state, 0x0000U, program, 7);
+    risky_stop_reason_t reason = RISKY_STOP_NONE;
+    test_status_t test = TEST_SUCCESS;
+
+    status_t result = run(&state, &reason);
+
+    if(result != STATUS_SUCCESS || reason != RISKY_STOP_HALTED) {
+        test = TEST_ERROR;
+    } else if(state.registers[1] != 0 || state.program_counter != 0x0018U) {
+        test = TEST_FAIL;
+    }
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * BRA should jump to the address in its return register for as long as its
+ * operand register is non-zero
+ */
+test_result_t test_run_loop() {
+    // initialise test result
+    test_result_t test = TEST;
+    test.result = run_with_both(run_loop);
+    return test;
+}
+
+// test body for test_run_sav_invalidates
+static test_status_t run_sav_invalidates(runner_t run) {
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        return TEST_ERROR;
+    }
+    risky_instruction_t program[] = {
+        // 0x00: the instruction that gets modified
+        set(7, 1),
+        // 0x04: halt the first time through, when register 8 is clear
+        op(BRA, 0x00U, 12, 8, 0),
+        op(HLT, 0, 0, 0, 0),
+        // 0x0c: overwrite the literal of the first instruction, jump to it
+        set(9, 2),
+        set(10, 0x0002U),
+        op(SAV, 0x06U, 9, 10, 0),
+        set(8, 1),
+        set(12, 0x0008U),
+        op(JMP, 0x00U, 11, 0, 0),
+    };
+    load_program(&state, 0x0000U, program, 9);
+    state.registers[12] = 0x0008U;
+    risky_stop_reason_t reason = RISKY_STOP_NONE;
+    test_status_t test = TEST_SUCCESS;
+
+    // first run decodes and caches the first instruction
+    status_t result = run(&state, &reason);
+    if(result != STATUS_SUCCESS || state.registers[7] != 1) {
+        free_risky_vm_state(&state);
+        return TEST_ERROR;
+    }
+    // second run modifies it with SAV and executes it again
+    state.program_counter = 0x000cU;
+    result = run(&state, &reason);
+
+    if(result != STATUS_SUCCESS || reason != RISKY_STOP_HALTED) {
+        test = TEST_ERROR;
+    } else if(state.registers[7] != 2) {
+        test = TEST_FAIL;
+    }
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * SAV should invalidate any cached instructions it overwrites, so that
+ * self-modifying code sees its modifications
+ */
+test_result_t test_run_sav_invalidates() {
+    // initialise test result
+    test_result_t test = TEST;
+    test.result = run_with_both(run_sav_invalidates);
+    return test;
+}
+
+// test body for test_run_lod
+static test_status_t run_lod(runner_t run) {
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        return TEST_ERROR;
+    }
+    risky_instruction_t program[] = {
+        set(1, 0x0100U),
+        op(LOD, 0x06U, 2, 1, 0),
+        op(LOD, 0x02U, 3, 1, 0),
+        op(HLT, 0, 0, 0, 0),
+    };
+    load_program(&state, 0x0000U, program, 4);
+    state.ram[0x0100U] = 0xabU;
+    state.ram[0x0101U] = 0xcdU;
+    risky_stop_reason_t reason = RISKY_STOP_NONE;
+    test_status_t test = TEST_SUCCESS;
+
+    status_t result = run(&state, &reason);
+
+    if(result != STATUS_SUCCESS || reason != RISKY_STOP_HALTED) {
+        test = TEST_ERROR;
+    } else if(state.registers[2] != 0xabcdU || state.registers[3] != 0xabU) {
+        test = TEST_FAIL;
+    }
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * LOD should read one byte, or two big-endian bytes if flag a is set
+ */
+test_result_t test_run_lod() {
+    // initialise test result
+    test_result_t test = TEST;
+    test.result = run_with_both(run_lod);
+    return test;
+}
+
+// channel I/O data for test_run_channels
+typedef struct channel_data_t {
+    bool ready;
+    risky_word_t read;
+    risky_channel_t written_channel;
+    risky_word_t written;
+} channel_data_t;
+
+static bool read_channel(
+    void * context, risky_channel_t channel, risky_word_t * data
+) {
+    channel_data_t * channel_data = (channel_data_t *) context;
+    if(!channel_data->ready || channel != 2) {
+        return false;
+    }
+    *data = channel_data->read;
+    return true;
+}
+
+static void write_channel(
+    void * context, risky_channel_t channel, risky_word_t data
+) {
+    channel_data_t * channel_data = (channel_data_t *) context;
+    channel_data->written_channel = channel;
+    channel_data->written = data;
+}
+
+// test body for test_run_channels
+static test_status_t run_channels(runner_t run) {
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        return TEST_ERROR;
+    }
+    channel_data_t data = { false, 0xc0deU, 0, 0, };
+    state.channel_io = (risky_channel_io_t) {
+        read_channel, write_channel, &data,
+    };
+    risky_instruction_t program[] = {
+        // channel 1 is an active write channel, channel 2 an active read one
+        op(CDC, 0x00U, 1, 1, 1),
+        op(CDC, 0x00U, 2, 0, 1),
+        op(REA, 0x00U, 3, 2, 0),
+        op(WRI, 0x00U, 1, 3, 0),
+        op(QDC, 0x00U, 4, 1, 0),
+        op(HLT, 0, 0, 0, 0),
+    };
+    load_program(&state, 0x0000U, program, 6);
+    risky_stop_reason_t reason = RISKY_STOP_NONE;
+    test_status_t test = TEST_SUCCESS;
+
+    // no data is ready yet, so should block at the REA
+    status_t result = run(&state, &reason);
+    if(result != STATUS_SUCCESS) {
+        test = TEST_ERROR;
+    } else if(reason != RISKY_STOP_BLOCKED || state.program_counter != 8) {
+        test = TEST_FAIL;
+    }
+    // resume once data is ready
+    data.ready = true;
+    result = run(&state, &reason);
+    if(result != STATUS_SUCCESS) {
+        test = TEST_ERROR;
+    } else if(
+        reason != RISKY_STOP_HALTED || data.written_channel != 1 ||
+        data.written != 0xc0deU ||
+        state.registers[4] != (RISKY_CHANNEL_ACTIVE | RISKY_CHANNEL_WRITE)
+    ) {
+        test = TEST_FAIL;
+    }
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * REA should stop the VM when no data is ready and resume where it left off,
+ * and WRI should pass data to the host through the channel callbacks
+ */
+test_result_t test_run_channels() {
+    // initialise test result
+    test_result_t test = TEST;
+    test.result = run_with_both(run_channels);
+    return test;
+}
+
+/*
+ * test helper function - loads the program used by test_run_loop, which
+ * executes 3004 instructions in total before it halts
+ */
+static void load_loop_program(risky_vm_state_t * state) {
+    risky_instruction_t program[] = {
+        set(1, 1000),
+        set(2, 1),
+        set(3, 0x000cU),
+        op(SUB, 0x07U, 1, 1, 2),
+        op(NEQ, 0x03U, 5, 1, 6),
+        op(BRA, 0x00U, 3, 5, 0),
+        op(HLT, 0, 0, 0, 0),
+    };
+    load_program(state, 0x0000U, program, 7);
+}
+
+/*
+ * Running a VM with a budget again and again should stop it when the budget
+ * is used up, overrunning it by less than a basic block, and resume it where
+ * it left off until it halts having executed every instruction exactly once
+ */
+test_result_t test_run_budget_resumes() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    load_loop_program(&state);
+    risky_stop_reason_t reason = RISKY_STOP_NONE;
+    uint64_t total = 0;
+    size_t runs = 0;
+    test.result = TEST_SUCCESS;
+
+    while(reason != RISKY_STOP_HALTED && runs < 1000) {
+        uint64_t executed = 0;
+        if(
+            run_risky_vm_for(&state, 100, &executed, &reason) != STATUS_SUCCESS
+        ) {
+            test.result = TEST_ERROR;
+            break;
+        }
+        // the longest basic block in the program is six instructions
+        if(
+            (reason == RISKY_STOP_BUDGET && executed < 100) ||
+            executed > 100 + 5
+        ) {
+            test.result = TEST_FAIL;
+        }
+        total += executed;
+        runs++;
+    }
+
+    if(
+        test.result == TEST_SUCCESS && (
+            reason != RISKY_STOP_HALTED || total != 3004 || runs < 30 ||
+            state.registers[1] != 0 || state.program_counter != 0x0018U
+        )
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * Running a VM with an unlimited budget should count exactly the
+ * instructions it executed, including the HLT
+ */
+test_result_t test_run_budget_counts() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    load_loop_program(&state);
+    risky_stop_reason_t reason = RISKY_STOP_NONE;
+    uint64_t executed = 0;
+
+    status_t result = run_risky_vm_for(&state, UINT64_MAX, &executed, &reason);
+
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+    } else if(reason != RISKY_STOP_HALTED || executed != 3004) {
+        test.result = TEST_FAIL;
+    } else {
+        test.result = TEST_SUCCESS;
+    }
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * Running a VM with a budget of zero should execute nothing, and a program
+ * with no branches should still be stopped when it wraps around the end of RAM
+ */
+test_result_t test_run_budget_bounds() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    // RAM starts out zeroed, which is all NOP instructions
+    risky_stop_reason_t reason = RISKY_STOP_NONE;
+    uint64_t executed = 1;
+    test.result = TEST_SUCCESS;
+
+    status_t result = run_risky_vm_for(&state, 0, &executed, &reason);
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+    } else if(
+        reason != RISKY_STOP_BUDGET || executed != 0 ||
+        state.program_counter != 0
+    ) {
+        test.result = TEST_FAIL;
+    }
+    result = run_risky_vm_for(&state, 1, &executed, &reason);
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+    } else if(
+        reason != RISKY_STOP_BUDGET || executed < 1 ||
+        executed > RISKY_RAM_AMOUNT / 4 || state.program_counter % 4 != 0
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * test helper function - loads a program made of instructions which are fused
+ * in pairs, which jumps into the middle of one pair, and executes 39
+ * instructions in total before it halts
+ */
+static void load_fused_program(risky_vm_state_t * state) {
+    risky_instruction_t program[] = {
+        set(1, 0),
+        set(2, 10),
+        set(3, 0x0018U),
+        set(4, 0x001cU),
+        // SET then JMP, to the LTN of the INC then LTN pair
+        set(5, 0),
+        op(JMP, 0x00U, 4, 0, 0),
+        // 0x18: count register 1 up until it reaches register 2
+        op(INC, 0x02U, 1, 1, 0),
+        op(LTN, 0x03U, 7, 1, 2),
+        op(BRA, 0x00U, 3, 7, 0),
+        op(HLT, 0, 0, 0, 0),
+    };
+    load_program(state, 0x0000U, program, 10);
+}
+
+// test body for test_run_fused
+static test_status_t run_fused(runner_t run) {
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        return TEST_ERROR;
+    }
+    load_fused_program(&state);
+    risky_stop_reason_t reason = RISKY_STOP_NONE;
+    test_status_t test = TEST_SUCCESS;
+
+    status_t result = run(&state, &reason);
+
+    if(result != STATUS_SUCCESS || reason != RISKY_STOP_HALTED) {
+        test = TEST_ERROR;
+    } else if(
+        state.registers[1] != 10 || state.registers[7] != 0 ||
+        state.program_counter != 0x0024U
+    ) {
+        test = TEST_FAIL;
+    }
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * Instructions fused in pairs should behave exactly as they do apart, even
+ * when a jump lands on the second instruction of a pair
+ */
+test_result_t test_run_fused() {
+    // initialise test result
+    test_result_t test = TEST;
+    test.result = run_with_both(run_fused);
+    return test;
+}
+
+/*
+ * Running a VM with an unlimited budget should count both instructions of
+ * each fused pair it executes
+ */
+test_result_t test_run_fused_counts() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    load_fused_program(&state);
+    risky_stop_reason_t reason = RISKY_STOP_NONE;
+    uint64_t executed = 0;
+
+    status_t result = run_risky_vm_for(&state, UINT64_MAX, &executed, &reason);
+
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+    } else if(reason != RISKY_STOP_HALTED || executed != 39) {
+        test.result = TEST_FAIL;
+    } else {
+        test.result = TEST_SUCCESS;
+    }
+    free_risky_vm_state(&state);
+    return test;
+}
+
+int main() {
+    // initialise test suite
+    test_suite_t suite = init_test_suite();
+    // add test cases
+    add_test_case(test_run_halts, &suite);
+    add_test_case(test_run_arithmetic, &suite);
+    add_test_case(test_run_loop, &suite);
+    add_test_case(test_run_sav_invalidates, &suite);
+    add_test_case(test_run_lod, &suite);
+    add_test_case(test_run_channels, &suite);
+    add_test_case(test_run_budget_resumes, &suite);
+    add_test_case(test_run_budget_counts, &suite);
+    add_test_case(test_run_budget_bounds, &suite);
+    add_test_case(test_run_fused, &suite);
+    add_test_case(test_run_fused_counts, &suite);
+    // run test suite
+    run_test_suite(&suite);
+    // return test suite status
+    return suite.result ? 0 : 1;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,235 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains unit tests for the jit module
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../jit/jit.h"
+#include "../risky/core.h"
+#include "../risky/encoder.h"
+#include "../risky/interpreter.h"
+#include "../risky/risky.h"
+#include "../unit_test_harness/harness.h"
+#include "instructions.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * test helper function - encodes the given instructions into the RAM of the
+ * given VM state, starting at the given address
+ */
+static void load_program(
+    risky_vm_state_t * state, risky_ram_address_t address,
+    risky_instruction_t * program, size_t count
+) {
+    for(size_t i = 0; i < count; i++) {
+        risky_raw_instruction_t raw;
+        encode_instruction_to_raw(&program[i], &raw);
+        for(size_t j = 0; j < 4; j++) {
+            state->ram[address + i * 4 + j] = raw.bytes[j];
+        }
+    }
+}
+
+/*
+ * test helper function - runs the given program from address 0 with both the
+ * interpreter and the JIT, and checks that they leave the VM in the same state
+ */
+static test_status_t run_compared(risky_instruction_t * program, size_t count) {
+    risky_vm_state_t expected = { .registers = {0}, .ram = NULL, };
+    risky_vm_state_t actual = { .registers = {0}, .ram = NULL, };
+    risky_jit_t * jit = malloc(sizeof(risky_jit_t));
+    if(
+        jit == NULL ||
+        init_risky_vm_state(&expected) != STATUS_SUCCESS ||
+        init_risky_vm_state(&actual) != STATUS_SUCCESS ||
+        init_risky_jit(jit, &actual) != STATUS_SUCCESS
+    ) {
+        free(jit);
+        return TEST_ERROR;
+    }
+    load_program(&expected, 0x0000U, program, count);
+    load_program(&actual, 0x0000U, program, count);
+    risky_stop_reason_t expected_reason = RISKY_STOP_NONE;
+    risky_stop_reason_t actual_reason = RISKY_STOP_NONE;
+    test_status_t test = TEST_SUCCESS;
+
+    status_t expected_result = run_risky_vm(&expected, &expected_reason);
+    status_t actual_result = run_risky_jit(jit, &actual_reason);
+
+    if(expected_result != STATUS_SUCCESS || actual_result != STATUS_SUCCESS) {
+        test = TEST_ERROR;
+    } else if(
+        actual_reason != expected_reason ||
+        actual.program_counter != expected.program_counter ||
+        actual.operation_flags != expected.operation_flags ||
+        memcmp(
+            actual.registers, expected.registers, sizeof(actual.registers)
+        ) != 0 ||
+        memcmp(actual.ram, expected.ram, RISKY_RAM_AMOUNT) != 0
+    ) {
+        test = TEST_FAIL;
+    }
+    free_risky_jit(jit);
+    free(jit);
+    free_risky_vm_state(&expected);
+    free_risky_vm_state(&actual);
+    return test;
+}
+
+/*
+ * Translated arithmetic, comparison, logic and shift instructions should give
+ * the same results and operation flags as the interpreter, including when
+ * interleaved with instructions that have to be interpreted.
+ */
+test_result_t test_jit_arithmetic() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_instruction_t program[] = {
+        set(1, 0x00ffU),
+        set(2, 0x0001U),
+        set(3, 0x1234U),
+        set(4, 20),
+        // 8-bit add overflows, QOP is interpreted
+        op(ADD, 0x00U, 5, 1, 2),
+        op(QOP, 0x04U, 6, 0, 0),
+        // 8-bit subtract underflows
+        op(SUB, 0x00U, 7, 2, 1),
+        op(QOP, 0x02U, 8, 0, 0),
+        op(MLT, 0x07U, 9, 3, 1),
+        op(MLT, 0x07U, 10, 1, 2),
+        op(INC, 0x06U, 11, 3, 0),
+        op(DEC, 0x00U, 12, 0, 0),
+        op(DEC, 0x06U, 13, 3, 0),
+        op(EQU, 0x00U, 14, 1, 1),
+        op(NEQ, 0x03U, 15, 1, 3),
+        op(GTN, 0x03U, 16, 3, 1),
+        op(LTN, 0x03U, 17, 3, 1),
+        op(EOR, 0x07U, 18, 3, 1),
+        op(AND, 0x07U, 19, 3, 1),
+        op(XOR, 0x05U, 20, 3, 1),
+        op(NOT, 0x06U, 21, 3, 0),
+        op(NOT, 0x02U, 22, 3, 0),
+        op(LSH, 0x07U, 23, 3, 2),
+        op(LSH, 0x07U, 24, 3, 4),
+        op(RSH, 0x07U, 25, 3, 2),
+        op(RSH, 0x06U, 26, 3, 4),
+        op(COP, 0x02U, 27, 3, 0),
+        op(COP, 0x06U, 28, 3, 0),
+        // the last flag-setting instruction in a block sets the flags
+        op(ADD, 0x07U, 29, 3, 3),
+        op(HLT, 0, 0, 0, 0),
+    };
+    test.result = run_compared(program, sizeof(program) / sizeof(program[0]));
+    return test;
+}
+
+/*
+ * Loops and calls which chain blocks together, through both constant and
+ * register jump targets, should run the same as in the interpreter.
+ */
+test_result_t test_jit_chaining() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_instruction_t program[] = {
+        // 0x00: call the function at 0x20 twenty times
+        set(0, 20),
+        set(1, 0x0020U),
+        set(2, 0x0010U),
+        op(JMP, 0x00U, 1, 0, 0),
+        // 0x10: return address
+        op(DEC, 0x06U, 0, 0, 0),
+        set(4, 0x000cU),
+        op(BRA, 0x04U, 4, 0, 0),
+        op(HLT, 0, 0, 0, 0),
+        // 0x20: function, returns through a register
+        op(INC, 0x06U, 5, 5, 0),
+        op(ADD, 0x07U, 6, 6, 5),
+        op(JMP, 0x00U, 2, 0, 0),
+    };
+    test.result = run_compared(program, sizeof(program) / sizeof(program[0]));
+    return test;
+}
+
+/*
+ * Translated LOD instructions should read the same bytes as the interpreter.
+ */
+test_result_t test_jit_lod() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_instruction_t program[] = {
+        set(1, 0x0010U),
+        set(2, 0xffffU),
+        op(LOD, 0x02U, 3, 1, 0),
+        op(LOD, 0x06U, 4, 1, 0),
+        // a 16-bit load from the last byte of RAM wraps around
+        op(LOD, 0x06U, 5, 2, 0),
+        op(HLT, 0, 0, 0, 0),
+    };
+    test.result = run_compared(program, sizeof(program) / sizeof(program[0]));
+    return test;
+}
+
+/*
+ * SAV instructions which overwrite translated code should cause it to be
+ * translated again, so that self-modifying code sees its modifications.
+ */
+test_result_t test_jit_sav_invalidates() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_instruction_t program[] = {
+        // 0x00: call the function at 0x40 three times
+        set(0, 3),
+        set(6, 0x0018U),
+        set(7, 0x0040U),
+        set(8, 10),
+        set(9, 0x0041U),
+        // 0x14: loop
+        op(JMP, 0x00U, 7, 0, 0),
+        // 0x18: change which register the function increments into
+        op(SAV, 0x02U, 8, 9, 0),
+        op(INC, 0x06U, 8, 8, 0),
+        op(DEC, 0x06U, 0, 0, 0),
+        set(20, 0x0014U),
+        op(BRA, 0x04U, 20, 0, 0),
+        op(HLT, 0, 0, 0, 0),
+        op(NOP, 0, 0, 0, 0),
+        op(NOP, 0, 0, 0, 0),
+        op(NOP, 0, 0, 0, 0),
+        op(NOP, 0, 0, 0, 0),
+        // 0x40: function
+        op(INC, 0x06U, 5, 5, 0),
+        op(JMP, 0x00U, 6, 0, 0),
+    };
+    test.result = run_compared(program, sizeof(program) / sizeof(program[0]));
+    return test;
+}
+
+int main() {
+    // initialise test suite
+    test_suite_t suite = init_test_suite();
+    // add test cases
+    add_test_case(test_jit_arithmetic, &suite);
+    add_test_case(test_jit_chaining, &suite);
+    add_test_case(test_jit_lod, &suite);
+    add_test_case(test_jit_sav_invalidates, &suite);
+    // run test suite
+    run_test_suite(&suite);
+    // return test suite status
+    return suite.result ? 0 : 1;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,163 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains unit tests for the lockstep module
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "../risky/core.h"
+#include "../risky/encoder.h"
+#include "../risky/interpreter.h"
+#include "../risky/lockstep.h"
+#include "../risky/risky.h"
+#include "../unit_test_harness/harness.h"
+#include "instructions.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of VMs run together, deliberately not a whole number of vectors
+#define VM_COUNT 37U
+
+/*
+ * test helper function - encodes the given instructions into the RAM of the
+ * given VM state, starting at the given address
+ */
+static void load_program(
+    risky_vm_state_t * state, risky_ram_address_t address,
+    risky_instruction_t * program, size_t count
+) {
+    for(size_t i = 0; i < count; i++) {
+        risky_raw_instruction_t raw;
+        encode_instruction_to_raw(&program[i], &raw);
+        for(size_t j = 0; j < 4; j++) {
+            state->ram[address + i * 4 + j] = raw.bytes[j];
+        }
+    }
+}
+
+/*
+ * Running many VMs in lockstep should leave each of them in the same state as
+ * running them one at a time, even when their paths through the program
+ * diverge, they execute instructions which aren't vectorised and they modify
+ * their own code differently from each other.
+ */
+test_result_t test_run_risky_lockstep() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    // counts the steps for the number at 0x1000 to reach 1 (Collatz)
+    risky_instruction_t program[] = {
+        set(10, 0x1000U),
+        op(LOD, 0x06U, 1, 10, 0),
+        set(2, 0),
+        set(3, 1),
+        set(4, 3),
+        set(11, 0x0020U),
+        set(12, 0x003cU),
+        set(13, 0x004cU),
+        // 0x20: loop
+        op(EQU, 0x07U, 5, 1, 3),
+        op(BRA, 0x04U, 13, 5, 0),
+        op(INC, 0x06U, 2, 2, 0),
+        op(AND, 0x07U, 6, 1, 3),
+        op(BRA, 0x04U, 12, 6, 0),
+        op(RSH, 0x07U, 1, 1, 3),
+        op(JMP, 0x00U, 11, 0, 0),
+        // 0x3c: odd
+        op(MLT, 0x07U, 1, 1, 4),
+        op(INC, 0x06U, 1, 1, 0),
+        op(DIV, 0x07U, 7, 1, 4),
+        op(JMP, 0x00U, 11, 0, 0),
+        // 0x4c: done, write the step count into the SET at 0x60 and run it
+        op(QOP, 0x07U, 8, 0, 0),
+        set(15, 0x0062U),
+        op(SAV, 0x06U, 2, 15, 0),
+        op(NOP, 0, 0, 0, 0),
+        op(NOP, 0, 0, 0, 0),
+        set(16, 0xdeadU),
+        op(HLT, 0, 0, 0, 0),
+    };
+    risky_vm_state_t states[VM_COUNT];
+    risky_vm_state_t expected[VM_COUNT];
+    risky_vm_state_t * pointers[VM_COUNT];
+    for(size_t i = 0; i < VM_COUNT; i++) {
+        states[i] = (risky_vm_state_t) { .registers = {0}, .ram = NULL, };
+        expected[i] = (risky_vm_state_t) { .registers = {0}, .ram = NULL, };
+        if(
+            init_risky_vm_state(&states[i]) != STATUS_SUCCESS ||
+            init_risky_vm_state(&expected[i]) != STATUS_SUCCESS
+        ) {
+            test.result = TEST_ERROR;
+            return test;
+        }
+        load_program(&states[i], 0x0000U, program, 26);
+        load_program(&expected[i], 0x0000U, program, 26);
+        // each VM gets a different input
+        risky_word_t input = (risky_word_t) (i * 7 + 1);
+        states[i].ram[0x1000] = expected[i].ram[0x1000] = input >> 8;
+        states[i].ram[0x1001] = expected[i].ram[0x1001] = input & 0xffU;
+        pointers[i] = &states[i];
+    }
+    risky_lockstep_t engine;
+    if(init_risky_lockstep(&engine, pointers, VM_COUNT) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+
+    status_t result = run_risky_lockstep(&engine);
+
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+    }
+    for(size_t i = 0; i < VM_COUNT && test.result == TEST_SUCCESS; i++) {
+        risky_stop_reason_t reason = RISKY_STOP_NONE;
+        if(run_risky_vm(&expected[i], &reason) != STATUS_SUCCESS) {
+            test.result = TEST_ERROR;
+        } else if(
+            engine.reasons[i] != reason ||
+            states[i].program_counter != expected[i].program_counter ||
+            states[i].operation_flags != expected[i].operation_flags ||
+            memcmp(
+                states[i].registers, expected[i].registers,
+                sizeof(states[i].registers)
+            ) != 0 ||
+            memcmp(states[i].ram, expected[i].ram, RISKY_RAM_AMOUNT) != 0 ||
+            // and the modified SET should have run with each VM's own value
+            states[i].registers[16] != states[i].registers[2]
+        ) {
+            test.result = TEST_FAIL;
+        }
+    }
+    free_risky_lockstep(&engine);
+    for(size_t i = 0; i < VM_COUNT; i++) {
+        free_risky_vm_state(&states[i]);
+        free_risky_vm_state(&expected[i]);
+    }
+    return test;
+}
+
+int main() {
+    // initialise test suite
+    test_suite_t suite = init_test_suite();
+    // add test cases
+    add_test_case(test_run_risky_lockstep, &suite);
+    // run test suite
+    run_test_suite(&suite);
+    // return test suite status
+    return suite.result ? 0 : 1;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,127 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains unit tests for the packed module
+ */
+#include <stdbool.h>
+
+#include "../risky/core.h"
+#include "../risky/decoder.h"
+#include "../risky/packed.h"
+#include "../risky/risky.h"
+#include "../unit_test_harness/harness.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * Packed instructions should take up no more than 8 bytes, so that at least
+ * eight of them fit in a 64-byte cache line.
+ */
+test_result_t test_packed_instruction_size() {
+    // initialise test result
+    test_result_t test = TEST;
+    test.result = (sizeof(risky_packed_instruction_t) <= 8) ?
+        TEST_SUCCESS : TEST_FAIL;
+    return test;
+}
+
+/*
+ * Function pack_instruction should keep the opcode and flags in the first byte
+ * in the same bit positions as the raw format.
+ */
+test_result_t test_pack_instruction() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_instruction_t instruction = {
+        .opcode = SET,
+        .a_flag = true, .b_flag = false, .c_flag = false,
+        .r = 0x12U, .a = 0, .b = 0,
+        .l = 0xbeefU,
+    };
+    risky_packed_instruction_t packed;
+
+    status_t result = pack_instruction(&instruction, &packed);
+
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+    } else if(
+        packed.operation != ((0x18U << 3) | 0x04U) || packed.r != 0x12U ||
+        packed.a != 0 || packed.b != 0 || packed.l != 0xbeefU ||
+        packed_opcode(&packed) != SET || !packed_a_flag(&packed) ||
+        packed_b_flag(&packed) || packed_c_flag(&packed)
+    ) {
+        test.result = TEST_FAIL;
+    }
+    return test;
+}
+
+/*
+ * Every possible decoded instruction should be unchanged after being packed and
+ * unpacked again, and decoding straight to the packed form should give the
+ * same result as packing the decoded instruction.
+ */
+test_result_t test_pack_unpack_round_trip() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    for(unsigned int first = 0; first < 256; first++) {
+        risky_raw_instruction_t raw = {
+            .bytes = { (risky_byte_t) first, 0x7fU, 0x33U, 0x69U, },
+        };
+        risky_instruction_t decoded, unpacked;
+        risky_packed_instruction_t packed, direct;
+        if(
+            decode_instruction_from_raw(&raw, &decoded) != STATUS_SUCCESS ||
+            pack_instruction(&decoded, &packed) != STATUS_SUCCESS ||
+            unpack_instruction(&packed, &unpacked) != STATUS_SUCCESS ||
+            decode_packed_instruction_from_raw(&raw, &direct) != STATUS_SUCCESS
+        ) {
+            test.result = TEST_ERROR;
+            return test;
+        }
+        if(
+            decoded.opcode != unpacked.opcode ||
+            decoded.a_flag != unpacked.a_flag ||
+            decoded.b_flag != unpacked.b_flag ||
+            decoded.c_flag != unpacked.c_flag || decoded.r != unpacked.r ||
+            decoded.a != unpacked.a || decoded.b != unpacked.b ||
+            decoded.l != unpacked.l ||
+            packed.operation != direct.operation || packed.r != direct.r ||
+            packed.a != direct.a || packed.b != direct.b ||
+            packed.l != direct.l
+        ) {
+            test.result = TEST_FAIL;
+            return test;
+        }
+    }
+    return test;
+}
+
+int main() {
+    // initialise test suite
+    test_suite_t suite = init_test_suite();
+    // add test cases
+    add_test_case(test_packed_instruction_size, &suite);
+    add_test_case(test_pack_instruction, &suite);
+    add_test_case(test_pack_unpack_round_trip, &suite);
+    // run test suite
+    run_test_suite(&suite);
+    // return test suite status
+    return suite.result ? 0 : 1;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,298 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains unit tests for the pool module
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "../risky/core.h"
+#include "../risky/fork.h"
+#include "../risky/pool.h"
+#include "../risky/risky.h"
+#include "../unit_test_harness/harness.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of VMs in the pools used by the tests
+#define POOL_CAPACITY 8U
+
+// test helper function - returns whether a VM is as if freshly initialised
+static bool is_fresh(risky_vm_state_t * state) {
+    for(size_t i = 0; i < RISKY_REGISTER_COUNT; i++) {
+        if(state->registers[i] != 0) {
+            return false;
+        }
+    }
+    for(size_t i = 0; i < RISKY_RAM_AMOUNT; i++) {
+        if(state->ram[i] != 0) {
+            return false;
+        }
+    }
+    for(size_t i = 0; i < RISKY_CHANNEL_COUNT; i++) {
+        if(state->channels[i] != 0) {
+            return false;
+        }
+    }
+    return (
+        state->program_counter == 0 && state->operation_flags == 0 &&
+        state->image == NULL && !state->ram_written
+    );
+}
+
+/*
+ * Every VM in a pool should be able to be acquired once until it is released
+ * again, and each should start off fresh, even if it was used before.
+ */
+test_result_t test_acquire_risky_vm() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_vm_pool_t pool;
+    if(init_risky_vm_pool(&pool, POOL_CAPACITY, 0) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    risky_vm_state_t * states[POOL_CAPACITY];
+    for(size_t i = 0; i < POOL_CAPACITY; i++) {
+        if(acquire_risky_vm(&pool, &states[i]) != STATUS_SUCCESS) {
+            test.result = TEST_ERROR;
+        } else if(!is_fresh(states[i])) {
+            test.result = TEST_FAIL;
+        } else {
+            // dirty the VM so that reusing it can be checked
+            states[i]->registers[i] = 0xffffU;
+            states[i]->ram[i * 4096] = 0xffU;
+            states[i]->program_counter = 0x1234U;
+            states[i]->channels[i] = RISKY_CHANNEL_ACTIVE;
+        }
+    }
+    risky_vm_state_t * spare;
+    // the pool should be empty now
+    if(acquire_risky_vm(&pool, &spare) == STATUS_SUCCESS) {
+        test.result = TEST_FAIL;
+    }
+    // give back two VMs, one each way, and the same two should be reused
+    if(
+        release_risky_vm(&pool, states[2]) != STATUS_SUCCESS ||
+        free_risky_vm_state(states[5]) != STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+    }
+    risky_vm_state_t * first, * second;
+    if(
+        acquire_risky_vm(&pool, &first) != STATUS_SUCCESS ||
+        acquire_risky_vm(&pool, &second) != STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+    } else if(
+        !((first == states[2] && second == states[5]) ||
+        (first == states[5] && second == states[2])) ||
+        !is_fresh(first) || !is_fresh(second)
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_vm_pool(&pool);
+    return test;
+}
+
+/*
+ * Releasing a VM which is already free should fail, and shouldn't let the VM
+ * be handed out twice by later acquires.
+ */
+test_result_t test_release_risky_vm_twice() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_vm_pool_t pool;
+    if(init_risky_vm_pool(&pool, 2, 0) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    risky_vm_state_t * state;
+    if(
+        acquire_risky_vm(&pool, &state) != STATUS_SUCCESS ||
+        release_risky_vm(&pool, state) != STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+    } else if(release_risky_vm(&pool, state) == STATUS_SUCCESS) {
+        test.result = TEST_FAIL;
+    }
+    // only the pool's two VMs should be handed out, each of them once
+    risky_vm_state_t * states[3];
+    for(size_t i = 0; i < 3; i++) {
+        bool acquired = acquire_risky_vm(&pool, &states[i]) == STATUS_SUCCESS;
+        if(acquired != (i < 2) || (i == 1 && states[0] == states[1])) {
+            test.result = TEST_FAIL;
+        }
+    }
+    free_risky_vm_pool(&pool);
+    return test;
+}
+
+/*
+ * A VM forked from a pooled VM should keep its copy of the RAM after its
+ * parent has been released, and the parent should come back fresh.
+ */
+test_result_t test_release_risky_vm_forked() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_vm_pool_t pool;
+    if(init_risky_vm_pool(&pool, POOL_CAPACITY, 0) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    risky_vm_state_t * parent, * reused;
+    risky_vm_state_t child;
+    if(acquire_risky_vm(&pool, &parent) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        free_risky_vm_pool(&pool);
+        return test;
+    }
+    risky_ram_t * ram = parent->ram;
+    parent->ram[0x8000] = 0x5aU;
+    if(fork_risky_vm(parent, &child) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        free_risky_vm_pool(&pool);
+        return test;
+    }
+    // the parent's RAM should stay in the pool's arena
+    if(parent->ram != ram) {
+        test.result = TEST_FAIL;
+    }
+    if(
+        release_risky_vm(&pool, parent) != STATUS_SUCCESS ||
+        acquire_risky_vm(&pool, &reused) != STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+    } else if(
+        reused != parent || !is_fresh(reused) || child.ram[0x8000] != 0x5aU
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_vm_state(&child);
+    free_risky_vm_pool(&pool);
+    return test;
+}
+
+/*
+ * A VM released with all of its RAM written to should come back with every
+ * byte of it zero, including any pages swapped out while it was released.
+ */
+test_result_t test_release_risky_vm_clears_ram() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_vm_pool_t pool;
+    if(init_risky_vm_pool(&pool, 1, 0) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    risky_vm_state_t * state, * reused;
+    if(acquire_risky_vm(&pool, &state) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        free_risky_vm_pool(&pool);
+        return test;
+    }
+    memset(state->ram, 0xa5, RISKY_RAM_AMOUNT);
+#ifdef MADV_PAGEOUT
+    // page half of it out, if there is swap for it to go to
+    madvise(state->ram, RISKY_RAM_AMOUNT / 2, MADV_PAGEOUT);
+#endif
+    if(
+        release_risky_vm(&pool, state) != STATUS_SUCCESS ||
+        acquire_risky_vm(&pool, &reused) != STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+    } else {
+        for(size_t i = 0; i < RISKY_RAM_AMOUNT; i++) {
+            if(reused->ram[i] != 0) {
+                test.result = TEST_FAIL;
+                break;
+            }
+        }
+    }
+    free_risky_vm_pool(&pool);
+    return test;
+}
+
+/*
+ * A pool asking for huge pages should work whichever kind of pages it ends up
+ * with, with its arena aligned to a huge page if it got them.
+ */
+test_result_t test_init_risky_vm_pool_huge_pages() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_vm_pool_t pool;
+
+    status_t result = init_risky_vm_pool(
+        &pool, POOL_CAPACITY, RISKY_POOL_HUGE_PAGES
+    );
+
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    if(
+        pool.arena_size % RISKY_HUGE_PAGE_SIZE != 0 ||
+        (pool.pages != RISKY_POOL_NORMAL_PAGES &&
+        (uintptr_t) pool.arena % RISKY_HUGE_PAGE_SIZE != 0)
+    ) {
+        test.result = TEST_FAIL;
+    }
+    risky_vm_state_t * state;
+    for(size_t i = 0; i < 2; i++) {
+        if(acquire_risky_vm(&pool, &state) != STATUS_SUCCESS) {
+            test.result = TEST_ERROR;
+            break;
+        }
+        if(!is_fresh(state)) {
+            test.result = TEST_FAIL;
+        }
+        state->ram[0xffff] = 0xffU;
+        release_risky_vm(&pool, state);
+    }
+    free_risky_vm_pool(&pool);
+    return test;
+}
+
+int main() {
+    // initialise test suite
+    test_suite_t suite = init_test_suite();
+    // add test cases
+    add_test_case(test_acquire_risky_vm, &suite);
+    add_test_case(test_release_risky_vm_twice, &suite);
+    add_test_case(test_release_risky_vm_forked, &suite);
+    add_test_case(test_release_risky_vm_clears_ram, &suite);
+    add_test_case(test_init_risky_vm_pool_huge_pages, &suite);
+    // run test suite
+    run_test_suite(&suite);
+    // return test suite status
+    return suite.result ? 0 : 1;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,194 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains unit tests for the profile module
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../risky/core.h"
+#include "../risky/interpreter.h"
+#include "../risky/profile.h"
+#include "../risky/risky.h"
+#include "../unit_test_harness/harness.h"
+#include "instructions.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * test helper function - initialises a VM and a profile, then runs a loop
+ * which counts down from 1000 to completion with profiling: 3 instructions of
+ * setup, then a block of 3 at 0x000c which runs 1000 times, then a HLT
+ */
+static test_status_t run_loop(
+    risky_vm_state_t * state, risky_profile_t * profile
+) {
+    *state = (risky_vm_state_t) { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(state) != STATUS_SUCCESS) {
+        return TEST_ERROR;
+    }
+    if(init_risky_profile(profile) != STATUS_SUCCESS) {
+        free_risky_vm_state(state);
+        return TEST_ERROR;
+    }
+    risky_instruction_t program[] = {
+        set(1, 1000),
+        set(2, 1),
+        set(3, 0x000cU),
+        op(SUB, 0x07U, 1, 1, 2),
+        op(NEQ, 0x03U, 5, 1, 6),
+        op(BRA, 0x00U, 3, 5, 0),
+        op(HLT, 0, 0, 0, 0),
+    };
+    encode_program(state->ram, program, sizeof(program) / sizeof(program[0]));
+    risky_stop_reason_t reason = RISKY_STOP_NONE;
+    status_t result = run_risky_vm_profiled(state, profile, &reason);
+    if(result != STATUS_SUCCESS || reason != RISKY_STOP_HALTED) {
+        free_risky_profile(profile);
+        free_risky_vm_state(state);
+        return TEST_ERROR;
+    }
+    return TEST_SUCCESS;
+}
+
+/*
+ * A profiled run should have the same result as an ordinary one, and count
+ * every instruction executed by address and by opcode
+ */
+test_result_t test_profile_counts() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_vm_state_t state;
+    risky_profile_t profile;
+    test.result = run_loop(&state, &profile);
+    if(test.result != TEST_SUCCESS) {
+        return test;
+    }
+
+    if(
+        state.registers[1] != 0 || state.program_counter != 0x0018U ||
+        profile.total != 3004 || profile.counts[0x0000U] != 1 ||
+        profile.counts[0x000cU] != 1000 || profile.counts[0x0018U] != 1 ||
+        profile.counts[0x001cU] != 0 || profile.opcodes[SET] != 3 ||
+        profile.opcodes[SUB] != 1000 || profile.opcodes[BRA] != 1000 ||
+        profile.opcodes[HLT] != 1 || profile.entries[0x0000U] != 1 ||
+        // every taken branch enters the loop, but the first time falls in
+        profile.entries[0x000cU] != 999 || profile.entries[0x0018U] != 0
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_profile(&profile);
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * The executed instructions of a profile should be split into basic blocks,
+ * hottest first
+ */
+test_result_t test_profile_blocks() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_vm_state_t state;
+    risky_profile_t profile;
+    test.result = run_loop(&state, &profile);
+    if(test.result != TEST_SUCCESS) {
+        return test;
+    }
+    risky_profile_block_t * blocks = NULL;
+    size_t count = 0;
+
+    status_t result = find_risky_profile_blocks(
+        &profile, &state, &blocks, &count
+    );
+
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+    } else if(
+        count != 3 ||
+        blocks[0].start != 0x000cU || blocks[0].length != 3 ||
+        blocks[0].runs != 1000 || blocks[0].executed != 3000 ||
+        blocks[1].start != 0x0000U || blocks[1].length != 3 ||
+        blocks[1].runs != 1 || blocks[1].executed != 3 ||
+        blocks[2].start != 0x0018U || blocks[2].length != 1 ||
+        blocks[2].executed != 1
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free(blocks);
+    free_risky_profile(&profile);
+    free_risky_vm_state(&state);
+    return test;
+}
+
+/*
+ * Collapsed stacks should have a line per executed instruction, naming the
+ * program, block and instruction, followed by its count
+ */
+test_result_t test_profile_stacks() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_vm_state_t state;
+    risky_profile_t profile;
+    test.result = run_loop(&state, &profile);
+    if(test.result != TEST_SUCCESS) {
+        return test;
+    }
+    FILE * stream = tmpfile();
+    if(stream == NULL) {
+        test.result = TEST_ERROR;
+    } else if(
+        write_risky_profile_stacks(&profile, &state, "loop", stream) !=
+        STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+    } else {
+        rewind(stream);
+        const char * expected = "loop;block 0x000c;0x0010 neq.bc 5 1 6 1000\n";
+        char line[128];
+        size_t lines = 0;
+        bool found = false;
+        while(fgets(line, sizeof(line), stream) != NULL) {
+            lines++;
+            if(strcmp(line, expected) == 0) {
+                found = true;
+            }
+        }
+        if(lines != 7 || !found) {
+            test.result = TEST_FAIL;
+        }
+    }
+    if(stream != NULL) {
+        fclose(stream);
+    }
+    free_risky_profile(&profile);
+    free_risky_vm_state(&state);
+    return test;
+}
+
+int main() {
+    // initialise test suite
+    test_suite_t suite = init_test_suite();
+    // add test cases
+    add_test_case(test_profile_counts, &suite);
+    add_test_case(test_profile_blocks, &suite);
+    add_test_case(test_profile_stacks, &suite);
+    // run test suite
+    run_test_suite(&suite);
+    // return test suite status
+    return suite.result ? 0 : 1;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,310 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains unit tests for the program module
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../risky/core.h"
+#include "../risky/interpreter.h"
+#include "../risky/program.h"
+#include "../risky/risky.h"
+#include "../unit_test_harness/harness.h"
+#include "instructions.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// address the test program's code is loaded at
+#define CODE_ADDRESS 0x0100U
+// address of the word the test program adds to
+#define DATA_ADDRESS 0x2000U
+
+// the code and data sections of the test program
+static const risky_program_section_t SECTIONS[] = {
+    { .type = RISKY_SECTION_CODE, .address = CODE_ADDRESS, .size = 5 * 4, },
+    { .type = RISKY_SECTION_DATA, .address = DATA_ADDRESS, .size = 2, },
+};
+
+/*
+ * test helper function - initialises a VM with a program at CODE_ADDRESS which
+ * adds register 1 to the word at DATA_ADDRESS and halts, with 0x1000 stored
+ * there to begin with, and encodes it as a program
+ */
+static status_t encode_adder(risky_byte_t ** bytes, size_t * size) {
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    status_t result = init_risky_vm_state(&state);
+    if(result != STATUS_SUCCESS) {
+        return result;
+    }
+    risky_instruction_t program[] = {
+        op(SET, 0x04U, 2, 0, 0),
+        op(LOD, 0x06U, 3, 2, 0),
+        op(ADD, 0x07U, 3, 3, 1),
+        op(SAV, 0x06U, 3, 2, 0),
+        op(HLT, 0x00U, 0, 0, 0),
+    };
+    program[0].l = DATA_ADDRESS;
+    encode_program(state.ram + CODE_ADDRESS, program, 5);
+    state.ram[DATA_ADDRESS] = 0x10U;
+    state.program_counter = CODE_ADDRESS;
+    result = encode_risky_program(&state, SECTIONS, 2, true, bytes, size);
+    free_risky_vm_state(&state);
+    return result;
+}
+
+/*
+ * test helper function - stores the checksum of the payload of the given
+ * program in its header, after the test has changed it
+ */
+static void update_checksum(risky_byte_t * bytes, size_t size) {
+    uint32_t hash = 0x811c9dc5U;
+    for(size_t i = RISKY_PROGRAM_HEADER_SIZE; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x01000193U;
+    }
+    bytes[16] = (risky_byte_t) (hash >> 24);
+    bytes[17] = (risky_byte_t) (hash >> 16);
+    bytes[18] = (risky_byte_t) (hash >> 8);
+    bytes[19] = (risky_byte_t) hash;
+}
+
+/*
+ * test helper function - loads the given program into a new VM with 5 in
+ * register 1 and runs it, returning the word it left at the given address,
+ * or 0xffff if it couldn't be loaded or run. Whether predecoded instructions
+ * were used is stored in the given bool
+ */
+static risky_word_t run_program(
+    const risky_byte_t * bytes, size_t size, risky_ram_address_t address,
+    bool * predecoded
+) {
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        return 0xffffU;
+    }
+    risky_word_t word = 0xffffU;
+    risky_stop_reason_t reason;
+    if(
+        decode_risky_program(&state, bytes, size, predecoded) ==
+        STATUS_SUCCESS &&
+        state.program_counter == CODE_ADDRESS
+    ) {
+        state.registers[1] = 5;
+        if(
+            run_risky_vm(&state, &reason) == STATUS_SUCCESS &&
+            reason == RISKY_STOP_HALTED
+        ) {
+            word = (risky_word_t) (
+                (state.ram[address] << 8) | state.ram[address + 1]
+            );
+        }
+    }
+    free_risky_vm_state(&state);
+    return word;
+}
+
+/*
+ * A program should load with its sections at their addresses and its entry
+ * point in the program counter, with the instructions of its code section
+ * taken from its predecoded section.
+ */
+test_result_t test_decode_risky_program() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_byte_t * bytes;
+    size_t size;
+    if(encode_adder(&bytes, &size) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    bool predecoded = false;
+
+    risky_word_t result = run_program(bytes, size, DATA_ADDRESS, &predecoded);
+
+    if(
+        !is_risky_program(bytes, size) || bytes[4] != VERSION.major ||
+        result != 0x1005U || !predecoded
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free(bytes);
+    return test;
+}
+
+/*
+ * Predecoded instructions should be ignored if the program was saved by a
+ * different version of RISKY, or no longer match the code they were decoded
+ * from, leaving the code to be decoded as usual.
+ */
+test_result_t test_decode_risky_program_stale() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_byte_t * bytes;
+    size_t size;
+    if(encode_adder(&bytes, &size) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    bool other_version = true;
+    bool changed_code = true;
+
+    // saved by a different patch version
+    bytes[6]++;
+    risky_word_t first = run_program(bytes, size, DATA_ADDRESS, &other_version);
+    bytes[6]--;
+    /*
+     * change the literal of the SET instruction (the first section's data
+     * follows the header and the table of three sections) to point two bytes
+     * further on, where the data section has left zero
+     */
+    size_t code = RISKY_PROGRAM_HEADER_SIZE + 3 * RISKY_PROGRAM_SECTION_SIZE;
+    bytes[code + 3] = 0x02U;
+    update_checksum(bytes, size);
+    risky_word_t second = run_program(
+        bytes, size, DATA_ADDRESS + 2, &changed_code
+    );
+
+    if(first != 0x1005U || other_version) {
+        test.result = TEST_FAIL;
+    }
+    if(second != 0x0005U || changed_code) {
+        test.result = TEST_FAIL;
+    }
+    free(bytes);
+    return test;
+}
+
+/*
+ * Programs which are truncated, corrupted or from a different major version
+ * of RISKY should be rejected.
+ */
+test_result_t test_decode_risky_program_invalid() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_byte_t * bytes;
+    size_t size;
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(
+        encode_adder(&bytes, &size) != STATUS_SUCCESS ||
+        init_risky_vm_state(&state) != STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+
+    status_t truncated = decode_risky_program(&state, bytes, size - 1, NULL);
+    bytes[4]++;
+    status_t other_major = decode_risky_program(&state, bytes, size, NULL);
+    bytes[4]--;
+    bytes[size - 1] ^= 0xffU;
+    status_t corrupted = decode_risky_program(&state, bytes, size, NULL);
+    bytes[0] = 'X';
+    status_t bad_magic = decode_risky_program(&state, bytes, size, NULL);
+
+    if(
+        truncated == STATUS_SUCCESS || other_major == STATUS_SUCCESS ||
+        corrupted == STATUS_SUCCESS || bad_magic == STATUS_SUCCESS
+    ) {
+        test.result = TEST_FAIL;
+    }
+    // RAM is cleared after a checksum mismatch
+    if(state.ram[CODE_ADDRESS] != 0x00U || state.ram[DATA_ADDRESS] != 0x00U) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_vm_state(&state);
+    free(bytes);
+    return test;
+}
+
+/*
+ * A program saved to a file should load back from it the same.
+ */
+test_result_t test_save_load_risky_program() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_byte_t * bytes;
+    size_t size;
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(
+        encode_adder(&bytes, &size) != STATUS_SUCCESS ||
+        init_risky_vm_state(&state) != STATUS_SUCCESS ||
+        decode_risky_program(&state, bytes, size, NULL) != STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    char path[] = "/tmp/risky-test-XXXXXX";
+    int descriptor = mkstemp(path);
+    if(descriptor == -1) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    close(descriptor);
+    risky_vm_state_t loaded = { .registers = {0}, .ram = NULL, };
+    bool predecoded = false;
+
+    status_t saved = save_risky_program(&state, SECTIONS, 2, true, path);
+    status_t result = STATUS_FAIL;
+    if(init_risky_vm_state(&loaded) == STATUS_SUCCESS) {
+        result = load_risky_program(&loaded, path, &predecoded);
+    }
+
+    if(saved != STATUS_SUCCESS || result != STATUS_SUCCESS || !predecoded) {
+        test.result = TEST_FAIL;
+    } else {
+        for(size_t i = 0; i < RISKY_RAM_AMOUNT; i++) {
+            if(loaded.ram[i] != state.ram[i]) {
+                test.result = TEST_FAIL;
+                break;
+            }
+        }
+        if(loaded.program_counter != CODE_ADDRESS) {
+            test.result = TEST_FAIL;
+        }
+    }
+    free_risky_vm_state(&state);
+    free_risky_vm_state(&loaded);
+    unlink(path);
+    free(bytes);
+    return test;
+}
+
+int main() {
+    // initialise test suite
+    test_suite_t suite = init_test_suite();
+    // add test cases
+    add_test_case(test_decode_risky_program, &suite);
+    add_test_case(test_decode_risky_program_stale, &suite);
+    add_test_case(test_decode_risky_program_invalid, &suite);
+    add_test_case(test_save_load_risky_program, &suite);
+    // run test suite
+    run_test_suite(&suite);
+    // return test suite status
+    return suite.result ? 0 : 1;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
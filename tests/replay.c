@@ -0,0 +1,370 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains unit tests for the replay module
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../risky/core.h"
+#include "../risky/interpreter.h"
+#include "../risky/replay.h"
+#include "../risky/risky.h"
+#include "../unit_test_harness/harness.h"
+#include "instructions.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// words read from channel 0 by the test program, the last one ending it
+static const risky_word_t INPUT[] = { 0x0005U, 0x1234U, 0xbeefU, 0x0000U, };
+
+// the channels of the test program: words it is given and words it wrote
+typedef struct channels_t {
+    size_t read;
+    risky_word_t written[8];
+    size_t write;
+} channels_t;
+
+// test helper function - channel read callback, reads the next word of INPUT
+static bool read_input(
+    void * context, risky_channel_t channel, risky_word_t * data
+) {
+    (void) channel;
+    channels_t * channels = (channels_t *) context;
+    if(channels->read == sizeof(INPUT) / sizeof(INPUT[0])) {
+        return false;
+    }
+    *data = INPUT[channels->read++];
+    return true;
+}
+
+// test helper function - channel write callback, stores the word written
+static void write_output(
+    void * context, risky_channel_t channel, risky_word_t data
+) {
+    (void) channel;
+    channels_t * channels = (channels_t *) context;
+    if(channels->write < sizeof(channels->written) / sizeof(risky_word_t)) {
+        channels->written[channels->write++] = data;
+    }
+}
+
+/*
+ * test helper function - initialises a VM with a program which activates
+ * channels 0 for reading and 1 for writing, then repeatedly reads a word from
+ * channel 0, queries its state, adds the word to a running total and writes
+ * the total to channel 1, until it reads a zero. With diverge set, it reads
+ * from channel 2 instead. The VM's channels are the given ones.
+ * Returns a test_status_t with the outcome
+ */
+static test_status_t init_replay_program(
+    risky_vm_state_t * state, channels_t * channels, bool diverge
+) {
+    *state = (risky_vm_state_t) { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(state) != STATUS_SUCCESS) {
+        return TEST_ERROR;
+    }
+    risky_instruction_t program[] = {
+        op(CDC, 0x00U, 0, 0, 1),
+        op(CDC, 0x00U, 1, 1, 1),
+        set(3, 0x0014U),
+        set(4, 0),
+        set(6, 0),
+        // loop:
+        op(REA, 0x00U, 1, diverge ? 2 : 0, 0),
+        op(QDC, 0x00U, 2, 0, 0),
+        op(ADD, 0x07U, 4, 4, 1),
+        op(WRI, 0x00U, 1, 4, 0),
+        op(NEQ, 0x03U, 5, 1, 6),
+        op(BRA, 0x00U, 3, 5, 0),
+        op(HLT, 0, 0, 0, 0),
+    };
+    encode_program(state->ram, program, sizeof(program) / sizeof(program[0]));
+    *channels = (channels_t) { .read = 0, .write = 0, };
+    state->channel_io = (risky_channel_io_t) {
+        .read = read_input, .write = write_output, .context = channels,
+    };
+    return TEST_SUCCESS;
+}
+
+/*
+ * test helper function - records a run of the test program into the given
+ * log, which is initialised first.
+ * Returns a test_status_t with the outcome
+ */
+static test_status_t record_program(
+    risky_replay_log_t * log, channels_t * recorded
+) {
+    risky_vm_state_t state;
+    if(init_replay_program(&state, recorded, false) != TEST_SUCCESS) {
+        return TEST_ERROR;
+    }
+    init_risky_replay_log(log);
+    risky_stop_reason_t reason;
+    status_t result = run_risky_vm_recorded(&state, log, &reason);
+    free_risky_vm_state(&state);
+    if(result != STATUS_SUCCESS || reason != RISKY_STOP_HALTED) {
+        free_risky_replay_log(log);
+        return TEST_ERROR;
+    }
+    return TEST_SUCCESS;
+}
+
+/*
+ * Replaying a recorded run without its input should repeat it exactly,
+ * writing the same output and ending in the same state
+ */
+test_result_t test_replay_repeats_run() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_replay_log_t log;
+    channels_t recorded;
+    test.result = record_program(&log, &recorded);
+    if(test.result != TEST_SUCCESS) {
+        return test;
+    }
+    uint64_t executed = log.executed;
+    risky_vm_state_t state;
+    channels_t replayed;
+    if(init_replay_program(&state, &replayed, false) != TEST_SUCCESS) {
+        free_risky_replay_log(&log);
+        test.result = TEST_ERROR;
+        return test;
+    }
+    // nothing is there to be read any more
+    state.channel_io.read = NULL;
+    rewind_risky_replay_log(&log);
+
+    risky_stop_reason_t reason;
+    status_t result = run_risky_vm_replayed(&state, &log, &reason);
+    if(result != STATUS_SUCCESS || reason != RISKY_STOP_HALTED) {
+        test.result = TEST_FAIL;
+    } else if(
+        log.executed != executed || executed != 5 + 4 * 6 + 1 ||
+        log.position != log.size || replayed.read != 0 ||
+        replayed.write != recorded.write || replayed.write != 4 ||
+        memcmp(
+            replayed.written, recorded.written,
+            replayed.write * sizeof(risky_word_t)
+        ) != 0 ||
+        replayed.written[3] != (risky_word_t) (0x0005U + 0x1234U + 0xbeefU) ||
+        state.registers[2] != RISKY_CHANNEL_ACTIVE ||
+        state.program_counter != 0x002cU
+    ) {
+        test.result = TEST_FAIL;
+    } else {
+        test.result = TEST_SUCCESS;
+    }
+    free_risky_vm_state(&state);
+    free_risky_replay_log(&log);
+    return test;
+}
+
+/*
+ * A log saved to a file should load back with the same events, and a log
+ * which runs out should stop the replayed VM as blocked
+ */
+test_result_t test_replay_save_load() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_replay_log_t log;
+    channels_t recorded;
+    test.result = record_program(&log, &recorded);
+    if(test.result != TEST_SUCCESS) {
+        return test;
+    }
+    char path[] = "/tmp/risky-test-XXXXXX";
+    int descriptor = mkstemp(path);
+    if(descriptor == -1) {
+        free_risky_replay_log(&log);
+        test.result = TEST_ERROR;
+        return test;
+    }
+    close(descriptor);
+    risky_replay_log_t loaded;
+    status_t saved = save_risky_replay_log(&log, path);
+    status_t result = load_risky_replay_log(&loaded, path);
+    unlink(path);
+    if(saved != STATUS_SUCCESS || result != STATUS_SUCCESS) {
+        free_risky_replay_log(&log);
+        test.result = TEST_ERROR;
+        return test;
+    }
+
+    if(
+        loaded.size != log.size ||
+        memcmp(loaded.bytes, log.bytes, log.size) != 0
+    ) {
+        test.result = TEST_FAIL;
+    } else {
+        // cut the log short after the first REA and QDC
+        risky_replay_event_t event;
+        next_risky_replay_event(&loaded, &event);
+        next_risky_replay_event(&loaded, &event);
+        loaded.size = loaded.position;
+        rewind_risky_replay_log(&loaded);
+        risky_vm_state_t state;
+        channels_t replayed;
+        if(init_replay_program(&state, &replayed, false) != TEST_SUCCESS) {
+            test.result = TEST_ERROR;
+        } else {
+            risky_stop_reason_t reason;
+            result = run_risky_vm_replayed(&state, &loaded, &reason);
+            test.result = (
+                result == STATUS_SUCCESS && reason == RISKY_STOP_BLOCKED &&
+                state.program_counter == 0x0014U && replayed.write == 1 &&
+                loaded.executed == 5 + 6
+            ) ? TEST_SUCCESS : TEST_FAIL;
+            free_risky_vm_state(&state);
+        }
+    }
+    free_risky_replay_log(&loaded);
+    free_risky_replay_log(&log);
+    return test;
+}
+
+/*
+ * Replaying a log against a run which has diverged from the recorded one
+ * should fail at the first channel instruction which doesn't match
+ */
+test_result_t test_replay_diverges() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_replay_log_t log;
+    channels_t recorded;
+    test.result = record_program(&log, &recorded);
+    if(test.result != TEST_SUCCESS) {
+        return test;
+    }
+    risky_vm_state_t state;
+    channels_t replayed;
+    // reading a different channel from the one recorded
+    if(init_replay_program(&state, &replayed, true) != TEST_SUCCESS) {
+        free_risky_replay_log(&log);
+        test.result = TEST_ERROR;
+        return test;
+    }
+    rewind_risky_replay_log(&log);
+
+    risky_stop_reason_t reason;
+    status_t result = run_risky_vm_replayed(&state, &log, &reason);
+    test.result = (
+        result != STATUS_SUCCESS && state.program_counter == 0x0014U &&
+        replayed.read == 0
+    ) ? TEST_SUCCESS : TEST_FAIL;
+    free_risky_vm_state(&state);
+    free_risky_replay_log(&log);
+    return test;
+}
+
+/*
+ * Each event recorded should hold the number of instructions executed before
+ * its REA or QDC, counting those in earlier times round the loop
+ */
+test_result_t test_replay_event_counts() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_replay_log_t log;
+    channels_t recorded;
+    test.result = record_program(&log, &recorded);
+    if(test.result != TEST_SUCCESS) {
+        return test;
+    }
+    rewind_risky_replay_log(&log);
+    // one REA and one QDC each time round the loop of 6 instructions
+    for(uint64_t i = 0; i < 8 && test.result == TEST_SUCCESS; i++) {
+        risky_replay_event_t event;
+        if(next_risky_replay_event(&log, &event) != STATUS_SUCCESS) {
+            test.result = TEST_FAIL;
+        } else if(
+            event.count != 5 + 6 * (i / 2) + i % 2 ||
+            event.opcode != ((i % 2) ? QDC : REA)
+        ) {
+            test.result = TEST_FAIL;
+        }
+    }
+    if(test.result == TEST_SUCCESS && log.position != log.size) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_replay_log(&log);
+    return test;
+}
+
+/*
+ * Events should be decoded exactly as they were appended, however far apart,
+ * and a malformed event should not be decoded
+ */
+test_result_t test_replay_events() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_replay_event_t events[] = {
+        { .count = 0, .opcode = REA, .channel = 7, .value = 0xbeefU, },
+        { .count = 0, .opcode = QDC, .channel = 255, .value = 0x03U, },
+        { .count = 200, .opcode = REA, .channel = 0, .value = 0x0001U, },
+        { .count = UINT64_MAX, .opcode = QDC, .channel = 1, .value = 0, },
+    };
+    size_t count = sizeof(events) / sizeof(events[0]);
+    risky_replay_log_t log;
+    init_risky_replay_log(&log);
+    test.result = TEST_SUCCESS;
+    for(size_t i = 0; i < count; i++) {
+        if(append_risky_replay_event(&log, &events[i]) != STATUS_SUCCESS) {
+            test.result = TEST_ERROR;
+        }
+    }
+    rewind_risky_replay_log(&log);
+    for(size_t i = 0; i < count && test.result == TEST_SUCCESS; i++) {
+        risky_replay_event_t event;
+        if(
+            next_risky_replay_event(&log, &event) != STATUS_SUCCESS ||
+            event.count != events[i].count ||
+            event.opcode != events[i].opcode ||
+            event.channel != events[i].channel ||
+            event.value != events[i].value
+        ) {
+            test.result = TEST_FAIL;
+        }
+    }
+    risky_replay_event_t event;
+    if(next_risky_replay_event(&log, &event) == STATUS_SUCCESS) {
+        test.result = TEST_FAIL;
+    }
+    // an event for an instruction other than REA or QDC
+    rewind_risky_replay_log(&log);
+    log.bytes[1] = (risky_byte_t) ADD;
+    if(next_risky_replay_event(&log, &event) == STATUS_SUCCESS) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_replay_log(&log);
+    return test;
+}
+
+int main() {
+    // initialise test suite
+    test_suite_t suite = init_test_suite();
+    // add test cases
+    add_test_case(test_replay_repeats_run, &suite);
+    add_test_case(test_replay_save_load, &suite);
+    add_test_case(test_replay_diverges, &suite);
+    add_test_case(test_replay_event_counts, &suite);
+    add_test_case(test_replay_events, &suite);
+    // run test suite
+    run_test_suite(&suite);
+    // return test suite status
+    return suite.result ? 0 : 1;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
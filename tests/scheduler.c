@@ -0,0 +1,357 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains unit tests for the scheduler module
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../risky/core.h"
+#include "../risky/interpreter.h"
+#include "../risky/risky.h"
+#include "../risky/scheduler.h"
+#include "../unit_test_harness/harness.h"
+#include "instructions.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// number of worker threads used by the tests, whatever the machine has
+#define WORKER_COUNT 4U
+// number of words passed from each producer VM to its consumer VM
+#define WORD_COUNT 300U
+
+// a queue of words written by one VM and read by another
+typedef struct pipe_t {
+    risky_word_t words[WORD_COUNT];
+    size_t written;
+    size_t read;
+    pthread_mutex_t lock;
+    // the scheduler running the reader, and the reader's index in it
+    risky_scheduler_t * scheduler;
+    size_t reader;
+} pipe_t;
+
+// test helper function - channel read callback, which reads from a pipe_t
+static bool read_pipe(
+    void * context, risky_channel_t channel, risky_word_t * data
+) {
+    pipe_t * pipe = (pipe_t *) context;
+    (void) channel;
+    pthread_mutex_lock(&pipe->lock);
+    bool ready = pipe->read < pipe->written;
+    if(ready) {
+        *data = pipe->words[pipe->read++];
+    }
+    pthread_mutex_unlock(&pipe->lock);
+    return ready;
+}
+
+/*
+ * test helper function - channel write callback, which writes to a pipe_t and
+ * wakes up the VM reading from it
+ */
+static void write_pipe(
+    void * context, risky_channel_t channel, risky_word_t data
+) {
+    pipe_t * pipe = (pipe_t *) context;
+    (void) channel;
+    pthread_mutex_lock(&pipe->lock);
+    if(pipe->written < WORD_COUNT) {
+        pipe->words[pipe->written++] = data;
+    }
+    pthread_mutex_unlock(&pipe->lock);
+    wake_risky_scheduler_vm(pipe->scheduler, pipe->reader);
+}
+
+/*
+ * test helper function - loads a program which reads WORD_COUNT words from
+ * channel 0 and leaves their sum in register 3
+ */
+static void load_consumer(risky_vm_state_t * state) {
+    risky_instruction_t program[] = {
+        set(1, WORD_COUNT),
+        set(3, 0),
+        set(5, 0x0010U),
+        op(CDC, 0x00U, 0, 0, 1),
+        // 0x10: loop
+        op(REA, 0x00U, 2, 0, 0),
+        op(ADD, 0x07U, 3, 3, 2),
+        op(DEC, 0x06U, 1, 1, 0),
+        op(BRA, 0x04U, 5, 1, 0),
+        op(HLT, 0x00U, 0, 0, 0),
+    };
+    encode_program(state->ram, program, 9);
+}
+
+/*
+ * test helper function - loads a program which writes the numbers 1 to
+ * WORD_COUNT to channel 0
+ */
+static void load_producer(risky_vm_state_t * state) {
+    risky_instruction_t program[] = {
+        set(1, WORD_COUNT),
+        set(2, 0),
+        set(5, 0x0010U),
+        op(CDC, 0x00U, 0, 1, 1),
+        // 0x10: loop
+        op(INC, 0x06U, 2, 2, 0),
+        op(WRI, 0x00U, 0, 2, 0),
+        op(DEC, 0x06U, 1, 1, 0),
+        op(BRA, 0x04U, 5, 1, 0),
+        op(HLT, 0x00U, 0, 0, 0),
+    };
+    encode_program(state->ram, program, 9);
+}
+
+/*
+ * Running many VMs with the scheduler should leave each of them in the same
+ * state as running them one at a time, and the workers should count every
+ * instruction executed between them.
+ */
+test_result_t test_run_risky_scheduler() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    // a hash-like loop, which each VM runs with a different input
+    risky_instruction_t program[] = {
+        set(2, 500),
+        set(3, 0x9e37U),
+        set(5, 0x000cU),
+        // 0x0c: loop
+        op(MLT, 0x07U, 1, 1, 3),
+        op(XOR, 0x07U, 1, 1, 2),
+        op(DEC, 0x06U, 2, 2, 0),
+        op(BRA, 0x04U, 5, 2, 0),
+        op(HLT, 0x00U, 0, 0, 0),
+    };
+    enum { VM_COUNT = 64 };
+    risky_vm_state_t states[VM_COUNT];
+    risky_vm_state_t expected[VM_COUNT];
+    risky_vm_state_t * pointers[VM_COUNT];
+    for(size_t i = 0; i < VM_COUNT; i++) {
+        states[i] = (risky_vm_state_t) { .registers = {0}, .ram = NULL, };
+        expected[i] = (risky_vm_state_t) { .registers = {0}, .ram = NULL, };
+        if(
+            init_risky_vm_state(&states[i]) != STATUS_SUCCESS ||
+            init_risky_vm_state(&expected[i]) != STATUS_SUCCESS
+        ) {
+            test.result = TEST_ERROR;
+            return test;
+        }
+        encode_program(states[i].ram, program, 8);
+        encode_program(expected[i].ram, program, 8);
+        states[i].registers[1] = expected[i].registers[1] = (risky_word_t) i;
+        pointers[i] = &states[i];
+    }
+    risky_scheduler_t scheduler;
+    // a short quantum, so that every VM is rescheduled many times
+    if(
+        init_risky_scheduler(
+            &scheduler, pointers, VM_COUNT, WORKER_COUNT, 100
+        ) != STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+
+    status_t result = run_risky_scheduler(&scheduler);
+
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+    }
+    uint64_t instructions = 0;
+    for(size_t i = 0; i < WORKER_COUNT; i++) {
+        risky_worker_stats_t stats;
+        if(get_risky_worker_stats(&scheduler, i, &stats) != STATUS_SUCCESS) {
+            test.result = TEST_ERROR;
+        }
+        instructions += stats.instructions;
+    }
+    // 3 setup instructions, 4 per loop and a HLT
+    if(instructions != VM_COUNT * (3U + 4U * 500U + 1U)) {
+        test.result = TEST_FAIL;
+    }
+    for(size_t i = 0; i < VM_COUNT && test.result == TEST_SUCCESS; i++) {
+        risky_stop_reason_t reason = RISKY_STOP_NONE;
+        if(run_risky_vm(&expected[i], &reason) != STATUS_SUCCESS) {
+            test.result = TEST_ERROR;
+        } else if(
+            scheduler.reasons[i] != reason ||
+            states[i].program_counter != expected[i].program_counter ||
+            memcmp(
+                states[i].registers, expected[i].registers,
+                sizeof(states[i].registers)
+            ) != 0
+        ) {
+            test.result = TEST_FAIL;
+        }
+    }
+    free_risky_scheduler(&scheduler);
+    for(size_t i = 0; i < VM_COUNT; i++) {
+        free_risky_vm_state(&states[i]);
+        free_risky_vm_state(&expected[i]);
+    }
+    return test;
+}
+
+/*
+ * VMs which block reading from a data channel should be parked until the VM
+ * writing to that channel wakes them up, and should then carry on to read
+ * every word written to them.
+ */
+test_result_t test_run_risky_scheduler_channels() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    enum { PAIR_COUNT = 8 };
+    risky_vm_state_t states[PAIR_COUNT * 2];
+    risky_vm_state_t * pointers[PAIR_COUNT * 2];
+    pipe_t pipes[PAIR_COUNT];
+    risky_scheduler_t scheduler;
+    for(size_t i = 0; i < PAIR_COUNT; i++) {
+        pipes[i] = (pipe_t) {
+            .written = 0, .read = 0, .scheduler = &scheduler, .reader = i * 2,
+        };
+        pthread_mutex_init(&pipes[i].lock, NULL);
+        for(size_t j = 0; j < 2; j++) {
+            risky_vm_state_t * state = &states[i * 2 + j];
+            *state = (risky_vm_state_t) { .registers = {0}, .ram = NULL, };
+            if(init_risky_vm_state(state) != STATUS_SUCCESS) {
+                test.result = TEST_ERROR;
+                return test;
+            }
+            state->channel_io = (risky_channel_io_t) {
+                .read = read_pipe, .write = write_pipe, .context = &pipes[i],
+            };
+            pointers[i * 2 + j] = state;
+        }
+        load_consumer(&states[i * 2]);
+        load_producer(&states[i * 2 + 1]);
+    }
+    // a short quantum, so that readers often catch up with their writers
+    if(
+        init_risky_scheduler(
+            &scheduler, pointers, PAIR_COUNT * 2, WORKER_COUNT, 16
+        ) != STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+
+    status_t result = run_risky_scheduler(&scheduler);
+
+    if(result != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+    }
+    for(size_t i = 0; i < PAIR_COUNT * 2; i++) {
+        if(
+            scheduler.reasons[i] != RISKY_STOP_HALTED ||
+            // each reader should have the sum of 1 to WORD_COUNT
+            (i % 2 == 0 && states[i].registers[3] != 45150U)
+        ) {
+            test.result = TEST_FAIL;
+        }
+    }
+    free_risky_scheduler(&scheduler);
+    for(size_t i = 0; i < PAIR_COUNT * 2; i++) {
+        free_risky_vm_state(&states[i]);
+    }
+    for(size_t i = 0; i < PAIR_COUNT; i++) {
+        pthread_mutex_destroy(&pipes[i].lock);
+    }
+    return test;
+}
+
+/*
+ * When every VM left is blocked, run_risky_scheduler() should return with
+ * them parked, and running it again after waking them should let them finish.
+ */
+test_result_t test_wake_risky_scheduler_vm() {
+    // initialise test result
+    test_result_t test = TEST;
+    // set result to success for now, until proven otherwise by checks
+    test.result = TEST_SUCCESS;
+
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    risky_vm_state_t * pointer = &state;
+    risky_scheduler_t scheduler;
+    pipe_t pipe = {
+        .written = 0, .read = 0, .scheduler = &scheduler, .reader = 0,
+    };
+    pthread_mutex_init(&pipe.lock, NULL);
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+    state.channel_io = (risky_channel_io_t) {
+        .read = read_pipe, .write = NULL, .context = &pipe,
+    };
+    load_consumer(&state);
+    if(
+        init_risky_scheduler(&scheduler, &pointer, 1, WORKER_COUNT, 0) !=
+        STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+        return test;
+    }
+
+    status_t first = run_risky_scheduler(&scheduler);
+    risky_stop_reason_t first_reason = scheduler.reasons[0];
+    // the host writes every word the VM wants at once, then wakes it
+    for(size_t i = 0; i < WORD_COUNT; i++) {
+        pipe.words[i] = (risky_word_t) (i + 1);
+    }
+    pipe.written = WORD_COUNT;
+    status_t woken = wake_risky_scheduler_vm(&scheduler, 0);
+    status_t second = run_risky_scheduler(&scheduler);
+
+    if(
+        first != STATUS_SUCCESS || woken != STATUS_SUCCESS ||
+        second != STATUS_SUCCESS
+    ) {
+        test.result = TEST_ERROR;
+    } else if(
+        first_reason != RISKY_STOP_BLOCKED ||
+        scheduler.reasons[0] != RISKY_STOP_HALTED ||
+        state.registers[3] != 45150U ||
+        // VMs that don't exist can't be woken
+        wake_risky_scheduler_vm(&scheduler, 1) == STATUS_SUCCESS
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free_risky_scheduler(&scheduler);
+    free_risky_vm_state(&state);
+    pthread_mutex_destroy(&pipe.lock);
+    return test;
+}
+
+int main() {
+    // initialise test suite
+    test_suite_t suite = init_test_suite();
+    // add test cases
+    add_test_case(test_run_risky_scheduler, &suite);
+    add_test_case(test_run_risky_scheduler_channels, &suite);
+    add_test_case(test_wake_risky_scheduler_vm, &suite);
+    // run test suite
+    run_test_suite(&suite);
+    // return test suite status
+    return suite.result ? 0 : 1;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
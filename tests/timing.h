@@ -0,0 +1,33 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * timing - this header contains the clock shared by the benchmarks for
+ * timing what they measure.
+ */
+#ifndef SAXBOPHONE_RISKY_TESTS_TIMING_H
+#define SAXBOPHONE_RISKY_TESTS_TIMING_H
+
+#include <time.h>
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// returns the number of seconds elapsed since an arbitrary point in time
+static inline double seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+// end of header file
+#endif
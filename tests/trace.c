@@ -0,0 +1,248 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2016, Joshua Saxby joshua.a.saxby+TNOPLuc8vM==@gmail.com
+ *
+ * this compilation unit contains unit tests for the trace module
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../risky/core.h"
+#include "../risky/encoder.h"
+#include "../risky/interpreter.h"
+#include "../risky/risky.h"
+#include "../risky/trace.h"
+#include "../unit_test_harness/harness.h"
+#include "instructions.h"
+
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * test helper function - runs a loop which counts down from the given number
+ * to completion, with a trace written to a temporary file: 3 instructions of
+ * setup, then a loop at 0x000c of the given number of NOPs and 3 more
+ * instructions, then a HLT. The bytes of the trace file are read back into
+ * a new buffer, which the caller must free.
+ * Returns a test_status_t with the outcome
+ */
+static test_status_t run_loop(
+    risky_word_t count, size_t padding, risky_byte_t ** bytes, size_t * size
+) {
+    risky_vm_state_t state = { .registers = {0}, .ram = NULL, };
+    if(init_risky_vm_state(&state) != STATUS_SUCCESS) {
+        return TEST_ERROR;
+    }
+    risky_instruction_t setup[] = {
+        set(1, count),
+        set(2, 1),
+        set(3, 0x000cU),
+    };
+    risky_instruction_t loop[] = {
+        op(SUB, 0x07U, 1, 1, 2),
+        op(NEQ, 0x03U, 5, 1, 6),
+        op(BRA, 0x00U, 3, 5, 0),
+        op(HLT, 0, 0, 0, 0),
+    };
+    encode_program(state.ram, setup, 3);
+    // zeroed RAM is NOPs, so the padding is already there
+    encode_program(state.ram + (3 + padding) * 4, loop, 4);
+    char path[] = "/tmp/risky-test-XXXXXX";
+    int descriptor = mkstemp(path);
+    if(descriptor == -1) {
+        free_risky_vm_state(&state);
+        return TEST_ERROR;
+    }
+    close(descriptor);
+    risky_trace_t trace;
+    risky_stop_reason_t reason = RISKY_STOP_NONE;
+    status_t result = open_risky_trace(&trace, path);
+    if(result == STATUS_SUCCESS) {
+        result = run_risky_vm_traced(&state, &trace, &reason);
+        if(close_risky_trace(&trace) != STATUS_SUCCESS) {
+            result = STATUS_FAIL;
+        }
+    }
+    free_risky_vm_state(&state);
+    FILE * file = fopen(path, "rb");
+    unlink(path);
+    if(file == NULL || result != STATUS_SUCCESS) {
+        if(file != NULL) {
+            fclose(file);
+        }
+        return TEST_ERROR;
+    }
+    fseek(file, 0, SEEK_END);
+    *size = (size_t) ftell(file);
+    rewind(file);
+    *bytes = (risky_byte_t *) malloc(*size);
+    bool read = *bytes != NULL && fread(*bytes, 1, *size, file) == *size;
+    fclose(file);
+    if(!read || reason != RISKY_STOP_HALTED) {
+        free(*bytes);
+        return TEST_ERROR;
+    }
+    return TEST_SUCCESS;
+}
+
+/*
+ * test helper function - returns whether the given record is of an
+ * instruction at the given address, which wrote the given value to the given
+ * register (or didn't write a register, if the register is -1)
+ */
+static bool check_record(
+    const risky_trace_record_t * record, risky_ram_address_t address,
+    int destination, risky_word_t value
+) {
+    if(
+        record->address[0] != (address >> 8) ||
+        record->address[1] != (address & 0xffU)
+    ) {
+        return false;
+    }
+    if(destination == -1) {
+        return !(record->flags & RISKY_TRACE_WROTE_REGISTER);
+    }
+    return (
+        (record->flags & RISKY_TRACE_WROTE_REGISTER) &&
+        record->destination == destination &&
+        record->value[0] == (value >> 8) && record->value[1] == (value & 0xffU)
+    );
+}
+
+/*
+ * A trace file should start with a valid header and hold a record of every
+ * instruction executed, in order, with its raw bytes and the new value of the
+ * register it wrote
+ */
+test_result_t test_trace_records() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_byte_t * bytes = NULL;
+    size_t size = 0;
+    test.result = run_loop(1000, 0, &bytes, &size);
+    if(test.result != TEST_SUCCESS) {
+        return test;
+    }
+
+    const risky_trace_record_t * records =
+        (const risky_trace_record_t *) &bytes[RISKY_TRACE_HEADER_SIZE];
+    size_t count = 3 + 3 * 1000 + 1;
+    risky_raw_instruction_t first;
+    risky_instruction_t instruction = set(1, 1000);
+    encode_instruction_to_raw(&instruction, &first);
+    if(
+        !is_risky_trace(bytes, size) ||
+        size != RISKY_TRACE_HEADER_SIZE + count * sizeof(risky_trace_record_t)
+    ) {
+        test.result = TEST_FAIL;
+    } else if(
+        memcmp(records[0].raw, first.bytes, sizeof(first.bytes)) != 0 ||
+        !check_record(&records[0], 0x0000U, 1, 1000) ||
+        !check_record(&records[3], 0x000cU, 1, 999) ||
+        !check_record(&records[4], 0x0010U, 5, 1) ||
+        !check_record(&records[5], 0x0014U, -1, 0) ||
+        !check_record(&records[6], 0x000cU, 1, 998) ||
+        !check_record(&records[count - 2], 0x0014U, -1, 0) ||
+        !check_record(&records[count - 1], 0x0018U, -1, 0)
+    ) {
+        test.result = TEST_FAIL;
+    }
+    free(bytes);
+    return test;
+}
+
+/*
+ * A trace of many more instructions than its ring buffer holds should still
+ * record every one of them, in order
+ */
+test_result_t test_trace_fills_ring() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_byte_t * bytes = NULL;
+    size_t size = 0;
+    // 23 instructions per loop, so over twice the size of the ring
+    test.result = run_loop(50000, 20, &bytes, &size);
+    if(test.result != TEST_SUCCESS) {
+        return test;
+    }
+
+    const risky_trace_record_t * records =
+        (const risky_trace_record_t *) &bytes[RISKY_TRACE_HEADER_SIZE];
+    size_t count = 3 + 23 * 50000 + 1;
+    if(
+        size != RISKY_TRACE_HEADER_SIZE + count * sizeof(risky_trace_record_t)
+    ) {
+        test.result = TEST_FAIL;
+    } else {
+        test.result = TEST_SUCCESS;
+        for(size_t i = 0; i < 50000; i++) {
+            const risky_trace_record_t * loop = &records[3 + i * 23];
+            if(
+                !check_record(&loop[0], 0x000cU, -1, 0) ||
+                !check_record(&loop[20], 0x005cU, 1, 49999 - i)
+            ) {
+                test.result = TEST_FAIL;
+                break;
+            }
+        }
+        if(!check_record(&records[count - 1], 0x0068U, -1, 0)) {
+            test.result = TEST_FAIL;
+        }
+    }
+    free(bytes);
+    return test;
+}
+
+/*
+ * Only the header of a trace file of a version that can be read should be
+ * recognised
+ */
+test_result_t test_is_risky_trace() {
+    // initialise test result
+    test_result_t test = TEST;
+    risky_byte_t header[RISKY_TRACE_HEADER_SIZE] = {
+        'R', 'T', 'R', 'C', RISKY_TRACE_VERSION_MAJOR, 0,
+        sizeof(risky_trace_record_t), 0,
+    };
+    risky_byte_t other[RISKY_TRACE_HEADER_SIZE] = {
+        'R', 'T', 'R', 'C', RISKY_TRACE_VERSION_MAJOR + 1, 0,
+        sizeof(risky_trace_record_t), 0,
+    };
+    if(
+        is_risky_trace(header, sizeof(header)) &&
+        !is_risky_trace(header, sizeof(header) - 1) &&
+        !is_risky_trace(other, sizeof(other))
+    ) {
+        test.result = TEST_SUCCESS;
+    } else {
+        test.result = TEST_FAIL;
+    }
+    return test;
+}
+
+int main() {
+    // initialise test suite
+    test_suite_t suite = init_test_suite();
+    // add test cases
+    add_test_case(test_trace_records, &suite);
+    add_test_case(test_trace_fills_ring, &suite);
+    add_test_case(test_is_risky_trace, &suite);
+    // run test suite
+    run_test_suite(&suite);
+    // return test suite status
+    return suite.result ? 0 : 1;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif